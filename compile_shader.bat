@@ -1,3 +0,0 @@
-cd shaders
-C:\VulkanSDK\1.3.216.0\Bin\glslc.exe shader.vert -o vert.spv
-C:\VulkanSDK\1.3.216.0\Bin\glslc.exe shader.frag -o frag.spv
\ No newline at end of file
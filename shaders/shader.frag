@@ -1,12 +1,15 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require // テクスチャの配列をインスタンス毎にばらばらな番号で引くのに必要
 
-layout(location = 0) in vec3 fragColor;
-layout(location = 1) in vec2 fragTexCoord;
+layout(location = 0) in vec2 fragTexCoord;
+layout(location = 1) flat in uint fragMaterialIndex; // テクスチャの表の中でのテクスチャの番号
 
-layout(binding = 1) uniform sampler2D texSampler;
+// 登録した全てのテクスチャの表(TextureTable)。要素数はアプリケーション側で決める
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
 layout(location = 0) out vec4 outColor;
 
 void main(){
-    outColor = texture(texSampler, fragTexCoord);
+    // 一度の描画の中でもインスタンス毎に番号が変わるので、nonuniformEXTで添え字が揃っていないことを伝える
+    outColor = texture(textures[nonuniformEXT(fragMaterialIndex)], fragTexCoord);
 }
\ No newline at end of file
@@ -1,20 +1,37 @@
 #version 450
 
-layout(binding = 0) uniform UnifomBufferObject{
-    mat4 model;
+// カメラの行列。フレーム毎の領域は動的オフセットで選ばれる
+layout(binding = 0) uniform CameraUniform{
     mat4 view;
     mat4 proj;
-} ubo;
+} camera;
+
+// オブジェクト毎のデータはプッシュ定数で渡される
+// 頂点バッファの座標とUV座標はメッシュを囲む範囲で0~1に正規化されているので、スケールとバイアスで元に戻す
+layout(push_constant) uniform ObjectConstants{
+    mat4 model;
+    vec4 positionScale;
+    vec4 positionBias;
+    vec4 texCoordScaleBias;
+    uint materialIndex; // 描画する塊のマテリアルの、テクスチャの表の中での番号
+} object;
 
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
-layout(location = 2) in vec2 inTexCoord;
+layout(location = 1) in vec2 inTexCoord;
+
+// インスタンス毎のデータ。変換行列は最後の行が(0, 0, 0, 1)なので、上の3行だけを受け取る
+layout(location = 2) in vec4 instanceRow0;
+layout(location = 3) in vec4 instanceRow1;
+layout(location = 4) in vec4 instanceRow2;
+layout(location = 5) in uint instanceMaterialIndex;
 
-layout(location = 0) out vec3 fragColor;
-layout(location = 1) out vec2 fragTexCoord;
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) flat out uint fragMaterialIndex;
 
 void main(){
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
-    fragTexCoord = inTexCoord;
+    vec4 position = vec4(inPosition * object.positionScale.xyz + object.positionBias.xyz, 1.0);
+    vec3 instancePosition = vec3(dot(instanceRow0, position), dot(instanceRow1, position), dot(instanceRow2, position));
+    gl_Position = camera.proj * camera.view * object.model * vec4(instancePosition, 1.0);
+    fragTexCoord = inTexCoord * object.texCoordScaleBias.xy + object.texCoordScaleBias.zw;
+    fragMaterialIndex = object.materialIndex + instanceMaterialIndex; // インスタンス毎の番号は、同じメッシュのインスタンス毎にマテリアルを差し替える場合のずれ
 }
\ No newline at end of file
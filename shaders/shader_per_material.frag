@@ -0,0 +1,16 @@
+#version 450
+
+// テクスチャの表(VK_EXT_descriptor_indexing)が使えないGPU向けのフラグメントシェーダ
+// マテリアル毎のデスクリプタセットに一枚だけテクスチャを入れ、マテリアルが変わる描画の前にデスクリプタセットをバインドし直す
+// 一度の描画では一枚のテクスチャしか使えないので、インスタンス毎のマテリアルの番号のずれは反映されない
+
+layout(location = 0) in vec2 fragTexCoord;
+
+// 描画中のマテリアルのテクスチャ
+layout(set = 1, binding = 0) uniform sampler2D materialTexture;
+
+layout(location = 0) out vec4 outColor;
+
+void main(){
+    outColor = texture(materialTexture, fragTexCoord);
+}
\ No newline at end of file
@@ -0,0 +1,566 @@
+#include "BlockCompressor.hpp"
+
+// ----------STLのinclude----------
+#include <algorithm> // min, max, swapを使用するのに必要
+#include <cstring>   // memcpyを使用するのに必要
+#include <cfloat>    // FLT_MAXを使用するのに必要
+#include <cmath>     // fabsを使用するのに必要
+#include <thread>    // ブロックの行を並列に圧縮するのに使用する
+#include <atomic>    // 次に圧縮するブロックの行の番号をスレッド間で共有するのに使用する
+#include <stdexcept> // 例外を投げるために必要
+
+// ----------SIMD命令のinclude----------
+#include <emmintrin.h> // SSE2。x64のCPUであれば必ず使える
+
+namespace
+{
+    const uint32_t BLOCK_SIZE = 4;         // ブロックの縦横の画素数
+    const uint32_t PARALLEL_MIN_BLOCKS = 256; // これより少ないブロック数の画像(小さなミップレベル)はスレッドを立てずに圧縮する
+
+    // BC7のモード6で使われる、4ビットのインデックスに対応する補間の重み(64分率)
+    const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    // ブロック内の16画素を、チャンネル毎に並べたもの(SoA)。SSEで4画素ずつまとめて読み込めるようにしている
+    struct Block
+    {
+        alignas(16) float channels[4][16]; // R, G, B, Aの順
+    };
+
+    float horizontalSum(__m128 v)
+    {
+        __m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 sums = _mm_add_ps(v, shuffled);
+        shuffled = _mm_movehl_ps(shuffled, sums);
+        sums = _mm_add_ss(sums, shuffled);
+        return _mm_cvtss_f32(sums);
+    }
+
+    float horizontalMin(__m128 v)
+    {
+        v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(v);
+    }
+
+    float horizontalMax(__m128 v)
+    {
+        v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(v);
+    }
+
+    // 画像の(blockX, blockY)番目のブロックを読み込む。画像の端からはみ出た画素は端の画素で埋める
+    void loadBlock(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, Block &block)
+    {
+        for (uint32_t y = 0; y < BLOCK_SIZE; y++)
+        {
+            uint32_t sourceY = std::min(blockY * BLOCK_SIZE + y, height - 1);
+            for (uint32_t x = 0; x < BLOCK_SIZE; x++)
+            {
+                uint32_t sourceX = std::min(blockX * BLOCK_SIZE + x, width - 1);
+                const uint8_t *pixel = rgba + (static_cast<size_t>(sourceY) * width + sourceX) * 4;
+                for (int c = 0; c < 4; c++)
+                {
+                    block.channels[c][y * BLOCK_SIZE + x] = pixel[c];
+                }
+            }
+        }
+    }
+
+    // ブロックの画素の分布の主軸(主成分)を求め、主軸上の両端の点を端点の初期値とする
+    void computeInitialEndpoints(const Block &block, int channelCount, float endpoint0[4], float endpoint1[4])
+    {
+        float mean[4] = {};
+        __m128 centered[4][4]; // centered[チャンネル][画素のグループ]。平均を引いた値
+        for (int c = 0; c < channelCount; c++)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < 4; k++)
+            {
+                sum = _mm_add_ps(sum, _mm_load_ps(&block.channels[c][k * 4]));
+            }
+            mean[c] = horizontalSum(sum) / 16.0f;
+
+            __m128 meanVector = _mm_set1_ps(mean[c]);
+            for (int k = 0; k < 4; k++)
+            {
+                centered[c][k] = _mm_sub_ps(_mm_load_ps(&block.channels[c][k * 4]), meanVector);
+            }
+        }
+
+        // 共分散行列
+        float covariance[4][4] = {};
+        for (int i = 0; i < channelCount; i++)
+        {
+            for (int j = 0; j <= i; j++)
+            {
+                __m128 sum = _mm_setzero_ps();
+                for (int k = 0; k < 4; k++)
+                {
+                    sum = _mm_add_ps(sum, _mm_mul_ps(centered[i][k], centered[j][k]));
+                }
+                covariance[i][j] = covariance[j][i] = horizontalSum(sum);
+            }
+        }
+
+        // べき乗法で最大固有値の固有ベクトルを求める。初期値には分散が最も大きいチャンネルの行を使う
+        int largest = 0;
+        for (int c = 1; c < channelCount; c++)
+        {
+            if (covariance[c][c] > covariance[largest][largest])
+            {
+                largest = c;
+            }
+        }
+        float axis[4] = {};
+        for (int c = 0; c < channelCount; c++)
+        {
+            axis[c] = covariance[largest][c];
+        }
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = {};
+            float norm = 0.0f;
+            for (int i = 0; i < channelCount; i++)
+            {
+                for (int j = 0; j < channelCount; j++)
+                {
+                    next[i] += covariance[i][j] * axis[j];
+                }
+                norm = std::max(norm, std::fabs(next[i]));
+            }
+            if (norm <= 0.0f)
+            {
+                break;
+            }
+            for (int c = 0; c < channelCount; c++)
+            {
+                axis[c] = next[c] / norm;
+            }
+        }
+
+        float length = 0.0f;
+        for (int c = 0; c < channelCount; c++)
+        {
+            length += axis[c] * axis[c];
+        }
+        if (length <= 0.0f)
+        {
+            // 全ての画素が同じ色なので、両端とも平均の色にする
+            for (int c = 0; c < 4; c++)
+            {
+                endpoint0[c] = endpoint1[c] = mean[c];
+            }
+            return;
+        }
+        length = std::sqrt(length);
+
+        // 各画素を主軸に射影し、その最小値と最大値を求める
+        __m128 minimum = _mm_set1_ps(FLT_MAX);
+        __m128 maximum = _mm_set1_ps(-FLT_MAX);
+        for (int k = 0; k < 4; k++)
+        {
+            __m128 t = _mm_setzero_ps();
+            for (int c = 0; c < channelCount; c++)
+            {
+                t = _mm_add_ps(t, _mm_mul_ps(centered[c][k], _mm_set1_ps(axis[c] / length)));
+            }
+            minimum = _mm_min_ps(minimum, t);
+            maximum = _mm_max_ps(maximum, t);
+        }
+        float tMin = horizontalMin(minimum);
+        float tMax = horizontalMax(maximum);
+
+        for (int c = 0; c < 4; c++)
+        {
+            float direction = c < channelCount ? axis[c] / length : 0.0f;
+            endpoint0[c] = std::clamp(mean[c] + tMin * direction, 0.0f, 255.0f);
+            endpoint1[c] = std::clamp(mean[c] + tMax * direction, 0.0f, 255.0f);
+        }
+    }
+
+    // 各画素に最も近いパレットの色の番号をindicesに書き込み、誤差(二乗和)の合計を返す
+    float selectIndices(const Block &block, int channelCount, const float (*palette)[4], int paletteSize, int32_t indices[16])
+    {
+        float totalError = 0.0f;
+        for (int k = 0; k < 4; k++)
+        {
+            __m128 bestError = _mm_set1_ps(FLT_MAX);
+            __m128 bestIndex = _mm_setzero_ps();
+            for (int j = 0; j < paletteSize; j++)
+            {
+                __m128 error = _mm_setzero_ps();
+                for (int c = 0; c < channelCount; c++)
+                {
+                    __m128 difference = _mm_sub_ps(_mm_load_ps(&block.channels[c][k * 4]), _mm_set1_ps(palette[j][c]));
+                    error = _mm_add_ps(error, _mm_mul_ps(difference, difference));
+                }
+
+                // 今までの最良よりも誤差が小さい画素だけ、番号をjに置き換える
+                __m128 closer = _mm_cmplt_ps(error, bestError);
+                bestError = _mm_min_ps(error, bestError);
+                bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps(static_cast<float>(j))), _mm_andnot_ps(closer, bestIndex));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(&indices[k * 4]), _mm_cvttps_epi32(bestIndex));
+            totalError += horizontalSum(bestError);
+        }
+        return totalError;
+    }
+
+    // 各画素の補間の重み(0~1)を固定して、誤差の二乗和が最小になる端点を最小二乗法で求め直す
+    bool refitEndpoints(const Block &block, int channelCount, const float weights[16], float endpoint0[4], float endpoint1[4])
+    {
+        __m128 a = _mm_setzero_ps(); // (1 - w)^2の和
+        __m128 b = _mm_setzero_ps(); // (1 - w) * wの和
+        __m128 c = _mm_setzero_ps(); // w^2の和
+        __m128 x0[4], x1[4];         // (1 - w) * 画素の値、w * 画素の値の和
+        for (int channel = 0; channel < channelCount; channel++)
+        {
+            x0[channel] = _mm_setzero_ps();
+            x1[channel] = _mm_setzero_ps();
+        }
+
+        __m128 one = _mm_set1_ps(1.0f);
+        for (int k = 0; k < 4; k++)
+        {
+            __m128 w = _mm_loadu_ps(&weights[k * 4]);
+            __m128 inverse = _mm_sub_ps(one, w);
+            a = _mm_add_ps(a, _mm_mul_ps(inverse, inverse));
+            b = _mm_add_ps(b, _mm_mul_ps(inverse, w));
+            c = _mm_add_ps(c, _mm_mul_ps(w, w));
+            for (int channel = 0; channel < channelCount; channel++)
+            {
+                __m128 value = _mm_load_ps(&block.channels[channel][k * 4]);
+                x0[channel] = _mm_add_ps(x0[channel], _mm_mul_ps(inverse, value));
+                x1[channel] = _mm_add_ps(x1[channel], _mm_mul_ps(w, value));
+            }
+        }
+
+        float sumA = horizontalSum(a);
+        float sumB = horizontalSum(b);
+        float sumC = horizontalSum(c);
+        float determinant = sumA * sumC - sumB * sumB;
+        if (std::fabs(determinant) < 1e-6f)
+        {
+            return false; // 全ての画素が同じ重みの場合は端点を決められない
+        }
+
+        for (int channel = 0; channel < channelCount; channel++)
+        {
+            float sum0 = horizontalSum(x0[channel]);
+            float sum1 = horizontalSum(x1[channel]);
+            endpoint0[channel] = std::clamp((sumC * sum0 - sumB * sum1) / determinant, 0.0f, 255.0f);
+            endpoint1[channel] = std::clamp((sumA * sum1 - sumB * sum0) / determinant, 0.0f, 255.0f);
+        }
+        return true;
+    }
+
+    // ---------- BC1 ----------
+
+    uint16_t toRgb565(const float color[4])
+    {
+        uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+        uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+        uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    void fromRgb565(uint16_t value, float color[4])
+    {
+        uint32_t r = (value >> 11) & 31;
+        uint32_t g = (value >> 5) & 63;
+        uint32_t b = value & 31;
+        color[0] = static_cast<float>((r << 3) | (r >> 2));
+        color[1] = static_cast<float>((g << 2) | (g >> 4));
+        color[2] = static_cast<float>((b << 3) | (b >> 2));
+        color[3] = 0.0f;
+    }
+
+    // 8バイトのBC1ブロック(RGB565の端点2つと、画素毎の2ビットのインデックス)を作る。アルファは無視する
+    void encodeBC1Block(const Block &block, uint8_t *dst)
+    {
+        // パレットの並びは 端点0, 端点1, 端点0寄りの中間色, 端点1寄りの中間色
+        const float BC1_WEIGHTS[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+        float endpoint0[4], endpoint1[4];
+        computeInitialEndpoints(block, 3, endpoint0, endpoint1);
+
+        float bestError = FLT_MAX;
+        uint16_t bestColor0 = 0, bestColor1 = 0;
+        int32_t bestIndices[16] = {};
+        for (int iteration = 0; iteration < 2; iteration++)
+        {
+            uint16_t color0 = toRgb565(endpoint0);
+            uint16_t color1 = toRgb565(endpoint1);
+
+            // color0 > color1の場合に4色のモードになるので、大小関係を揃える(等しい場合は全画素が端点0を使う)
+            if (color0 < color1)
+            {
+                std::swap(color0, color1);
+            }
+
+            alignas(16) float palette[4][4];
+            fromRgb565(color0, palette[0]);
+            fromRgb565(color1, palette[1]);
+            for (int c = 0; c < 3; c++)
+            {
+                palette[2][c] = static_cast<float>((2 * static_cast<int>(palette[0][c]) + static_cast<int>(palette[1][c])) / 3);
+                palette[3][c] = static_cast<float>((static_cast<int>(palette[0][c]) + 2 * static_cast<int>(palette[1][c])) / 3);
+            }
+
+            int32_t indices[16];
+            float error = selectIndices(block, 3, palette, color0 == color1 ? 1 : 4, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                bestColor0 = color0;
+                bestColor1 = color1;
+                std::copy(indices, indices + 16, bestIndices);
+            }
+
+            float weights[16];
+            for (int i = 0; i < 16; i++)
+            {
+                weights[i] = BC1_WEIGHTS[indices[i]];
+            }
+            fromRgb565(color0, endpoint0);
+            fromRgb565(color1, endpoint1);
+            if (color0 == color1 || !refitEndpoints(block, 3, weights, endpoint0, endpoint1))
+            {
+                break;
+            }
+        }
+
+        uint32_t indexBits = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            indexBits |= static_cast<uint32_t>(bestIndices[i]) << (i * 2);
+        }
+        dst[0] = static_cast<uint8_t>(bestColor0 & 0xff);
+        dst[1] = static_cast<uint8_t>(bestColor0 >> 8);
+        dst[2] = static_cast<uint8_t>(bestColor1 & 0xff);
+        dst[3] = static_cast<uint8_t>(bestColor1 >> 8);
+        memcpy(dst + 4, &indexBits, sizeof(indexBits));
+    }
+
+    // ---------- BC7 ----------
+
+    // 端点を7ビット+共有の1ビット(pビット)に量子化する。誤差が小さくなる方のpビットを選ぶ
+    void quantizeBC7Endpoint(const float endpoint[4], uint32_t quantized[4], uint32_t &pBit)
+    {
+        float bestError = FLT_MAX;
+        for (uint32_t p = 0; p < 2; p++)
+        {
+            uint32_t candidate[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; c++)
+            {
+                int value = static_cast<int>((endpoint[c] - static_cast<float>(p)) / 2.0f + 0.5f);
+                candidate[c] = static_cast<uint32_t>(std::clamp(value, 0, 127));
+                float difference = static_cast<float>((candidate[c] << 1) | p) - endpoint[c];
+                error += difference * difference;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pBit = p;
+                std::copy(candidate, candidate + 4, quantized);
+            }
+        }
+    }
+
+    // 128ビットのブロックに下位ビットから順番に値を書き込んでいくためのクラス
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(uint8_t *dst) : dst(dst) { memset(dst, 0, 16); }
+
+        void write(uint32_t value, uint32_t bitCount)
+        {
+            for (uint32_t i = 0; i < bitCount; i++)
+            {
+                if (value & (1u << i))
+                {
+                    dst[position / 8] |= static_cast<uint8_t>(1u << (position % 8));
+                }
+                position++;
+            }
+        }
+
+    private:
+        uint8_t *dst;
+        uint32_t position = 0;
+    };
+
+    // 16バイトのBC7ブロックをモード6(RGBA 7ビット+pビットの端点2つと、画素毎の4ビットのインデックス)で作る
+    void encodeBC7Block(const Block &block, uint8_t *dst)
+    {
+        float endpoint0[4], endpoint1[4];
+        computeInitialEndpoints(block, 4, endpoint0, endpoint1);
+
+        float bestError = FLT_MAX;
+        uint32_t best0[4] = {}, best1[4] = {}, bestP0 = 0, bestP1 = 0;
+        int32_t bestIndices[16] = {};
+        for (int iteration = 0; iteration < 3; iteration++)
+        {
+            uint32_t quantized0[4], quantized1[4], p0 = 0, p1 = 0;
+            quantizeBC7Endpoint(endpoint0, quantized0, p0);
+            quantizeBC7Endpoint(endpoint1, quantized1, p1);
+
+            // デコーダと同じ計算でパレットを作る
+            alignas(16) float palette[16][4];
+            int decoded0[4], decoded1[4];
+            for (int c = 0; c < 4; c++)
+            {
+                decoded0[c] = static_cast<int>((quantized0[c] << 1) | p0);
+                decoded1[c] = static_cast<int>((quantized1[c] << 1) | p1);
+            }
+            for (int j = 0; j < 16; j++)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    palette[j][c] = static_cast<float>(((64 - BC7_WEIGHTS[j]) * decoded0[c] + BC7_WEIGHTS[j] * decoded1[c] + 32) >> 6);
+                }
+            }
+
+            int32_t indices[16];
+            float error = selectIndices(block, 4, palette, 16, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                std::copy(quantized0, quantized0 + 4, best0);
+                std::copy(quantized1, quantized1 + 4, best1);
+                bestP0 = p0;
+                bestP1 = p1;
+                std::copy(indices, indices + 16, bestIndices);
+            }
+
+            float weights[16];
+            for (int i = 0; i < 16; i++)
+            {
+                weights[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+            }
+            if (!refitEndpoints(block, 4, weights, endpoint0, endpoint1))
+            {
+                break;
+            }
+        }
+
+        // 先頭の画素のインデックスは最上位ビットが0である必要がある(3ビットしか格納されない)ので、
+        // そうでない場合は端点を入れ替えてインデックスを反転する(重みの表は対称なので結果は変わらない)
+        if (bestIndices[0] & 8)
+        {
+            std::swap(best0, best1);
+            std::swap(bestP0, bestP1);
+            for (int i = 0; i < 16; i++)
+            {
+                bestIndices[i] = 15 - bestIndices[i];
+            }
+        }
+
+        BitWriter writer(dst);
+        writer.write(1u << 6, 7); // モード6
+        for (int c = 0; c < 4; c++)
+        {
+            writer.write(best0[c], 7);
+            writer.write(best1[c], 7);
+        }
+        writer.write(bestP0, 1);
+        writer.write(bestP1, 1);
+        writer.write(static_cast<uint32_t>(bestIndices[0]), 3);
+        for (int i = 1; i < 16; i++)
+        {
+            writer.write(static_cast<uint32_t>(bestIndices[i]), 4);
+        }
+    }
+
+    size_t getBlockBytes(VkFormat format)
+    {
+        switch (format)
+        {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            return 8;
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+}
+
+bool isBlockCompressedFormat(VkFormat format)
+{
+    return getBlockBytes(format) != 0;
+}
+
+size_t getEncodedImageSize(VkFormat format, uint32_t width, uint32_t height)
+{
+    if (!isBlockCompressedFormat(format))
+    {
+        return static_cast<size_t>(width) * height * 4;
+    }
+
+    size_t blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t blocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    return blocksX * blocksY * getBlockBytes(format);
+}
+
+void encodeImage(VkFormat format, const uint8_t *rgba, uint32_t width, uint32_t height, uint8_t *dst)
+{
+    if (format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB)
+    {
+        memcpy(dst, rgba, getEncodedImageSize(format, width, height));
+        return;
+    }
+    if (!isBlockCompressedFormat(format))
+    {
+        throw std::runtime_error("unsupported texture encoding format!");
+    }
+
+    // SRGBのフォーマットでも、sRGBの値のまま圧縮すればデコード時に線形に変換される
+    bool bc7 = format == VK_FORMAT_BC7_UNORM_BLOCK || format == VK_FORMAT_BC7_SRGB_BLOCK;
+    size_t blockBytes = getBlockBytes(format);
+    uint32_t blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t blocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // ブロックは互いに独立しているので、ブロックの行単位でスレッドに割り振る
+    std::atomic<uint32_t> nextRow{0};
+    auto encodeRows = [&]()
+    {
+        Block block;
+        for (uint32_t blockY = nextRow++; blockY < blocksY; blockY = nextRow++)
+        {
+            uint8_t *rowDst = dst + static_cast<size_t>(blockY) * blocksX * blockBytes;
+            for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+            {
+                loadBlock(rgba, width, height, blockX, blockY, block);
+                if (bc7)
+                {
+                    encodeBC7Block(block, rowDst + blockX * blockBytes);
+                }
+                else
+                {
+                    encodeBC1Block(block, rowDst + blockX * blockBytes);
+                }
+            }
+        }
+    };
+
+    size_t threadCount = 1;
+    if (static_cast<size_t>(blocksX) * blocksY >= PARALLEL_MIN_BLOCKS)
+    {
+        threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), blocksY);
+    }
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threadCount; i++)
+    {
+        workers.emplace_back(encodeRows);
+    }
+    encodeRows(); // メインスレッドも遊ばせずにブロックを処理する
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
\ No newline at end of file
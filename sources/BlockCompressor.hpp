@@ -0,0 +1,23 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint8_tを使用するために必要
+#include <cstddef> // size_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// RGBAが1バイトずつ並んだ画像を、4x4画素のブロック単位で圧縮するフォーマット(BC1, BC7)に変換する
+// ブロック内の計算はSSE2で4画素ずつまとめて行い、ブロックの行は複数のスレッドで並列に処理する
+
+// formatがこのファイルの関数で作成できる圧縮フォーマットかどうか
+bool isBlockCompressedFormat(VkFormat format);
+
+// width x heightの画像をformatで表した時のバイト数。圧縮フォーマットでない場合は1画素4バイトとして計算する
+size_t getEncodedImageSize(VkFormat format, uint32_t width, uint32_t height);
+
+// width x heightのRGBA画像rgbaをformatに変換してdstに書き込む。dstにはgetEncodedImageSizeバイトの領域が必要
+// 対応しているのはBC1(アルファ無し)、BC7、R8G8B8A8(そのままコピー)で、いずれもUNORMとSRGBの両方を受け付ける
+void encodeImage(VkFormat format, const uint8_t *rgba, uint32_t width, uint32_t height, uint8_t *dst);
\ No newline at end of file
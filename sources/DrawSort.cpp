@@ -0,0 +1,66 @@
+#include "DrawSort.hpp"
+
+// ----------STLのinclude----------
+#include <array>
+#include <utility> // swapを使用するのに必要
+
+namespace
+{
+    const uint32_t RADIX_BITS = 8;                 // 一度に並べる桁のビット数
+    const uint32_t RADIX_SIZE = 1u << RADIX_BITS;  // 一つの桁が取り得る値の数
+    const uint32_t RADIX_PASSES = 64 / RADIX_BITS; // 64ビットのキーを並べ終えるまでの回数
+}
+
+void radixSortDraws(std::vector<DrawItem> &items, std::vector<DrawItem> &scratch)
+{
+    size_t count = items.size();
+    if (count < 2)
+    {
+        return;
+    }
+    scratch.resize(count);
+
+    // 全ての桁の出現回数を一度に数えておく
+    std::array<std::array<uint32_t, RADIX_SIZE>, RADIX_PASSES> histograms{};
+    for (const DrawItem &item : items)
+    {
+        for (uint32_t pass = 0; pass < RADIX_PASSES; pass++)
+        {
+            histograms[pass][(item.key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1)]++;
+        }
+    }
+
+    std::vector<DrawItem> *source = &items;
+    std::vector<DrawItem> *destination = &scratch;
+    for (uint32_t pass = 0; pass < RADIX_PASSES; pass++)
+    {
+        // 全ての要素が同じ値の桁(使っていないパイプラインの番号など)は、並べても順番が変わらないので飛ばす
+        std::array<uint32_t, RADIX_SIZE> &histogram = histograms[pass];
+        uint32_t shift = pass * RADIX_BITS;
+        if (histogram[((*source)[0].key >> shift) & (RADIX_SIZE - 1)] == count)
+        {
+            continue;
+        }
+
+        // 出現回数から、桁の値毎の書き込み先の先頭を求める
+        uint32_t offset = 0;
+        for (uint32_t &bucket : histogram)
+        {
+            uint32_t bucketCount = bucket;
+            bucket = offset;
+            offset += bucketCount;
+        }
+
+        for (const DrawItem &item : *source)
+        {
+            (*destination)[histogram[(item.key >> shift) & (RADIX_SIZE - 1)]++] = item;
+        }
+        std::swap(source, destination);
+    }
+
+    // 飛ばさなかった回数が奇数の場合は、並べ終えた結果が作業用の配列にある
+    if (source != &items)
+    {
+        items.swap(scratch);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint64_tを使用するために必要
+#include <cstring> // memcpyを使用するのに必要
+
+// 描画の順番を決める64ビットのソートキー。上位のビットほど切り替えのコストが大きい状態を置く
+// [63:56] パイプラインの番号、[55] 32ビットのインデックスを使うか、[54:32] マテリアルの番号、[31:0] カメラからの距離
+// キーの昇順に並べると、同じ状態の描画がまとまり、その中では手前の物から描画される(早期の深度テストで奥の物のフラグメントを省ける)
+const uint32_t DRAW_SORT_PIPELINE_SHIFT = 56;
+const uint32_t DRAW_SORT_WIDE_INDICES_SHIFT = 55;
+const uint32_t DRAW_SORT_MATERIAL_SHIFT = 32;
+const uint32_t DRAW_SORT_MAX_MATERIALS = 1u << 23; // キーに入るマテリアルの番号の数
+
+// 描画する塊とそのソートキー
+struct DrawItem
+{
+    uint64_t key;
+    uint32_t meshlet; // 描画する塊の番号
+};
+
+// depthは0以上の距離。0以上のfloatはビット列を整数として比べても大小関係が変わらないので、そのまま下位32ビットに入れる
+inline uint64_t makeDrawSortKey(uint32_t pipeline, bool wideIndices, uint32_t material, float depth)
+{
+    uint32_t depthBits;
+    static_assert(sizeof(depthBits) == sizeof(depth), "float must be 32 bits");
+    depth = depth > 0.0f ? depth : 0.0f; // -0.0fやNaNも0として扱う
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+    return (static_cast<uint64_t>(pipeline & 0xff) << DRAW_SORT_PIPELINE_SHIFT) |
+           (static_cast<uint64_t>(wideIndices ? 1 : 0) << DRAW_SORT_WIDE_INDICES_SHIFT) |
+           (static_cast<uint64_t>(material & (DRAW_SORT_MAX_MATERIALS - 1)) << DRAW_SORT_MATERIAL_SHIFT) |
+           depthBits;
+}
+
+inline bool isDrawSortKeyWide(uint64_t key) { return (key >> DRAW_SORT_WIDE_INDICES_SHIFT) & 1; }
+inline uint32_t getDrawSortKeyMaterial(uint64_t key) { return static_cast<uint32_t>(key >> DRAW_SORT_MATERIAL_SHIFT) & (DRAW_SORT_MAX_MATERIALS - 1); }
+
+// itemsをキーの昇順に並べる。8ビットずつ下位の桁から数え上げて並べる基数ソートで、同じキーの並びは保たれる
+// 比較を行わないので、毎フレーム数千個の描画を並べても要素数に比例した時間で済む
+// scratchは作業用の配列で、呼び出し側で使い回すとフレーム毎の確保を省ける
+void radixSortDraws(std::vector<DrawItem> &items, std::vector<DrawItem> &scratch);
\ No newline at end of file
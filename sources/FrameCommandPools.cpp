@@ -0,0 +1,66 @@
+#include "FrameCommandPools.hpp"
+
+// ----------STLのinclude----------
+#include <stdexcept> // 例外を投げるために必要
+
+void FrameCommandPools::init(VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount, uint32_t threadCount)
+{
+    this->device = device;
+    this->threadCount = threadCount;
+    pools.resize(static_cast<size_t>(frameCount) * threadCount);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // 毎フレーム記録し直す短命なコマンドバッファである事をドライバに伝える。個別のリセットはしないのでRESET_COMMAND_BUFFER_BITは付けない
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    for (Pool &pool : pools)
+    {
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool.pool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create frame command pool!");
+        }
+    }
+}
+
+void FrameCommandPools::destroy()
+{
+    // コマンドバッファはプールと一緒に破棄される
+    for (Pool &pool : pools)
+    {
+        vkDestroyCommandPool(device, pool.pool, nullptr);
+    }
+    pools.clear();
+}
+
+void FrameCommandPools::reset(uint32_t frame)
+{
+    for (uint32_t thread = 0; thread < threadCount; thread++)
+    {
+        Pool &pool = getPool(frame, thread);
+        vkResetCommandPool(device, pool.pool, 0); // 割り当てたメモリはプールに残し、次のフレームの記録で使い回す
+        pool.usedCount = 0;
+    }
+}
+
+VkCommandBuffer FrameCommandPools::acquireSecondary(uint32_t frame, uint32_t thread)
+{
+    Pool &pool = getPool(frame, thread);
+    if (pool.usedCount == pool.secondaries.size())
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate secondary command buffer!");
+        }
+        pool.secondaries.push_back(commandBuffer);
+    }
+
+    return pool.secondaries[pool.usedCount++];
+}
\ No newline at end of file
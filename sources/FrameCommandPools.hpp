@@ -0,0 +1,41 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// 二次コマンドバッファを複数のスレッドで並列に記録するための、スレッド毎・フレーム毎のコマンドプール
+// コマンドプールは外部で同期する必要があるので、スレッド毎に分ければロック無しで記録できる
+// さらにフレーム毎に分けておけば、そのフレームの描画が終わった時点でプールごとまとめてリセットでき、コマンドバッファを個別にリセットする必要が無い
+class FrameCommandPools
+{
+public:
+    void init(VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount, uint32_t threadCount);
+    void destroy();
+
+    // frame番目のフレームの全てのスレッドのプールをリセットし、コマンドバッファを再利用できるようにする
+    // frameの前回の描画が終わってから、記録を始める前に呼ぶ事
+    void reset(uint32_t frame);
+
+    // frame番目のフレームのthread番目のスレッドのプールから、未使用の二次コマンドバッファを返す。足りなければ割り当てる
+    // thread番目のスレッドからのみ呼び出す事
+    VkCommandBuffer acquireSecondary(uint32_t frame, uint32_t thread);
+
+private:
+    struct Pool
+    {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> secondaries; // このプールから割り当てた二次コマンドバッファ。プールと一緒に再利用する
+        size_t usedCount = 0;                     // 前回のresetから使用した数
+    };
+
+    Pool &getPool(uint32_t frame, uint32_t thread) { return pools[frame * threadCount + thread]; }
+
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t threadCount = 0;
+    std::vector<Pool> pools; // フレーム毎にスレッドの数だけ並べる
+};
\ No newline at end of file
@@ -7,62 +7,81 @@ HDC dc_src;
 HBITMAP hBitmap;
 std::vector<RECT> monitorRects;
 
-std::vector<char> HelloTriangleApplication::readFile(const std::string &filename)
+void HelloTriangleApplication::run()
 {
-    // ate->at the end ファイルの末尾から読み始める
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-    if (!file.is_open())
-    {
-        printf("file name is : %s\n", filename.c_str());
-        throw std::runtime_error("failed to open file!");
-    }
-
-    size_t fileSize = (size_t)file.tellg(); // 末尾から読み始めているので、今の読み取り位置がファイルサイズと一致する
-    std::vector<char> buffer(fileSize);
+    startupReport.begin();
 
-    file.seekg(0); // 読み取り位置を先頭に戻す
-    file.read(buffer.data(), fileSize);
+    // モデルの読み込みはVulkanに依存しないCPUだけの処理なので、ウインドウやデバイスの作成を待たずにワーカースレッドで始めておく
+    modelLoadJob = std::async(std::launch::async, &HelloTriangleApplication::prepareModel, this);
 
-    file.close();
-
-    return std::move(buffer);
-}
-
-void HelloTriangleApplication::run()
-{
+    auto windowStart = StartupReport::Clock::now();
     initWindow();
+    startupReport.addStage("initWindow", StartupReport::millisecondsSince(windowStart));
+
     initVulkan();
+    startupReport.print();
+    memoryAllocator.printStatistics();
+    memoryAllocator.printBudget();
+    lastMemoryBudgetLog = std::chrono::steady_clock::now();
+
     mainLoop();
     cleanup();
 }
 
 void HelloTriangleApplication::initVulkan()
 {
-    createInstance();
-    setupDebugMessenger();
-    createSurface();
-    pickPhysicalDevice();
-    createLogicalDevice();
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
-    createDescriptorSetLayout();
-    createGraphicsPipeline();
-    createCommandPool();
-    createColorResources();
-    createDepthResources();
-    createFramebuffers();
-    createTextureImage();
-    createTextureImageView();
-    createTextureSampler();
-    loadModel();
-    createVertexBuffer();
-    createIndexBuffer();
-    createUnifomBuffers();
-    createDescriptorPool();
-    createDescriptorSets();
-    createCommandBuffers();
-    createSyncObjects();
+    // 各段階にかかった時間を記録するために、段階を表にして順番に呼び出す
+    // モデルとテクスチャの読み込みはワーカースレッドで進めておき、GPUへの転送の直前でその完了を待つ
+    const std::vector<std::pair<const char *, void (HelloTriangleApplication::*)()>> stages = {
+        {"createInstance", &HelloTriangleApplication::createInstance},
+        {"setupDebugMessenger", &HelloTriangleApplication::setupDebugMessenger},
+        {"createSurface", &HelloTriangleApplication::createSurface},
+        {"pickPhysicalDevice", &HelloTriangleApplication::pickPhysicalDevice},
+        {"startTextureLoad", &HelloTriangleApplication::startTextureLoad}, // テクスチャのフォーマットは物理デバイスによって決まるので、選んだ直後に読み込みを始める
+        {"createLogicalDevice", &HelloTriangleApplication::createLogicalDevice},
+        {"createSwapChain", &HelloTriangleApplication::createSwapChain},
+        {"createImageViews", &HelloTriangleApplication::createImageViews},
+        {"createRenderPass", &HelloTriangleApplication::createRenderPass},
+        {"createDescriptorSetLayout", &HelloTriangleApplication::createDescriptorSetLayout},
+        {"createGraphicsPipeline", &HelloTriangleApplication::createGraphicsPipeline},
+        {"createCommandPool", &HelloTriangleApplication::createCommandPool},
+        {"createColorResources", &HelloTriangleApplication::createColorResources},
+        {"createDepthResources", &HelloTriangleApplication::createDepthResources},
+        {"createFramebuffers", &HelloTriangleApplication::createFramebuffers},
+        {"createTextureImage", &HelloTriangleApplication::createTextureImage},
+        {"createTextureImageView", &HelloTriangleApplication::createTextureImageView},
+        {"createTextureSampler", &HelloTriangleApplication::createTextureSampler},
+        {"createVertexBuffer", &HelloTriangleApplication::createVertexBuffer},
+        {"createIndexBuffer", &HelloTriangleApplication::createIndexBuffer},
+        {"createUnifomBuffers", &HelloTriangleApplication::createUnifomBuffers},
+        {"createInstanceBuffer", &HelloTriangleApplication::createInstanceBuffer},
+        {"createMeshletCuller", &HelloTriangleApplication::createMeshletCuller},
+        {"createDescriptorPool", &HelloTriangleApplication::createDescriptorPool},
+        {"createDescriptorSets", &HelloTriangleApplication::createDescriptorSets},
+        {"createCommandBuffers", &HelloTriangleApplication::createCommandBuffers},
+        {"createCachedCommandBuffers", &HelloTriangleApplication::createCachedCommandBuffers},
+        {"createSyncObjects", &HelloTriangleApplication::createSyncObjects},
+    };
+
+    for (const auto &[name, stage] : stages)
+    {
+        auto start = StartupReport::Clock::now();
+        (this->*stage)();
+        startupReport.addStage(name, StartupReport::millisecondsSince(start));
+    }
+}
+
+void HelloTriangleApplication::waitForAssetJob(std::future<void> &job, const char *name)
+{
+    if (!job.valid())
+    {
+        return;
+    }
+
+    // ワーカースレッドで投げられた例外はget()でこのスレッドに再送出される
+    auto start = StartupReport::Clock::now();
+    job.get();
+    startupReport.addWait(name, StartupReport::millisecondsSince(start));
 }
 
 void HelloTriangleApplication::createInstance()
@@ -148,6 +167,23 @@ std::vector<const char *> HelloTriangleApplication::getRequiredExtensions()
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
 
+    // VK_EXT_memory_budgetでメモリの予算を問い合わせるにはvkGetPhysicalDeviceMemoryProperties2が必要だが、
+    // Vulkan 1.0ではインスタンスの拡張機能なので、使える場合は有効にしておく
+    uint32_t availableCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(availableCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, availableExtensions.data());
+    physicalDeviceProperties2Enabled = false;
+    for (const auto &extension : availableExtensions)
+    {
+        if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+        {
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            physicalDeviceProperties2Enabled = true;
+            break;
+        }
+    }
+
     return extensions;
 }
 
@@ -353,6 +389,10 @@ void HelloTriangleApplication::createLogicalDevice()
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    if (indices.transferFamily.has_value())
+    {
+        uniqueQueueFamilies.insert(indices.transferFamily.value());
+    }
 
     float queuePriority = 1.0f;
 
@@ -372,6 +412,20 @@ void HelloTriangleApplication::createLogicalDevice()
     deviceFeatures.samplerAnisotropy = VK_TRUE; // 異方性フィルタリングが出来る事
     deviceFeatures.sampleRateShading = VK_TRUE; // テクスチャに対するマルチサンプリングを有効化する
 
+    // ブロック圧縮されたテクスチャ(BC1~BC7)は、対応しているGPUであれば使えるようにしておく
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+    // GPUでのカリングでは、描画コマンドの数をGPUが決める間接描画を使う。一度に複数の描画コマンドを実行するのでmultiDrawIndirectも必要になる
+    // 描画コマンドはLOD毎のインスタンスの範囲を描画するので、間接描画で0以外のfirstInstanceを使うためのdrawIndirectFirstInstanceも必要になる
+    drawIndirectCountEnabled = USE_GPU_CULLING &&
+                               supportedFeatures.multiDrawIndirect &&
+                               supportedFeatures.drawIndirectFirstInstance &&
+                               isDeviceExtensionAvailable(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    deviceFeatures.multiDrawIndirect = drawIndirectCountEnabled ? VK_TRUE : VK_FALSE;
+    deviceFeatures.drawIndirectFirstInstance = drawIndirectCountEnabled ? VK_TRUE : VK_FALSE;
+
     // ここから論理デバイスの作成情報を埋めていく
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -381,9 +435,34 @@ void HelloTriangleApplication::createLogicalDevice()
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
+    // テクスチャの表に使うdescriptor indexingの機能は、VkPhysicalDeviceFeaturesには無いので拡張の構造体で有効にする
+    // 対応していないGPUでは構造体を繋がず、マテリアル毎のデスクリプタセットを切り替えて描画する
+    textureTableEnabled = physicalDeviceProperties2Enabled &&
+                          std::all_of(textureTableExtensions.begin(), textureTableExtensions.end(), [&](const char *extension)
+                                      { return isDeviceExtensionAvailable(physicalDevice, extension); }) &&
+                          TextureTable::queryCapacity(instance, physicalDevice) > 0;
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = TextureTable::getRequiredFeatures();
+    createInfo.pNext = textureTableEnabled ? &descriptorIndexingFeatures : nullptr;
+    printf("textures : %s\n", textureTableEnabled ? "bindless texture table" : "per-material descriptor sets (descriptor indexing not supported)");
+
     // どんな拡張機能に対応するのか
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    // メモリの予算を問い合わせる拡張機能は必須ではないので、対応している場合だけ追加で有効にする
+    std::vector<const char *> extensions = deviceExtensions;
+    bool memoryBudgetEnabled = physicalDeviceProperties2Enabled && isDeviceExtensionAvailable(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudgetEnabled)
+    {
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    if (drawIndirectCountEnabled)
+    {
+        extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+    if (textureTableEnabled)
+    {
+        extensions.insert(extensions.end(), textureTableExtensions.begin(), textureTableExtensions.end());
+    }
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     if (enableValidationLayers)
     {
@@ -405,6 +484,16 @@ void HelloTriangleApplication::createLogicalDevice()
     // 出来上がった論理デバイスから、各種命令を扱えるキューのハンドラを取得する。
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    if (indices.transferFamily.has_value())
+    {
+        vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+    }
+
+    // バッファや画像のメモリはここからまとめて割り当てる
+    memoryAllocator.init(instance, physicalDevice, device, memoryBudgetEnabled);
+
+    // 前回の起動時にドライバがコンパイルしたパイプラインを読み込んでおき、パイプラインの作成時に使う
+    pipelineCache.init(physicalDevice, device, PipelineCache::getDefaultDirectory(PIPELINE_CACHE_APPLICATION_NAME));
 }
 
 bool HelloTriangleApplication::isDeviceSuitable(VkPhysicalDevice device)
@@ -426,6 +515,7 @@ bool HelloTriangleApplication::isDeviceSuitable(VkPhysicalDevice device)
     VkPhysicalDeviceFeatures supportedFeatures;
     vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
+    // テクスチャの表(descriptor indexing)は、使えなければマテリアル毎のデスクリプタセットで代わりにするので条件にしない
     return indices.isComplete() && extensionSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
 }
 
@@ -447,6 +537,23 @@ bool HelloTriangleApplication::checkDeviceExtensionSupport(VkPhysicalDevice devi
     return requiredExtensions.empty();
 }
 
+bool HelloTriangleApplication::isDeviceExtensionAvailable(VkPhysicalDevice device, const char *name)
+{
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto &extension : availableExtensions)
+    {
+        if (strcmp(extension.extensionName, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 QueueFamilyIndices HelloTriangleApplication::findQueueFamilies(VkPhysicalDevice device)
 {
     QueueFamilyIndices indices;
@@ -462,25 +569,39 @@ QueueFamilyIndices HelloTriangleApplication::findQueueFamilies(VkPhysicalDevice
     int i = 0;
     for (const auto &queueFamily : queueFamilies)
     {
-
-        // グラフィックスコマンドを実行可能なキューかどうか
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        // 描画と表示に使うキューは、両方が見つかった時点で決める
+        if (!indices.isComplete())
         {
-            indices.graphicsFamily = i;
-        }
+            // グラフィックスコマンドを実行可能なキューかどうか
+            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+            {
+                indices.graphicsFamily = i;
+            }
 
-        // ウインドウへの表示コマンドを実行可能なキューかどうか
-        VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-        if (presentSupport)
-        {
-            indices.presentFamily = i;
+            // ウインドウへの表示コマンドを実行可能なキューかどうか
+            VkBool32 presentSupport = false;
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            if (presentSupport)
+            {
+                indices.presentFamily = i;
+            }
         }
 
-        // 全部のパラメータに何らかの値が入っていればそれ以上探索する必要は無い
-        if (indices.isComplete())
+        // グラフィックスコマンドを実行できない転送用のキューかどうか。GPUのコピー専用のエンジンに対応している事が多い
+        // コンピュートも実行できないもの(純粋な転送専用のキュー)が見つかればそちらを優先する
+        if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))
         {
-            break;
+            bool pureTransfer = !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
+            if (!indices.transferFamily.has_value() || pureTransfer)
+            {
+                indices.transferFamily = i;
+            }
+
+            // 全部のパラメータに何らかの値が入っていればそれ以上探索する必要は無い
+            if (indices.isComplete() && pureTransfer)
+            {
+                break;
+            }
         }
 
         i++;
@@ -610,6 +731,9 @@ void HelloTriangleApplication::recreateSwapChain()
     createColorResources();
     createDepthResources();
     createFramebuffers();
+
+    // フレームバッファが変わったので、記録済みのコマンドバッファは使えない
+    createCachedCommandBuffers();
 }
 
 void HelloTriangleApplication::createImageViews()
@@ -651,7 +775,7 @@ void HelloTriangleApplication::createRenderPass()
     VkAttachmentDescription colorAttachment{};
     colorAttachment.format = swapChainImageFormat;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;                   // フレームバッファに書き込む前に既存の内容をクリアする
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;                 // フレームバッファに書き込まれた値を保持し、後でウインドウに表示したりする際に読みだされるようにする
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;             // 表示するのはresolve先の画像なので、MSAA用の画像の内容はメモリに書き戻さなくて良い
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;        // ステンシルの値はクリアされてもされなくてもどっちでもいい
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;      // ステンシルの値は保持されてもされなくてもどっちでもいい
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;              // 最初にフレームバッファに書き込まれているデータの構造は気にしない
@@ -731,25 +855,46 @@ void HelloTriangleApplication::createRenderPass()
     }
 }
 
-void HelloTriangleApplication::createDescriptorSetLayout()
+std::vector<VkDescriptorSetLayoutBinding> HelloTriangleApplication::getDescriptorSetLayoutBindings()
 {
-    // MVP行列をシェーダ内で使えるようにバインディングする
-    VkDescriptorSetLayoutBinding uboLayoutBinding{};
-    uboLayoutBinding.binding = 0; // シェーダー内で何番目のバインディングにあたるか
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // どのシェーダが使用するデスクリプタなのか
-    uboLayoutBinding.pImmutableSamplers = nullptr;            // 画像をデスクリプタとして渡す際に使用するパラメータ
+    // バインディングの番号、種類、使用するステージはビルド時にシェーダから読み取った物をそのまま使う
+    // シェーダを書き換えてバインディングが変わっても、ここを直さずにレイアウトが追従する
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    for (const ReflectedBinding &reflected : SHADER_BINDINGS)
+    {
+        // テクスチャの表はTextureTableが自分のレイアウトを作る
+        if (reflected.set == TEXTURE_TABLE_SET)
+        {
+            continue;
+        }
+        if (reflected.set != 0)
+        {
+            throw std::runtime_error("shaders use a descriptor set other than 0 and the texture table!"); // デスクリプタセットは二つしか作っていない
+        }
+
+        VkDescriptorSetLayoutBinding binding{};
+        binding.binding = reflected.binding; // シェーダー内で何番目のバインディングにあたるか
+        binding.descriptorType = reflected.descriptorType;
+        binding.descriptorCount = reflected.descriptorCount;
+        binding.stageFlags = reflected.stageFlags; // どのシェーダが使用するデスクリプタなのか
+        binding.pImmutableSamplers = nullptr;      // 画像をデスクリプタとして渡す際に使用するパラメータ
+
+        // 動的オフセットを使うかどうかはシェーダからは分からないので、カメラの行列のブロックだけ書き換える
+        // フレーム毎の領域はバインド時の動的オフセットで選ぶ
+        if (isSameName(reflected.name, "CameraUniform"))
+        {
+            binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        }
+
+        bindings.push_back(binding);
+    }
 
-    // テクスチャをシェーダ内で使えるようにバインディングする
-    VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-    samplerLayoutBinding.binding = 1;
-    samplerLayoutBinding.descriptorCount = 1;
-    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
-    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT; // テクスチャはフラグメントシェーダが使用する
+    return bindings;
+}
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
+void HelloTriangleApplication::createDescriptorSetLayout()
+{
+    std::vector<VkDescriptorSetLayoutBinding> bindings = getDescriptorSetLayoutBindings();
 
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -760,31 +905,32 @@ void HelloTriangleApplication::createDescriptorSetLayout()
     {
         throw std::runtime_error("failed to create descriptor set layout!");
     }
+
+    // テクスチャの表はupdate-after-bindなので、カメラの行列とは別のデスクリプタセットにする
+    // 表が使えない場合は、マテリアル毎に切り替える一枚のテクスチャを、別版のフラグメントシェーダの同じ番号のデスクリプタセットに置く
+    const ReflectedBinding *texturesBinding = textureTableEnabled ? findReflectedBinding(SHADER_BINDINGS, "textures")
+                                                                  : findReflectedBinding(FRAG_PER_MATERIAL_SHADER_BINDINGS, "materialTexture");
+    if (texturesBinding == nullptr || texturesBinding->set != TEXTURE_TABLE_SET)
+    {
+        throw std::runtime_error("shaders do not declare the texture table!");
+    }
+    uint32_t textureCapacity = textureTableEnabled ? std::min(MAX_TEXTURES, TextureTable::queryCapacity(instance, physicalDevice)) : MAX_TEXTURES;
+    textureTable.init(device, *texturesBinding, textureCapacity, textureTableEnabled);
 }
 
 void HelloTriangleApplication::createGraphicsPipeline()
 {
-    auto vertexShaderCode = readFile("shaders/vert.spv");
-    auto fragShaderCode = readFile("shaders/frag.spv");
-
-    VkShaderModule vertShaderModule = createShaderModule(vertexShaderCode);
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-    // vertex shaderの作成
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vertShaderModule;
-    vertShaderStageInfo.pName = "main"; // シェーダー開始時に実行される関数名
-
-    // fragment shaderの作成
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = fragShaderModule;
-    fragShaderStageInfo.pName = "main";
-
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+    // シェーダはビルド時にSPIR-Vにコンパイルして実行ファイルに埋め込んであるので、ファイルから読み込む必要は無い
+    std::array<VkPipelineShaderStageCreateInfo, EMBEDDED_SHADERS.size()> shaderStages{};
+    for (size_t i = 0; i < EMBEDDED_SHADERS.size(); i++)
+    {
+        // テクスチャの表が使えない場合は、フラグメントシェーダをマテリアル毎のテクスチャを読む別版に差し替える
+        const EmbeddedShader &shader = !textureTableEnabled && EMBEDDED_SHADERS[i].stage == FRAG_PER_MATERIAL_SHADER.stage ? FRAG_PER_MATERIAL_SHADER : EMBEDDED_SHADERS[i];
+        shaderStages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[i].stage = shader.stage;
+        shaderStages[i].module = createShaderModule(shader);
+        shaderStages[i].pName = shader.entryPoint; // シェーダー開始時に実行される関数名
+    }
 
     // パイプライン作成後に動的に変更可能なプロパティを定義する
     // ここではフレームバッファの描画に使う範囲やウインドウのサイズを変更できるようにしておく
@@ -806,12 +952,19 @@ void HelloTriangleApplication::createGraphicsPipeline()
     vertexInputInfo.vertexAttributeDescriptionCount = 0;
     vertexInputInfo.pVertexAttributeDescriptions = nullptr;
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    // 0番目のバインディングは頂点毎のデータ、1番目のバインディングはインスタンス毎のデータ
+    std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = {
+        getBindingDescription<MeshVertex>(0, VK_VERTEX_INPUT_RATE_VERTEX),
+        getBindingDescription<InstanceData>(1, VK_VERTEX_INPUT_RATE_INSTANCE),
+    };
+    auto vertexAttributeDescriptions = getAttributeDescriptions<MeshVertex>(0);
+    auto instanceAttributeDescriptions = getAttributeDescriptions<InstanceData>(1);
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(vertexAttributeDescriptions.begin(), vertexAttributeDescriptions.end());
+    attributeDescriptions.insert(attributeDescriptions.end(), instanceAttributeDescriptions.begin(), instanceAttributeDescriptions.end());
 
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
     vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
     // 頂点データがどのような図形を表しているのかを定義する。
@@ -915,10 +1068,18 @@ void HelloTriangleApplication::createGraphicsPipeline()
     // シェーダーにグローバルな変数を渡し、動的に挙動を変更する
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout; // シェーダに渡したい変数についての情報
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-    pipelineLayoutInfo.pPushConstantRanges = nullptr;
+    std::array<VkDescriptorSetLayout, 2> setLayouts = {descriptorSetLayout, textureTable.getLayout()};
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data(); // シェーダに渡したい変数についての情報。0番目がカメラの行列、1番目がテクスチャの表
+
+    // モデル行列と、量子化した頂点を元に戻すためのスケールとバイアスは、デスクリプタを介さずにプッシュ定数として頂点シェーダに渡す
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = SHADER_PUSH_CONSTANTS.stageFlags; // ブロックを宣言しているステージ。大きさがObjectConstantsと一致する事はビルド時に確かめている
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(ObjectConstants);
+
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
     {
@@ -927,8 +1088,8 @@ void HelloTriangleApplication::createGraphicsPipeline()
 
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;         // グラフィックパイプラインに含まれるシェーダーの段階の数
-    pipelineInfo.pStages = shaderStages; // バーテックスシェーダーとフラグメントシェーダーを使用することを指示する
+    pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size()); // グラフィックパイプラインに含まれるシェーダーの段階の数
+    pipelineInfo.pStages = shaderStages.data();                            // 埋め込んだ全てのシェーダー(バーテックスシェーダーとフラグメントシェーダー)を使用することを指示する
     // パイプライン中の固定ステージの設定
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
@@ -945,27 +1106,32 @@ void HelloTriangleApplication::createGraphicsPipeline()
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // 派生するパイプラインオブジェクト
     pipelineInfo.basePipelineIndex = -1;              // 派生するパイプラインのインデックス
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
+    // キャッシュにヒットすれば、ドライバはシェーダをコンパイルし直さずに済む
+    if (pipelineCache.createGraphicsPipeline(pipelineInfo, &graphicsPipeline, "graphicsPipeline") != VK_SUCCESS)
     {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
+    markCommandBuffersDirty(); // 記録済みのコマンドバッファは古いパイプラインを使っている
+
     // グラフィックスパイプラインが出来たらシェーダーモジュールはもう不要なので削除する
-    vkDestroyShaderModule(device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    for (const VkPipelineShaderStageCreateInfo &shaderStage : shaderStages)
+    {
+        vkDestroyShaderModule(device, shaderStage.module, nullptr);
+    }
 }
 
-VkShaderModule HelloTriangleApplication::createShaderModule(const std::vector<char> &code)
+VkShaderModule HelloTriangleApplication::createShaderModule(const EmbeddedShader &shader)
 {
     VkShaderModuleCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = code.size();
-    createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data()); // uint32_tの配列として渡すする必要があるのでreinterpretする
+    createInfo.codeSize = shader.codeSize;
+    createInfo.pCode = shader.code; // 埋め込んだ配列は初めからuint32_tなので、アラインメントも満たしている
 
     VkShaderModule shaderModule;
     if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
     {
-        printf("shader size %d\n", (int)code.size());
+        printf("shader size %d\n", (int)shader.codeSize);
         throw std::runtime_error("failed to create shader module!");
     }
 
@@ -1012,41 +1178,20 @@ void HelloTriangleApplication::createCommandPool()
     {
         throw std::runtime_error("failed to create command pool!");
     }
-}
-
-VkCommandBuffer HelloTriangleApplication::beginSingleTimeCommands()
-{
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-    return commandBuffer;
-}
-
-void HelloTriangleApplication::endSingleTimeCommands(VkCommandBuffer commandBuffer)
-{
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
 
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphicsQueue);
+    // 描画コマンドを並列に記録するスレッドと、スレッド毎・フレーム毎のコマンドプールを用意する
+    uint32_t recordingThreadCount = std::min(std::max(1u, std::thread::hardware_concurrency()), MAX_RECORDING_THREADS);
+    recordingJobs.init(recordingThreadCount);
+    frameCommandPools.init(device, queueFamilyIndices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, recordingJobs.getThreadCount());
 
-    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    // CPUからのデータの転送は描画用のコマンドプールとは別に、転送専用のキューがあればそちらで行う
+    uploadEngine.init(device,
+                      &memoryAllocator,
+                      queueFamilyIndices.graphicsFamily.value(),
+                      graphicsQueue,
+                      queueFamilyIndices.transferFamily,
+                      transferQueue,
+                      STAGING_RING_SIZE);
 }
 
 void HelloTriangleApplication::createColorResources()
@@ -1060,9 +1205,10 @@ void HelloTriangleApplication::createColorResources()
                 colorFormat,
                 VK_IMAGE_TILING_OPTIMAL,
                 VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, // 内容はレンダーパスの中でしか使わないので、タイルメモリだけで済むGPUでは実際のメモリを確保させない
                 colorImage,
-                colorImageMemory);
+                colorImageMemory,
+                MemoryCategory::Attachment);
     colorImageView = createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 }
 
@@ -1075,18 +1221,14 @@ void HelloTriangleApplication::createDepthResources()
                 msaaSamples,
                 depthFormat,
                 VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, // 深度もレンダーパスの後では使わないので一時的な物とする
+                VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
                 depthImage,
-                depthImageMemory);
+                depthImageMemory,
+                MemoryCategory::Attachment);
 
+    // レンダーパスの開始時に未定義のレイアウトから変換されるので、ここでレイアウトを変換しておく必要は無い
     depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-
-    transitionImageLayout(depthImage,
-                          depthFormat,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-                          1);
 }
 
 VkFormat HelloTriangleApplication::findDepthFormat()
@@ -1097,6 +1239,27 @@ VkFormat HelloTriangleApplication::findDepthFormat()
         VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 }
 
+VkFormat HelloTriangleApplication::findTextureFormat()
+{
+    // ブロック圧縮のフォーマットは、論理デバイスでtextureCompressionBCを有効にした場合にしか使えない
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+    std::vector<VkFormat> candidates;
+    for (VkFormat format : TEXTURE_FORMAT_CANDIDATES)
+    {
+        if (!isBlockCompressedFormat(format) || supportedFeatures.textureCompressionBC)
+        {
+            candidates.push_back(format);
+        }
+    }
+
+    // コンテナの画素データをそのまま転送してサンプリングするので、転送先にできる事とサンプリングできる事が必要
+    return findSupportedFormat(candidates,
+                               VK_IMAGE_TILING_OPTIMAL,
+                               VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT);
+}
+
 VkFormat HelloTriangleApplication::findSupportedFormat(const std::vector<VkFormat> &candidates,
                                                        VkImageTiling tiling,
                                                        VkFormatFeatureFlags features)
@@ -1120,74 +1283,136 @@ VkFormat HelloTriangleApplication::findSupportedFormat(const std::vector<VkForma
     throw std::runtime_error("failed to find supported format!");
 }
 
-bool HelloTriangleApplication::hasStencilComponent(VkFormat format)
+void HelloTriangleApplication::createTextureImage()
 {
-    return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+    // ワーカースレッドでのコンテナの読み込みが終わるのを待つ
+    waitForAssetJob(textureLoadJob, "loadTexture");
+
+    for (MaterialTexture &texture : textures)
+    {
+        TextureContainer &container = *texture.container;
+        texture.mipLevels = container.getMipLevels();
+
+        // 最終的な伝送先となるImageを作成する
+        createImage(container.getWidth(),
+                    container.getHeight(),
+                    texture.mipLevels,
+                    VK_SAMPLE_COUNT_1_BIT,
+                    textureFormat,
+                    VK_IMAGE_TILING_OPTIMAL,
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, // ミップマップはコンテナに入っているので、GPU上で作成するためのTRANSFER_SRCは不要
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    texture.image,
+                    texture.memory,
+                    MemoryCategory::Texture);
+
+        // ミップレベル毎に、コンテナの画素データのどこからどのミップレベルにコピーするかを指定する
+        std::vector<VkBufferImageCopy> regions(texture.mipLevels);
+        for (uint32_t i = 0; i < texture.mipLevels; i++)
+        {
+            const TextureLevel &level = container.getLevel(i);
+            regions[i] = {};
+            regions[i].bufferOffset = level.offset;
+            regions[i].bufferRowLength = 0; // 0の場合は画素が隙間なく並んでいるものとして扱われる
+            regions[i].bufferImageHeight = 0;
+            regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            regions[i].imageSubresource.mipLevel = i;
+            regions[i].imageSubresource.baseArrayLayer = 0;
+            regions[i].imageSubresource.layerCount = 1;
+            regions[i].imageOffset = {0, 0, 0};
+            regions[i].imageExtent = {level.width, level.height, 1};
+        }
+        // コンテナの画素データは全ミップレベル分がそのまま転送できる形で並んでいるので、マップしたファイルから一次バッファのリングに直接コピーする
+        // リングに収まらないミップレベルは分けて転送される。レイアウトの変換もまとめて記録され、コピーが終わると全てのミップレベルがシェーダから読み込める形になる
+        const uint8_t *pixels = static_cast<const uint8_t *>(container.getData());
+        uploadEngine.uploadImage(texture.image,
+                                 textureFormat,
+                                 texture.mipLevels,
+                                 regions,
+                                 [&](void *staging, VkDeviceSize offset, VkDeviceSize size)
+                                 { memcpy(staging, pixels + offset, static_cast<size_t>(size)); });
+
+        // 画素データは一次バッファに写し終えたのでコンテナはすぐに閉じてよい
+        // 転送の完了は待たずに、残りの初期化を進めている間にGPUでコピーしてもらう
+        texture.container.reset();
+    }
 }
 
-void HelloTriangleApplication::createTextureImage()
+void HelloTriangleApplication::startTextureLoad()
 {
-    // テクスチャ画像を読み込む
-    int texWidth, texHeight, texChannels;
-    stbi_uc *pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4; // RGBAが1バイトずつ並ぶ
+    textureFormat = findTextureFormat();
+    textureLoadJob = std::async(std::launch::async, &HelloTriangleApplication::loadTexture, this);
+}
 
-    // ミップマップをいくつ作成するかの計算。長辺を2で何回割れるかに元の画像の分で1を足す事で求められる。
-    mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+void HelloTriangleApplication::loadTexture()
+{
+    auto start = StartupReport::Clock::now();
 
-    if (!pixels)
+    // テクスチャの無いマテリアルに使うテクスチャは、モデルの読み込みを待たずに読み込み始める
+    textures.clear();
+    textures.emplace_back();
+    textures[0].path = TEXTURE_PATH;
+    textures[0].container = std::make_unique<TextureContainer>();
+    if (!openTextureContainer(*textures[0].container, TEXTURE_PATH))
     {
+        printf("file name is : %s\n", TEXTURE_PATH.c_str());
         throw std::runtime_error("failed to load texture image!");
     }
 
-    // まずはCPUから見える領域にテクスチャを転送して、その後GPUのみが見える領域にコピーする
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    createBuffer(imageSize,
-                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer,
-                 stagingBufferMemory);
-
-    void *data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    stbi_image_free(pixels);
-
-    // 最終的な伝送先となるImageを作成する
-    createImage(texWidth,
-                texHeight,
-                mipLevels,
-                VK_SAMPLE_COUNT_1_BIT,
-                VK_FORMAT_R8G8B8A8_SRGB,
-                VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, // ミップマップを作成する際に書き込む必要があるので、TRAANSFER_SRCも指定する必要がある
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                textureImage,
-                textureImageMemory);
+    // マテリアルのテクスチャはモデルを読み込むまで分からないので、ワーカースレッドでマテリアルを読み終えるのを待つ
+    // materialTexturesにはまずtexturesの中での番号を入れておき、テクスチャの表に登録する時に表の中での番号に置き換える
+    materialsLoaded.get_future().get();
+    materialTextures.assign(meshMaterials.size(), 0);
+    for (size_t material = 0; material < meshMaterials.size(); material++)
+    {
+        std::string path = meshMaterials[material].texturePath;
+        if (path.empty())
+        {
+            continue;
+        }
 
-    // textureImageのレイアウトを転送するのに最適な形に変換する
-    transitionImageLayout(textureImage,
-                          VK_FORMAT_R8G8B8A8_SRGB,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                          mipLevels);
+        // 同じ画像を使うマテリアルは、一つのテクスチャを共有する
+        auto found = std::find_if(textures.begin(), textures.end(), [&](const MaterialTexture &texture)
+                                  { return texture.path == path; });
+        if (found != textures.end())
+        {
+            materialTextures[material] = static_cast<uint32_t>(found - textures.begin());
+            continue;
+        }
 
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+        // 一つの画像が無いだけでモデル全体を表示できなくならないように、読めないテクスチャのマテリアルはテクスチャの無いマテリアルとして扱う
+        auto container = std::make_unique<TextureContainer>();
+        if (!openTextureContainer(*container, path))
+        {
+            printf("failed to load material texture : %s\n", path.c_str());
+            continue;
+        }
+        materialTextures[material] = static_cast<uint32_t>(textures.size());
+        textures.emplace_back();
+        textures.back().path = path;
+        textures.back().container = std::move(container);
+    }
 
-    // 転送用のステージングバッファはもう不要なので消してしまう。
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    printf("textures : %zu (%zu materials)\n", textures.size(), meshMaterials.size());
+    startupReport.addJob("loadTexture", StartupReport::millisecondsSince(start));
+}
 
-    generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
+bool HelloTriangleApplication::openTextureContainer(TextureContainer &container, const std::string &path)
+{
+    // 全てのミップレベルを作成済みのテクスチャのコンテナを読み込む。無いか古いか、このGPUで使えないフォーマットの場合は元画像から作成し直す
+    if (container.open(path, textureFormat))
+    {
+        return true;
+    }
+    return TextureContainer::bake(path, textureFormat) && container.open(path, textureFormat);
 }
 
 void HelloTriangleApplication::createTextureImageView()
 {
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+    for (MaterialTexture &texture : textures)
+    {
+        texture.view = createImageView(texture.image, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, texture.mipLevels);
+    }
 }
 
 void HelloTriangleApplication::createImage(uint32_t width,
@@ -1199,7 +1424,8 @@ void HelloTriangleApplication::createImage(uint32_t width,
                                            VkImageUsageFlags usage,
                                            VkMemoryPropertyFlags properties,
                                            VkImage &image,
-                                           VkDeviceMemory &imageMemory)
+                                           MemoryAllocation &imageMemory,
+                                           MemoryCategory category)
 {
     // 画像をVkImageの形でロードする
     VkImageCreateInfo imageInfo{};
@@ -1226,205 +1452,26 @@ void HelloTriangleApplication::createImage(uint32_t width,
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
-    {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(device, image, imageMemory, 0);
-}
-
-void HelloTriangleApplication::generateMipmaps(VkImage image,
-                                               VkFormat imageFormat,
-                                               int32_t texWidth,
-                                               int32_t texHeight,
-                                               uint32_t mipLevels)
-{
-    // Blitするためには、ハードウェアでBlit対象の画像フォーマットのリニアフィルタを扱える必要がある。
-    VkFormatProperties formatProperties;
-    vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
-    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
-    {
-        throw std::runtime_error("texture image format does not support linear blitting");
-    }
-
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.image = image;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
-    int32_t mipWidth = texWidth;
-    int32_t mipHeight = texHeight;
-
-    for (uint32_t i = 1; i < mipLevels; i++)
-    {
-        // i - 1番目のミップマップが埋まるのを待ってから(Blitが終わるのを待ってから)、そのレベルのミップマップをVK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMALに変換する
-        barrier.subresourceRange.baseMipLevel = i - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-        vkCmdPipelineBarrier(commandBuffer,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             0,
-                             0, nullptr,
-                             0, nullptr,
-                             1, &barrier);
-
-        // i - 1番目のミップマップをi番目のミップマップにコピーする
-        VkImageBlit blit{};
-        blit.srcOffsets[0] = {0, 0, 0};                // どこからコピーするか
-        blit.srcOffsets[1] = {mipWidth, mipHeight, 1}; // [0]の点からどの程度の範囲をコピーするのか
-        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.srcSubresource.mipLevel = i - 1;
-        blit.srcSubresource.baseArrayLayer = 0;
-        blit.srcSubresource.layerCount = 1;
-        blit.dstOffsets[0] = {0, 0, 0};                                                               // どこにコピーするか
-        blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1}; // [0]の点からどの程度の範囲にコピーするのか。ミップマップのサイズは半分ずつに減らしていく
-        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.dstSubresource.mipLevel = i;
-        blit.dstSubresource.baseArrayLayer = 0;
-        blit.dstSubresource.layerCount = 1;
-
-        vkCmdBlitImage(commandBuffer,
-                       image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, // コピー元になるミップレベルは上の変換でSRC_OPTIMALになっているはず
-                       image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, // コピー先になるミップレベルはDST_OPTIMAL(textureImageの元の形式)にする
-                       1, &blit,
-                       VK_FILTER_LINEAR);
-
-        // i - 1番目のミップマップはもうBlitで読み込まれることは無いので、SRC_OPTIMALからシェーダで読み込むためにREAD_ONLY_OPTIMALに変換する
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(commandBuffer,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-                             0, nullptr,
-                             0, nullptr,
-                             1, &barrier);
-
-        if (mipWidth > 1)
-        {
-            mipWidth /= 2;
-        }
-        if (mipHeight > 1)
-        {
-            mipHeight /= 2;
-        }
-    }
-
-    // 最後に作成したミップレベルをSRC_OPTIMALからREAD_ONLY_OPTIMALに変換する
-    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(commandBuffer,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-                         0, nullptr,
-                         0, nullptr,
-                         1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
-}
-
-void HelloTriangleApplication::transitionImageLayout(VkImage image,
-                                                     VkFormat format,
-                                                     VkImageLayout oldLayout,
-                                                     VkImageLayout newLayout,
-                                                     uint32_t mipLevels)
-{
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    // image memory barrierを使用してレイアウトの変更ができるらしい
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    // キューファミリーのオーナーシップを転送する際にはこれらのインデックスにキューファミリーのインデックスを入れる
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    // imageのどの範囲のレイアウトを変更するかをsubresourceRangeで指定する。ここでは画像全域を指定している。
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = mipLevels;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-
-    if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-    {
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-        if (hasStencilComponent(format))
-        {
-            barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
-        }
-    }
-    else
-    {
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    }
-
-    // どのレイアウトからどのレイアウトに変化するか次第でどのステージを待ってどのステージに進むのかを決定する
-    VkPipelineStageFlags sourceStage;
-    VkPipelineStageFlags destinationStage;
-
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    // 遅延割り当てのメモリはタイルベースのGPU(モバイルや一部の統合GPU)にしか無いので、無い場合は通常のGPUのメモリに置く
+    if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !memoryAllocator.hasMemoryType(memRequirements.memoryTypeBits, properties))
     {
-        // 作られたばかりの未定義なレイアウトのImageへBuffer上に読み込んだデータを転送するために転送に適した形式に変換する場合
-        barrier.srcAccessMask = 0;                            // バリアが完了するのを待つ操作。ここでは特に何も待たない
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; // 全ての処理を待った後に行われる処理。転送の書き込み処理
-
-        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;   // パイプラインの開始→待つステージは特にない
-        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT; // 転送処理ステージ
+        properties = (properties & ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     }
-    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-    {
-        // Bufferからデータを転送されたImageをシェーダがサンプリングするのに適した形式に変換する場合
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; // バリアが完了するのを待つ操作。転送の書き込み処理
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;    // 全ての処理を待った後に行われる処理。シェーダからの読み込み処理
 
-        sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    }
-    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+    // imageMemoryに前の画像(スワップチェインの再作成前のアタッチメントなど)のメモリが残っていて、新しい画像が収まるならそのまま使い回す
+    // 前の画像は破棄済みなので、同じ範囲に新しい画像を割り付けても問題無い。大きく余る場合は他のリソースに返すために割り当て直す
+    if (imageMemory.memory != VK_NULL_HANDLE &&
+        !(memoryAllocator.isCompatible(imageMemory, memRequirements, properties) && imageMemory.size / 2 < memRequirements.size))
     {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;               // パイプラインの開始→待つステージは特にない
-        destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT; // フラグメントバッファにおける深度テストのステージ
+        memoryAllocator.free(imageMemory);
     }
-    else
+    if (imageMemory.memory == VK_NULL_HANDLE)
     {
-        throw std::invalid_argument("unsupported layout transition!");
+        // 最適なタイリングの画像はバッファと同じページに置けない場合があるので、線形かどうかをアロケータに伝える
+        imageMemory = memoryAllocator.allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR, category);
     }
 
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        sourceStage,      // バリアの前までにパイプラインのどのステージが終わっていないといけないか
-        destinationStage, // バリアが解除された後に実行された後に実行されるステージ。バリアはどのステージのために処理を待つのか
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
+    vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
 }
 
 void HelloTriangleApplication::createTextureSampler()
@@ -1454,170 +1501,496 @@ void HelloTriangleApplication::createTextureSampler()
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = static_cast<float>(mipLevels); // カメラから遠ざかっていった時にミップマップを何段階に分けるか
+    // カメラから遠ざかっていった時にミップマップを何段階に分けるか。サンプラーは全てのテクスチャで共有するので、最もミップレベルの多いテクスチャに合わせる
+    // ミップレベルの少ないテクスチャでは、最後のミップレベルより先は最後のミップレベルが使われる
+    uint32_t maxMipLevels = 1;
+    for (const MaterialTexture &texture : textures)
+    {
+        maxMipLevels = std::max(maxMipLevels, texture.mipLevels);
+    }
+    samplerInfo.maxLod = static_cast<float>(maxMipLevels);
 
     if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to create texture sampler!");
     }
+
+    // 全てのテクスチャを表に登録し、マテリアル毎のテクスチャの番号を表の中での番号に置き換える
+    for (MaterialTexture &texture : textures)
+    {
+        texture.tableIndex = textureTable.add(texture.view, textureSampler);
+    }
+    for (uint32_t &texture : materialTextures)
+    {
+        texture = textures[texture].tableIndex;
+    }
 }
 
-void HelloTriangleApplication::loadModel()
+void HelloTriangleApplication::prepareModel()
 {
-    tinyobj::attrib_t attrib;             // 頂点の座標、法線、UV情報を全て持っているコンテナ
-    std::vector<tinyobj::shape_t> shapes; // 一つのファイルに含まれるモデルの配列。モデルを構成する各面の頂点数は任意だが、tinyobjが自動的に全て三角形に変換してくれる
-    std::vector<tinyobj::material_t> materials;
-    std::string err;
+    auto start = StartupReport::Clock::now();
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str()))
+    // テクスチャの読み込みがマテリアルを待っているので、読み込みに失敗した場合も例外を渡して待たせたままにしない
+    try
     {
-        throw std::runtime_error(err);
+        loadModel();
     }
-
-    // 全ての配列を一つの頂点配列としてまとめて扱う
-    for (const auto &shape : shapes)
+    catch (...)
     {
-        for (const auto &index : shape.mesh.indices)
-        {
-            Vertex vertex{};
+        materialsLoaded.set_exception(std::current_exception());
+        throw;
+    }
+    materialsLoaded.set_value();
 
-            vertex.pos = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2],
-            };
+    // 頂点バッファに格納する際の量子化のスケールとバイアスと、LODの作成とメッシュの塊への分割もGPUを使わずに求められるので、ここで済ませておく
+    // 全てのLODは同じ頂点配列を使い、塊のインデックスは一つのインデックスバッファにLODの順に並ぶ
+    meshQuantization = computeMeshQuantization<MeshVertex>(vertexData, vertexCount);
+    meshlets.clear();
+    meshletIndices16.clear();
+    meshletIndices32.clear();
+    buildMeshLods(vertexData, vertexCount, indexData, indexCount, submeshes.data(), submeshes.size(), meshLods, meshlets, meshletIndices16, meshletIndices32);
 
-            vertex.texCoord = {
-                attrib.texcoords[2 * index.texcoord_index + 0],
-                1.0f - attrib.texcoords[2 * index.texcoord_index + 1], // Objファイルは画像下をVの0と扱っているが、Vulkanでは画像上をVの0としているため、上下を反転してやる必要がある。
-            };
+    // GPUに転送するのは塊毎のインデックスなので、元のインデックス配列はここで手放し、頂点バッファの作成中に抱えたままにしない
+    // キャッシュをマップしている場合はファイルを参照しているだけなので、indicesは元から空
+    std::vector<uint32_t>().swap(indices);
+    indexData = nullptr;
 
-            vertex.color = {1.0f, 1.0f, 1.0};
+    startupReport.addJob("prepareModel", StartupReport::millisecondsSince(start));
+}
 
-            // 頂点vertexと一致する頂点がuniqueVerticesに含まれているかチェックする
-            if (uniqueVertices.count(vertex) == 0)
+void HelloTriangleApplication::loadModel()
+{
+    // 前回の起動時に作ったキャッシュが使える場合はobjファイルを解析せず、キャッシュをマップするだけで済ませる
+    if (!meshCache.open(MODEL_PATH))
+    {
+        // 巨大なobjファイルは全体をメモリ上に展開すると足りなくなるので、少しずつ解析しながら直接キャッシュに書き出す
+        std::error_code ec;
+        auto modelSize = std::filesystem::file_size(MODEL_PATH, ec);
+        if (!ec && modelSize >= STREAMING_OBJ_THRESHOLD)
+        {
+            streamModelToCache();
+            optimizeMeshCache();
+            if (!meshCache.open(MODEL_PATH))
             {
-                // 含まれていなかった場合は、vertexをキーとして新たなインデックスを加える
-                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                vertices.push_back(vertex); // 今まで存在していなかった頂点のみを頂点バッファに加える
+                throw std::runtime_error("failed to open mesh cache!");
             }
-
-            indices.push_back(uniqueVertices[vertex]); // uniqueVerticesに含まれているvertexと一致する頂点のインデックスを格納する。
+        }
+        else
+        {
+            loadModelWithTinyObj();
         }
     }
-}
-
-void HelloTriangleApplication::createVertexBuffer()
-{
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
 
-    // CPUからGPUへデータを転送するための一次バッファであるステージングバッファを作成する
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize,
-                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer,
-                 stagingBufferMemory);
-    void *data;
-    // VRAMをRAMにマッピングする
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    // マップした領域に頂点情報を流し込む
-    memcpy(data, vertices.data(), (size_t)bufferSize);
-    // マッピングを解除する
-    vkUnmapMemory(device, stagingBufferMemory);
+    if (meshCache.isOpen())
+    {
+        vertexData = meshCache.getVertices();
+        vertexCount = meshCache.getVertexCount();
+        indexData = meshCache.getIndices();
+        indexCount = meshCache.getIndexCount();
 
-    // 実際にGPUがレンダリング用に使用する頂点バッファを作成する
-    createBuffer(
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, // ステージングバッファから転送する先として使用でき、かつ頂点バッファとして使用できるよう指定しておく
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        vertexBuffer,
-        vertexBufferMemory);
+        // サブメッシュとマテリアルは小さいので、キャッシュを閉じても使えるようにコピーしておく
+        submeshes.assign(meshCache.getSubmeshes(), meshCache.getSubmeshes() + meshCache.getSubmeshCount());
+        meshMaterials.assign(meshCache.getMaterials(), meshCache.getMaterials() + meshCache.getMaterialCount());
+    }
 
-    // GPUとCPUが両方アクセスできるメモリ領域よりもGPUのみが専有的にアクセスできるメモリ領域の方がGPUからのアクセス効率がいい
-    // 今回は実行途中で頂点情報がアップデートされることは無いので、わざわざ一次バッファを用意してGPUのみがアクセス可能な頂点バッファにデータをコピーした方が
-    // 読み込みが速いので効率が良くなる
-    // もしも頂点情報が実行中に変化するのであれば、毎回バッファ間のコピーを行うと無駄なので、CPUとGPUがアクセスできる領域をそのまま頂点バッファにした方がいい
-    copyBuffer(stagingBuffer, vertexBuffer, bufferSize); // 一次バッファから頂点バッファに頂点データを移す
+    // 少しずつ解析して読み込んだモデルにはマテリアルが無いので、全体を一つのテクスチャの無いマテリアルで描画する
+    if (submeshes.empty())
+    {
+        submeshes.push_back({0, indexCount, 0});
+    }
+    if (meshMaterials.empty())
+    {
+        meshMaterials.push_back(MeshMaterial{});
+    }
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    printf("model loaded : %u vertices, %u indices, %zu submeshes, %zu materials\n", vertexCount, indexCount, submeshes.size(), meshMaterials.size());
+    reportPeakMemoryUsage("loadModel");
 }
 
-void HelloTriangleApplication::createIndexBuffer()
+void HelloTriangleApplication::streamModelToCache()
 {
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    MeshCacheWriter writer;
+    if (!writer.begin(MODEL_PATH))
+    {
+        throw std::runtime_error("failed to create mesh cache!");
+    }
 
-    // インデックスバッファはGPUのみがアクセスできる領域に作成するので、CPUとGPUが両方アクセス可能な一次バッファを作成する
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize,
-                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer,
-                 stagingBufferMemory);
+    // 重複を取り除いた頂点とインデックスは一定数ずつ渡されてくるので、そのままキャッシュファイルに書き出していく
+    ObjStreamReader reader;
+    reader.read(
+        MODEL_PATH,
+        [&](const Vertex *chunk, size_t count)
+        { writer.appendVertices(chunk, count); },
+        [&](const uint32_t *chunk, size_t count)
+        { writer.appendIndices(chunk, count); });
+
+    if (!writer.finish())
+    {
+        throw std::runtime_error("failed to write mesh cache!");
+    }
 
-    void *data;
-    // VRAM上の一次バッファをRAMにマッピングし、そこにインデックス情報を流し込む。使い終わった後はアンマップする。
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
+    printf("obj streaming reader peak memory : %.1f MiB\n", reader.getPeakMemoryUsage() / (1024.0 * 1024.0));
+}
 
-    // インデックスバッファを作成する。
-    createBuffer(bufferSize,
-                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                 indexBuffer,
-                 indexBufferMemory);
-
-    // 一次バッファからインデックスバッファに内容をコピーする
-    copyBuffer(stagingBuffer, indexBuffer, bufferSize);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
-}
-
-void HelloTriangleApplication::copyBufferToImage(VkBuffer buffer,
-                                                 VkImage image,
-                                                 uint32_t width,
-                                                 uint32_t height)
-{
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkBufferImageCopy region{};
-    // バッファのどの範囲をコピー対象とするか
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    // 画像のどの範囲にコピーするか
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {
-        width,
-        height,
-        1};
-
-    vkCmdCopyBufferToImage(
-        commandBuffer,
-        buffer,
-        image,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, // 現在の画像のレイアウトを指定する
-        1,
-        &region);
+void HelloTriangleApplication::optimizeMeshCache()
+{
+    // 書き出したキャッシュファイルを書き込み可能な状態でマップし、その場で三角形を並べ替える
+    // 並べ替えが終わるまではフラグを立てないので、途中で終了された場合は次回の起動時にキャッシュが作り直される
+    if (!meshCache.openForUpdate(MODEL_PATH))
+    {
+        throw std::runtime_error("failed to open mesh cache for optimization!");
+    }
 
-    endSingleTimeCommands(commandBuffer);
+    // メッシュ全体を一度に最適化すると、インデックス配列と同じ大きさの作業領域をいくつも確保してしまい、少しずつ解析して抑えたメモリの使用量が無駄になる
+    // そのため一定数のインデックス毎の窓の中だけで並べ替え、頂点配列の並べ替えは行わない
+    // 少しずつ解析した頂点は最初に参照された順に並んでいるので、頂点配列を並べ替えなくても読み込みは大きくは飛ばない
+    optimizeMeshInWindows(meshCache.getVertices(),
+                          meshCache.getMutableIndices(),
+                          meshCache.getIndexCount(),
+                          STREAMING_OPTIMIZE_WINDOW_INDEX_COUNT);
+    meshCache.addFlags(MESH_CACHE_OPTIMIZED);
+    meshCache.close();
 }
 
-void HelloTriangleApplication::createBuffer(
-    VkDeviceSize size,
-    VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties,
-    VkBuffer &buffer,
-    VkDeviceMemory &bufferMemory)
+void HelloTriangleApplication::reportPeakMemoryUsage(const char *stage)
+{
+    // プロセス全体の物理メモリ使用量の最大値(ピークワーキングセット)を表示する
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        printf("peak memory after %s : %.1f MiB\n", stage, counters.PeakWorkingSetSize / (1024.0 * 1024.0));
+    }
+}
+
+void HelloTriangleApplication::loadModelWithTinyObj()
+{
+    tinyobj::attrib_t attrib;             // 頂点の座標、法線、UV情報を全て持っているコンテナ
+    std::vector<tinyobj::shape_t> shapes; // 一つのファイルに含まれるモデルの配列。モデルを構成する各面の頂点数は任意だが、tinyobjが自動的に全て三角形に変換してくれる
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+
+    // mtlファイルとテクスチャのパスはobjファイルのあるディレクトリからの相対パスで書かれている
+    std::string baseDirectory = std::filesystem::path(MODEL_PATH).parent_path().generic_string();
+    if (!baseDirectory.empty())
+    {
+        baseDirectory += '/';
+    }
+
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str(), baseDirectory.c_str()))
+    {
+        throw std::runtime_error(err);
+    }
+
+    // mtlファイルが更新された場合にキャッシュを作り直せるように、キャッシュの依存ファイルとして記録しておく
+    // tinyobjloaderは読み込んだmtlファイルの名前を返さないので、objファイルの"mtllib"の行だけを読み直して求める
+    std::vector<std::string> materialLibraries = ObjStreamReader::readMaterialLibraries(MODEL_PATH);
+    for (std::string &library : materialLibraries)
+    {
+        library = baseDirectory + library;
+    }
+
+    // マテリアルのディフューズのテクスチャのパスを、実行時のディレクトリからのパスにして持っておく
+    // マテリアルの指定の無い面のために、最後にテクスチャの無いマテリアルを一つ置く
+    meshMaterials.assign(materials.size() + 1, MeshMaterial{});
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        if (materials[i].diffuse_texname.empty())
+        {
+            continue;
+        }
+        std::string path = baseDirectory + materials[i].diffuse_texname;
+        if (path.size() >= MAX_MATERIAL_PATH)
+        {
+            printf("material texture path is too long : %s\n", path.c_str());
+            continue;
+        }
+        memcpy(meshMaterials[i].texturePath, path.c_str(), path.size() + 1);
+    }
+
+    // shapeの中でマテリアルが切り替わる所でサブメッシュに分ける。三角形の順番は統合した後も変わらないので、面の番号の3倍がインデックスの位置になる
+    // 隣り合う範囲が同じマテリアルであれば、shapeをまたいでも一つのサブメッシュにまとめる
+    submeshes.clear();
+    uint32_t shapeFirstIndex = 0;
+    for (const tinyobj::shape_t &shape : shapes)
+    {
+        const std::vector<int> &materialIds = shape.mesh.material_ids;
+        uint32_t faceCount = static_cast<uint32_t>(shape.mesh.indices.size() / 3);
+        for (uint32_t face = 0; face < faceCount; face++)
+        {
+            int materialId = face < materialIds.size() ? materialIds[face] : -1;
+            uint32_t material = materialId < 0 ? static_cast<uint32_t>(materials.size()) : static_cast<uint32_t>(materialId);
+            if (submeshes.empty() || submeshes.back().material != material)
+            {
+                submeshes.push_back({shapeFirstIndex + face * 3, 0, material});
+            }
+            submeshes.back().indexCount += 3;
+        }
+        shapeFirstIndex += static_cast<uint32_t>(shape.mesh.indices.size());
+    }
+
+    // 全てのshapeの頂点を一つの頂点配列としてまとめて扱う
+    // 頂点列をシャードに分割し、シャード毎の重複除去を複数のスレッドで並列に行ってから、シャードの順番通りに統合する
+    // 大きなshapeが一つだけのモデルでも並列化が効くように、shapeの中も一定の頂点数毎に分割する
+    struct ShardRange
+    {
+        size_t shape; // どのshapeの頂点列か
+        size_t begin; // shape.mesh.indicesの何番目から
+        size_t end;   // shape.mesh.indicesの何番目まで(endは含まない)
+    };
+    std::vector<ShardRange> ranges;
+    for (size_t s = 0; s < shapes.size(); s++)
+    {
+        size_t cornerCount = shapes[s].mesh.indices.size();
+        for (size_t begin = 0; begin < cornerCount; begin += DEDUP_SHARD_CORNER_COUNT)
+        {
+            ranges.push_back({s, begin, std::min(begin + DEDUP_SHARD_CORNER_COUNT, cornerCount)});
+        }
+    }
+
+    std::vector<VertexShard> shards(ranges.size());
+    std::atomic<size_t> nextShard{0}; // 次にどのスレッドも処理していないシャードの番号
+
+    auto deduplicateShards = [&]()
+    {
+        VertexDeduplicator deduplicator;
+        for (size_t i = nextShard++; i < ranges.size(); i = nextShard++)
+        {
+            const auto &range = ranges[i];
+            const auto &meshIndices = shapes[range.shape].mesh.indices;
+            auto &shard = shards[i];
+
+            deduplicator.clear();
+            deduplicator.reserve((range.end - range.begin) / 2);
+            shard.indices.reserve(range.end - range.begin);
+
+            for (size_t corner = range.begin; corner < range.end; corner++)
+            {
+                const auto &index = meshIndices[corner];
+                Vertex vertex{};
+
+                vertex.pos = {
+                    attrib.vertices[3 * index.vertex_index + 0],
+                    attrib.vertices[3 * index.vertex_index + 1],
+                    attrib.vertices[3 * index.vertex_index + 2],
+                };
+
+                vertex.texCoord = {
+                    attrib.texcoords[2 * index.texcoord_index + 0],
+                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1], // Objファイルは画像下をVの0と扱っているが、Vulkanでは画像上をVの0としているため、上下を反転してやる必要がある。
+                };
+
+                // 頂点vertexと一致する頂点がシャード内に既にあればそのインデックスが、無ければ新たに追加された頂点のインデックスが返ってくる
+                shard.indices.push_back(deduplicator.add(vertex));
+            }
+
+            shard.vertices = std::move(deduplicator.getVertices());
+        }
+    };
+
+    // 処理するシャードの数以上のスレッドを立てても仕方が無いので、スレッド数はシャード数で頭打ちにする
+    size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), ranges.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threadCount; i++)
+    {
+        workers.emplace_back(deduplicateShards);
+    }
+    deduplicateShards(); // メインスレッドも遊ばせずにシャードを処理する
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    // 統合はシャードの順番通りに行うので、スレッドの実行順に関わらず常に同じインデックスの並びになる
+    mergeVertexShards(shards, vertices, indices);
+
+    // objファイルの面の順番のままだと頂点キャッシュが効きにくいので、三角形と頂点を並べ替えてから使う
+    // マテリアルの違う三角形が混ざらないように、並べ替えはサブメッシュ毎に行う
+    optimizeMesh(vertices.data(), vertices.size(), indices.data(), indices.size(), submeshes.data(), submeshes.size());
+
+    vertexData = vertices.data();
+    vertexCount = static_cast<uint32_t>(vertices.size());
+    indexData = indices.data();
+    indexCount = static_cast<uint32_t>(indices.size());
+
+    // 次回の起動時にobjファイルの解析を省略できるように、出来上がった頂点・インデックス配列をキャッシュに書き出しておく
+    if (!MeshCache::write(MODEL_PATH, vertexData, vertexCount, indexData, indexCount, submeshes, meshMaterials, materialLibraries, MESH_CACHE_OPTIMIZED))
+    {
+        std::cerr << "failed to write mesh cache for " << MODEL_PATH << std::endl;
+    }
+}
+
+void HelloTriangleApplication::createVertexBuffer()
+{
+    // ワーカースレッドでのモデルの読み込みが終わるのを待つ
+    // 頂点バッファにはメッシュを囲む範囲で正規化した頂点を格納するので、元に戻すためのスケールとバイアスもその中で求めてある
+    waitForAssetJob(modelLoadJob, "prepareModel");
+
+    VkDeviceSize bufferSize = sizeof(MeshVertex) * vertexCount;
+
+    // 実際にGPUがレンダリング用に使用する頂点バッファを作成する
+    createBuffer(
+        bufferSize,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, // ステージングバッファから転送する先として使用でき、かつ頂点バッファとして使用できるよう指定しておく
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vertexBuffer,
+        vertexBufferMemory,
+        MemoryCategory::Mesh);
+
+    // GPUとCPUが両方アクセスできるメモリ領域よりもGPUのみが専有的にアクセスできるメモリ領域の方がGPUからのアクセス効率がいい
+    // 今回は実行途中で頂点情報がアップデートされることは無いので、わざわざ一次バッファを用意してGPUのみがアクセス可能な頂点バッファにデータをコピーした方が
+    // 読み込みが速いので効率が良くなる
+    // もしも頂点情報が実行中に変化するのであれば、毎回バッファ間のコピーを行うと無駄なので、CPUとGPUがアクセスできる領域をそのまま頂点バッファにした方がいい
+    // 頂点は一次バッファに書き込む際にMeshVertexの形式に変換する
+    uploadBuffer(vertexBuffer,
+                 bufferSize,
+                 sizeof(MeshVertex),
+                 [&](void *staging, VkDeviceSize offset, VkDeviceSize size)
+                 {
+                     encodeVertices(vertexData + offset / sizeof(MeshVertex),
+                                    static_cast<size_t>(size / sizeof(MeshVertex)),
+                                    meshQuantization,
+                                    static_cast<MeshVertex *>(staging));
+                 });
+}
+
+void HelloTriangleApplication::createIndexBuffer()
+{
+    // メッシュの塊と、塊毎の16ビットか32ビットのインデックスはprepareModelで作成済み
+    waitForAssetJob(modelLoadJob, "prepareModel");
+    std::vector<uint16_t> indices16 = std::move(meshletIndices16);
+    std::vector<uint32_t> indices32 = std::move(meshletIndices32);
+
+    size_t wideMeshletCount = std::count_if(meshlets.begin(), meshlets.end(), [](const Meshlet &meshlet)
+                                            { return meshlet.wideIndices; });
+    hasWideMeshlets = wideMeshletCount > 0;
+    printf("meshlets : %zu (16-bit indices %zu, 32-bit indices %zu)\n", meshlets.size(), meshlets.size() - wideMeshletCount, wideMeshletCount);
+
+    // 一つのインデックスバッファの前半に16ビットのインデックスを、後半に32ビットのインデックスを格納する
+    // 32ビットのインデックスの開始位置は4バイト境界に揃えておく必要がある
+    VkDeviceSize narrowSize = sizeof(uint16_t) * indices16.size();
+    VkDeviceSize wideSize = sizeof(uint32_t) * indices32.size();
+    wideIndexOffset = (narrowSize + 3) & ~(VkDeviceSize)3;
+    VkDeviceSize bufferSize = std::max(wideIndexOffset + wideSize, (VkDeviceSize)sizeof(uint32_t));
+
+    // インデックスバッファを作成する。
+    createBuffer(bufferSize,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 indexBuffer,
+                 indexBufferMemory,
+                 MemoryCategory::Mesh);
+
+    // インデックスバッファはGPUのみがアクセスできる領域に作成するので、一次バッファを経由して内容をコピーする
+    if (narrowSize > 0)
+    {
+        uploadBuffer(indexBuffer, indices16.data(), narrowSize);
+    }
+    if (wideSize > 0)
+    {
+        uploadBuffer(indexBuffer, indices32.data(), wideSize, wideIndexOffset);
+    }
+
+    // 最初のフレームでLODを選ぶまでは全ての塊を、距離を0にしたソートキーの順に並べておく
+    visibleDraws.clear();
+    for (uint32_t i = 0; i < static_cast<uint32_t>(meshlets.size()); i++)
+    {
+        visibleDraws.push_back({makeDrawSortKey(0, meshlets[i].wideIndices, materialTextures[meshlets[i].material], 0.0f), i});
+    }
+    radixSortDraws(visibleDraws, drawSortScratch);
+    markCommandBuffersDirty(); // 描画するメッシュが変わった
+}
+
+void HelloTriangleApplication::cullMeshlets(const glm::mat4 &model, const CameraUniform &camera, bool cullingEnabled, bool spinning)
+{
+    // 塊の境界球や法線の円錐はモデルの座標系で持っているので、視錐台とカメラの位置をモデルの座標系に直して判定する
+    Frustum frustum = extractFrustum(camera.proj * camera.view * model);
+    glm::vec4 cameraPosition = glm::inverse(camera.view * model) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    // spinningの場合は、ワールドの座標系で塊の境界球をZ軸の周りに一周させた範囲を囲む球で判定する
+    // どの角度でも見える可能性のある塊が残るので、回転させても選び直す必要が無い。裏面の判定は角度で変わるので行わない
+    Frustum worldFrustum = extractFrustum(camera.proj * camera.view);
+    glm::vec3 worldCameraPosition = glm::vec3(glm::inverse(camera.view) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    float modelScale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))});
+
+    // インスタンスが一つも無いLODの塊は描画しない
+    // 見える塊は、パイプライン、インデックスの幅、マテリアル、カメラからの距離の順に比べるソートキーを付けて集める
+    visibleDraws.clear();
+    for (uint32_t lod = 0; lod < static_cast<uint32_t>(meshLods.size()); lod++)
+    {
+        if (lodInstances[lod].instanceCount == 0)
+        {
+            continue;
+        }
+
+        const MeshLod &meshLod = meshLods[lod];
+        for (uint32_t i = meshLod.firstMeshlet; i < meshLod.firstMeshlet + meshLod.meshletCount; i++)
+        {
+            const Meshlet &meshlet = meshlets[i];
+            bool visible;
+            float depth;
+            if (spinning)
+            {
+                glm::vec3 center = glm::vec3(model * glm::vec4(meshlet.center, 1.0f));
+                glm::vec3 sweptCenter(0.0f, 0.0f, center.z);
+                float sweptRadius = meshlet.radius * modelScale + glm::length(glm::vec2(center.x, center.y));
+                visible = !cullingEnabled || isSphereInFrustum(sweptCenter, sweptRadius, worldFrustum);
+                depth = glm::length(sweptCenter - worldCameraPosition) - sweptRadius;
+            }
+            else
+            {
+                visible = !cullingEnabled || isMeshletVisible(meshlet, frustum, glm::vec3(cameraPosition));
+                depth = glm::length(meshlet.center - glm::vec3(cameraPosition)) - meshlet.radius;
+            }
+
+            // 距離は塊を囲む球の表面までにして、カメラが球の中にある塊は最も手前として扱う
+            if (visible)
+            {
+                visibleDraws.push_back({makeDrawSortKey(0, meshlet.wideIndices, materialTextures[meshlet.material], depth), i});
+            }
+        }
+    }
+
+    // 同じ状態の描画をまとめ、その中では手前から描画するように並べる。記録する時は状態が変わった所でだけ切り替える
+    radixSortDraws(visibleDraws, drawSortScratch);
+}
+
+void HelloTriangleApplication::uploadBuffer(VkBuffer dstBuffer, const void *data, VkDeviceSize size, VkDeviceSize dstOffset)
+{
+    // キャッシュを使用している場合はマップしたキャッシュファイルから直接一次バッファにコピーされる
+    uploadBuffer(
+        dstBuffer,
+        size,
+        1,
+        [&](void *staging, VkDeviceSize offset, VkDeviceSize chunkSize)
+        { memcpy(staging, static_cast<const char *>(data) + offset, (size_t)chunkSize); },
+        dstOffset);
+}
+
+void HelloTriangleApplication::uploadBuffer(VkBuffer dstBuffer,
+                                            VkDeviceSize size,
+                                            VkDeviceSize elementSize,
+                                            const std::function<void(void *staging, VkDeviceSize offset, VkDeviceSize size)> &fill,
+                                            VkDeviceSize dstOffset)
+{
+    // 一次バッファはアップロード毎に作らず、uploadEngineが持つ固定の大きさのリングから切り出して使い回す
+    // データがリングに収まらない場合は、要素が分断されないようにelementSizeの倍数ずつに分けて転送される
+    // 頂点・インデックスバッファは頂点入力のステージでしか読まれないので、グラフィックス用のキューではそこだけを待たせる
+    uploadEngine.uploadBuffer(dstBuffer,
+                              dstOffset,
+                              size,
+                              elementSize,
+                              fill,
+                              VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                              VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT);
+}
+
+void HelloTriangleApplication::createBuffer(
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    VkMemoryPropertyFlags properties,
+    VkBuffer &buffer,
+    MemoryAllocation &bufferMemory,
+    MemoryCategory category)
 {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1634,69 +2007,140 @@ void HelloTriangleApplication::createBuffer(
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-    // 頂点バッファに実際に割り付けるメモリのサイズや機能を指定する
-    // メモリの機能にはCPU側から見ることが出来て、ホスト側でそのメモリをマッピングした即座に内容が同期される事を指定している
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    // propertiesの機能を持つ種類のメモリブロックから、バッファの分の範囲を切り出してもらう
+    // CPUから見える種類のメモリであれば、切り出した範囲は既にマップされている
+    bufferMemory = memoryAllocator.allocate(memRequirements, properties, true, category);
 
-    // メモリの確保
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-    {
-        throw std::runtime_error("failed to allocate vertex buffer memory");
-    }
-
-    // vertexBufferに確保したメモリを割り付ける
-    vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    // バッファに割り当てられた範囲を割り付ける。メモリブロックは他のリソースと共有しているので、先頭からの位置も指定する
+    vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
-void HelloTriangleApplication::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+void HelloTriangleApplication::createUnifomBuffers()
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-    VkBufferCopy copyRegion{};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+    // フレーム数分の領域を一つのバッファに並べる。動的オフセットの制約に合わせて、各領域の位置はminUniformBufferOffsetAlignmentに揃えられる
+    cameraRing.init(device,
+                    &memoryAllocator,
+                    properties.limits.minUniformBufferOffsetAlignment,
+                    sizeof(CameraUniform),
+                    static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT));
 
-    endSingleTimeCommands(commandBuffer);
+    // カメラの行列はupdateUniformBufferで求めるので、ここでは書き込むことはしない。内容が変わった時だけ、使い終わったフレームの領域に書き込まれる
 }
 
-void HelloTriangleApplication::createUnifomBuffers()
+void HelloTriangleApplication::createInstanceBuffer()
 {
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+    instanceBuffer.init(device, &memoryAllocator, MAX_INSTANCES, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT));
+
+    // メッシュを囲む球の半径を塊の境界球から求め、インスタンス同士が重ならない間隔で格子状に並べる
+    float meshRadius = 0.0f;
+    for (const Meshlet &meshlet : meshlets)
+    {
+        meshRadius = std::max(meshRadius, glm::length(meshlet.center) + meshlet.radius);
+    }
+    float spacing = meshRadius * 2.0f;
+    float gridOrigin = -0.5f * spacing * static_cast<float>(INSTANCE_GRID_SIZE - 1); // 格子の中心を原点に合わせる
+
+    for (uint32_t y = 0; y < INSTANCE_GRID_SIZE; y++)
+    {
+        for (uint32_t x = 0; x < INSTANCE_GRID_SIZE; x++)
+        {
+            glm::vec3 position(gridOrigin + spacing * static_cast<float>(x), gridOrigin + spacing * static_cast<float>(y), 0.0f);
+            scene.add(glm::translate(glm::mat4(1.0f), position), glm::vec3(0.0f), meshRadius, 0, 0); // テクスチャは塊のマテリアルで決まるので、インスタンス毎には差し替えない
+        }
+    }
+
+    // インスタンスのバッファには、毎フレームupdateUniformBufferで見えるオブジェクトだけを詰めて書き込む
+    // 各フレームの領域への書き込みは、そのフレームで最初にacquireした時に行われる
+    markCommandBuffersDirty(); // 描画するインスタンスの数が変わった
+}
 
-    // フレーム数分のバッファを用意する
-    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+void HelloTriangleApplication::createMeshletCuller()
+{
+    if (!drawIndirectCountEnabled || meshlets.empty())
+    {
+        printf("meshlet culling : cpu\n");
+        return;
+    }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    // 一度の間接描画で実行できる描画コマンドの数には上限があるので、塊がそれより多い場合はCPUでカリングする
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    if (meshlets.size() > properties.limits.maxDrawIndirectCount)
     {
-        createBuffer(bufferSize,
-                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     uniformBuffers[i],
-                     uniformBuffersMemory[i]);
+        printf("meshlet culling : cpu (%zu meshlets exceed maxDrawIndirectCount %u)\n", meshlets.size(), properties.limits.maxDrawIndirectCount);
+        return;
     }
 
-    // MVP行列の情報は毎フレーム変化するため、ここではMapMemory等を使用して書き込むことはしない
+    // 塊をインデックスの幅とマテリアルが同じ物毎のバッチに分け、バッチ毎に描画コマンドを書き出させる
+    std::vector<uint32_t> meshletBatches;
+    meshletDrawBatches = buildMeshletDrawBatches(meshlets, meshletBatches);
+
+    // 塊の境界と描画に必要な情報はコンピュートシェーダからしか読まないので、GPUのみがアクセスできる領域に転送する
+    VkDeviceSize bufferSize = sizeof(GpuMeshletBounds) * meshlets.size();
+    createBuffer(bufferSize,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 meshletBuffer,
+                 meshletBufferMemory,
+                 MemoryCategory::Mesh);
+    uploadEngine.uploadBuffer(meshletBuffer,
+                              0,
+                              bufferSize,
+                              sizeof(GpuMeshletBounds),
+                              [&](void *staging, VkDeviceSize offset, VkDeviceSize size)
+                              {
+                                  GpuMeshletBounds *bounds = static_cast<GpuMeshletBounds *>(staging);
+                                  size_t first = static_cast<size_t>(offset / sizeof(GpuMeshletBounds));
+                                  for (size_t i = 0; i < size / sizeof(GpuMeshletBounds); i++)
+                                  {
+                                      uint32_t batch = meshletBatches[first + i];
+                                      bounds[i] = makeGpuMeshletBounds(meshlets[first + i], batch, meshletDrawBatches[batch]);
+                                  }
+                              },
+                              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                              VK_ACCESS_SHADER_READ_BIT);
+
+    meshletCuller.init(device,
+                       &memoryAllocator,
+                       &pipelineCache,
+                       properties.limits,
+                       meshletBuffer,
+                       static_cast<uint32_t>(meshlets.size()),
+                       static_cast<uint32_t>(meshletDrawBatches.size()),
+                       static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT));
+    gpuCullingEnabled = true;
+    printf("meshlet culling : gpu (%zu draw batches)\n", meshletDrawBatches.size());
+
+    markCommandBuffersDirty(); // 描画コマンドの記録の仕方が変わった
 }
 
 void HelloTriangleApplication::createDescriptorPool()
 {
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
-    // MVP行列のための設定
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    // テクスチャのための設定
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    // レイアウトと同じバインディングから、種類毎に必要なデスクリプタの数を集める
+    // カメラの行列のフレーム毎の違いは動的オフセットで表すので、デスクリプタセットは全フレームで一つだけ使う
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (const VkDescriptorSetLayoutBinding &binding : getDescriptorSetLayoutBindings())
+    {
+        auto poolSize = std::find_if(poolSizes.begin(), poolSizes.end(), [&](const VkDescriptorPoolSize &size)
+                                     { return size.type == binding.descriptorType; });
+        if (poolSize == poolSizes.end())
+        {
+            poolSizes.push_back({binding.descriptorType, binding.descriptorCount});
+        }
+        else
+        {
+            poolSize->descriptorCount += binding.descriptorCount;
+        }
+    }
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.maxSets = 1;
 
     if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
     {
@@ -1706,56 +2150,39 @@ void HelloTriangleApplication::createDescriptorPool()
 
 void HelloTriangleApplication::createDescriptorSets()
 {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    allocInfo.pSetLayouts = layouts.data();
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
 
-    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-    if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+    if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to allocate descriptor sets!");
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-    {
-        // MVP行列を保存してあるバッファ群の各フレームに対応するバッファと、同じフレームに対応するデスクリプタの関連付けを設定する
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = uniformBuffers[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
-
-        // 各フレームに対して、テクスチャのビューとサンプラーを渡す
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = textureImageView;
-        imageInfo.sampler = textureSampler;
+    // カメラの行列を並べたバッファの、一つのフレームの分の範囲をデスクリプタに関連付ける
+    // 実際にどのフレームの領域を読むかは、vkCmdBindDescriptorSetsで渡す動的オフセットで決まる
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = cameraRing.getBuffer();
+    bufferInfo.offset = 0;
+    bufferInfo.range = cameraRing.getRange();
 
-        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        // i番目のdescriptorSetsの0番目の要素をシェーダの0番目のバインディングに設定する
-        descriptorWrites[0].dstSet = descriptorSets[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        // デスクリプタの種類を設定する。複数のデスクリプタを与えている場合一気に種類を設定する事が出来るので個数を設定する。今回は1
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        // デスクリプタがどのような形で保持されているか。今回はバッファとして保持されているのでpBufferInfoにbufferInfoを渡す
-        descriptorWrites[0].pBufferInfo = &bufferInfo;
+    // テクスチャはテクスチャの表に登録してあるので、ここではカメラの行列だけを設定する
+    std::array<VkWriteDescriptorSet, 1> descriptorWrites{};
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    // descriptorSetの0番目の要素をシェーダの0番目のバインディングに設定する
+    descriptorWrites[0].dstSet = descriptorSet;
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].dstArrayElement = 0;
+    // デスクリプタの種類を設定する。複数のデスクリプタを与えている場合一気に種類を設定する事が出来るので個数を設定する。今回は1
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptorWrites[0].descriptorCount = 1;
+    // デスクリプタがどのような形で保持されているか。今回はバッファとして保持されているのでpBufferInfoにbufferInfoを渡す
+    descriptorWrites[0].pBufferInfo = &bufferInfo;
 
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = descriptorSets[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].pImageInfo = &imageInfo;
-
-        // デスクリプタの情報を更新する。後ろ2つのパラメータは既存のデスクリプタをコピーする際に使用する
-        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-    }
+    // デスクリプタの情報を更新する。後ろ2つのパラメータは既存のデスクリプタをコピーする際に使用する
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
 void HelloTriangleApplication::createCommandBuffers()
@@ -1774,6 +2201,42 @@ void HelloTriangleApplication::createCommandBuffers()
     // コマンドバッファはコマンドプールが破棄されたときに自動的に破棄されるのでcleanupで何かする必要は無い
 }
 
+void HelloTriangleApplication::createCachedCommandBuffers()
+{
+    if (!USE_CACHED_COMMAND_BUFFERS)
+    {
+        return;
+    }
+
+    // スワップチェインの画像の数が変わっているかもしれないので、作り直す場合は前の物を返してから割り当て直す
+    if (!cachedCommandBuffers.empty())
+    {
+        vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(cachedCommandBuffers.size()), cachedCommandBuffers.data());
+    }
+
+    // フレームバッファはスワップチェインの画像毎に、カメラの行列の動的オフセットはフレーム毎に違うので、その組毎に一つ用意する
+    cachedCommandBuffers.resize(swapChainImages.size() * MAX_FRAMES_IN_FLIGHT);
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(cachedCommandBuffers.size());
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, cachedCommandBuffers.data()) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate cached command buffers!");
+    }
+
+    // まだ何も記録していないので、全て記録し直しが必要な状態にしておく
+    cachedCommandBufferDirty.assign(cachedCommandBuffers.size(), true);
+}
+
+void HelloTriangleApplication::markCommandBuffersDirty()
+{
+    // 実行中かもしれないコマンドバッファもあるので、ここでは記録し直さずに印だけ付け、drawFrameで使う直前に記録し直す
+    cachedCommandBufferDirty.assign(cachedCommandBufferDirty.size(), true);
+}
+
 void HelloTriangleApplication::createSyncObjects()
 {
     imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
@@ -1828,10 +2291,125 @@ void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer commandBuffer
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
 
-    // コマンドバッファに今まで設定したレンダーパス関連の情報を流し込むコマンド
-    // 最後のフラグは、このコマンドバッファが二次的なものでないことを示している
+    // GPUでカリングする場合は、レンダーパスに入る前にこのフレームの描画コマンドを書き出しておく
+    if (gpuCullingEnabled)
+    {
+        meshletCuller.recordCulling(commandBuffer, currentFrame);
+    }
+
+    // 描画コマンドは二次コマンドバッファに複数のスレッドで並列に記録し、一次コマンドバッファはそれを実行するだけにする
+    // 最後のフラグで、このレンダーパスの中身は二次コマンドバッファで与える事を示している
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    // このフレームの前回の二次コマンドバッファは描画が終わっているので、プールごとリセットして使い回す
+    frameCommandPools.reset(currentFrame);
+
+    // 見えると判定された塊をDRAWS_PER_RECORDING_JOB個ずつのジョブに分ける。塊が無くてもレンダーパスのクリアは必要なので、ジョブは最低一つ作る
+    // GPUでカリングする場合は、間接描画のバッチをBATCHES_PER_RECORDING_JOB個ずつのジョブに分ける。バッチの数はマテリアルの数程度なので、ジョブの数もそれに比例する
+    size_t totalDrawCount = getRecordedDrawCount();
+    size_t drawsPerJob = gpuCullingEnabled ? BATCHES_PER_RECORDING_JOB : DRAWS_PER_RECORDING_JOB;
+    uint32_t jobCount = static_cast<uint32_t>(std::max<size_t>(1, (totalDrawCount + drawsPerJob - 1) / drawsPerJob));
+    recordedSecondaries.assign(jobCount, VK_NULL_HANDLE);
+    recordingJobs.parallelFor(jobCount,
+                              [&](uint32_t job, uint32_t thread)
+                              {
+                                  size_t firstDraw = static_cast<size_t>(job) * drawsPerJob;
+                                  VkCommandBuffer secondary = frameCommandPools.acquireSecondary(currentFrame, thread); // スレッド毎のプールから取るのでロックは要らない
+                                  recordDrawCommands(secondary, imageIndex, firstDraw, std::min(drawsPerJob, totalDrawCount - firstDraw));
+                                  recordedSecondaries[job] = secondary;
+                              });
+
+    // どのスレッドが記録したかによらず、ジョブの順番に実行する
+    vkCmdExecuteCommands(commandBuffer, jobCount, recordedSecondaries.data());
+
+    // レンダーパスを操作するのを終了する
+    vkCmdEndRenderPass(commandBuffer);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+}
+
+void HelloTriangleApplication::recordCachedCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frame)
+{
+    // 何度も実行するコマンドバッファなので、ONE_TIME_SUBMIT_BITは付けない
+    // 同じコマンドバッファが同時に複数回実行される事は無い(同じフレームの前回の描画が終わってから実行する)ので、SIMULTANEOUS_USE_BITも要らない
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to begin recording cached command buffer!");
+    }
+
+    std::array<VkClearValue, 2> clearValues{};
+    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = swapChainExtent;
+    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassInfo.pClearValues = clearValues.data();
+
+    // 記録は描画し直しが必要になった時にしか行わないので、並列化せずにそのまま一次コマンドバッファに記録する
+    // カメラの行列は、このコマンドバッファを実行するフレームの領域を動的オフセットで指しておく。中身は毎フレームupdateUniformBufferで書き換わる
+    // GPUでカリングする場合は、実行する度にその時のカメラで描画コマンドが作り直されるので、記録し直さなくても見える塊が変わる
+    if (gpuCullingEnabled)
+    {
+        meshletCuller.recordCulling(commandBuffer, frame);
+    }
     vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    recordDraws(commandBuffer, frame, 0, getRecordedDrawCount());
+    vkCmdEndRenderPass(commandBuffer);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to record cached command buffer!");
+    }
+}
+
+void HelloTriangleApplication::recordDrawCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex, size_t firstDraw, size_t drawCount)
+{
+    // レンダーパスの中で実行される二次コマンドバッファなので、どのレンダーパスのどのサブパスで実行されるかを継承情報として渡す
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex]; // 省略もできるが、分かっている場合は渡した方がドライバが最適化しやすい
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | // レンダーパスの中で実行される
+                      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;       // 一度実行したらプールごとリセットして記録し直す
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to begin recording secondary command buffer!");
+    }
+
+    // パイプラインや動的なステート、デスクリプタセットは一次コマンドバッファから引き継がれないので、二次コマンドバッファ毎に設定する
+    recordDraws(commandBuffer, currentFrame, firstDraw, drawCount);
 
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to record secondary command buffer!");
+    }
+}
+
+size_t HelloTriangleApplication::getRecordedDrawCount() const
+{
+    return gpuCullingEnabled ? meshletDrawBatches.size() : visibleDraws.size();
+}
+
+void HelloTriangleApplication::recordDraws(VkCommandBuffer commandBuffer, uint32_t frame, size_t firstDraw, size_t drawCount)
+{
     // コマンドバッファをグラフィックスパイプラインと結びつけるコマンド
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
@@ -1850,30 +2428,86 @@ void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer commandBuffer
     scissor.extent = swapChainExtent;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-    // 頂点バッファのバインディング
-    VkBuffer vertexBuffers[] = {vertexBuffer};
-    VkDeviceSize offsets[] = {0}; // 何バイト目から頂点情報を読むか
-    // 0番目から1つのバインド情報でvertexBuffersをバインドする
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
-    // currentFrame番目のデスクリプタセットをシェーダのデスクリプタに割り当てる
+    // 頂点バッファのバインディング。1番目のバインディングには、このフレームのインスタンス毎のデータの領域を指定する
+    VkBuffer vertexBuffers[] = {vertexBuffer, instanceBuffer.getBuffer()};
+    VkDeviceSize offsets[] = {0, instanceBuffer.getOffset(frame)}; // 何バイト目から頂点情報を読むか
+    // 0番目から2つのバインド情報でvertexBuffersをバインドする
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+
+    // デスクリプタセットをシェーダのデスクリプタに割り当てる。カメラの行列はフレーム毎の領域をdynamicOffsetで選ぶ
+    // テクスチャの表はインスタンス毎にシェーダが番号で引くので、描画の間でバインドし直す必要は無い
+    // 表が使えない場合、1番目のデスクリプタセットはマテリアルが変わる所でsetDrawStateがバインドする
+    uint32_t dynamicOffset = cameraRing.getOffset(frame);
+    std::array<VkDescriptorSet, 2> descriptorSets = {descriptorSet, textureTableEnabled ? textureTable.getSet(0) : VK_NULL_HANDLE};
     vkCmdBindDescriptorSets(commandBuffer,
                             VK_PIPELINE_BIND_POINT_GRAPHICS, // デスクリプタはGPGPUにも使用できるので、グラフィックスかコンピュートのどちらに使用するかを指定する必要がある
                             pipelineLayout,
-                            0,                             // 何番目のデスクリプタから使い始めるか
-                            1,                             // 何個のデスクリプタを使うか
-                            &descriptorSets[currentFrame], // デスクリプタの配列。ここでは1つしからデスクリプタが無いので、それのポインタを渡している
-                            0,                             // ラスト2つのパラメータはダイナミックデスクリプタのために使用する。今は無視してOK
-                            nullptr);
+                            0,                                // 何番目のデスクリプタセットから使い始めるか
+                            textureTableEnabled ? 2u : 1u,    // 何個のデスクリプタセットを使うか
+                            descriptorSets.data(),            // デスクリプタセットの配列。0番目がカメラの行列、1番目がテクスチャの表
+                            1,                                // ラスト2つのパラメータは動的なデスクリプタのオフセットの数と配列。カメラの行列の分だけ渡す
+                            &dynamicOffset);
+
+    // モデル行列と、頂点座標とUV座標を元に戻すためのスケールとバイアスをプッシュ定数として渡す
+    // マテリアルの番号は描画毎に変わるので、最初の描画の前とマテリアルが変わる所でその部分だけを書き換える
+    ObjectConstants objectConstants{};
+    objectConstants.model = modelMatrix;
+    objectConstants.quantization = meshQuantization;
+    objectConstants.materialIndex = 0;
+    vkCmdPushConstants(commandBuffer,
+                       pipelineLayout,
+                       SHADER_PUSH_CONSTANTS.stageFlags, // パイプラインレイアウトのプッシュ定数の範囲と同じステージを指定する
+                       0,
+                       sizeof(ObjectConstants),
+                       &objectConstants);
+
+    // 描画の間で切り替える状態。インデックスバッファとマテリアルは、今の値と違う描画の前にだけ設定し直す
+    // 最初の描画の前には必ず設定するように、どちらの値とも一致しない状態から始める
+    int boundWideIndices = -1;
+    uint32_t boundMaterial = UINT32_MAX;
+    auto setDrawState = [&](bool wideIndices, uint32_t material)
+    {
+        if (boundWideIndices != (wideIndices ? 1 : 0))
+        {
+            vkCmdBindIndexBuffer(commandBuffer, indexBuffer, wideIndices ? wideIndexOffset : 0, wideIndices ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16);
+            boundWideIndices = wideIndices ? 1 : 0;
+        }
+        if (boundMaterial != material)
+        {
+            vkCmdPushConstants(commandBuffer,
+                               pipelineLayout,
+                               SHADER_PUSH_CONSTANTS.stageFlags,
+                               offsetof(ObjectConstants, materialIndex),
+                               sizeof(uint32_t),
+                               &material);
+            if (!textureTableEnabled)
+            {
+                VkDescriptorSet materialSet = textureTable.getSet(material);
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, TEXTURE_TABLE_SET, 1, &materialSet, 0, nullptr);
+            }
+            boundMaterial = material;
+        }
+    };
+
+    // GPUでカリングする場合は、コンピュートシェーダが書き出した描画コマンドをバッチ毎に間接描画する
+    // バッチはソートキーの順に並んでいるので、インデックスバッファとマテリアルの切り替えは最小限になる
+    // このジョブの担当は、firstDraw番目からdrawCount個のバッチ
+    if (gpuCullingEnabled)
+    {
+        uint32_t batchEnd = static_cast<uint32_t>(firstDraw + drawCount);
+        for (uint32_t batch = static_cast<uint32_t>(firstDraw); batch < batchEnd; batch++)
+        {
+            uint64_t key = meshletDrawBatches[batch].key;
+            setDrawState(isDrawSortKeyWide(key), materialTextures[getDrawSortKeyMaterial(key)]);
+            meshletCuller.recordDraws(commandBuffer, frame, batch, meshletDrawBatches[batch]);
+        }
+        return;
+    }
 
     // インデックスバッファを使用しない描画コマンド
     // 第二引数以降の意味は
     // vertexCount : 頂点データの要素数を流し込む
-    // instanceCount : 今回はインスタンスドレンダリングを行わないので1を指定する
+    // instanceCount : 同じメッシュを何個描画するか。インスタンス毎のデータはinstanceCount個読み込まれる
     // firstVertex : 何番目の頂点からレンダリングを始めるか
     // firstInstance : 何番目のインスタンスからレンダリングを始めるか
     // vkCmdDraw(commandBuffer, static_cast<uint32_t>(vertices.size()), 1, 0, 0);
@@ -1883,36 +2517,22 @@ void HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer commandBuffer
     // 第四引数以降の意味は
     // 4 : インデックスバッファ内のオフセット。今回は先頭から使用するので0。1にすると2番目のインデックスから読み込まれる
     // 5 : インデックスバッファの値に対するオフセット。今回はインデックスバッファの値をそのまま使用するので0。1等にするとその値が加わったインデックスの頂点情報を参照する
-    // 6 : インスタンスのオフセット。今回はインスタンスドレンダリングを行わないので0
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-
-    // レンダーパスを操作するのを終了する
-    vkCmdEndRenderPass(commandBuffer);
-
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    // 6 : インスタンスのオフセット。インスタンスはLODの順に並べてあるので、塊のLODのインスタンスの範囲の先頭を渡す
+    // cullMeshletsで見えると判定された塊だけを、ソートキーの順に描画する
+    // 一つの塊の描画コマンドでそのLODの全てのインスタンスを描画するので、インスタンスが増えても描画コマンドの数は変わらない
+    // 塊のインデックスは塊の最小の頂点番号を引いた値で格納されているので、5番目の引数でその頂点番号を足し戻す
+    // このジョブの担当は、見えると判定された塊のうちfirstDraw番目からdrawCount個。ジョブの境目では状態を設定し直す
+    auto drawsBegin = visibleDraws.begin() + firstDraw;
+    auto drawsEnd = drawsBegin + drawCount;
+    for (auto draw = drawsBegin; draw != drawsEnd; ++draw)
     {
-        throw std::runtime_error("failed to record command buffer!");
+        const Meshlet &meshlet = meshlets[draw->meshlet];
+        setDrawState(isDrawSortKeyWide(draw->key), getDrawSortKeyMaterial(draw->key));
+        const LodInstanceRange &instances = lodInstances[meshlet.lod];
+        vkCmdDrawIndexed(commandBuffer, meshlet.indexCount, instances.instanceCount, meshlet.firstIndex, static_cast<int32_t>(meshlet.vertexOffset), instances.firstInstance);
     }
 }
 
-uint32_t HelloTriangleApplication::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-    // VRAMが対応しているメモリの種類を取得する
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-    {
-        if ((typeFilter & (1 << i)) &&
-            (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-        {
-            return i;
-        }
-    }
-
-    throw std::runtime_error("failed to find suitable memory type!");
-}
-
 VkSurfaceFormatKHR HelloTriangleApplication::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &availableFormats)
 {
     // スワップチェインが対応している画像フォーマットの中から、BGRAが8ビットずつのフォーマットでsRGB色空間の値を扱うものを探して返す
@@ -2045,6 +2665,35 @@ void HelloTriangleApplication::drawFrame()
     // フェンスを利用して前のフレームのレンダリングが完了するのを待つ
     vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
 
+    // 完了したアップロードが使っていた一次バッファのリングの範囲を空きに戻す
+    uploadEngine.collect();
+
+    // 他のプロセス(ゲームなど)がメモリを使い始めると予算が減るので、毎フレーム問い合わせ直し、一定の間隔でログに出す
+    memoryAllocator.updateBudget();
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastMemoryBudgetLog >= MEMORY_BUDGET_LOG_INTERVAL)
+    {
+        memoryAllocator.printBudget();
+        const SceneCullStats &cullStats = scene.getCullStats();
+        printf("scene culling (%s) : %u / %u objects visible (%.3f ms)\n", getSphereCullingKernelName(), cullStats.visibleCount, cullStats.objectCount, cullStats.milliseconds);
+        printf("instances per lod :");
+        for (const LodInstanceRange &range : lodInstances)
+        {
+            printf(" %u", range.instanceCount);
+        }
+        printf("\n");
+        if (USE_CACHED_COMMAND_BUFFERS)
+        {
+            // 記録し直さずに使えたフレームの数で、記録済みのコマンドバッファが実際に使い回されているかを確かめられる
+            printf("cached command buffers : %u frames reused, %u frames recorded\n", cachedCommandBufferStats.reused, cachedCommandBufferStats.recorded);
+            cachedCommandBufferStats = {};
+        }
+        lastMemoryBudgetLog = now;
+    }
+
+    // 強制終了された場合でもコンパイル結果が残るように、パイプラインキャッシュは定期的にも保存する
+    pipelineCache.saveIfDue(PIPELINE_CACHE_SAVE_INTERVAL);
+
     // スワップチェインから画像を取得してくる。画像そのものが返ってくるわけではなく、次に利用可能なswapChainImagesの要素のインデックスが返ってくる
     uint32_t imageIndex;
     VkResult result = vkAcquireNextImageKHR(
@@ -2074,10 +2723,33 @@ void HelloTriangleApplication::drawFrame()
 
     vkResetFences(device, 1, &inFlightFences[currentFrame]); // フェンスの状態を次の待機のためにリセットする
 
-    // コマンドバッファにレンダリングのためのコマンドを記録していくために、まずは既存のコマンドをリセットする
-    // 第二引数としてフラグを渡すことが出来るが、ここを0にしておくことで、全てデフォルトの動作をさせている
-    vkResetCommandBuffer(commandBuffers[currentFrame], 0);
-    recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    VkCommandBuffer commandBuffer;
+    if (USE_CACHED_COMMAND_BUFFERS)
+    {
+        // 記録済みのコマンドバッファを選んで実行するだけにし、記録し直すのはシーンやスワップチェインが変わった時だけにする
+        // この組のコマンドバッファを前回実行したのは同じフレームなので、上のフェンスの待機で実行は終わっている
+        size_t cachedIndex = static_cast<size_t>(imageIndex) * MAX_FRAMES_IN_FLIGHT + currentFrame;
+        commandBuffer = cachedCommandBuffers[cachedIndex];
+        if (cachedCommandBufferDirty[cachedIndex])
+        {
+            vkResetCommandBuffer(commandBuffer, 0);
+            recordCachedCommandBuffer(commandBuffer, imageIndex, currentFrame);
+            cachedCommandBufferDirty[cachedIndex] = false;
+            cachedCommandBufferStats.recorded++;
+        }
+        else
+        {
+            cachedCommandBufferStats.reused++;
+        }
+    }
+    else
+    {
+        // コマンドバッファにレンダリングのためのコマンドを記録していくために、まずは既存のコマンドをリセットする
+        // 第二引数としてフラグを渡すことが出来るが、ここを0にしておくことで、全てデフォルトの動作をさせている
+        commandBuffer = commandBuffers[currentFrame];
+        vkResetCommandBuffer(commandBuffer, 0);
+        recordCommandBuffer(commandBuffer, imageIndex);
+    }
 
     // コマンドバッファを実行するための情報を設定する
     VkSubmitInfo submitInfo{};
@@ -2091,7 +2763,7 @@ void HelloTriangleApplication::drawFrame()
     submitInfo.pWaitDstStageMask = waitStages;
     // 実行するコマンドバッファの数とポインタ
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+    submitInfo.pCommandBuffers = &commandBuffer;
     // 実行が完了したときにどのセマフォをシグナルするか
     VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
     submitInfo.signalSemaphoreCount = 1;
@@ -2129,29 +2801,112 @@ void HelloTriangleApplication::updateUniformBuffer(uint32_t currentImage)
 
     float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
-    UniformBufferObject ubo{};
+    // モデル行列は毎フレーム変わるので、バッファには書かずにプッシュ定数で渡す(記録済みのコマンドバッファを使う場合を除く)
     // 第一引数は回転する元となる行列
     // 第二引数は回転する角度
     // 第三引数は回転軸
-    ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 
     // 第一引数はカメラの位置
     // 第二引数はカメラが見る位置
     // 第三引数はカメラから見て上方向のベクトル
-    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    CameraUniform camera{};
+    camera.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 
     // 第一引数は縦方向の視野角
     // 第二引数は画面のアスペクト比
     // 第三引数は手前のクリッピングプレーンまでの距離
     // 第四引数は奥のクリッピングプレーンまでの距離
-    ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
+    camera.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
     // GLMはOpenGL用に作られており、Vulkanとはクリップ座標系におけるY座標が反転しているので、-1をかけて上下を反転させてVulkanの座標系に揃える
-    ubo.proj[1][1] *= -1;
+    camera.proj[1][1] *= -1;
+
+    CameraUniform cullingCamera = camera; // モデルの回転を含まないカメラ。記録済みのコマンドバッファの塊を選び直すかの判定に使う
+    if (USE_CACHED_COMMAND_BUFFERS)
+    {
+        // 記録済みのコマンドバッファのプッシュ定数は書き換えられないので、モデルの回転はビュー行列に畳み込んでユニフォームで渡す
+        camera.view = camera.view * rotation;
+        modelMatrix = glm::mat4(1.0f);
+    }
+    else
+    {
+        modelMatrix = rotation;
+    }
+
+    // シーンのオブジェクトを境界球で視錐台カリングし、見える物のLODを形のずれが画面上で何ピクセルになるかで選ぶ
+    // pixelsPerUnitは、距離1の所にある長さ1の物が画面の縦方向に何ピクセルで映るか
+    glm::mat4 sceneView = camera.view * modelMatrix;
+    const std::vector<uint32_t> &visibleObjects = scene.cull(extractFrustum(camera.proj * sceneView));
+    glm::vec4 sceneCameraPosition = glm::inverse(sceneView) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    float pixelsPerUnit = 0.5f * static_cast<float>(swapChainExtent.height) * std::abs(camera.proj[1][1]);
+    scene.selectLods(visibleObjects, glm::vec3(sceneCameraPosition), pixelsPerUnit, meshLods, LOD_PIXEL_ERROR);
+
+    // 見える物をLODの順に詰めてインスタンスにし、LOD毎に連続した範囲のインスタンスを一度の描画コマンドで描画する
+    // 並びが前のフレームと同じ所は書き込まれないので、カメラが止まっていればインスタンスのバッファへの書き込みは起きない
+    uint32_t instanceCount = static_cast<uint32_t>(std::min<size_t>(visibleObjects.size(), MAX_INSTANCES));
+    std::array<LodInstanceRange, MAX_MESH_LODS> ranges{};
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+        ranges[scene.getLod(visibleObjects[i])].instanceCount++;
+    }
+    std::array<uint32_t, MAX_MESH_LODS> nextInstances{}; // LOD毎の、次にインスタンスを書き込む位置
+    uint32_t firstInstance = 0;
+    for (uint32_t lod = 0; lod < MAX_MESH_LODS; lod++)
+    {
+        ranges[lod].firstInstance = firstInstance;
+        nextInstances[lod] = firstInstance;
+        firstInstance += ranges[lod].instanceCount;
+    }
+    instanceBuffer.resize(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+        uint32_t object = visibleObjects[i];
+        instanceBuffer.set(nextInstances[scene.getLod(object)]++, scene.getInstanceData(object));
+    }
+
+    bool lodInstancesChanged = memcmp(ranges.data(), lodInstances.data(), sizeof(LodInstanceRange) * MAX_MESH_LODS) != 0;
+    lodInstances = ranges;
+    if (lodInstancesChanged && !gpuCullingEnabled)
+    {
+        markCommandBuffersDirty(); // 記録済みのコマンドバッファにはLOD毎のインスタンスの範囲が埋め込まれている
+    }
 
-    void *data;
-    vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
+    // 描画コマンドはLODの全てのインスタンスで共通なので、塊を選べるのはインスタンスが一つの場合だけ。複数の場合はインスタンスのあるLODの全ての塊を描画する
+    bool cullingEnabled = instanceBuffer.getCount() == 1;
+    glm::mat4 cullingModel = cullingEnabled ? modelMatrix * getInstanceTransform(instanceBuffer.get(0)) : modelMatrix;
+    if (gpuCullingEnabled)
+    {
+        // GPUに渡すのは視錐台とカメラの位置だけなので、塊の数によらずCPUの処理は一定
+        Frustum frustum = extractFrustum(camera.proj * camera.view * cullingModel);
+        glm::vec4 cameraPosition = glm::inverse(camera.view * cullingModel) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        meshletCuller.set(frustum, glm::vec3(cameraPosition), lodInstances, cullingEnabled);
+        meshletCuller.acquire(currentImage);
+    }
+    else if (!USE_CACHED_COMMAND_BUFFERS)
+    {
+        // このフレームで描画する塊を選んでおく
+        cullMeshlets(cullingModel, camera, cullingEnabled, false);
+    }
+    else
+    {
+        // 記録済みのコマンドバッファには描画する塊とその順番が埋め込まれているので、見え方が変わった時は塊を選び直して記録し直す
+        // 毎フレーム変わるモデルの回転は判定に含めず、どの角度でも見える可能性のある塊を選んでおく。カメラが止まっていれば記録済みのコマンドバッファをそのまま使う
+        glm::mat4 cullingViewProj = cullingCamera.proj * cullingCamera.view * cullingModel;
+        if (lodInstancesChanged || memcmp(&cullingViewProj, &cachedCullingViewProj, sizeof(glm::mat4)) != 0)
+        {
+            cachedCullingViewProj = cullingViewProj;
+            cullMeshlets(cullingModel, cullingCamera, cullingEnabled, true);
+            markCommandBuffersDirty();
+        }
+    }
+
+    // 記録済みのコマンドバッファを使わない場合、カメラの行列はウインドウサイズが変わった時にしか変わらないので、前回と同じ内容であればバッファには書き込まれない
+    // 動的オフセットは記録時にフレームの番号から求めるので、ここでは領域を最新にするだけ
+    cameraRing.set(&camera);
+    cameraRing.acquire(currentImage);
+
+    // インスタンスのデータも、前回このフレームの領域に書き込んでから変更された範囲だけが書き込まれる
+    instanceBuffer.acquire(currentImage);
 }
 
 void HelloTriangleApplication::cleanup()
@@ -2172,27 +2927,40 @@ void HelloTriangleApplication::cleanup()
         }
     }
     cleanupSwapChain();
+    memoryAllocator.free(colorImageMemory);
+    memoryAllocator.free(depthImageMemory);
 
-    vkDestroySampler(device, textureSampler, nullptr);
-    vkDestroyImageView(device, textureImageView, nullptr);
+    // 転送中のバッファや画像を破棄しないように、アップロードの完了を待ってから後始末する
+    uploadEngine.destroy();
 
-    vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
+    vkDestroySampler(device, textureSampler, nullptr);
+    for (MaterialTexture &texture : textures)
+    {
+        vkDestroyImageView(device, texture.view, nullptr);
+        vkDestroyImage(device, texture.image, nullptr);
+        memoryAllocator.free(texture.memory);
+    }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    cameraRing.destroy();
+    instanceBuffer.destroy();
+    if (gpuCullingEnabled)
     {
-        vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-        vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+        meshletCuller.destroy();
+        vkDestroyBuffer(device, meshletBuffer, nullptr);
+        memoryAllocator.free(meshletBufferMemory);
     }
 
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    textureTable.destroy();
 
     vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
+    memoryAllocator.free(vertexBufferMemory);
 
     vkDestroyBuffer(device, indexBuffer, nullptr);
-    vkFreeMemory(device, indexBufferMemory, nullptr);
+    memoryAllocator.free(indexBufferMemory);
+
+    meshCache.close();
 
     for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
@@ -2201,10 +2969,16 @@ void HelloTriangleApplication::cleanup()
         vkDestroyFence(device, inFlightFences[i], nullptr);
     }
     vkDestroyCommandPool(device, commandPool, nullptr);
+    frameCommandPools.destroy();
+    recordingJobs.destroy();
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
+    pipelineCache.destroy(); // 破棄する前にファイルに保存される
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
 
+    // 全てのバッファと画像を破棄したので、メモリブロックを解放する
+    memoryAllocator.destroy();
+
     // instanceよりも先にinstanceに依存する機能のクリーンアップを行う
     vkDestroyDevice(device, nullptr);
     if (enableValidationLayers)
@@ -2223,13 +2997,12 @@ void HelloTriangleApplication::cleanup()
 
 void HelloTriangleApplication::cleanupSwapChain()
 {
+    // カラーバッファと深度バッファのメモリは、スワップチェインを作り直した時に新しい画像で使い回すので、ここでは解放しない
     vkDestroyImageView(device, colorImageView, nullptr);
     vkDestroyImage(device, colorImage, nullptr);
-    vkFreeMemory(device, colorImageMemory, nullptr);
 
     vkDestroyImageView(device, depthImageView, nullptr);
     vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
 
     for (size_t i = 0; i < swapChainFramebuffers.size(); i++)
     {
@@ -9,10 +9,14 @@
 #include <set>           // 今回のアプリケーションで使用するキューのIDの集合を取り扱うために必要
 #include <cstdint>       // uint32_tを使用するために必要
 #include <limits>        // numeric_limitsを使用するために必要
-#include <algorithm>     // clampを使用するために必要
-#include <fstream>       // シェーダーコードを読み込むために必要
+#include <algorithm>     // clamp, all_ofを使用するために必要
 #include <chrono>        // 時間に関する処理を扱うために必要
-#include <unordered_map> // 一度読み込んだ頂点情報のインデックスを記憶しておくのに使用する
+#include <thread>        // 頂点の重複除去を並列に行うのに使用する
+#include <atomic>        // 並列に処理するシャードの番号をスレッド間で共有するのに使用する
+#include <filesystem>    // objファイルのサイズを調べるのに使用する
+#include <functional>    // 一次バッファへの書き込み処理を受け取るのに使用する
+#include <future>        // モデルやテクスチャの読み込みをワーカースレッドで行うのに使用する
+#include <memory>        // テクスチャのコンテナをunique_ptrで持つのに使用する
 
 // ----------GLFW(Vulkan込み)のinclude-----------
 #define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
@@ -21,28 +25,45 @@
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3native.h> // win32のAPIを使用してウインドウにアクセスするために必要
 
-// ----------GLMのinclude----------
-#define GLM_FORCE_RADIANS
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE // GLMのデフォルトでは深度は-1.0~1.0で扱われるが、Vulkanでは0.0~1.0なので変更する
-#define GLM_ENABLE_EXPERIMENTAL     // GLMのオブジェクトのハッシュを使用するために必要
-#include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtx/hash.hpp>
-
 // ----------Win32APIのinclude----------------
 #include "windows.h"
-
-// ----------STB(画像ライブラリ)のinclude---------------
-#include "stb_image.h"
+#include "psapi.h" // プロセスのメモリ使用量を取得するのに使用する
 
 // -----------tinyobjloader(Objファイルのライブラリ)のinclude------------
 #include "tiny_obj_loader.h"
 
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"             // 頂点データの構造体
+#include "MeshCache.hpp"          // objファイルから作った頂点・インデックス配列のキャッシュ
+#include "VertexDeduplicator.hpp" // 頂点の重複除去
+#include "ObjStreamReader.hpp"    // 巨大なobjファイルを少しずつ解析するためのクラス
+#include "MeshOptimizer.hpp"      // 三角形と頂点の並べ替え
+#include "VertexQuantization.hpp" // 頂点の量子化
+#include "Meshlet.hpp"            // メッシュの塊への分割とカリング
+#include "MeshLod.hpp"            // メッシュの簡略化とLODの選択
+#include "TextureContainer.hpp"   // ミップマップ込みのテクスチャのコンテナ
+#include "BlockCompressor.hpp"    // テクスチャのブロック圧縮
+#include "StartupReport.hpp"      // 起動時の各段階にかかった時間の記録
+#include "UploadEngine.hpp"       // 転送専用のキューを使った非同期のアップロード
+#include "MemoryAllocator.hpp"    // メモリブロックからのバッファ・画像のメモリの切り出し
+#include "UniformRing.hpp"        // 常にマップしたフレーム毎のユニフォームデータ
+#include "PipelineCache.hpp"      // 起動をまたいだパイプラインキャッシュ
+#include "JobSystem.hpp"          // 毎フレームの並列処理に使い回すワーカースレッド
+#include "FrameCommandPools.hpp"  // スレッド毎・フレーム毎のコマンドプール
+#include "InstanceBuffer.hpp"     // 変更された範囲だけを書き込むインスタンス毎のデータ
+#include "MeshletCuller.hpp"      // コンピュートシェーダでの塊のカリングと間接描画
+#include "SceneStore.hpp"         // オブジェクトの要素毎の配列とSIMDでの視錐台カリング
+#include "TextureTable.hpp"       // 全てのテクスチャを一つの配列にまとめたデスクリプタセット
+#include "Submesh.hpp"            // マテリアル毎のインデックスの範囲とマテリアル
+#include "DrawSort.hpp"           // 描画の順番を決めるソートキーと基数ソート
+#include "EmbeddedShaders.hpp"     // ビルド時に埋め込んだSPIR-Vと、そこから読み取ったバインディング(ビルドディレクトリに生成される)
+
 // 各コマンドに対応するキューのIDをまとめて保持する構造体
 struct QueueFamilyIndices
 {
     std::optional<uint32_t> graphicsFamily; // レンダリングコマンドを実行可能なキューファミリーのID
     std::optional<uint32_t> presentFamily;  // レンダリング結果をウインドウサーフェースに表示するコマンドが実行可能なキューファミリーのID
+    std::optional<uint32_t> transferFamily; // グラフィックスコマンドを実行できない、転送専用のキューファミリーのID。無いGPUもあるので必須ではない
 
     // 各パラメータに何らかの値が代入されているかをチェックする
     bool isComplete()
@@ -59,75 +80,45 @@ struct SwapChainSupportDetails
     std::vector<VkPresentModeKHR> presentModes; // ウインドウサーフェースが対応している表示モード
 };
 
-struct Vertex
+// カメラが変わった時だけ書き換わるデータ。UniformRingに置き、動的オフセットでフレーム毎の領域を選ぶ
+struct CameraUniform
 {
-    glm::vec3 pos;
-    glm::vec3 color;
-    glm::vec2 texCoord;
-
-    static VkVertexInputBindingDescription getBindingDescription()
-    {
-        // CPU上の頂点情報をGPUに渡す際に、情報一つ当たりのデータサイズを決定する
-        VkVertexInputBindingDescription bindingDescription{};
+    glm::mat4 view;
+    glm::mat4 proj;
+};
 
-        bindingDescription.binding = 0;                             // 今から作ろうとしているバインディングのインデックス
-        bindingDescription.stride = sizeof(Vertex);                 // 一つの頂点データのサイズ
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // 各データが頂点ごとかインスタンス毎か。インスタンスレンダリングとかでは別の値にするらしい
+// 描画するオブジェクト毎に変わるデータ。毎フレーム変わるので、バッファを介さずにプッシュ定数として渡す
+struct ObjectConstants
+{
+    glm::mat4 model;
+    MeshQuantization quantization; // 頂点バッファの頂点を元の座標・UV座標に戻すためのスケールとバイアス
+    uint32_t materialIndex;        // 描画する塊のマテリアルの、テクスチャの表の中での番号。マテリアルが変わる描画の前にだけ書き換える
+};
+static_assert(sizeof(ObjectConstants) <= 128, "push constants larger than the guaranteed maxPushConstantsSize"); // 128バイトまでは全てのGPUで使える事が保証されている
 
-        return bindingDescription;
-    }
+// C++側の構造体がシェーダのブロックと同じ大きさかを、ビルド時にシェーダから読み取った値で確かめる
+static_assert(sizeof(ObjectConstants) == SHADER_PUSH_CONSTANTS.size, "ObjectConstants does not match the push_constant block in the shaders");
+static_assert(findReflectedBinding(SHADER_BINDINGS, "CameraUniform") != nullptr &&
+                  findReflectedBinding(SHADER_BINDINGS, "CameraUniform")->blockSize == sizeof(CameraUniform),
+              "CameraUniform does not match the uniform block in the shaders");
 
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
-    {
-        // CPU上の頂点情報をGPUに渡し際の渡し方を決定する
-        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-
-        // 頂点座標のバインディングの設定
-        attributeDescriptions[0].binding = 0;                         // どのインデックスのバインディングと紐づくか
-        attributeDescriptions[0].location = 0;                        // vertexシェーダの何番目のinputと紐づくか
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT; // データのフォーマット、32ビットのfloatデータが3つ
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);      // 構造体の先頭アドレスから頂点座標が入っているアドレスのオフセット
-
-        // 頂点色のバインディングの設定
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-        // テクスチャのUVマッピングのバインディングの設定
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
-
-        return attributeDescriptions;
-    }
-
-    bool operator==(const Vertex &other) const
-    {
-        return pos == other.pos && color == other.color && texCoord == other.texCoord;
-    }
+// マテリアルのテクスチャ一つ分。同じ画像を使うマテリアルは一つのテクスチャを共有する
+struct MaterialTexture
+{
+    std::string path;                            // 元画像のパス
+    std::unique_ptr<TextureContainer> container; // ワーカースレッドで読み込んだテクスチャのコンテナ。GPUに転送したら閉じる
+    uint32_t mipLevels = 0;                      // テクスチャのミップレベルの数
+    VkImage image = VK_NULL_HANDLE;              // テクスチャ画像
+    MemoryAllocation memory;                     // テクスチャ画像が格納されるメモリ実体
+    VkImageView view = VK_NULL_HANDLE;           // テクスチャのビュー
+    uint32_t tableIndex = 0;                     // テクスチャの表の中での番号
 };
 
-namespace std
+// 記録済みのコマンドバッファを使い回せたかを数えたもの。ログに出したら0に戻す
+struct CachedCommandBufferStats
 {
-    // Vertexをunordered_mapで使用するためにはハッシュ関数を定義しておく必要がある。
-    template <>
-    struct hash<Vertex>
-    {
-        size_t operator()(Vertex const &vertex) const
-        {
-            return ((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-                   (hash<glm::vec2>()(vertex.texCoord) << 1);
-        }
-    };
-}
-
-struct UniformBufferObject
-{
-    glm::mat4 model;
-    glm::mat4 view;
-    glm::mat4 proj;
+    uint32_t reused = 0;   // 記録し直さずに実行したフレームの数
+    uint32_t recorded = 0; // 使う前に記録し直したフレームの数
 };
 
 class HelloTriangleApplication
@@ -145,8 +136,45 @@ private:
 
     const int MAX_FRAMES_IN_FLIGHT = 2;
 
+    const std::chrono::seconds MEMORY_BUDGET_LOG_INTERVAL{10}; // メモリの使用量と予算をログに出す間隔
+
+    const char *PIPELINE_CACHE_APPLICATION_NAME = "VulkanStudy"; // パイプラインキャッシュを置くユーザーごとのディレクトリの名前
+    const std::chrono::seconds PIPELINE_CACHE_SAVE_INTERVAL{60}; // パイプラインキャッシュを保存する間隔。終了時にも保存する
+
+    const size_t DEDUP_SHARD_CORNER_COUNT = 3 * 65536; // 頂点の重複除去を並列に行う際に、一つのスレッドがまとめて処理する頂点数。三角形の途中で区切られないように3の倍数にしておく
+    const uintmax_t STREAMING_OBJ_THRESHOLD = 256ull << 20; // この大きさ以上のobjファイルはtinyobjloaderを使わずに少しずつ解析して読み込む
+    const size_t STREAMING_OPTIMIZE_WINDOW_INDEX_COUNT = 3 * 262144; // 少しずつ解析して読み込んだメッシュを最適化する際に、一度に並べ替えるインデックスの数。作業用のメモリはこれに比例する
+    const VkDeviceSize STAGING_RING_SIZE = 32ull << 20;     // CPUからGPUへの転送に使い回す一次バッファのリングのバイト数。これより大きいデータは分けて転送する
+    const uint32_t MAX_RECORDING_THREADS = 8;               // 描画コマンドを並列に記録するスレッドの最大数(呼び出し元のスレッドを含む)
+    const size_t DRAWS_PER_RECORDING_JOB = 512;             // 一つの二次コマンドバッファに記録する描画の数。少なすぎると二次コマンドバッファの開始と設定のコストが目立つ
+    const size_t BATCHES_PER_RECORDING_JOB = 4;             // GPUでカリングする場合に、一つの二次コマンドバッファに記録するバッチの数。バッチ一つは間接描画一回とマテリアルの切り替えだけなので少なめにする
+    const uint32_t MAX_INSTANCES = 65536;                   // 一度の描画で描けるメッシュのインスタンスの最大数
+    const uint32_t INSTANCE_GRID_SIZE = 1;                  // メッシュをINSTANCE_GRID_SIZE×INSTANCE_GRID_SIZE個並べて描画する。1の場合は一つだけを原点に置く
+    const float LOD_PIXEL_ERROR = 1.0f;                     // LODの形のずれを画面上で何ピクセルまで許すか。大きくすると遠くの物ほど早く粗いLODになる
+    const uint32_t MAX_TEXTURES = 4096;                     // テクスチャの表に登録できるテクスチャの最大数。GPUの上限の方が小さければそちらに合わせる
+
+    // テクスチャのフォーマットの候補。GPUが対応していて、先に書かれている物が使われる
+    // BC7は1画素1バイトで高画質、BC1は1画素0.5バイトでアルファ無し、どちらも使えない場合は無圧縮で読み込む
+    const std::vector<VkFormat> TEXTURE_FORMAT_CANDIDATES = {VK_FORMAT_BC7_SRGB_BLOCK, VK_FORMAT_BC1_RGB_SRGB_BLOCK, VK_FORMAT_R8G8B8A8_SRGB};
+
+    using MeshVertex = PackedVertex; // 頂点バッファに格納する頂点の形式。Vertexにすると量子化せずにfloatのまま描画する
+    // trueにすると、コマンドバッファをスワップチェインの画像とフレームの組毎に記録しておき、シーンやスワップチェインが変わった時だけ記録し直す
+    // 静止したシーンでは毎フレームのCPUの処理が画像の取得と送信と表示だけになるが、CPUでカリングする場合はカメラが動く度に記録し直す事になる
+    // 既定では毎フレーム記録し、二次コマンドバッファへの並列な記録を使う
+    const bool USE_CACHED_COMMAND_BUFFERS = false;
+    // trueにすると、GPUがVK_KHR_draw_indirect_countに対応している場合に、塊のカリングをコンピュートシェーダで行い間接描画する
+    // カリングの結果はGPU上で描画コマンドになるので、記録済みのコマンドバッファを使う場合でもカリングが行われる
+    const bool USE_GPU_CULLING = true;
+
+    static_assert(isVertexLayoutCompatible(concatAttributes(VertexLayout<MeshVertex>::ATTRIBUTES, VertexLayout<InstanceData>::ATTRIBUTES), SHADER_VERTEX_INPUTS),
+                  "MeshVertex and InstanceData do not provide every vertex shader input");
+
     const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};   // 使用するvalidation layerの種類を指定
     const std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME}; // 物理GPUが対応していてほしい拡張機能の名称のリスト
+    // テクスチャの表に使う拡張機能。無くても起動できるように必須にはせず、対応している場合だけ有効にする
+    // VK_EXT_descriptor_indexingは、それが依存するVK_KHR_maintenance3も必要になる
+    const std::vector<const char *> textureTableExtensions = {VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+                                                              VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME};
 
 #ifdef NDEBUG
     const bool enableValidationLayers = false;
@@ -155,6 +183,7 @@ private:
 #endif
     VkQueue graphicsQueue; // グラフィック命令を受け付けるキューのハンドラ。論理デバイスが削除されたら自動的に消えるので明示的にcleanupする必要は無い
     VkQueue presentQueue;  // ウインドウへの表示命令を受け付けるキューのハンドラ。
+    VkQueue transferQueue = VK_NULL_HANDLE; // 転送専用のキューのハンドラ。転送専用のキューファミリーが無い場合はVK_NULL_HANDLEのまま
 
     GLFWwindow *window;                               // GLFWのウインドウハンドラ
     VkInstance instance;                              // Vulkanアプリケーションのインスタンス
@@ -171,55 +200,99 @@ private:
     VkRenderPass renderPass;                          // パイプラインの中で取り扱われるテクスチャ群をまとめたレンダーパスのオブジェクト
     VkDescriptorSetLayout descriptorSetLayout;        // シェーダ渡すデスクリプタの情報をまとめるオブジェクト
     VkDescriptorPool descriptorPool;                  // デスクリプタセットを払いだすためのプール
-    std::vector<VkDescriptorSet> descriptorSets;      // プールから払いだされるデスクリプタセット。スワップチェーンの各フレーム毎に一つ作られる
+    VkDescriptorSet descriptorSet;                    // プールから払いだされるデスクリプタセット。フレーム毎の違いは動的オフセットで表すので一つだけ作る
+    TextureTable textureTable;                        // 1番目のデスクリプタセット。全てのテクスチャの配列で、シェーダはマテリアルの番号で引く(表が使えない場合はテクスチャ毎のデスクリプタセット)
     VkPipelineLayout pipelineLayout;                  // シェーダーにグローバルな変数を渡して動的に挙動を変更するために使用する。
     VkPipeline graphicsPipeline;
-    VkCommandPool commandPool;                   // レンダリングなどのVulkanへのコマンドをキューに流し込むオブジェクト
-    std::vector<VkCommandBuffer> commandBuffers; // コマンドプールの記憶実体(?)
+    VkCommandPool commandPool;                         // レンダリングなどのVulkanへのコマンドをキューに流し込むオブジェクト
+    std::vector<VkCommandBuffer> commandBuffers;       // コマンドプールの記憶実体(?)
+    UploadEngine uploadEngine;                         // 頂点・インデックスバッファやテクスチャへのCPUからの転送を、転送専用のキューで非同期に行う
+    JobSystem recordingJobs;                           // 描画コマンドを二次コマンドバッファに並列に記録するスレッド
+    FrameCommandPools frameCommandPools;               // 二次コマンドバッファを割り当てる、記録するスレッド毎・フレーム毎のコマンドプール
+    std::vector<VkCommandBuffer> recordedSecondaries;  // 今のフレームでジョブ毎に記録した二次コマンドバッファ。ジョブの順番に一次コマンドバッファから実行する
+    std::vector<VkCommandBuffer> cachedCommandBuffers; // USE_CACHED_COMMAND_BUFFERSの場合の記録済みのコマンドバッファ。スワップチェインの画像 x フレームの数だけある
+    std::vector<bool> cachedCommandBufferDirty;        // cachedCommandBuffersの各要素を、次に使う前に記録し直す必要があるか
+    CachedCommandBufferStats cachedCommandBufferStats; // 前回ログに出してから、記録済みのコマンドバッファを使い回したフレームと記録し直したフレームの数
+    MemoryAllocator memoryAllocator;                   // バッファや画像のメモリを、まとめて確保したメモリブロックから割り当てる
+    PipelineCache pipelineCache;                       // 起動をまたいで使い回すパイプラインのコンパイル結果
 
     std::vector<Vertex> vertices;                          // objファイルから読み込んだ頂点情報が格納される配列
     std::vector<uint32_t> indices;                         // objファイルから読み込んだ頂点のインデックス情報が格納される配列
     VkBuffer vertexBuffer;                                 // 頂点データを格納するバッファ
-    VkDeviceMemory vertexBufferMemory;                     // 頂点データを格納するバッファのメモリ実体
+    MemoryAllocation vertexBufferMemory;                   // 頂点データを格納するバッファのメモリ実体
     VkBuffer indexBuffer;                                  // 各ポリゴンがどの頂点を使用するかをまとめたデータのためのバッファ
-    VkDeviceMemory indexBufferMemory;                      // インデックスバッファのメモリ実体
-    std::unordered_map<Vertex, uint32_t> uniqueVertices{}; // 一度読み込んだ頂点の座標をキーとしてインデックスを保持しておき、同一の頂点を何度も頂点バッファに格納するのを防ぐ
-
-    std::vector<VkBuffer> uniformBuffers;             // MVP行列を書き込むためのバッファ。フレーム数分用意するので配列にしている
-    std::vector<VkDeviceMemory> uniformBuffersMemory; // uniformBuffersが使用するメモリ実体
+    MemoryAllocation indexBufferMemory;                    // インデックスバッファのメモリ実体
+    MeshCache meshCache;                                   // 前回の起動時に作成した頂点・インデックス配列のキャッシュ
+    const Vertex *vertexData = nullptr;                    // GPUに転送する頂点配列の先頭。verticesかメモリマップしたキャッシュのどちらかを指す
+    uint32_t vertexCount = 0;                              // GPUに転送する頂点の数
+    const uint32_t *indexData = nullptr;                   // LODと塊を作る元のインデックス配列の先頭。indicesかメモリマップしたキャッシュのどちらかを指す。prepareModelの後はnullptr
+    uint32_t indexCount = 0;                               // 元のインデックス配列の要素数
+    MeshQuantization meshQuantization{};                   // 頂点バッファの頂点を元の座標・UV座標に戻すためのスケールとバイアス
+    std::vector<Meshlet> meshlets;                         // メッシュを分割した塊。全てのLODの塊を、LODの順に並べてある
+    std::vector<MeshLod> meshLods;                         // メッシュのLOD。各LODの塊はmeshletsの中の連続した範囲にある
+    std::vector<Submesh> submeshes;                        // マテリアル毎のインデックス配列の範囲。無いモデルでも全体を一つのサブメッシュにしてある
+    std::vector<MeshMaterial> meshMaterials;               // モデルのマテリアル。無いモデルでもテクスチャの無いマテリアルを一つ置いてある
+    std::vector<DrawItem> visibleDraws;                    // このフレームで描画する塊とソートキー。キーの順に並べてある
+    std::vector<DrawItem> drawSortScratch;                 // visibleDrawsを並べる時の作業用の配列
+    std::vector<MeshletDrawBatch> meshletDrawBatches;      // GPUでカリングする場合の、バッチ毎の描画コマンドの範囲。ソートキーの順に並べてある
+    VkDeviceSize wideIndexOffset = 0;                      // インデックスバッファ内の、32ビットのインデックスが始まる位置
+    bool hasWideMeshlets = false;                          // 32ビットのインデックスを使う塊があるか
+    std::vector<uint16_t> meshletIndices16;                // 16ビットのインデックスを使う塊のインデックス。インデックスバッファに転送したら解放する
+    std::vector<uint32_t> meshletIndices32;                // 32ビットのインデックスを使う塊のインデックス。インデックスバッファに転送したら解放する
+
+    StartupReport startupReport;        // 起動時の各段階にかかった時間
+    std::future<void> modelLoadJob;     // ワーカースレッドで行っているモデルの読み込み
+    std::future<void> textureLoadJob;   // ワーカースレッドで行っているテクスチャのコンテナの読み込み
+    std::promise<void> materialsLoaded; // モデルのマテリアルを読み終えた事をテクスチャの読み込みに伝える
+
+    UniformRing cameraRing;      // ビュー・プロジェクション行列をフレーム数分並べて持つ、常にマップされたバッファ
+    glm::mat4 modelMatrix{1.0f}; // モデル行列。プッシュ定数として毎フレーム渡す
+
+    SceneStore scene;                                           // シーンに置いたメッシュのオブジェクト。毎フレームCPUで視錐台カリングし、見える物だけをinstanceBufferに詰める
+    InstanceBuffer instanceBuffer;                              // メッシュのインスタンス毎の変換行列とマテリアルの番号。頂点バッファの1番目のバインディングとしてインスタンス毎に読み込む
+    std::array<LodInstanceRange, MAX_MESH_LODS> lodInstances{}; // LOD毎の、instanceBufferの中でのインスタンスの範囲
+    glm::mat4 cachedCullingViewProj{0.0f};                      // 記録済みのコマンドバッファの塊を選んだ時の、モデルからクリップ座標への行列
+
+    bool drawIndirectCountEnabled = false; // 論理デバイスでVK_KHR_draw_indirect_countとmultiDrawIndirectを有効にしたか
+    bool textureTableEnabled = false;      // 論理デバイスでVK_EXT_descriptor_indexingを有効にし、全てのテクスチャを一つの表から引くか。無効の場合はマテリアル毎にデスクリプタセットを切り替える
+    bool gpuCullingEnabled = false;        // 塊のカリングと描画コマンドの作成をmeshletCullerで行うか
+    MeshletCuller meshletCuller;           // コンピュートシェーダで塊をカリングし、描画コマンドを書き出す
+    VkBuffer meshletBuffer;                // GPUでのカリングに使う、塊の境界と描画に必要な情報
+    MemoryAllocation meshletBufferMemory;  // 塊の情報のバッファのメモリ実体
 
     std::vector<VkSemaphore> imageAvailableSemaphores; // スワップチェインから書き込み先の画像を取得してくるのを待つためのセマフォ
     std::vector<VkSemaphore> renderFinishedSemaphores; // スワップチェインへの書き込みが完了するのを待つためのセマフォ
     std::vector<VkFence> inFlightFences;               // あるフレームへのレンダリングが終わるのを待つためのフェンス
 
-    uint32_t mipLevels;                // いくつのミップマップを作成するか
-    VkImage textureImage;              // モデルに貼り付けるテクスチャ画像
-    VkDeviceMemory textureImageMemory; // テクスチャ画像が格納されるメモリ実体
-    VkImageView textureImageView;      // テクスチャのビュー
-    VkSampler textureSampler;          // テクスチャのサンプラー
+    VkFormat textureFormat;                 // テクスチャ画像のフォーマット
+    std::vector<MaterialTexture> textures;  // モデルに貼り付けるテクスチャ。0番目はテクスチャの無いマテリアルに使うTEXTURE_PATHのテクスチャ
+    std::vector<uint32_t> materialTextures; // マテリアル毎の、テクスチャの表の中でのテクスチャの番号
+    VkSampler textureSampler;               // 全てのテクスチャで共有するサンプラー
 
-    VkImage depthImage;              // 深度バッファのイメージ
-    VkDeviceMemory depthImageMemory; // 深度バッファが実際に格納されるメモリ実体
-    VkImageView depthImageView;      // 深度バッファのビュー
+    VkImage depthImage;                // 深度バッファのイメージ
+    MemoryAllocation depthImageMemory; // 深度バッファが実際に格納されるメモリ実体。スワップチェインを作り直しても使い回す
+    VkImageView depthImageView;        // 深度バッファのビュー
 
     // マルチサンプリング用のバッファに関連する変数
     VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
+    MemoryAllocation colorImageMemory; // スワップチェインを作り直しても使い回す
     VkImageView colorImageView;
 
     bool framebufferResized = false; // ウインドウサイズの変更等があったときにそれを知らせるために立てられるフラグ
 
     uint32_t currentFrame = 0; // 今使用しているフレームバッファのインデックス
 
+    bool physicalDeviceProperties2Enabled = false;               // インスタンスでVK_KHR_get_physical_device_properties2を有効にしたか
+    std::chrono::steady_clock::time_point lastMemoryBudgetLog{}; // 最後にメモリの使用量と予算をログに出した時刻
+
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT; // MSAAを行うために何点のサンプリングポイントを使用するか
 
     int monitorLeftOffset = 0; // 全モニタの左上の座標を(0, 0)にするためのオフセット
     int monitorTopOffset = 0;  // 全モニタの左上の座標を(0, 0)にするためのオフセット
 
     // -----関数の宣言-----
-    static std::vector<char> readFile(const std::string &filename); // filenameのパスの指すファイルを読み込んでバイトコードのvectorとして返す
-
     void initVulkan();                                 // Vulkan関連の初期化を行う
+    void waitForAssetJob(std::future<void> &job, const char *name); // ワーカースレッドでの読み込みjobの完了を待ち、待った時間を記録する
     bool checkValidationLayerSupport();                // 指定したvalidation layerがサポートされているかを確かめる
     std::vector<const char *> getRequiredExtensions(); // GLFWからウインドウマネージャのextensionsをもらってくる
     void setupDebugMessenger();                        // debugMessengerを作成し、validation layerへのコールバック関数の登録を行う
@@ -244,6 +317,7 @@ private:
     void createLogicalDevice();                                             // 物理デバイスから論理デバイスを作成する
     bool isDeviceSuitable(VkPhysicalDevice device);                         // 物理GPU deviceが要求する機能を満たすかどうかをチェックする
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);              // 物理GPU deviceが必要な拡張機能に対応しているかどうかをチェックする
+    bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char *name); // 物理GPU deviceがnameの拡張機能に対応しているかどうか。必須でない拡張機能を調べるのに使う
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);          // 物理GPU deviceが持っているキューファミリーの中から要求する機能に対応するものを探す
     SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device); // 物理GPU deviceが対応しているスワップチェインの情報を取得する
 
@@ -256,19 +330,21 @@ private:
                                 uint32_t mipLevels); // 画像のビューを作成する処理をまとめたヘルパー関数
     void createRenderPass();                         // フレームバッファーに含まれるバッファの種類や数などを定める
     void createDescriptorSetLayout();                // シェーダに頂点情報以外の情報を伝えるためのデスクリプタを作成する
+    static std::vector<VkDescriptorSetLayoutBinding> getDescriptorSetLayoutBindings(); // シェーダから読み取ったバインディングを、このアプリケーションでの使い方に合わせて並べる
     void createGraphicsPipeline();                   // グラフィックパイプラインを作成する
     void createFramebuffers();                       // フレームバッファを作成する
     void createCommandPool();                        // コマンドプールを作成する
     void createColorResources();                     // マルチサンプリング可能なカラーバッファを作成する
     void createDepthResources();                     // 深度バッファを作成する
     VkFormat findDepthFormat();                      // 最も適した深度バッファのフォーマットを調べて返す
+    VkFormat findTextureFormat();                    // テクスチャを格納するフォーマットを、GPUが対応している中で最も圧縮率と画質の良いものから選んで返す
     VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates,
                                  VkImageTiling tiling,
                                  VkFormatFeatureFlags features); // candidatesのフォーマットの中からtilingのタイリングパターンでfeaturesの機能を提供できるフォーマットを返す
-    bool hasStencilComponent(VkFormat format);                   // 深度バッファのフォーマットformatがステンシルを取り扱えるかどうかを調べて返す
-    VkCommandBuffer beginSingleTimeCommands();                   // 単発実行するためのコマンドバッファを作成する。
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer);   // 単発実行するためのコマンドバッファの中身を実行に移す
-    void createTextureImage();                                   // モデルに貼り付けるテクスチャ画像を読み込む
+    void createTextureImage();                                   // 読み込んだテクスチャのコンテナをGPUに転送してテクスチャ画像を作成する
+    void startTextureLoad();                                     // テクスチャのフォーマットを決めて、コンテナの読み込みをワーカースレッドで始める
+    void loadTexture();                                          // モデルのマテリアルのテクスチャのコンテナを読み込む。無いか古い場合は元画像から作成する。ワーカースレッドで実行される
+    bool openTextureContainer(TextureContainer &container, const std::string &path); // pathの画像のコンテナを開く。無いか古い場合は元画像から作成し、それもできなければfalseを返す
     void createImage(uint32_t width,
                      uint32_t height,
                      uint32_t mipLevels,
@@ -278,44 +354,59 @@ private:
                      VkImageUsageFlags usage,
                      VkMemoryPropertyFlags properties,
                      VkImage &image,
-                     VkDeviceMemory &imageMemory); // VkImageを作成する処理をまとめたユーティリティ関数
-    void generateMipmaps(VkImage image,
-                         VkFormat imageFormat,
-                         int32_t texWindth,
-                         int32_t texHeight,
-                         uint32_t mipLevels); // ミップマップの生成
-    void transitionImageLayout(VkImage image,
-                               VkFormat format,
-                               VkImageLayout oldLayout,
-                               VkImageLayout newLayout,
-                               uint32_t mipLevels); // VkImageのレイアウトを変更する
+                     MemoryAllocation &imageMemory,
+                     MemoryCategory category); // VkImageを作成する処理をまとめたユーティリティ関数。categoryはメモリの使用量の集計に使う。imageMemoryに収まる範囲が既にあれば使い回す
     void createTextureImageView();                  // モデルに貼り付けるテクスチャのビューを作成する。
     void createTextureSampler();                    // テクスチャのサンプラー(テクセルのサンプル方法を定義するオブジェクト)を作成する
+    void prepareModel();                            // モデルを読み込み、量子化のパラメータと塊への分割まで求める。ワーカースレッドで実行される
     void loadModel();                               // Objファイルからデータをロードする。
+    void loadModelWithTinyObj();                    // Objファイル全体をtinyobjloaderで読み込み、頂点の重複除去を並列に行う
+    void streamModelToCache();                      // Objファイルを少しずつ解析しながら、メッシュのキャッシュファイルに直接書き出す
+    void optimizeMeshCache();                       // 書き出したキャッシュファイル上のメッシュを、その場で窓毎に頂点キャッシュ・オーバードロー向けに並べ替える
+    void reportPeakMemoryUsage(const char *stage);  // これまでのプロセスのメモリ使用量の最大値を表示する
     void createVertexBuffer();                      // 頂点データを保存しておくためのバッファを作成し、CPUからGPUにデータを転送する
-    void createIndexBuffer();                       // インデックスバッファを作成し、CPUからGPUにデータを転送する
-    void copyBufferToImage(VkBuffer buffer,
-                           VkImage image,
-                           uint32_t width,
-                           uint32_t height); // buffer上のテクセルデータをimageに転送する
-    void createUnifomBuffers();              // シェーダに渡すMVP行列を書き込むためのバッファを作成する
+    void createIndexBuffer();                       // メッシュを塊に分割してインデックスバッファを作成し、CPUからGPUにデータを転送する
+    void cullMeshlets(const glm::mat4 &model, const CameraUniform &camera, bool cullingEnabled, bool spinning); // インスタンスのあるLODの塊のうち、modelで配置してcameraから見える物をvisibleDrawsに集めてソートキーの順に並べる。spinningの場合はワールドのZ軸周りにどれだけ回しても見える可能性のある物を集める
+    void createUnifomBuffers();                                             // シェーダに渡すビュー・プロジェクション行列を書き込むためのバッファを作成する
+    void createInstanceBuffer();                                            // インスタンス毎のデータのバッファを作成し、シーンにメッシュを格子状に並べる
+    void createMeshletCuller();                                             // 対応している場合に、塊の情報をGPUに転送してGPUでのカリングを準備する
     void createBuffer(
         VkDeviceSize size,
         VkBufferUsageFlags usage,
         VkMemoryPropertyFlags properties,
         VkBuffer &buffer,
-        VkDeviceMemory &bufferMemory);                                          // VkBufferとVkDeviceMemoryの作成処理をまとめたヘルパ関数
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size); // 頂点データを一次バッファからGPUが管理する頂点バッファにコピーする
-    void createDescriptorPool();                                                // デスクリプタセットを発行するためのプールを作成する
+        MemoryAllocation &bufferMemory,
+        MemoryCategory category);                                               // VkBufferの作成とメモリの割り当てをまとめたヘルパ関数
+    void uploadBuffer(VkBuffer dstBuffer,
+                      const void *data,
+                      VkDeviceSize size,
+                      VkDeviceSize dstOffset = 0); // CPU上のdataを一次バッファのリング経由でdstBufferのdstOffsetバイト目以降に転送する
+    void uploadBuffer(VkBuffer dstBuffer,
+                      VkDeviceSize size,
+                      VkDeviceSize elementSize,
+                      const std::function<void(void *staging, VkDeviceSize offset, VkDeviceSize size)> &fill,
+                      VkDeviceSize dstOffset = 0); // 一次バッファへの書き込みをfillに任せて、elementSizeの倍数ずつdstBufferに転送する。転送の完了は待たない
+    void createDescriptorPool();                                                // デスクリプタセットを発行するためのプールを作成する。プールの大きさはシェーダから読み取ったバインディングから決める
     void createDescriptorSets();                                                // プールからデスクリプタセットを作成する
     void createCommandBuffers();                                                // コマンドバッファを作成する
+    void createCachedCommandBuffers();                                          // USE_CACHED_COMMAND_BUFFERSの場合に、記録しておくコマンドバッファを(作り直して)割り当てる
+    void markCommandBuffersDirty();                                             // シーンやパイプラインを変えた時に呼び、記録済みのコマンドバッファを使う前に記録し直させる
     void createSyncObjects();                                                   // セマフォやフェンスなど同期するためのオブジェクトを作成する
 
-    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex); // コマンドバッファにコマンドを記録する
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex); // コマンドバッファにコマンドを記録する。描画コマンドは二次コマンドバッファに並列に記録して実行する
+    void recordCachedCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frame); // 繰り返し実行するコマンドバッファに、frame番目のフレームで実行するコマンドを記録する
+    void recordDraws(VkCommandBuffer commandBuffer,
+                     uint32_t frame,
+                     size_t firstDraw,
+                     size_t drawCount); // パイプラインやバッファのバインドと、見えると判定された塊のうちfirstDraw番目からdrawCount個を全てのインスタンスについて描画するコマンドを記録する。GPUでカリングする場合は、frame番目のフレームの描画コマンドのうちfirstDraw番目からdrawCount個のバッチを描画する
+    void recordDrawCommands(VkCommandBuffer commandBuffer,
+                            uint32_t imageIndex,
+                            size_t firstDraw,
+                            size_t drawCount); // 見えると判定された塊(GPUでカリングする場合はバッチ)のうちfirstDraw番目からdrawCount個を描画するコマンドを二次コマンドバッファに記録する。複数のスレッドから同時に呼ばれる
+    size_t getRecordedDrawCount() const;        // recordDrawsで記録する描画の総数。GPUでカリングする場合はバッチの数、そうでなければ見えると判定された塊の数
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties); // VRAMが対応しているメモリの種類と用途が必要とするメモリの機能を比較して最適なメモリの種類を選んで返す
 
-    VkShaderModule createShaderModule(const std::vector<char> &code);                                    // shaderのバイトコードからシェーダーモジュールを作成する
+    VkShaderModule createShaderModule(const EmbeddedShader &shader);                                     // 埋め込んだshaderのバイトコードからシェーダーモジュールを作成する
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &availableFormats); // スワップチェインが対応している画像フォーマットの中から最適なものを選んで返す
     VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> &availablePresentModes);  // スワップチェインへの画像の渡し方の中で最適な物を選んで返す
     VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities);                           // スワップチェインへ渡す画像の解像度を決定して返す
@@ -326,7 +417,7 @@ private:
 
     void mainLoop();
     void drawFrame();
-    void updateUniformBuffer(uint32_t currentImage); // MVP行列をアップデートする。引数はスワップチェーン上の現在使用している画像の番号
+    void updateUniformBuffer(uint32_t currentImage); // モデル行列とカメラの行列をアップデートする。引数は現在使用しているフレームの番号
 
     void cleanup();
     void cleanupSwapChain();
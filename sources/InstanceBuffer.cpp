@@ -0,0 +1,141 @@
+#include "InstanceBuffer.hpp"
+
+// ----------STLのinclude----------
+#include <stdexcept> // 例外を投げるために必要
+#include <cstring>   // memcpy, memcmpを使用するために必要
+#include <algorithm> // min, maxを使用するために必要
+
+void InstanceBuffer::init(VkDevice device, MemoryAllocator *allocator, uint32_t capacity, uint32_t frameCount)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->capacity = std::max(capacity, 1u);
+
+    // 頂点バッファのバインドのオフセットには揃える制約が無いので、フレームの領域は詰めて並べる
+    stride = sizeof(InstanceData) * this->capacity;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = stride * frameCount;
+    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create instance buffer!");
+    }
+
+    // 変更された範囲をCPUから直接書き込むので、CPUから見えるメモリに置く
+    // GPUのローカルなメモリにCPUから書き込める(Resizable BARなど)場合はそちらを使い、毎フレームの頂点の読み込みをPCIeを跨がずに済ませる
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (allocator->hasMemoryType(memRequirements.memoryTypeBits, properties | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+    {
+        properties |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    }
+    memory = allocator->allocate(memRequirements, properties, true, MemoryCategory::Instance);
+    vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+
+    instances.clear();
+    instances.reserve(this->capacity);
+    dirtyRanges.assign(frameCount, DirtyRange{});
+}
+
+void InstanceBuffer::destroy()
+{
+    if (buffer == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator->free(memory);
+    buffer = VK_NULL_HANDLE;
+}
+
+uint32_t InstanceBuffer::add(const InstanceData &instance)
+{
+    if (instances.size() >= capacity)
+    {
+        throw std::runtime_error("instance buffer is full!");
+    }
+
+    uint32_t index = static_cast<uint32_t>(instances.size());
+    instances.push_back(instance);
+    markDirty(index, index + 1);
+    return index;
+}
+
+void InstanceBuffer::set(uint32_t index, const InstanceData &instance)
+{
+    // 見えるオブジェクトを毎フレーム詰め直す場合でも、並びが変わらなかった所は書き込まずに済ませる
+    if (memcmp(&instances[index], &instance, sizeof(InstanceData)) == 0)
+    {
+        return;
+    }
+
+    instances[index] = instance;
+    markDirty(index, index + 1);
+}
+
+void InstanceBuffer::resize(uint32_t count)
+{
+    if (count > capacity)
+    {
+        throw std::runtime_error("instance buffer is full!");
+    }
+
+    // 減らした場合は描画するインスタンスの数が減るだけなので、書き込む必要は無い
+    uint32_t oldCount = getCount();
+    instances.resize(count);
+    if (count > oldCount)
+    {
+        markDirty(oldCount, count);
+    }
+}
+
+void InstanceBuffer::clear()
+{
+    // 描画するインスタンスの数が0になるだけで、バッファの中身は書き換える必要が無い
+    instances.clear();
+    for (DirtyRange &range : dirtyRanges)
+    {
+        range = DirtyRange{};
+    }
+}
+
+VkDeviceSize InstanceBuffer::acquire(uint32_t frame)
+{
+    VkDeviceSize offset = getOffset(frame);
+
+    // 他のフレームの領域はGPUが読んでいる途中かもしれないので、書き込むのはこのフレームの領域だけにする
+    // 変更された範囲はフレーム毎に積み上げてあるので、飛び飛びに変更された場合はその間もまとめて書き込む
+    DirtyRange &range = dirtyRanges[frame];
+    uint32_t end = std::min(range.end, static_cast<uint32_t>(instances.size()));
+    if (range.begin < end)
+    {
+        memcpy(static_cast<char *>(memory.mapped) + offset + sizeof(InstanceData) * range.begin,
+               instances.data() + range.begin,
+               sizeof(InstanceData) * (end - range.begin));
+    }
+    range = DirtyRange{};
+
+    return offset;
+}
+
+void InstanceBuffer::markDirty(uint32_t begin, uint32_t end)
+{
+    for (DirtyRange &range : dirtyRanges)
+    {
+        if (range.begin == range.end)
+        {
+            range.begin = begin;
+            range.end = end;
+        }
+        else
+        {
+            range.begin = std::min(range.begin, begin);
+            range.end = std::max(range.end, end);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ----------自作クラスのinclude----------
+#include "MemoryAllocator.hpp"
+#include "Vertex.hpp" // InstanceDataを使用するのに必要
+
+// インスタンス毎のデータを、常にマップした一つのバッファにフレーム数分並べて持つクラス
+// 最新の内容はCPU側に持ち、変更された範囲だけを、GPUが使い終わったフレームの領域に書き込む
+// 数十万のインスタンスのうち一部だけを動かす場合に、毎フレーム全体を書き込まずに済む
+class InstanceBuffer
+{
+public:
+    // capacity個のインスタンスを収められるバッファを作成する
+    void init(VkDevice device, MemoryAllocator *allocator, uint32_t capacity, uint32_t frameCount);
+    void destroy();
+
+    uint32_t add(const InstanceData &instance);            // インスタンスを末尾に追加してその番号を返す。容量を超える場合は例外を投げる
+    void set(uint32_t index, const InstanceData &instance); // index番目のインスタンスを書き換える。内容が同じなら何もしない
+    void resize(uint32_t count);                            // インスタンスの数を変える。増えた分の内容はsetで書き込む事
+    void clear();                                           // 全てのインスタンスを取り除く
+
+    // frame番目の領域に変更された範囲を書き込み、その領域のバッファ内での位置を返す。frameの前回の描画が終わってから呼ぶ事
+    VkDeviceSize acquire(uint32_t frame);
+    VkDeviceSize getOffset(uint32_t frame) const { return stride * frame; } // frame番目の領域の位置。記録済みのコマンドバッファに埋め込むのに使う
+
+    VkBuffer getBuffer() const { return buffer; }
+    uint32_t getCount() const { return static_cast<uint32_t>(instances.size()); }
+    const InstanceData &get(uint32_t index) const { return instances[index]; }
+
+private:
+    // フレームの領域毎の、まだ書き込んでいない範囲[begin, end)
+    struct DirtyRange
+    {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+    };
+
+    void markDirty(uint32_t begin, uint32_t end); // 全てのフレームの領域で[begin, end)を書き込みが必要な範囲に加える
+
+    VkDevice device = VK_NULL_HANDLE;
+    MemoryAllocator *allocator = nullptr;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    MemoryAllocation memory;
+    uint32_t capacity = 0;
+    VkDeviceSize stride = 0; // フレーム毎の領域の間隔
+
+    std::vector<InstanceData> instances; // 最新の内容
+    std::vector<DirtyRange> dirtyRanges; // フレームの領域毎の、書き込みが必要な範囲
+};
\ No newline at end of file
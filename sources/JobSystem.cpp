@@ -0,0 +1,131 @@
+#include "JobSystem.hpp"
+
+// ----------STLのinclude----------
+#include <algorithm> // maxを使用するために必要
+
+void JobSystem::init(uint32_t threadCount)
+{
+    stopping = false;
+    for (uint32_t thread = 1; thread < std::max(threadCount, 1u); thread++)
+    {
+        workers.emplace_back(&JobSystem::workerLoop, this, thread);
+    }
+}
+
+void JobSystem::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void JobSystem::parallelFor(uint32_t jobCount, const JobFunction &function)
+{
+    if (jobCount == 0)
+    {
+        return;
+    }
+
+    // ワーカースレッドが無いか、ジョブが一つだけなら起こさずにその場で実行する
+    if (workers.empty() || jobCount == 1)
+    {
+        for (uint32_t job = 0; job < jobCount; job++)
+        {
+            function(job, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->function = &function;
+        this->jobCount = jobCount;
+        nextJob.store(0);
+        error = nullptr;
+        generation++;
+    }
+    workAvailable.notify_all();
+
+    runJobs(0);
+
+    // 呼び出し元が最後のジョブを取り出した時点でも、ワーカースレッドはまだ自分のジョブを実行しているかもしれないので待つ
+    // functionを戻しておく事で、遅れて起きたワーカースレッドがこの関数から戻った後のfunctionを使わないようにする
+    std::exception_ptr firstError;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        workFinished.wait(lock, [this]
+                          { return busyWorkers == 0; });
+        this->function = nullptr;
+        firstError = error;
+        error = nullptr;
+    }
+
+    if (firstError)
+    {
+        std::rethrow_exception(firstError);
+    }
+}
+
+void JobSystem::workerLoop(uint32_t thread)
+{
+    uint64_t seenGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workAvailable.wait(lock, [&]
+                               { return stopping || generation != seenGeneration; });
+            if (stopping)
+            {
+                return;
+            }
+            seenGeneration = generation;
+            if (function == nullptr)
+            {
+                continue; // 起きるのが遅れて、parallelForが既に終わっていた
+            }
+            busyWorkers++;
+        }
+
+        runJobs(thread);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+        }
+        workFinished.notify_one();
+    }
+}
+
+void JobSystem::runJobs(uint32_t thread)
+{
+    while (true)
+    {
+        uint32_t job = nextJob.fetch_add(1);
+        if (job >= jobCount)
+        {
+            return;
+        }
+
+        try
+        {
+            (*function)(job, thread);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+}
\ No newline at end of file
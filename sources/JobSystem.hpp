@@ -0,0 +1,48 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint>            // uint32_tを使用するために必要
+#include <thread>             // ワーカースレッドを作成するのに使用する
+#include <mutex>              // ワーカースレッドとの状態の共有に使用する
+#include <condition_variable> // ワーカースレッドを寝かせておくのに使用する
+#include <atomic>             // 次に処理するジョブの番号をスレッド間で共有するのに使用する
+#include <functional>         // ジョブの処理を受け取るのに使用する
+#include <exception>          // ワーカースレッドで投げられた例外を呼び出し元に伝えるのに使用する
+
+// 毎フレームの並列処理のために、ワーカースレッドを起動したまま使い回すクラス
+// 起動時の重複除去やブロック圧縮のように一回限りの処理ならその場でスレッドを作れば良いが、
+// 毎フレームスレッドを作ると作成と終了だけで描画の間隔に対して無視できない時間がかかる
+// parallelForを呼んだスレッドも処理に加わるので、スレッドの番号は0が呼び出し元、1以降がワーカースレッドになる
+class JobSystem
+{
+public:
+    using JobFunction = std::function<void(uint32_t job, uint32_t thread)>; // jobはジョブの番号、threadは実行しているスレッドの番号
+
+    void init(uint32_t threadCount); // 呼び出し元を含めてthreadCount個のスレッドで処理するように、threadCount - 1個のワーカースレッドを起動する
+    void destroy();                  // ワーカースレッドを終了させる
+
+    // 0からjobCount - 1までのジョブを全てのスレッドで分担して実行し、全て終わるまで待つ
+    // ジョブの中で例外が投げられた場合は、全てのジョブが終わった後に最初の例外を投げ直す
+    void parallelFor(uint32_t jobCount, const JobFunction &function);
+
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+private:
+    void workerLoop(uint32_t thread);
+    void runJobs(uint32_t thread); // 残っているジョブが無くなるまで取り出して実行する
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workAvailable; // parallelForが呼ばれた事をワーカースレッドに知らせる
+    std::condition_variable workFinished;  // ワーカースレッドがジョブを取り出し終えた事をparallelForに知らせる
+
+    // 以下はmutexで保護する
+    const JobFunction *function = nullptr; // 実行中のジョブの処理。parallelForの外ではnullptr
+    uint64_t generation = 0;               // parallelForが呼ばれた回数。ワーカースレッドはこの値が変わったら起きる
+    uint32_t busyWorkers = 0;              // ジョブを取り出している最中のワーカースレッドの数
+    bool stopping = false;
+    std::exception_ptr error; // ジョブの中で最初に投げられた例外
+
+    uint32_t jobCount = 0;
+    std::atomic<uint32_t> nextJob{0};
+};
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "MappedFile.hpp"
+
+// ----------STLのinclude----------
+#include <filesystem> // ファイルサイズや更新時刻を取得するのに使用する
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string &filename, bool writable)
+{
+    close();
+
+    fileHandle = CreateFileA(filename.c_str(),
+                             writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                             FILE_SHARE_READ,
+                             nullptr,
+                             OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, // 先頭から順に読む使い方が殆どなので先読みを効かせてもらう
+                             nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0)
+    {
+        // サイズ0のファイルはマップできないので、開けなかったものとして扱う
+        close();
+        return false;
+    }
+    fileSize = static_cast<size_t>(size.QuadPart);
+
+    // 第4,5引数を0にするとファイル全体がマッピングの対象になる
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    view = static_cast<uint8_t *>(MapViewOfFile(mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+    if (view == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (view != nullptr)
+    {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+    if (mappingHandle != nullptr)
+    {
+        CloseHandle(mappingHandle);
+        mappingHandle = nullptr;
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+    fileSize = 0;
+}
+
+bool MappedFile::getFileStamp(const std::string &filename, uint64_t &size, int64_t &writeTime)
+{
+    // ファイルが見つからない場合等に例外を投げられると困るので、error_codeを受け取る版の関数を使う
+    std::error_code ec;
+    auto fileSize = std::filesystem::file_size(filename, ec);
+    if (ec)
+    {
+        return false;
+    }
+    auto lastWriteTime = std::filesystem::last_write_time(filename, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    size = static_cast<uint64_t>(fileSize);
+    writeTime = static_cast<int64_t>(lastWriteTime.time_since_epoch().count());
+    return true;
+}
\ No newline at end of file
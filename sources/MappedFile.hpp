@@ -0,0 +1,38 @@
+#pragma once
+// ----------STLのinclude----------
+#include <string>
+#include <cstdint> // uint8_tを使用するために必要
+#include <cstddef> // size_tを使用するために必要
+
+// ----------Win32APIのinclude----------------
+#include "windows.h"
+
+// ファイルの中身をメモリマップしてポインタ経由で直接読み書きできるようにするクラス
+// ifstreamで読み込む場合と違って、ファイルの中身をプロセスのメモリにコピーする必要が無い
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    // マップしたビューは一つのインスタンスが専有するのでコピーは禁止しておく
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // filenameのファイルのサイズと最終更新時刻を取得する。キャッシュ等を作成した時から元のファイルが更新されていないかの確認に使う
+    static bool getFileStamp(const std::string &filename, uint64_t &size, int64_t &writeTime);
+
+    bool open(const std::string &filename, bool writable = false); // filenameのファイルをマップする。開けなかった場合はfalseを返す
+    void close();                                                  // マップを解除してファイルを閉じる
+
+    bool isOpen() const { return view != nullptr; }
+    const uint8_t *data() const { return view; }
+    uint8_t *data() { return view; } // writable = trueで開いた時のみ書き込み可能
+    size_t size() const { return fileSize; }
+
+private:
+    HANDLE fileHandle = INVALID_HANDLE_VALUE; // マップ元のファイルのハンドル
+    HANDLE mappingHandle = nullptr;           // ファイルマッピングオブジェクトのハンドル
+    uint8_t *view = nullptr;                  // マップされたファイルの先頭アドレス
+    size_t fileSize = 0;                      // マップされたファイルのサイズ
+};
\ No newline at end of file
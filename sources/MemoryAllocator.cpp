@@ -0,0 +1,587 @@
+#include "MemoryAllocator.hpp"
+
+// ----------STLのinclude----------
+#include <stdexcept> // 例外を投げるために必要
+#include <algorithm> // maxを使用するのに必要
+#include <cstdio>    // printfを使用するのに必要
+
+namespace
+{
+    // valueを超えない最大の2の累乗の指数。valueは0より大きい事
+    uint32_t floorLog2(VkDeviceSize value)
+    {
+        uint32_t result = 0;
+        while (value >>= 1)
+        {
+            result++;
+        }
+        return result;
+    }
+
+    // 立っているビットの中で最も下位のものの番号。valueは0より大きい事
+    uint32_t lowestBit(uint64_t value)
+    {
+        uint32_t result = 0;
+        while (!(value & 1))
+        {
+            value >>= 1;
+            result++;
+        }
+        return result;
+    }
+
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    const char *const CATEGORY_NAMES[] = {"mesh", "texture", "uniform", "attachment", "staging", "instance", "indirect"};
+
+    const double MiB = 1024.0 * 1024.0;
+}
+
+void MemoryAllocator::init(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudgetEnabled)
+{
+    this->physicalDevice = physicalDevice;
+    this->device = device;
+
+    // メモリの種類とヒープの情報は変わらないので、メモリの種類を探す度に問い合わせずにここで控えておく
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    bufferImageGranularity = properties.limits.bufferImageGranularity;
+
+    // Vulkan 1.0ではvkGetPhysicalDeviceMemoryProperties2はコアの関数ではないので、拡張機能の関数を取得する
+    getMemoryProperties2 = nullptr;
+    if (memoryBudgetEnabled)
+    {
+        getMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(
+            vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR"));
+    }
+
+    heapBudgets.assign(memoryProperties.memoryHeapCount, MemoryHeapBudget{});
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        heapBudgets[i].size = memoryProperties.memoryHeaps[i].size;
+        heapBudgets[i].deviceLocal = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    }
+    std::fill(std::begin(categoryBytes), std::end(categoryBytes), 0);
+    std::fill(std::begin(categoryCounts), std::end(categoryCounts), 0);
+    updateBudget();
+}
+
+void MemoryAllocator::destroy()
+{
+    for (auto &pool : pools)
+    {
+        for (uint32_t i = 0; i < pool.blocks.size(); i++)
+        {
+            if (pool.blocks[i].memory != VK_NULL_HANDLE)
+            {
+                releaseBlock(pool, i);
+            }
+        }
+    }
+    pools.clear();
+    device = VK_NULL_HANDLE;
+}
+
+void MemoryAllocator::mapping(VkDeviceSize size, uint32_t &firstLevel, uint32_t &secondLevel)
+{
+    // 上位の区分は2の累乗毎、下位の区分はその範囲をSECOND_LEVEL_COUNT等分したもの
+    // sizeはMIN_ALLOCATION_SIZEの倍数なので、firstLevelは必ずSECOND_LEVEL_BITS以上になる
+    firstLevel = floorLog2(size);
+    secondLevel = static_cast<uint32_t>(size >> (firstLevel - SECOND_LEVEL_BITS)) ^ SECOND_LEVEL_COUNT;
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+    {
+        if ((typeFilter & (1 << i)) &&
+            (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool MemoryAllocator::hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+    {
+        if ((typeFilter & (1 << i)) &&
+            (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MemoryAllocator::isCompatible(const MemoryAllocation &allocation, const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties) const
+{
+    return allocation.memory != VK_NULL_HANDLE &&
+           (requirements.memoryTypeBits & (1u << allocation.memoryType)) &&
+           (memoryProperties.memoryTypes[allocation.memoryType].propertyFlags & properties) == properties &&
+           allocation.size >= requirements.size &&
+           allocation.offset % std::max(requirements.alignment, (VkDeviceSize)1) == 0;
+}
+
+uint32_t MemoryAllocator::getPool(uint32_t memoryType, bool linear)
+{
+    // 範囲の位置と大きさはMIN_ALLOCATION_SIZEの倍数に揃えているので、bufferImageGranularityがそれ以下であれば
+    // 線形なリソースと最適なタイリングの画像が同じページに載る事は無く、同じメモリブロックから割り当てても良い
+    if (bufferImageGranularity <= MIN_ALLOCATION_SIZE)
+    {
+        linear = true;
+    }
+
+    for (uint32_t i = 0; i < pools.size(); i++)
+    {
+        if (pools[i].memoryType == memoryType && pools[i].linear == linear)
+        {
+            return i;
+        }
+    }
+
+    Pool pool;
+    pool.memoryType = memoryType;
+    pool.linear = linear;
+    for (auto &lists : pool.freeLists)
+    {
+        std::fill(std::begin(lists), std::end(lists), NONE);
+    }
+
+    // 小さなヒープ(統合GPUのCPUから見えるVRAMなど)では、メモリブロックを小さくしてヒープを使い切らないようにする
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    pool.blockSize = heapSize <= (1ull << 30) ? alignUp(heapSize / 8, MIN_ALLOCATION_SIZE) : DEFAULT_BLOCK_SIZE;
+
+    pools.push_back(std::move(pool));
+    return static_cast<uint32_t>(pools.size() - 1);
+}
+
+uint32_t MemoryAllocator::createNode(Pool &pool)
+{
+    if (!pool.unusedNodes.empty())
+    {
+        uint32_t node = pool.unusedNodes.back();
+        pool.unusedNodes.pop_back();
+        pool.nodes[node] = Node{};
+        return node;
+    }
+
+    pool.nodes.push_back(Node{});
+    return static_cast<uint32_t>(pool.nodes.size() - 1);
+}
+
+void MemoryAllocator::insertFreeNode(Pool &pool, uint32_t node)
+{
+    uint32_t firstLevel, secondLevel;
+    mapping(pool.nodes[node].size, firstLevel, secondLevel);
+
+    // 区分のリストの先頭に繋ぐ
+    uint32_t head = pool.freeLists[firstLevel][secondLevel];
+    pool.nodes[node].isFree = true;
+    pool.nodes[node].prevFree = NONE;
+    pool.nodes[node].nextFree = head;
+    if (head != NONE)
+    {
+        pool.nodes[head].prevFree = node;
+    }
+    pool.freeLists[firstLevel][secondLevel] = node;
+
+    pool.firstLevelMap |= 1ull << firstLevel;
+    pool.secondLevelMap[firstLevel] |= 1u << secondLevel;
+}
+
+void MemoryAllocator::removeFreeNode(Pool &pool, uint32_t node)
+{
+    uint32_t firstLevel, secondLevel;
+    mapping(pool.nodes[node].size, firstLevel, secondLevel);
+
+    Node &n = pool.nodes[node];
+    if (n.prevFree != NONE)
+    {
+        pool.nodes[n.prevFree].nextFree = n.nextFree;
+    }
+    else
+    {
+        pool.freeLists[firstLevel][secondLevel] = n.nextFree;
+    }
+    if (n.nextFree != NONE)
+    {
+        pool.nodes[n.nextFree].prevFree = n.prevFree;
+    }
+    n.isFree = false;
+    n.prevFree = n.nextFree = NONE;
+
+    // リストが空になったら、その区分に空き領域が無い事をビットで示す
+    if (pool.freeLists[firstLevel][secondLevel] == NONE)
+    {
+        pool.secondLevelMap[firstLevel] &= ~(1u << secondLevel);
+        if (pool.secondLevelMap[firstLevel] == 0)
+        {
+            pool.firstLevelMap &= ~(1ull << firstLevel);
+        }
+    }
+}
+
+uint32_t MemoryAllocator::findFreeNode(Pool &pool, VkDeviceSize size)
+{
+    // 区分の中には様々な大きさの空き領域が混ざっているので、sizeを次の区分の先頭まで切り上げてから探す
+    // そうすると見つかった区分の空き領域はどれもsize以上の大きさなので、リストの先頭を取るだけで良い
+    uint32_t firstLevel = floorLog2(size);
+    VkDeviceSize rounded = size + (1ull << (firstLevel - SECOND_LEVEL_BITS)) - 1;
+    uint32_t secondLevel;
+    mapping(rounded, firstLevel, secondLevel);
+    if (firstLevel >= FIRST_LEVEL_COUNT)
+    {
+        return NONE;
+    }
+
+    uint32_t secondLevelMap = pool.secondLevelMap[firstLevel] & (~0u << secondLevel);
+    if (secondLevelMap == 0)
+    {
+        // 同じ上位の区分に無ければ、それより大きい上位の区分の中で最も小さいものを使う
+        uint64_t firstLevelMap = firstLevel + 1 < FIRST_LEVEL_COUNT ? pool.firstLevelMap & (~0ull << (firstLevel + 1)) : 0;
+        if (firstLevelMap == 0)
+        {
+            return NONE;
+        }
+        firstLevel = lowestBit(firstLevelMap);
+        secondLevelMap = pool.secondLevelMap[firstLevel];
+    }
+    secondLevel = lowestBit(secondLevelMap);
+
+    uint32_t node = pool.freeLists[firstLevel][secondLevel];
+    removeFreeNode(pool, node);
+    return node;
+}
+
+uint32_t MemoryAllocator::createBlock(Pool &pool, VkDeviceSize size, bool dedicated)
+{
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = pool.memoryType;
+
+    Block block;
+    block.size = size;
+    block.dedicated = dedicated;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate device memory block!");
+    }
+    heapBudgets[memoryProperties.memoryTypes[pool.memoryType].heapIndex].blockBytes += size;
+
+    // 一つのVkDeviceMemoryは同時に一か所にしかマップできないので、CPUから見えるメモリブロックは最初に全体をマップしておく
+    if (memoryProperties.memoryTypes[pool.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        if (vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS)
+        {
+            vkFreeMemory(device, block.memory, nullptr);
+            throw std::runtime_error("failed to map device memory block!");
+        }
+    }
+
+    // 解放済みのメモリブロックの場所があれば再利用する
+    uint32_t blockIndex = static_cast<uint32_t>(pool.blocks.size());
+    for (uint32_t i = 0; i < pool.blocks.size(); i++)
+    {
+        if (pool.blocks[i].memory == VK_NULL_HANDLE)
+        {
+            blockIndex = i;
+            break;
+        }
+    }
+    if (blockIndex == pool.blocks.size())
+    {
+        pool.blocks.push_back(block);
+    }
+    else
+    {
+        pool.blocks[blockIndex] = block;
+    }
+
+    uint32_t node = createNode(pool);
+    pool.nodes[node].offset = 0;
+    pool.nodes[node].size = size;
+    pool.nodes[node].block = blockIndex;
+    return node;
+}
+
+void MemoryAllocator::releaseBlock(Pool &pool, uint32_t block)
+{
+    // メモリを解放するとマップも解除される
+    vkFreeMemory(device, pool.blocks[block].memory, nullptr);
+    heapBudgets[memoryProperties.memoryTypes[pool.memoryType].heapIndex].blockBytes -= pool.blocks[block].size;
+    pool.blocks[block] = Block{};
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear, MemoryCategory category)
+{
+    uint32_t poolIndex = getPool(findMemoryType(requirements.memoryTypeBits, properties), linear);
+    Pool &pool = pools[poolIndex];
+
+    VkDeviceSize size = alignUp(std::max(requirements.size, (VkDeviceSize)1), MIN_ALLOCATION_SIZE);
+    VkDeviceSize alignment = std::max(requirements.alignment, MIN_ALLOCATION_SIZE);
+
+    uint32_t node;
+    if (size > pool.blockSize / 2)
+    {
+        // メモリブロックの半分を超えるような大きなリソースは、専用のメモリブロックに置いた方が無駄が少ない
+        node = createBlock(pool, size, true);
+    }
+    else
+    {
+        // 空き領域の位置はMIN_ALLOCATION_SIZEの倍数なので、それより大きいアラインメントの場合は先頭を揃えるための余白も含めて探す
+        VkDeviceSize searchSize = size + alignment - MIN_ALLOCATION_SIZE;
+        node = findFreeNode(pool, searchSize);
+        if (node == NONE)
+        {
+            node = createBlock(pool, pool.blockSize, false);
+        }
+        else if (pool.nodes[node].prevPhysical == NONE && pool.nodes[node].nextPhysical == NONE)
+        {
+            pool.emptyBlockCount--; // 残しておいた空のメモリブロックを使い始める
+        }
+
+        // 先頭の余白を空き領域として切り分ける
+        VkDeviceSize padding = alignUp(pool.nodes[node].offset, alignment) - pool.nodes[node].offset;
+        if (padding > 0)
+        {
+            uint32_t front = createNode(pool);
+            Node &n = pool.nodes[node];
+            Node &f = pool.nodes[front];
+            f.offset = n.offset;
+            f.size = padding;
+            f.block = n.block;
+            f.prevPhysical = n.prevPhysical;
+            f.nextPhysical = node;
+            if (n.prevPhysical != NONE)
+            {
+                pool.nodes[n.prevPhysical].nextPhysical = front;
+            }
+            n.prevPhysical = front;
+            n.offset += padding;
+            n.size -= padding;
+            insertFreeNode(pool, front);
+        }
+
+        // 後ろの余りを空き領域として切り分ける
+        if (pool.nodes[node].size > size)
+        {
+            uint32_t back = createNode(pool);
+            Node &n = pool.nodes[node];
+            Node &b = pool.nodes[back];
+            b.offset = n.offset + size;
+            b.size = n.size - size;
+            b.block = n.block;
+            b.prevPhysical = node;
+            b.nextPhysical = n.nextPhysical;
+            if (n.nextPhysical != NONE)
+            {
+                pool.nodes[n.nextPhysical].prevPhysical = back;
+            }
+            n.nextPhysical = back;
+            n.size = size;
+            insertFreeNode(pool, back);
+        }
+    }
+
+    const Node &n = pool.nodes[node];
+    const Block &block = pool.blocks[n.block];
+    pool.allocationCount++;
+    pool.usedBytes += n.size;
+    categoryBytes[static_cast<uint32_t>(category)] += n.size;
+    categoryCounts[static_cast<uint32_t>(category)]++;
+
+    MemoryAllocation allocation;
+    allocation.memory = block.memory;
+    allocation.offset = n.offset;
+    allocation.size = n.size;
+    allocation.mapped = block.mapped != nullptr ? static_cast<char *>(block.mapped) + n.offset : nullptr;
+    allocation.pool = poolIndex;
+    allocation.node = node;
+    allocation.category = category;
+    allocation.memoryType = pool.memoryType;
+    return allocation;
+}
+
+void MemoryAllocator::free(MemoryAllocation &allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    Pool &pool = pools[allocation.pool];
+    uint32_t node = allocation.node;
+    pool.allocationCount--;
+    pool.usedBytes -= pool.nodes[node].size;
+    categoryBytes[static_cast<uint32_t>(allocation.category)] -= pool.nodes[node].size;
+    categoryCounts[static_cast<uint32_t>(allocation.category)]--;
+    allocation = MemoryAllocation{};
+
+    // 前後の範囲が空いていれば一つの空き領域にまとめる
+    uint32_t prev = pool.nodes[node].prevPhysical;
+    if (prev != NONE && pool.nodes[prev].isFree)
+    {
+        removeFreeNode(pool, prev);
+        pool.nodes[prev].size += pool.nodes[node].size;
+        pool.nodes[prev].nextPhysical = pool.nodes[node].nextPhysical;
+        if (pool.nodes[node].nextPhysical != NONE)
+        {
+            pool.nodes[pool.nodes[node].nextPhysical].prevPhysical = prev;
+        }
+        pool.unusedNodes.push_back(node);
+        node = prev;
+    }
+    uint32_t next = pool.nodes[node].nextPhysical;
+    if (next != NONE && pool.nodes[next].isFree)
+    {
+        removeFreeNode(pool, next);
+        pool.nodes[node].size += pool.nodes[next].size;
+        pool.nodes[node].nextPhysical = pool.nodes[next].nextPhysical;
+        if (pool.nodes[next].nextPhysical != NONE)
+        {
+            pool.nodes[pool.nodes[next].nextPhysical].prevPhysical = node;
+        }
+        pool.unusedNodes.push_back(next);
+    }
+
+    // メモリブロック全体が空いた場合、専用のメモリブロックか、他にも空のメモリブロックがあれば解放する
+    // 空のメモリブロックを一つ残しておくのは、確保と解放を繰り返した時に毎回vkAllocateMemoryしないようにするため
+    const Node &n = pool.nodes[node];
+    if (n.prevPhysical == NONE && n.nextPhysical == NONE)
+    {
+        uint32_t block = n.block;
+        if (pool.blocks[block].dedicated || pool.emptyBlockCount > 0)
+        {
+            pool.unusedNodes.push_back(node);
+            pool.nodes[node].isFree = false;
+            releaseBlock(pool, block);
+            return;
+        }
+        pool.emptyBlockCount++;
+    }
+
+    insertFreeNode(pool, node);
+}
+
+void MemoryAllocator::addStatistics(const Pool &pool, MemoryStatistics &statistics) const
+{
+    for (const auto &block : pool.blocks)
+    {
+        if (block.memory != VK_NULL_HANDLE)
+        {
+            statistics.blockCount++;
+            statistics.blockBytes += block.size;
+        }
+    }
+    VkDeviceSize largestFreeBytes = 0;
+    for (const auto &node : pool.nodes)
+    {
+        if (node.isFree)
+        {
+            largestFreeBytes = std::max(largestFreeBytes, node.size);
+        }
+    }
+    statistics.largestFreeBytes += largestFreeBytes;
+    statistics.allocationCount += pool.allocationCount;
+    statistics.usedBytes += pool.usedBytes;
+}
+
+MemoryStatistics MemoryAllocator::getStatistics() const
+{
+    MemoryStatistics statistics;
+    for (const auto &pool : pools)
+    {
+        addStatistics(pool, statistics);
+    }
+    return statistics;
+}
+
+void MemoryAllocator::printStatistics() const
+{
+    for (const auto &pool : pools)
+    {
+        MemoryStatistics statistics;
+        addStatistics(pool, statistics);
+        printf("memory type %u (%s) : %u blocks %.1f MiB, %u allocations %.1f MiB used, fragmentation %.2f\n",
+               pool.memoryType,
+               pool.linear ? "linear" : "optimal",
+               statistics.blockCount,
+               statistics.blockBytes / MiB,
+               statistics.allocationCount,
+               statistics.usedBytes / MiB,
+               statistics.getFragmentation());
+    }
+
+    MemoryStatistics total = getStatistics();
+    printf("device memory total : %u blocks %.1f MiB, %u allocations %.1f MiB used, fragmentation %.2f\n",
+           total.blockCount,
+           total.blockBytes / MiB,
+           total.allocationCount,
+           total.usedBytes / MiB,
+           total.getFragmentation());
+
+    for (uint32_t i = 0; i < CATEGORY_COUNT; i++)
+    {
+        printf("  %-10s : %u allocations %.1f MiB\n", CATEGORY_NAMES[i], categoryCounts[i], categoryBytes[i] / MiB);
+    }
+}
+
+void MemoryAllocator::updateBudget()
+{
+    if (getMemoryProperties2 != nullptr)
+    {
+        // 予算と使用量はVkPhysicalDeviceMemoryProperties2のpNextに繋いだ構造体に書き込まれる
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties2.pNext = &budgetProperties;
+        getMemoryProperties2(physicalDevice, &properties2);
+
+        for (uint32_t i = 0; i < heapBudgets.size(); i++)
+        {
+            heapBudgets[i].budget = budgetProperties.heapBudget[i];
+            heapBudgets[i].usage = budgetProperties.heapUsage[i];
+        }
+        return;
+    }
+
+    // 拡張機能が使えない場合は、他のプロセスの使用量が分からないので、ヒープの8割を予算と見なし、確保したメモリブロックの量を使用量とする
+    for (auto &heap : heapBudgets)
+    {
+        heap.budget = heap.size / 10 * 8;
+        heap.usage = heap.blockBytes;
+    }
+}
+
+void MemoryAllocator::printBudget() const
+{
+    // 例 : memory budget (driver) : heap0 VRAM 180.2/7372.8 MiB 2% | heap1 sysmem 34.0/12000.0 MiB 0% | mesh 20.1 texture 10.7 ... MiB
+    printf("memory budget (%s) :", isBudgetFromDriver() ? "driver" : "estimate");
+    for (uint32_t i = 0; i < heapBudgets.size(); i++)
+    {
+        const MemoryHeapBudget &heap = heapBudgets[i];
+        printf(" heap%u %s %.1f/%.1f MiB %.0f%%%s |",
+               i,
+               heap.deviceLocal ? "VRAM" : "sysmem",
+               heap.usage / MiB,
+               heap.budget / MiB,
+               heap.getPressure() * 100.0f,
+               heap.getPressure() > 0.9f ? " (pressure)" : "");
+    }
+    for (uint32_t i = 0; i < CATEGORY_COUNT; i++)
+    {
+        printf(" %s %.1f", CATEGORY_NAMES[i], categoryBytes[i] / MiB);
+    }
+    printf(" MiB\n");
+}
\ No newline at end of file
@@ -0,0 +1,175 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// 割り当てたメモリを何に使っているか。用途毎の使用量を集計するのに使う
+enum class MemoryCategory : uint32_t
+{
+    Mesh,       // 頂点・インデックスバッファ
+    Texture,    // テクスチャ画像
+    Uniform,    // ユニフォームバッファ
+    Attachment, // カラー・深度のアタッチメント
+    Staging,    // CPUからの転送に使う一次バッファ
+    Instance,   // インスタンス毎の変換行列などのバッファ
+    Indirect,   // GPUが書き込む間接描画のコマンドのバッファ
+    Count
+};
+
+// MemoryAllocatorから割り当てられたメモリの範囲
+struct MemoryAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE; // 範囲を含むメモリブロック。他のリソースと共有しているので、vkFreeMemoryしてはいけない
+    VkDeviceSize offset = 0;                // メモリブロックの先頭からの位置。vkBind*Memoryにはこの値を渡す
+    VkDeviceSize size = 0;
+    void *mapped = nullptr; // CPUから見えるメモリの場合の、範囲の先頭をマップしたアドレス。メモリブロックは作成時から常にマップしてある
+
+    uint32_t pool = 0; // 以下はMemoryAllocator::freeで範囲を返すための情報
+    uint32_t node = 0;
+    uint32_t memoryType = 0;
+    MemoryCategory category = MemoryCategory::Mesh;
+};
+
+// メモリの使用状況
+struct MemoryStatistics
+{
+    uint32_t blockCount = 0;           // vkAllocateMemoryで確保したメモリブロックの数
+    uint32_t allocationCount = 0;      // メモリブロックから割り当てている範囲の数
+    VkDeviceSize blockBytes = 0;       // メモリブロックの合計のバイト数
+    VkDeviceSize usedBytes = 0;        // 割り当てている範囲の合計のバイト数
+    VkDeviceSize largestFreeBytes = 0; // 一続きの空き領域の最大のバイト数。複数の種類のメモリをまとめた場合は種類毎の最大値の合計
+
+    // 空き領域がどれだけ細切れになっているか。0なら空き領域が一続きになっていて、1に近いほど細かく分かれている
+    float getFragmentation() const
+    {
+        VkDeviceSize freeBytes = blockBytes - usedBytes;
+        return freeBytes > 0 ? 1.0f - static_cast<float>(largestFreeBytes) / static_cast<float>(freeBytes) : 0.0f;
+    }
+};
+
+// メモリヒープ毎の使用量と予算
+struct MemoryHeapBudget
+{
+    VkDeviceSize size = 0;       // ヒープ全体の大きさ
+    VkDeviceSize budget = 0;     // このプロセスが使っても良いと見込まれる量。他のプロセス(ゲームなど)の使用量によって変わる
+    VkDeviceSize usage = 0;      // このプロセスが使っている量。ドライバの内部で使っている分も含む
+    VkDeviceSize blockBytes = 0; // そのうちMemoryAllocatorがメモリブロックとして確保している量
+    bool deviceLocal = false;    // GPUのローカルなメモリ(VRAM)のヒープか
+
+    // 予算に対する使用量の割合。1を超えると、ドライバがメモリを追い出したり描画が詰まったりし始める
+    float getPressure() const
+    {
+        return budget > 0 ? static_cast<float>(usage) / static_cast<float>(budget) : 0.0f;
+    }
+};
+
+// vkAllocateMemoryで大きなメモリブロックを確保し、そこからバッファや画像のメモリを切り出して割り当てるクラス
+// ドライバはメモリの確保の回数をmaxMemoryAllocationCountまでに制限していて、確保自体も重い処理なので、リソース毎には確保しない
+// 空き領域はTLSF(Two-Level Segregated Fit)で管理し、割り当てと解放を一定の時間で行う
+// バッファ(と線形な画像)と、最適なタイリングの画像は別のメモリブロックから割り当てる事で、bufferImageGranularityの制約を満たす
+// メインスレッドからのみ呼び出す事
+class MemoryAllocator
+{
+public:
+    // memoryBudgetEnabledは、インスタンスでVK_KHR_get_physical_device_properties2を、デバイスでVK_EXT_memory_budgetを有効にした場合にtrueを渡す
+    void init(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudgetEnabled);
+    void destroy(); // 全てのメモリブロックを解放する。割り当てた範囲は先に全てfreeしておく事
+
+    // requirementsを満たし、propertiesの性質を全て持つメモリを割り当てる
+    // linearはバッファか線形なタイリングの画像の場合にtrue、最適なタイリングの画像の場合にfalseを指定する
+    // categoryは用途毎の使用量の集計に使う
+    MemoryAllocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear, MemoryCategory category);
+    void free(MemoryAllocation &allocation);
+
+    bool hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const; // typeFilterの中にpropertiesの性質を全て持つメモリの種類があるか
+    // allocationを、requirementsを満たしpropertiesの性質を持つリソースにそのまま割り付けられるか。作り直したリソースでメモリを使い回す際に使う
+    bool isCompatible(const MemoryAllocation &allocation, const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties) const;
+
+    MemoryStatistics getStatistics() const;
+    void printStatistics() const; // メモリの種類毎と用途毎の使用状況を表示する
+
+    // ヒープ毎の使用量と予算を問い合わせ直す。VK_EXT_memory_budgetが使えない場合は、確保したメモリブロックの量とヒープの大きさから見積もる
+    // 他のプロセスの使用量によって予算が変わるので、毎フレーム呼ぶ
+    void updateBudget();
+    const std::vector<MemoryHeapBudget> &getBudget() const { return heapBudgets; } // 最後にupdateBudgetした時点の値
+    bool isBudgetFromDriver() const { return getMemoryProperties2 != nullptr; }     // 予算がドライバから得た値か、見積もりか
+    VkDeviceSize getCategoryBytes(MemoryCategory category) const { return categoryBytes[static_cast<uint32_t>(category)]; }
+    void printBudget() const; // ヒープ毎の使用量と予算、用途毎の使用量を一行で表示する
+
+private:
+    static constexpr uint32_t SECOND_LEVEL_BITS = 4;                        // 2の累乗毎の大きさの区分を、さらに何ビットで細かく分けるか
+    static constexpr uint32_t SECOND_LEVEL_COUNT = 1u << SECOND_LEVEL_BITS; // 2の累乗毎の大きさの区分をいくつに分けるか
+    static constexpr uint32_t FIRST_LEVEL_COUNT = 64;                       // VkDeviceSizeのビット数
+    static constexpr VkDeviceSize MIN_ALLOCATION_SIZE = 256;                // 割り当てる範囲の大きさと位置はこの倍数に揃える
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;         // メモリブロックの大きさ
+    static constexpr uint32_t NONE = UINT32_MAX;                            // ノードの番号が無い事を表す
+    static constexpr uint32_t CATEGORY_COUNT = static_cast<uint32_t>(MemoryCategory::Count);
+
+    // メモリブロック内の、連続した範囲
+    struct Node
+    {
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        uint32_t block = 0;
+        uint32_t prevPhysical = NONE; // 同じメモリブロックの、直前の範囲
+        uint32_t nextPhysical = NONE; // 同じメモリブロックの、直後の範囲
+        uint32_t prevFree = NONE;     // 同じ大きさの区分の空き領域のリストでの前後
+        uint32_t nextFree = NONE;
+        bool isFree = false;
+    };
+
+    struct Block
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE; // 解放済みの場合はVK_NULL_HANDLE
+        VkDeviceSize size = 0;
+        void *mapped = nullptr;
+        bool dedicated = false; // 一つのリソースのためだけに確保したメモリブロックか
+    };
+
+    // メモリの種類とリソースの種類(線形かどうか)の組毎の、メモリブロックと空き領域の管理情報
+    struct Pool
+    {
+        uint32_t memoryType = 0;
+        bool linear = true;
+        VkDeviceSize blockSize = 0;
+        std::vector<Block> blocks;
+        std::vector<Node> nodes;
+        std::vector<uint32_t> unusedNodes; // nodesの中で再利用できる要素の番号
+
+        uint64_t firstLevelMap = 0;                                // 空き領域がある大きさの区分(上位)のビット
+        uint32_t secondLevelMap[FIRST_LEVEL_COUNT] = {};           // 空き領域がある大きさの区分(下位)のビット
+        uint32_t freeLists[FIRST_LEVEL_COUNT][SECOND_LEVEL_COUNT]; // 大きさの区分毎の空き領域のリストの先頭
+
+        uint32_t allocationCount = 0;
+        VkDeviceSize usedBytes = 0;
+        uint32_t emptyBlockCount = 0; // 全体が空いたまま残してある、専用でないメモリブロックの数。freeが他の空のメモリブロックを探さずに済むように数えておく
+    };
+
+    static void mapping(VkDeviceSize size, uint32_t &firstLevel, uint32_t &secondLevel); // 大きさsizeが含まれる区分を求める
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+    uint32_t getPool(uint32_t memoryType, bool linear);
+    uint32_t createNode(Pool &pool);
+    void insertFreeNode(Pool &pool, uint32_t node);
+    void removeFreeNode(Pool &pool, uint32_t node);
+    uint32_t findFreeNode(Pool &pool, VkDeviceSize size); // size以上の空き領域を探して、空き領域のリストから外して返す
+    uint32_t createBlock(Pool &pool, VkDeviceSize size, bool dedicated); // メモリブロックを確保し、全体を一つの空き領域としたノードを返す
+    void releaseBlock(Pool &pool, uint32_t block);
+    void addStatistics(const Pool &pool, MemoryStatistics &statistics) const;
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{}; // 起動時に一度だけ問い合わせたメモリの種類とヒープの情報
+    VkDeviceSize bufferImageGranularity = 1;
+    std::vector<Pool> pools;
+
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr; // VK_EXT_memory_budgetを使わない場合はnullptr
+    std::vector<MemoryHeapBudget> heapBudgets;                                 // ヒープ毎の使用量と予算
+    VkDeviceSize categoryBytes[CATEGORY_COUNT] = {};                           // 用途毎の割り当てている範囲の合計のバイト数
+    uint32_t categoryCounts[CATEGORY_COUNT] = {};                              // 用途毎の割り当てている範囲の数
+};
\ No newline at end of file
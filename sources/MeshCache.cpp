@@ -0,0 +1,332 @@
+#include "MeshCache.hpp"
+
+// ----------STLのinclude----------
+#include <vector>
+#include <filesystem> // 一時ファイルの削除やリネームに使用する
+#include <cstring>    // strcmp, memcpyを使用するために必要
+#include <cstdio>     // printfを使用するために必要
+
+namespace
+{
+    // 依存ファイルの今の状態を取得する。ファイルが無い場合も、後から作られた事が分かるように決まった値にしておく
+    void getDependencyStamp(const char *path, uint64_t &size, int64_t &writeTime)
+    {
+        if (!MappedFile::getFileStamp(path, size, writeTime))
+        {
+            size = UINT64_MAX;
+            writeTime = 0;
+        }
+    }
+}
+
+std::string MeshCache::getCachePath(const std::string &sourcePath)
+{
+    return sourcePath + ".meshcache";
+}
+
+bool MeshCache::write(const std::string &sourcePath,
+                      const Vertex *vertices,
+                      uint32_t vertexCount,
+                      const uint32_t *indices,
+                      uint32_t indexCount,
+                      const std::vector<Submesh> &submeshes,
+                      const std::vector<MeshMaterial> &materials,
+                      const std::vector<std::string> &dependencies,
+                      uint32_t flags)
+{
+    MeshCacheWriter writer;
+    if (!writer.begin(sourcePath, flags))
+    {
+        return false;
+    }
+    writer.appendVertices(vertices, vertexCount);
+    writer.appendIndices(indices, indexCount);
+    writer.setSubmeshes(submeshes.data(), submeshes.size(), materials.data(), materials.size());
+    for (const std::string &dependency : dependencies)
+    {
+        writer.addDependency(dependency);
+    }
+    return writer.finish();
+}
+
+MeshCacheWriter::~MeshCacheWriter()
+{
+    // finishを呼ばずに破棄された場合は書き出し途中のファイルを残さない
+    if (out.is_open())
+    {
+        abort();
+    }
+}
+
+bool MeshCacheWriter::begin(const std::string &sourcePath, uint32_t flags)
+{
+    header = {};
+    header.magic = MeshCache::MAGIC;
+    header.version = MeshCache::VERSION;
+    header.vertexStride = sizeof(Vertex);
+    header.flags = flags;
+    submeshes.clear();
+    materials.clear();
+    dependencies.clear();
+    if (!MappedFile::getFileStamp(sourcePath, header.sourceSize, header.sourceWriteTime))
+    {
+        return false;
+    }
+
+    // 書き込み途中で終了された場合に壊れたキャッシュが残らないように、一時ファイルに書き込んでからリネームする
+    cachePath = MeshCache::getCachePath(sourcePath);
+    tempPath = cachePath + ".tmp";
+    indexPath = cachePath + ".indices.tmp";
+
+    out.open(tempPath, std::ios::binary | std::ios::trunc);
+    indexOut.open(indexPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open() || !indexOut.is_open())
+    {
+        abort();
+        return false;
+    }
+
+    // ヘッダの中身は全て書き終わるまで確定しないので、ここでは場所だけ確保しておく
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    return true;
+}
+
+void MeshCacheWriter::appendVertices(const Vertex *vertices, size_t count)
+{
+    out.write(reinterpret_cast<const char *>(vertices), sizeof(Vertex) * count);
+    header.vertexCount += static_cast<uint32_t>(count);
+}
+
+void MeshCacheWriter::appendIndices(const uint32_t *indices, size_t count)
+{
+    indexOut.write(reinterpret_cast<const char *>(indices), sizeof(uint32_t) * count);
+    header.indexCount += static_cast<uint32_t>(count);
+}
+
+void MeshCacheWriter::setSubmeshes(const Submesh *submeshes, size_t submeshCount, const MeshMaterial *materials, size_t materialCount)
+{
+    this->submeshes.assign(submeshes, submeshes + submeshCount);
+    this->materials.assign(materials, materials + materialCount);
+    header.submeshCount = static_cast<uint32_t>(submeshCount);
+    header.materialCount = static_cast<uint32_t>(materialCount);
+
+    for (size_t i = 0; i < materialCount; i++)
+    {
+        if (materials[i].texturePath[0] != '\0')
+        {
+            addDependency(materials[i].texturePath);
+        }
+    }
+}
+
+void MeshCacheWriter::addDependency(const std::string &path)
+{
+    // 長すぎるパスは固定長の配列に入らないので検証できない。マテリアルのテクスチャと同じく諦めて表示だけしておく
+    if (path.size() >= MAX_MATERIAL_PATH)
+    {
+        printf("mesh cache dependency path is too long : %s\n", path.c_str());
+        return;
+    }
+    for (const MeshCacheDependency &dependency : dependencies)
+    {
+        if (strcmp(dependency.path, path.c_str()) == 0)
+        {
+            return;
+        }
+    }
+
+    MeshCacheDependency dependency{};
+    memcpy(dependency.path, path.c_str(), path.size() + 1);
+    getDependencyStamp(dependency.path, dependency.size, dependency.writeTime);
+    dependencies.push_back(dependency);
+    header.dependencyCount = static_cast<uint32_t>(dependencies.size());
+}
+
+bool MeshCacheWriter::finish()
+{
+    indexOut.close();
+    if (!out.good() || indexOut.fail())
+    {
+        abort();
+        return false;
+    }
+
+    // 頂点配列の後ろに、一時ファイルに退避しておいたインデックス配列を一定サイズずつ移していく
+    {
+        std::ifstream indexIn(indexPath, std::ios::binary);
+        std::vector<char> buffer(1 << 20);
+        while (indexIn)
+        {
+            indexIn.read(buffer.data(), buffer.size());
+            out.write(buffer.data(), indexIn.gcount());
+        }
+    }
+
+    // サブメッシュとマテリアルと依存ファイルは小さいので、メモリ上に持っておいた物をそのまま書き出す
+    out.write(reinterpret_cast<const char *>(submeshes.data()), sizeof(Submesh) * submeshes.size());
+    out.write(reinterpret_cast<const char *>(materials.data()), sizeof(MeshMaterial) * materials.size());
+    out.write(reinterpret_cast<const char *>(dependencies.data()), sizeof(MeshCacheDependency) * dependencies.size());
+
+    // 確定したヘッダで先頭を上書きする
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+
+    std::error_code ec;
+    std::filesystem::remove(indexPath, ec);
+    if (out.fail())
+    {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    return true;
+}
+
+void MeshCacheWriter::abort()
+{
+    out.close();
+    indexOut.close();
+
+    std::error_code ec;
+    std::filesystem::remove(tempPath, ec);
+    std::filesystem::remove(indexPath, ec);
+}
+
+bool MeshCache::open(const std::string &sourcePath)
+{
+    if (!map(sourcePath, false))
+    {
+        return false;
+    }
+
+    // 最適化の途中で終了された場合などは、中途半端な状態のメッシュが残っている可能性があるので使わない
+    if ((header->flags & MESH_CACHE_OPTIMIZED) == 0)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool MeshCache::openForUpdate(const std::string &sourcePath)
+{
+    return map(sourcePath, true);
+}
+
+bool MeshCache::map(const std::string &sourcePath, bool writable)
+{
+    close();
+
+    if (!file.open(getCachePath(sourcePath), writable) || file.size() < sizeof(MeshCacheHeader))
+    {
+        file.close();
+        return false;
+    }
+
+    auto cacheHeader = reinterpret_cast<const MeshCacheHeader *>(file.data());
+
+    // 別のフォーマットで書かれたキャッシュや、Vertexの定義が変わる前に書かれたキャッシュは使えない
+    if (cacheHeader->magic != MAGIC ||
+        cacheHeader->version != VERSION ||
+        cacheHeader->vertexStride != sizeof(Vertex))
+    {
+        file.close();
+        return false;
+    }
+
+    // キャッシュを作った後にobjファイルが更新されていたら作り直す必要がある
+    uint64_t sourceSize;
+    int64_t sourceWriteTime;
+    if (!MappedFile::getFileStamp(sourcePath, sourceSize, sourceWriteTime) ||
+        cacheHeader->sourceSize != sourceSize ||
+        cacheHeader->sourceWriteTime != sourceWriteTime)
+    {
+        file.close();
+        return false;
+    }
+
+    // 書き込みが途中で途切れたファイルでないかを確認する
+    size_t expectedSize = sizeof(MeshCacheHeader) +
+                          sizeof(Vertex) * static_cast<size_t>(cacheHeader->vertexCount) +
+                          sizeof(uint32_t) * static_cast<size_t>(cacheHeader->indexCount) +
+                          sizeof(Submesh) * static_cast<size_t>(cacheHeader->submeshCount) +
+                          sizeof(MeshMaterial) * static_cast<size_t>(cacheHeader->materialCount) +
+                          sizeof(MeshCacheDependency) * static_cast<size_t>(cacheHeader->dependencyCount);
+    if (file.size() < expectedSize)
+    {
+        file.close();
+        return false;
+    }
+
+    // mtlファイルやテクスチャが更新されていた場合も、マテリアルが変わっている可能性があるので作り直す
+    header = cacheHeader;
+    const MeshCacheDependency *dependencies = getDependencies();
+    for (uint32_t i = 0; i < header->dependencyCount; i++)
+    {
+        uint64_t dependencySize;
+        int64_t dependencyWriteTime;
+        getDependencyStamp(dependencies[i].path, dependencySize, dependencyWriteTime);
+        if (dependencies[i].size != dependencySize || dependencies[i].writeTime != dependencyWriteTime)
+        {
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MeshCache::close()
+{
+    header = nullptr;
+    file.close();
+}
+
+const Vertex *MeshCache::getVertices() const
+{
+    return reinterpret_cast<const Vertex *>(file.data() + sizeof(MeshCacheHeader));
+}
+
+const uint32_t *MeshCache::getIndices() const
+{
+    return reinterpret_cast<const uint32_t *>(file.data() + sizeof(MeshCacheHeader) + sizeof(Vertex) * header->vertexCount);
+}
+
+const Submesh *MeshCache::getSubmeshes() const
+{
+    return reinterpret_cast<const Submesh *>(getIndices() + header->indexCount);
+}
+
+const MeshMaterial *MeshCache::getMaterials() const
+{
+    return reinterpret_cast<const MeshMaterial *>(getSubmeshes() + header->submeshCount);
+}
+
+const MeshCacheDependency *MeshCache::getDependencies() const
+{
+    return reinterpret_cast<const MeshCacheDependency *>(getMaterials() + header->materialCount);
+}
+
+Vertex *MeshCache::getMutableVertices()
+{
+    return reinterpret_cast<Vertex *>(file.data() + sizeof(MeshCacheHeader));
+}
+
+uint32_t *MeshCache::getMutableIndices()
+{
+    return reinterpret_cast<uint32_t *>(file.data() + sizeof(MeshCacheHeader) + sizeof(Vertex) * header->vertexCount);
+}
+
+void MeshCache::addFlags(uint32_t flags)
+{
+    reinterpret_cast<MeshCacheHeader *>(file.data())->flags |= flags;
+}
\ No newline at end of file
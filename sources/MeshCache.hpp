@@ -0,0 +1,122 @@
+#pragma once
+// ----------STLのinclude----------
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"
+#include "Submesh.hpp" // マテリアル毎の範囲とマテリアルもキャッシュに含める
+#include "MappedFile.hpp"
+
+// キャッシュファイルの先頭に置かれるヘッダ。この後ろに頂点配列、インデックス配列、サブメッシュの配列、マテリアルの配列、依存ファイルの配列の順でデータが並ぶ
+struct MeshCacheHeader
+{
+    uint32_t magic;           // キャッシュファイルであることを示す識別子
+    uint32_t version;         // キャッシュファイルのフォーマットのバージョン。フォーマットを変えたら上げる
+    uint64_t sourceSize;      // キャッシュを作成した時のobjファイルのサイズ
+    int64_t sourceWriteTime;  // キャッシュを作成した時のobjファイルの最終更新時刻
+    uint32_t vertexStride;    // 頂点一つ当たりのバイト数。Vertexの定義が変わっていないかの確認に使う
+    uint32_t vertexCount;     // 頂点配列の要素数
+    uint32_t indexCount;      // インデックス配列の要素数
+    uint32_t flags;           // MeshCacheFlagsの組み合わせ
+    uint32_t submeshCount;    // サブメッシュの配列の要素数
+    uint32_t materialCount;   // マテリアルの配列の要素数
+    uint32_t dependencyCount; // 依存ファイルの配列の要素数
+};
+
+// objファイル以外にキャッシュの内容が依存しているファイル(mtlファイルとマテリアルのテクスチャ)と、キャッシュを作成した時のその状態
+// どれか一つでも大きさか更新時刻が変わっていたら、objファイルが変わっていなくてもキャッシュを作り直す
+struct MeshCacheDependency
+{
+    char path[MAX_MATERIAL_PATH]; // 実行時のディレクトリからのパス
+    uint64_t size;                // キャッシュを作成した時のファイルのサイズ。ファイルが無かった場合はUINT64_MAX
+    int64_t writeTime;            // キャッシュを作成した時のファイルの最終更新時刻。ファイルが無かった場合は0
+};
+
+// キャッシュに格納されたメッシュにどの処理が済んでいるかを表すフラグ
+enum MeshCacheFlags : uint32_t
+{
+    MESH_CACHE_OPTIMIZED = 1 << 0, // 頂点キャッシュ・オーバードロー・頂点フェッチの最適化が済んでいる
+};
+
+// キャッシュファイルを先頭から順番に書き出していくクラス
+// 頂点とインデックスを少しずつ追加していけるので、全ての頂点・インデックスをメモリ上に持たなくてもキャッシュを作成できる
+class MeshCacheWriter
+{
+public:
+    ~MeshCacheWriter();
+
+    bool begin(const std::string &sourcePath, uint32_t flags = 0); // sourcePathのobjファイルに対応するキャッシュの書き出しを始める
+    void appendVertices(const Vertex *vertices, size_t count); // 頂点配列の末尾にcount個の頂点を追加する
+    void appendIndices(const uint32_t *indices, size_t count); // インデックス配列の末尾にcount個のインデックスを追加する
+    // インデックス配列の後ろに書き出すサブメッシュとマテリアルを設定する。設定しない場合はどちらも空になる
+    // マテリアルのテクスチャは依存ファイルとして追加される
+    void setSubmeshes(const Submesh *submeshes, size_t submeshCount, const MeshMaterial *materials, size_t materialCount);
+    void addDependency(const std::string &path); // キャッシュの検証に使う依存ファイルを追加する。同じパスは一度だけ追加される
+    bool finish();                                           // 書き出しを完了してキャッシュファイルを置き換える。失敗した場合はfalseを返す
+
+private:
+    void abort(); // 書き出し途中の一時ファイルを削除する
+
+    MeshCacheHeader header{};
+    std::string cachePath;   // 最終的なキャッシュファイルのパス
+    std::string tempPath;    // 書き出し途中のキャッシュファイルのパス
+    std::string indexPath;   // 頂点配列を書き終えるまでインデックスを置いておく一時ファイルのパス
+    std::ofstream out;       // キャッシュファイル本体(ヘッダと頂点配列)の出力先
+    std::ofstream indexOut;  // インデックス配列の出力先
+
+    std::vector<Submesh> submeshes;                // finishでインデックス配列の後ろに書き出すサブメッシュ
+    std::vector<MeshMaterial> materials;           // finishでサブメッシュの後ろに書き出すマテリアル
+    std::vector<MeshCacheDependency> dependencies; // finishでマテリアルの後ろに書き出す依存ファイル
+};
+
+// objファイルを解析して作った重複の無い頂点配列とインデックス配列をバイナリ形式で保存しておき、
+// 次回以降の起動時にはobjファイルを解析せずにメモリマップするだけで読み込めるようにするクラス
+class MeshCache
+{
+public:
+    static std::string getCachePath(const std::string &sourcePath); // sourcePathのobjファイルに対応するキャッシュファイルのパスを返す
+    static bool write(const std::string &sourcePath,
+                      const Vertex *vertices,
+                      uint32_t vertexCount,
+                      const uint32_t *indices,
+                      uint32_t indexCount,
+                      const std::vector<Submesh> &submeshes,
+                      const std::vector<MeshMaterial> &materials,
+                      const std::vector<std::string> &dependencies,
+                      uint32_t flags = 0); // sourcePathのobjファイルから作った頂点・インデックス配列と、サブメッシュとマテリアルと、mtlファイルなどの依存ファイルをキャッシュファイルに書き出す
+
+    bool open(const std::string &sourcePath);          // キャッシュファイルをマップする。キャッシュが無いか、objファイルか依存ファイルが更新されていたか、最適化が済んでいない場合はfalseを返す
+    bool openForUpdate(const std::string &sourcePath); // 最適化が済んでいないキャッシュファイルも含めて、書き込み可能な状態でマップする
+    void close();                                      // キャッシュファイルのマップを解除する
+
+    bool isOpen() const { return header != nullptr; }
+    const Vertex *getVertices() const;
+    uint32_t getVertexCount() const { return header->vertexCount; }
+    const uint32_t *getIndices() const;
+    uint32_t getIndexCount() const { return header->indexCount; }
+    const Submesh *getSubmeshes() const;
+    uint32_t getSubmeshCount() const { return header->submeshCount; }
+    const MeshMaterial *getMaterials() const;
+    uint32_t getMaterialCount() const { return header->materialCount; }
+    uint32_t getFlags() const { return header->flags; }
+
+    // openForUpdateで開いた場合のみ使用できる
+    Vertex *getMutableVertices();
+    uint32_t *getMutableIndices();
+    void addFlags(uint32_t flags); // ヘッダのフラグを追加する
+
+private:
+    friend class MeshCacheWriter;
+
+    static constexpr uint32_t MAGIC = 0x434D5356; // "VSMC"
+    static constexpr uint32_t VERSION = 4;
+
+    bool map(const std::string &sourcePath, bool writable); // キャッシュファイルをマップし、ヘッダの内容を検証する
+    const MeshCacheDependency *getDependencies() const;    // マテリアルの配列の後ろにある依存ファイルの配列
+
+    MappedFile file;                          // マップしたキャッシュファイル
+    const MeshCacheHeader *header = nullptr; // マップしたキャッシュファイルの先頭にあるヘッダ
+};
\ No newline at end of file
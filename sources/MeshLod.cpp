@@ -0,0 +1,509 @@
+#include "MeshLod.hpp"
+
+// ----------STLのinclude----------
+#include <algorithm>     // sort, equal_range, min, maxを使用するのに必要
+#include <unordered_map> // 同じ位置の頂点をまとめるのに使用する
+#include <cmath>         // sqrtを使用するのに必要
+#include <cfloat>        // FLT_MAXを使用するのに必要
+#include <cstring>       // memcpyを使用するのに必要
+#include <cstdio>        // printfを使用するのに必要
+
+// ----------自作クラスのinclude----------
+#include "MeshOptimizer.hpp" // LOD毎の三角形の並べ替えと、サブメッシュの頂点の詰め直し
+
+namespace
+{
+    const float MIN_LOD_DISTANCE = 1e-4f; // カメラが物体の境界球の中にある場合に、距離の代わりに使う値
+
+    // 平面からの距離の二乗を点の位置の二次式で表したもの。足し合わせると、それらの平面からの距離の二乗の(面積で重み付けした)和になる
+    // 平面 n・p + d = 0 に対して、対称行列 A = nn^T の6成分、b = dn、c = d^2 を持つ
+    // 細かいメッシュでは誤差がd^2に比べて極端に小さく、floatでは打ち消し合って0になってしまうのでdoubleで持つ
+    struct Quadric
+    {
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+        double weight; // 足し合わせた平面の重みの合計
+    };
+
+    Quadric makePlaneQuadric(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2)
+    {
+        Quadric q{};
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if (length == 0.0f)
+        {
+            return q;
+        }
+
+        // 大きな三角形ほど形への影響が大きいので、面積で重み付けする
+        normal /= length;
+        double nx = normal.x;
+        double ny = normal.y;
+        double nz = normal.z;
+        double d = -glm::dot(normal, p0);
+        double w = length * 0.5;
+        q.a00 = w * nx * nx;
+        q.a01 = w * nx * ny;
+        q.a02 = w * nx * nz;
+        q.a11 = w * ny * ny;
+        q.a12 = w * ny * nz;
+        q.a22 = w * nz * nz;
+        q.b0 = w * d * nx;
+        q.b1 = w * d * ny;
+        q.b2 = w * d * nz;
+        q.c = w * d * d;
+        q.weight = w;
+        return q;
+    }
+
+    void addQuadric(Quadric &q, const Quadric &other)
+    {
+        q.a00 += other.a00;
+        q.a01 += other.a01;
+        q.a02 += other.a02;
+        q.a11 += other.a11;
+        q.a12 += other.a12;
+        q.a22 += other.a22;
+        q.b0 += other.b0;
+        q.b1 += other.b1;
+        q.b2 += other.b2;
+        q.c += other.c;
+        q.weight += other.weight;
+    }
+
+    // 点pから平面までの距離の二乗の、重み付きの平均
+    float evaluateQuadric(const Quadric &q, const glm::vec3 &p)
+    {
+        if (q.weight <= 0.0)
+        {
+            return 0.0f;
+        }
+
+        double x = p.x;
+        double y = p.y;
+        double z = p.z;
+        double rx = q.a00 * x + q.a01 * y + q.a02 * z + q.b0;
+        double ry = q.a01 * x + q.a11 * y + q.a12 * z + q.b1;
+        double rz = q.a02 * x + q.a12 * y + q.a22 * z + q.b2;
+        double value = rx * x + ry * y + rz * z + q.b0 * x + q.b1 * y + q.b2 * z + q.c;
+        return static_cast<float>(std::max(value, 0.0) / q.weight);
+    }
+
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3 &p) const
+        {
+            uint32_t bits[3];
+            memcpy(bits, &p, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+
+    struct PositionEqual
+    {
+        bool operator()(const glm::vec3 &a, const glm::vec3 &b) const
+        {
+            return a.x == b.x && a.y == b.y && a.z == b.z;
+        }
+    };
+
+    // 縮約の候補の辺
+    struct Collapse
+    {
+        uint32_t from; // 動かす頂点
+        uint32_t to;   // fromの移動先の頂点
+        float cost;    // 縮約した場合の二乗誤差
+    };
+
+    // 動かすと形やテクスチャが崩れる頂点に印を付ける
+    // UVの継ぎ目では同じ位置に別の頂点があり、穴の縁や3枚以上の三角形が共有する辺では反対向きの辺がちょうど一つにならない
+    void findLockedVertices(const Vertex *vertices, size_t vertexCount, const uint32_t *indices, size_t indexCount, std::vector<uint8_t> &locked)
+    {
+        locked.assign(vertexCount, 0);
+
+        // 同じ位置の頂点は、その位置で最初に見つかった頂点の番号にまとめる
+        std::vector<uint32_t> positionIds(vertexCount);
+        std::unordered_map<glm::vec3, uint32_t, PositionHash, PositionEqual> firstVertices;
+        firstVertices.reserve(vertexCount);
+        for (uint32_t v = 0; v < static_cast<uint32_t>(vertexCount); v++)
+        {
+            positionIds[v] = firstVertices.emplace(vertices[v].pos, v).first->second;
+            if (positionIds[v] != v)
+            {
+                locked[v] = 1;
+                locked[positionIds[v]] = 1;
+            }
+        }
+
+        // 位置でまとめた番号での有向辺を並べておき、反対向きの辺を二分探索で数える
+        std::vector<uint64_t> edges;
+        edges.reserve(indexCount);
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            for (size_t k = 0; k < 3; k++)
+            {
+                uint64_t a = positionIds[indices[i + k]];
+                uint64_t b = positionIds[indices[i + (k + 1) % 3]];
+                edges.push_back((a << 32) | b);
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        auto countEdges = [&](uint64_t edge)
+        {
+            auto range = std::equal_range(edges.begin(), edges.end(), edge);
+            return range.second - range.first;
+        };
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            for (size_t k = 0; k < 3; k++)
+            {
+                uint32_t a = indices[i + k];
+                uint32_t b = indices[i + (k + 1) % 3];
+                uint64_t edge = (static_cast<uint64_t>(positionIds[a]) << 32) | positionIds[b];
+                uint64_t reversed = (static_cast<uint64_t>(positionIds[b]) << 32) | positionIds[a];
+                if (countEdges(edge) != 1 || countEdges(reversed) != 1)
+                {
+                    locked[a] = 1;
+                    locked[b] = 1;
+                }
+            }
+        }
+    }
+
+    // 三角形のcorner番目の頂点をmovedの位置に動かした時に、三角形が裏返るか潰れるか
+    bool isTriangleFlipped(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2, uint32_t corner, const glm::vec3 &moved)
+    {
+        glm::vec3 before = glm::cross(p1 - p0, p2 - p0);
+        glm::vec3 q0 = corner == 0 ? moved : p0;
+        glm::vec3 q1 = corner == 1 ? moved : p1;
+        glm::vec3 q2 = corner == 2 ? moved : p2;
+        glm::vec3 after = glm::cross(q1 - q0, q2 - q0);
+        return glm::dot(before, after) <= 0.0f;
+    }
+}
+
+size_t simplifyMesh(const Vertex *vertices,
+                    size_t vertexCount,
+                    const uint32_t *indices,
+                    size_t indexCount,
+                    size_t targetIndexCount,
+                    uint32_t *destination,
+                    float *error)
+{
+    memcpy(destination, indices, sizeof(uint32_t) * indexCount);
+    size_t resultCount = indexCount;
+    float maxCost = 0.0f;
+
+    std::vector<uint8_t> locked;
+    findLockedVertices(vertices, vertexCount, indices, indexCount, locked);
+
+    // 頂点毎に、その頂点を使う三角形の平面の二次式を足し合わせておく
+    std::vector<Quadric> quadrics(vertexCount, Quadric{});
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        Quadric q = makePlaneQuadric(vertices[indices[i]].pos, vertices[indices[i + 1]].pos, vertices[indices[i + 2]].pos);
+        for (size_t k = 0; k < 3; k++)
+        {
+            addQuadric(quadrics[indices[i + k]], q);
+        }
+    }
+
+    std::vector<uint32_t> collapseTargets(vertexCount);     // 縮約した頂点の移動先。縮約していない頂点は自分自身
+    for (uint32_t v = 0; v < static_cast<uint32_t>(vertexCount); v++)
+    {
+        collapseTargets[v] = v;
+    }
+    std::vector<uint8_t> touched(vertexCount);              // 今回の周回で縮約に関わった頂点
+    std::vector<uint32_t> triangleOffsets(vertexCount + 1); // vertexTrianglesの中での、頂点毎の範囲の始まり
+    std::vector<uint32_t> vertexTriangles;                  // 頂点毎の、その頂点を使う三角形の番号
+    std::vector<Collapse> collapses;
+
+    // 一周毎に安い辺からまとめて縮約し、インデックスを書き直す。一周の中では一つの頂点は一度しか縮約に関わらない
+    while (resultCount > targetIndexCount)
+    {
+        size_t triangleCount = resultCount / 3;
+
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0u);
+        for (size_t i = 0; i < resultCount; i++)
+        {
+            triangleOffsets[destination[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        }
+        vertexTriangles.resize(resultCount);
+        {
+            std::vector<uint32_t> cursor(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (size_t i = 0; i < resultCount; i++)
+            {
+                vertexTriangles[cursor[destination[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        // 内側の辺は向きを変えて2回現れるので、番号の小さい頂点から大きい頂点への向きの時だけ候補にする
+        collapses.clear();
+        for (size_t i = 0; i < resultCount; i += 3)
+        {
+            for (size_t k = 0; k < 3; k++)
+            {
+                uint32_t a = destination[i + k];
+                uint32_t b = destination[i + (k + 1) % 3];
+                if (a >= b || (locked[a] && locked[b]))
+                {
+                    continue;
+                }
+
+                float costAB = locked[a] ? FLT_MAX : evaluateQuadric(quadrics[a], vertices[b].pos);
+                float costBA = locked[b] ? FLT_MAX : evaluateQuadric(quadrics[b], vertices[a].pos);
+                collapses.push_back(costAB <= costBA ? Collapse{a, b, costAB} : Collapse{b, a, costBA});
+            }
+        }
+        if (collapses.empty())
+        {
+            break;
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &l, const Collapse &r)
+                  { return l.cost < r.cost; });
+
+        // 一回の縮約で三角形は概ね2つ減るので、目標までに必要な数の辺を目安に、それより大きく誤差が増える縮約は次の周回に回す
+        size_t removeGoal = triangleCount - targetIndexCount / 3;
+        size_t edgeGoal = std::min(std::max<size_t>(removeGoal / 2, 1), collapses.size());
+        float costLimit = collapses[edgeGoal - 1].cost * 1.5f;
+
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t removed = 0;
+        size_t collapsed = 0;
+        for (const Collapse &collapse : collapses)
+        {
+            if (collapse.cost > costLimit || removed >= removeGoal)
+            {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to])
+            {
+                continue;
+            }
+
+            // fromを使う三角形のうち、toも使う物は潰れて無くなり、それ以外は裏返らなければ縮約できる
+            const glm::vec3 &moved = vertices[collapse.to].pos;
+            size_t degenerate = 0;
+            bool flipped = false;
+            for (uint32_t j = triangleOffsets[collapse.from]; j < triangleOffsets[collapse.from + 1] && !flipped; j++)
+            {
+                const uint32_t *triangle = destination + vertexTriangles[j] * 3;
+                uint32_t corners[3] = {collapseTargets[triangle[0]], collapseTargets[triangle[1]], collapseTargets[triangle[2]]};
+                if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+                {
+                    degenerate++;
+                    continue;
+                }
+                uint32_t corner = corners[0] == collapse.from ? 0 : (corners[1] == collapse.from ? 1 : 2);
+                flipped = isTriangleFlipped(vertices[corners[0]].pos, vertices[corners[1]].pos, vertices[corners[2]].pos, corner, moved);
+            }
+            if (flipped)
+            {
+                continue;
+            }
+
+            collapseTargets[collapse.from] = collapse.to;
+            touched[collapse.from] = 1;
+            touched[collapse.to] = 1;
+            addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+            maxCost = std::max(maxCost, collapse.cost);
+            removed += degenerate;
+            collapsed++;
+        }
+        if (collapsed == 0)
+        {
+            break;
+        }
+
+        // 縮約した頂点を移動先に置き換え、潰れた三角形を取り除く
+        size_t writeCount = 0;
+        for (size_t i = 0; i < resultCount; i += 3)
+        {
+            uint32_t a = collapseTargets[destination[i]];
+            uint32_t b = collapseTargets[destination[i + 1]];
+            uint32_t c = collapseTargets[destination[i + 2]];
+            if (a == b || b == c || c == a)
+            {
+                continue;
+            }
+            destination[writeCount++] = a;
+            destination[writeCount++] = b;
+            destination[writeCount++] = c;
+        }
+        resultCount = writeCount;
+    }
+
+    *error = std::sqrt(maxCost);
+    return resultCount;
+}
+
+void buildMeshLods(const Vertex *vertices,
+                   size_t vertexCount,
+                   const uint32_t *indices,
+                   size_t indexCount,
+                   const Submesh *submeshes,
+                   size_t submeshCount,
+                   std::vector<MeshLod> &lods,
+                   std::vector<Meshlet> &meshlets,
+                   std::vector<uint16_t> &indices16,
+                   std::vector<uint32_t> &indices32)
+{
+    lods.clear();
+
+    // サブメッシュが無い場合は全体を一つのサブメッシュとして扱う
+    Submesh whole{0, static_cast<uint32_t>(indexCount), 0};
+    if (submeshCount == 0)
+    {
+        submeshes = &whole;
+        submeshCount = 1;
+    }
+
+    // サブメッシュ毎に、今のLODのインデックスと元のメッシュからのずれを持つ
+    // 元のメッシュのインデックスはコピーせずにそのまま参照し、2段階目以降は一つ前のLODのインデックスから減らした物をcurrentに持つ
+    // 巨大なメッシュでもインデックス配列全体の複製を作らないようにするため
+    std::vector<std::vector<uint32_t>> current(submeshCount);
+    std::vector<std::vector<uint32_t>> next(submeshCount);
+    std::vector<float> errors(submeshCount, 0.0f);
+    std::vector<float> nextErrors(submeshCount, 0.0f);
+    std::vector<uint32_t> clusters;
+    bool currentIsOriginal = true; // まだLODを作っておらず、currentの代わりに元のメッシュのインデックスを参照している間はtrue
+    auto currentIndices = [&](size_t i)
+    { return currentIsOriginal ? indices + submeshes[i].firstIndex : current[i].data(); };
+    auto currentIndexCount = [&](size_t i)
+    { return currentIsOriginal ? static_cast<size_t>(submeshes[i].indexCount) : current[i].size(); };
+
+    // 簡略化はサブメッシュが使う頂点だけを詰めた番号で行い、作業用のメモリと時間をメッシュ全体ではなくサブメッシュの大きさに比例させる
+    // メッシュ全体が一つのサブメッシュの場合は詰めても頂点配列の複製ができるだけなので、元の頂点番号のまま簡略化する
+    std::vector<uint32_t> globalToLocal(vertexCount, NOT_COMPACTED);
+    std::vector<uint32_t> localToGlobal;
+    std::vector<Vertex> localVertices;
+    std::vector<uint32_t> localIndices;
+    std::vector<uint32_t> localResult;
+    std::vector<uint32_t> meshletScratch;
+    size_t sourceCount = indexCount;
+
+    for (uint32_t level = 0; level < MAX_MESH_LODS; level++)
+    {
+        if (level > 0)
+        {
+            size_t count = 0;
+            for (size_t i = 0; i < submeshCount; i++)
+            {
+                const uint32_t *source = currentIndices(i);
+                size_t sourceIndexCount = currentIndexCount(i);
+                size_t target = static_cast<size_t>(submeshes[i].indexCount * MESH_LOD_INDEX_RATIOS[level]) / 3 * 3;
+                float levelError = 0.0f;
+                size_t submeshIndexCount;
+                if (submeshes[i].indexCount == indexCount)
+                {
+                    next[i].resize(sourceIndexCount);
+                    submeshIndexCount = simplifyMesh(vertices, vertexCount, source, sourceIndexCount, target, next[i].data(), &levelError);
+                    if (submeshIndexCount > 0)
+                    {
+                        next[i].resize(submeshIndexCount);
+                        optimizeVertexCache(next[i].data(), submeshIndexCount, vertexCount, clusters);
+                    }
+                }
+                else
+                {
+                    compactVertices(vertices, source, sourceIndexCount, globalToLocal, localToGlobal, localVertices, localIndices);
+                    localResult.resize(localIndices.size());
+                    submeshIndexCount = simplifyMesh(localVertices.data(), localVertices.size(), localIndices.data(), localIndices.size(), target, localResult.data(), &levelError);
+                    if (submeshIndexCount > 0)
+                    {
+                        // 縮約で三角形の並びが崩れているので、頂点キャッシュに乗りやすい順に並べ直してから元の頂点番号に戻す
+                        optimizeVertexCache(localResult.data(), submeshIndexCount, localVertices.size(), clusters);
+                        next[i].resize(submeshIndexCount);
+                        for (size_t j = 0; j < submeshIndexCount; j++)
+                        {
+                            next[i][j] = localToGlobal[localResult[j]];
+                        }
+                    }
+                }
+
+                if (submeshIndexCount == 0)
+                {
+                    // 小さすぎて三角形が全て無くなるサブメッシュは、穴が空かないように一つ前のLODのまま残す
+                    next[i].assign(source, source + sourceIndexCount);
+                    levelError = 0.0f;
+                    submeshIndexCount = sourceIndexCount;
+                }
+                nextErrors[i] = errors[i] + levelError; // 一つ前のLODからのずれを積み上げて、元のメッシュからのずれの見積もりにする
+                count += submeshIndexCount;
+            }
+
+            // 全体で1割も減らせなかった場合は、LODを増やしても描画の負荷は殆ど変わらない
+            if (count * 10 > sourceCount * 9)
+            {
+                break;
+            }
+
+            current.swap(next);
+            errors.swap(nextErrors);
+            currentIsOriginal = false;
+            sourceCount = count;
+        }
+
+        MeshLod lod{};
+        lod.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+        lod.indexCount = static_cast<uint32_t>(sourceCount);
+        lod.error = *std::max_element(errors.begin(), errors.end());
+        for (size_t i = 0; i < submeshCount; i++)
+        {
+            uint32_t firstMeshlet = static_cast<uint32_t>(meshlets.size());
+            buildMeshlets(vertices, vertexCount, currentIndices(i), currentIndexCount(i), meshlets, indices16, indices32, meshletScratch);
+            for (uint32_t m = firstMeshlet; m < static_cast<uint32_t>(meshlets.size()); m++)
+            {
+                meshlets[m].lod = level;
+                meshlets[m].material = submeshes[i].material;
+            }
+        }
+        lod.meshletCount = static_cast<uint32_t>(meshlets.size()) - lod.firstMeshlet;
+        lods.push_back(lod);
+
+        printf("mesh lod %u : %u triangles, %u meshlets, error %g\n", level, lod.indexCount / 3, lod.meshletCount, lod.error);
+    }
+}
+
+uint32_t selectMeshLod(const MeshLod *lods,
+                       uint32_t lodCount,
+                       uint32_t currentLod,
+                       float distance,
+                       float scale,
+                       float pixelsPerUnit,
+                       float threshold)
+{
+    if (lodCount == 0)
+    {
+        return 0;
+    }
+
+    // 形のずれを画面に投影した時のピクセル数
+    float pixelsPerError = scale * pixelsPerUnit / std::max(distance, MIN_LOD_DISTANCE);
+    auto projectedError = [&](uint32_t lod)
+    { return lods[lod].error * pixelsPerError; };
+
+    // ずれが境目を大きく超えた場合だけ細かくし、境目より十分小さく収まる場合だけ粗くする
+    uint32_t lod = std::min(currentLod, lodCount - 1);
+    if (projectedError(lod) > threshold * (1.0f + LOD_HYSTERESIS))
+    {
+        while (lod > 0 && projectedError(lod) > threshold)
+        {
+            lod--;
+        }
+    }
+    else
+    {
+        while (lod + 1 < lodCount && projectedError(lod + 1) <= threshold * (1.0f - LOD_HYSTERESIS))
+        {
+            lod++;
+        }
+    }
+    return lod;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+#include <cstddef> // size_tを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"
+#include "Meshlet.hpp" // LOD毎に塊に分割する
+#include "Submesh.hpp" // マテリアル毎の範囲を別々に簡略化する
+
+// メッシュの詳細度(Level of Detail)の一段階。全てのLODは同じ頂点配列を共有し、三角形だけが少なくなっていく
+// 各LODの三角形は塊に分割され、塊の配列の中の連続した範囲を占める
+struct MeshLod
+{
+    uint32_t firstMeshlet; // このLODの最初の塊の番号
+    uint32_t meshletCount; // このLODの塊の数
+    uint32_t indexCount;   // このLODのインデックスの数
+    float error;           // 元のメッシュからの形のずれの見積もり。メッシュの座標系での距離で、全てのサブメッシュの中で最も大きい物
+};
+
+// LOD毎に描画するインスタンスの、インスタンスのバッファの中での範囲。インスタンスはLODの順に詰めて並べる
+struct LodInstanceRange
+{
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
+const uint32_t MAX_MESH_LODS = 5;                                                        // 元のメッシュを含めたLODの最大数
+const float MESH_LOD_INDEX_RATIOS[MAX_MESH_LODS] = {1.0f, 0.5f, 0.25f, 0.125f, 0.0625f}; // 元のメッシュに対する、各LODのインデックスの数の目標の割合
+const float LOD_HYSTERESIS = 0.25f;                                                      // LODを切り替える境目の幅。selectMeshLodのthresholdに対する割合
+
+// 二次誤差(Quadric Error Metrics)を使った辺の縮約で、三角形をtargetIndexCount個程度のインデックスになるまで減らす
+// 頂点は移動させずに既存の頂点へ縮約するので、結果のインデックスはverticesをそのまま参照する
+// UVの継ぎ目と穴の縁にある頂点は形やテクスチャが崩れないように動かさないため、目標まで減らせない場合もある
+// destinationにはindexCount個分の領域が必要。結果のインデックスの数を返し、形のずれの見積もりをerrorに書き込む
+size_t simplifyMesh(const Vertex *vertices,
+                    size_t vertexCount,
+                    const uint32_t *indices,
+                    size_t indexCount,
+                    size_t targetIndexCount,
+                    uint32_t *destination,
+                    float *error);
+
+// MESH_LOD_INDEX_RATIOSの割合でLODを作り、LOD毎に塊へ分割してmeshletsとindices16, indices32の末尾に追加する
+// 一つ前のLODから減らしていくので、三角形が殆ど減らなくなった所でLODの作成を打ち切る
+// 簡略化と塊への分割はサブメッシュ毎に行うので、塊はどれも一つのマテリアルだけを含む。サブメッシュの境目の辺は縁として動かさないので、LODでも隙間は空かない
+void buildMeshLods(const Vertex *vertices,
+                   size_t vertexCount,
+                   const uint32_t *indices,
+                   size_t indexCount,
+                   const Submesh *submeshes,
+                   size_t submeshCount,
+                   std::vector<MeshLod> &lods,
+                   std::vector<Meshlet> &meshlets,
+                   std::vector<uint16_t> &indices16,
+                   std::vector<uint32_t> &indices32);
+
+// 形のずれを画面に投影した大きさがthresholdピクセル以下に収まる、最も粗いLODを選ぶ
+// distanceはカメラから物体の表面までの距離、scaleは物体の変換行列の拡大率、pixelsPerUnitは距離1の所での1単位の長さのピクセル数
+// 境目の距離で毎フレームLODが切り替わらないように、currentLodから変えるのは境目をLOD_HYSTERESISの割合だけ越えた場合に限る
+uint32_t selectMeshLod(const MeshLod *lods,
+                       uint32_t lodCount,
+                       uint32_t currentLod,
+                       float distance,
+                       float scale,
+                       float pixelsPerUnit,
+                       float threshold);
\ No newline at end of file
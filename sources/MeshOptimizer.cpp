@@ -0,0 +1,527 @@
+#include "MeshOptimizer.hpp"
+
+// ----------STLのinclude----------
+#include <algorithm>     // stable_sort, copyを使用するのに必要
+#include <stdexcept>     // 例外を投げるために必要
+#include <cstdio>        // printfを使用するのに必要
+#include <unordered_map> // 窓の中の頂点の番号を詰め直すのに使用する
+
+namespace
+{
+    const uint32_t NO_VERTEX = UINT32_MAX; // 次に扇の中心にする頂点が見つからなかったことを表す値
+
+    // FIFOの頂点キャッシュの状態を、頂点毎に最後にキャッシュへ入った時刻を記録することで表現するクラス
+    // 現在時刻との差がキャッシュサイズ以下ならまだキャッシュに残っているとみなす
+    class VertexCacheSimulator
+    {
+    public:
+        VertexCacheSimulator(size_t vertexCount, uint32_t cacheSize)
+            : cacheSize(cacheSize), timestamps(vertexCount, 0), timestamp(cacheSize + 1)
+        {
+        }
+
+        // 頂点vertexを参照する。キャッシュに無かった(頂点シェーダが実行される)場合は1を返す
+        uint32_t access(uint32_t vertex)
+        {
+            if (timestamp - timestamps[vertex] > cacheSize)
+            {
+                timestamps[vertex] = timestamp++;
+                return 1;
+            }
+            return 0;
+        }
+
+        // 三角形の3頂点を参照し、キャッシュミスの回数を返す
+        uint32_t accessTriangle(const uint32_t *triangle)
+        {
+            return access(triangle[0]) + access(triangle[1]) + access(triangle[2]);
+        }
+
+        // 時刻をキャッシュサイズ分進めて、全ての頂点をキャッシュから追い出す
+        void flush()
+        {
+            timestamp += cacheSize + 1;
+        }
+
+        // 頂点vertexがキャッシュに入ってから経過した時間
+        uint32_t getAge(uint32_t vertex) const { return timestamp - timestamps[vertex]; }
+
+    private:
+        uint32_t cacheSize;
+        std::vector<uint32_t> timestamps;
+        uint32_t timestamp;
+    };
+}
+
+VertexCacheStatistics analyzeVertexCache(const uint32_t *indices,
+                                         size_t indexCount,
+                                         size_t vertexCount,
+                                         uint32_t cacheSize)
+{
+    VertexCacheSimulator cache(vertexCount, cacheSize);
+    std::vector<uint8_t> referenced(vertexCount, 0);
+
+    size_t misses = 0;
+    size_t referencedCount = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        uint32_t vertex = indices[i];
+        if (!referenced[vertex])
+        {
+            referenced[vertex] = 1;
+            referencedCount++;
+        }
+        misses += cache.access(vertex);
+    }
+
+    size_t triangleCount = indexCount / 3;
+    VertexCacheStatistics statistics{};
+    statistics.acmr = triangleCount == 0 ? 0.0f : static_cast<float>(misses) / static_cast<float>(triangleCount);
+    statistics.atvr = referencedCount == 0 ? 0.0f : static_cast<float>(misses) / static_cast<float>(referencedCount);
+    return statistics;
+}
+
+void optimizeVertexCache(uint32_t *indices,
+                         size_t indexCount,
+                         size_t vertexCount,
+                         std::vector<uint32_t> &clusters,
+                         uint32_t cacheSize)
+{
+    clusters.clear();
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // 頂点毎にその頂点を使う三角形の一覧を作る。
+    // 頂点vを使う三角形の番号はadjacency[offsets[v]]~adjacency[offsets[v + 1] - 1]に並ぶ
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+    {
+        if (indices[i] >= vertexCount)
+        {
+            throw std::runtime_error("mesh has an out of range vertex index!");
+        }
+        offsets[indices[i] + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        offsets[v + 1] += offsets[v];
+    }
+
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    std::vector<uint32_t> liveCount(vertexCount); // 頂点毎の、まだ出力していない三角形の数
+    {
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (size_t k = 0; k < 3; k++)
+            {
+                adjacency[cursor[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+            }
+        }
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        liveCount[v] = offsets[v + 1] - offsets[v];
+    }
+
+    VertexCacheSimulator cache(vertexCount, cacheSize);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEndStack; // これまでに出力した頂点。隣接する三角形が無くなった時に、ここから近場の頂点を探す
+    std::vector<uint32_t> candidates;   // 今回出力した三角形の頂点。次に扇の中心にする頂点の候補
+    std::vector<uint32_t> output;
+    deadEndStack.reserve(triangleCount * 3);
+    output.reserve(triangleCount * 3);
+    uint32_t scanCursor = 0; // 候補もスタックも尽きた時に、未出力の三角形を持つ頂点を先頭から探すための位置
+
+    uint32_t fanning = indices[0];
+    clusters.push_back(0);
+    while (fanning != NO_VERTEX)
+    {
+        // fanningを中心とした扇状に、まだ出力していない三角形を全て出力する
+        candidates.clear();
+        for (uint32_t j = offsets[fanning]; j < offsets[fanning + 1]; j++)
+        {
+            uint32_t t = adjacency[j];
+            if (emitted[t])
+            {
+                continue;
+            }
+            emitted[t] = 1;
+
+            for (size_t k = 0; k < 3; k++)
+            {
+                uint32_t vertex = indices[t * 3 + k];
+                output.push_back(vertex);
+                deadEndStack.push_back(vertex);
+                candidates.push_back(vertex);
+                liveCount[vertex]--;
+                cache.access(vertex);
+            }
+        }
+
+        // 次の中心は、扇を出力し終えてもまだキャッシュに残っている頂点の中で、最も古くキャッシュに入ったものを選ぶ
+        // (扇を出力すると最大で2 * liveCount個の頂点がキャッシュに入る)
+        // そのような頂点が無ければ、未出力の三角形を持つ候補の中で最初のものを選ぶ
+        uint32_t next = NO_VERTEX;
+        int64_t bestPriority = -1;
+        for (uint32_t vertex : candidates)
+        {
+            if (liveCount[vertex] == 0)
+            {
+                continue;
+            }
+
+            int64_t priority = 0;
+            if (cache.getAge(vertex) + 2 * liveCount[vertex] <= cacheSize)
+            {
+                priority = cache.getAge(vertex);
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next = vertex;
+            }
+        }
+
+        if (next == NO_VERTEX)
+        {
+            // 隣接する三角形が尽きたので、最近出力した頂点から順に未出力の三角形を持つものを探す
+            while (!deadEndStack.empty())
+            {
+                uint32_t vertex = deadEndStack.back();
+                deadEndStack.pop_back();
+                if (liveCount[vertex] > 0)
+                {
+                    next = vertex;
+                    break;
+                }
+            }
+
+            // それでも見つからなければ、メッシュの離れた部分に飛ぶ
+            while (next == NO_VERTEX && scanCursor < vertexCount)
+            {
+                if (liveCount[scanCursor] > 0)
+                {
+                    next = scanCursor;
+                }
+                scanCursor++;
+            }
+
+            // ここでキャッシュの内容が途切れるので、クラスタの境界とする
+            if (next != NO_VERTEX)
+            {
+                clusters.push_back(static_cast<uint32_t>(output.size() / 3));
+            }
+        }
+
+        fanning = next;
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void optimizeOverdraw(uint32_t *indices,
+                      size_t indexCount,
+                      const Vertex *vertices,
+                      size_t vertexCount,
+                      const std::vector<uint32_t> &clusters,
+                      float threshold,
+                      uint32_t cacheSize)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || clusters.empty())
+    {
+        return;
+    }
+
+    // Tipsifyのクラスタは大きすぎて並べ替えの効果が薄いので、クラスタ内でACMRが十分下がった位置でさらに分割する
+    // 分割したクラスタの先頭ではキャッシュが空になるので、分割後のACMRはクラスタ全体のACMRのthreshold倍程度に収まる
+    std::vector<uint32_t> boundaries;
+    VertexCacheSimulator cache(vertexCount, cacheSize);
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        size_t begin = clusters[c];
+        size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        if (begin >= end)
+        {
+            continue;
+        }
+
+        cache.flush();
+        uint32_t clusterMisses = 0;
+        for (size_t t = begin; t < end; t++)
+        {
+            clusterMisses += cache.accessTriangle(indices + t * 3);
+        }
+        float clusterThreshold = threshold * static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+        boundaries.push_back(static_cast<uint32_t>(begin));
+        cache.flush();
+        uint32_t runningMisses = 0;
+        uint32_t runningTriangles = 0;
+        for (size_t t = begin; t + 1 < end; t++)
+        {
+            runningMisses += cache.accessTriangle(indices + t * 3);
+            runningTriangles++;
+            if (static_cast<float>(runningMisses) <= clusterThreshold * static_cast<float>(runningTriangles))
+            {
+                boundaries.push_back(static_cast<uint32_t>(t + 1));
+                cache.flush();
+                runningMisses = 0;
+                runningTriangles = 0;
+            }
+        }
+    }
+
+    // メッシュの中心は全頂点の座標の平均とする
+    glm::vec3 meshCentroid(0.0f);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        meshCentroid += vertices[v].pos;
+    }
+    if (vertexCount > 0)
+    {
+        meshCentroid /= static_cast<float>(vertexCount);
+    }
+
+    // クラスタの中心がメッシュの中心から見てクラスタの法線方向に離れているほど、そのクラスタは外側を向いていて手前に来やすい
+    // そのようなクラスタを先に描くと、後から描かれる内側のクラスタが深度テストで棄却されやすくなる
+    std::vector<float> sortKeys(boundaries.size());
+    for (size_t c = 0; c < boundaries.size(); c++)
+    {
+        size_t begin = boundaries[c];
+        size_t end = c + 1 < boundaries.size() ? boundaries[c + 1] : triangleCount;
+
+        float clusterArea = 0.0f;
+        glm::vec3 clusterCentroid(0.0f);
+        glm::vec3 clusterNormal(0.0f);
+        for (size_t t = begin; t < end; t++)
+        {
+            const glm::vec3 &p0 = vertices[indices[t * 3 + 0]].pos;
+            const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].pos;
+            const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].pos;
+
+            // 外積の長さは三角形の面積の2倍なので、そのまま面積による重みとして使う
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+
+            clusterCentroid += (p0 + p1 + p2) * (area / 3.0f);
+            clusterNormal += normal;
+            clusterArea += area;
+        }
+
+        float normalLength = glm::length(clusterNormal);
+        if (clusterArea <= 0.0f || normalLength <= 0.0f)
+        {
+            sortKeys[c] = 0.0f;
+            continue;
+        }
+
+        clusterCentroid /= clusterArea;
+        sortKeys[c] = glm::dot(clusterCentroid - meshCentroid, clusterNormal / normalLength);
+    }
+
+    std::vector<uint32_t> order(boundaries.size());
+    for (size_t c = 0; c < order.size(); c++)
+    {
+        order[c] = static_cast<uint32_t>(c);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+                     { return sortKeys[a] > sortKeys[b]; });
+
+    // クラスタの並び順に従って三角形を並べ直す
+    std::vector<uint32_t> sorted;
+    sorted.reserve(triangleCount * 3);
+    for (uint32_t c : order)
+    {
+        size_t begin = boundaries[c];
+        size_t end = c + 1 < boundaries.size() ? boundaries[c + 1] : triangleCount;
+        sorted.insert(sorted.end(), indices + begin * 3, indices + end * 3);
+    }
+
+    std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+void optimizeVertexFetch(Vertex *vertices,
+                         size_t vertexCount,
+                         uint32_t *indices,
+                         size_t indexCount)
+{
+    // 頂点の新しい番号をインデックスから最初に参照された順に割り振る
+    std::vector<uint32_t> remap(vertexCount, NO_VERTEX);
+    uint32_t nextVertex = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        uint32_t &newIndex = remap[indices[i]];
+        if (newIndex == NO_VERTEX)
+        {
+            newIndex = nextVertex++;
+        }
+        indices[i] = newIndex;
+    }
+
+    // どこからも参照されない頂点は末尾に回す
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        if (remap[v] == NO_VERTEX)
+        {
+            remap[v] = nextVertex++;
+        }
+    }
+
+    std::vector<Vertex> reordered(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        reordered[remap[v]] = vertices[v];
+    }
+    std::copy(reordered.begin(), reordered.end(), vertices);
+}
+
+void compactVertices(const Vertex *vertices,
+                     const uint32_t *indices,
+                     size_t indexCount,
+                     std::vector<uint32_t> &globalToLocal,
+                     std::vector<uint32_t> &localToGlobal,
+                     std::vector<Vertex> &localVertices,
+                     std::vector<uint32_t> &localIndices)
+{
+    localToGlobal.clear();
+    localVertices.clear();
+    localIndices.resize(indexCount);
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        uint32_t &local = globalToLocal[indices[i]];
+        if (local == NOT_COMPACTED)
+        {
+            local = static_cast<uint32_t>(localToGlobal.size());
+            localToGlobal.push_back(indices[i]);
+            localVertices.push_back(vertices[indices[i]]);
+        }
+        localIndices[i] = local;
+    }
+    for (uint32_t global : localToGlobal)
+    {
+        globalToLocal[global] = NOT_COMPACTED;
+    }
+}
+
+void optimizeMesh(Vertex *vertices,
+                  size_t vertexCount,
+                  uint32_t *indices,
+                  size_t indexCount,
+                  const Submesh *submeshes,
+                  size_t submeshCount)
+{
+    VertexCacheStatistics original = analyzeVertexCache(indices, indexCount, vertexCount);
+
+    // サブメッシュが無い場合は全体を一つの範囲として扱う
+    Submesh whole{0, static_cast<uint32_t>(indexCount), 0};
+    if (submeshCount == 0)
+    {
+        submeshes = &whole;
+        submeshCount = 1;
+    }
+
+    // 範囲毎の最適化は、その範囲が使う頂点だけを詰めた番号で行い、終わったら元の頂点番号に戻す
+    std::vector<uint32_t> globalToLocal(vertexCount, NOT_COMPACTED);
+    std::vector<uint32_t> localToGlobal;
+    std::vector<Vertex> localVertices;
+    std::vector<uint32_t> localIndices;
+    auto restoreIndices = [&](uint32_t *destination)
+    {
+        for (size_t i = 0; i < localIndices.size(); i++)
+        {
+            destination[i] = localToGlobal[localIndices[i]];
+        }
+    };
+
+    // クラスタの三角形番号は範囲の中での番号なので、範囲毎に分けて持っておき、同じ範囲のオーバードローの最適化に渡す
+    std::vector<std::vector<uint32_t>> clusters(submeshCount);
+    size_t clusterCount = 0;
+    for (size_t i = 0; i < submeshCount; i++)
+    {
+        uint32_t *range = indices + submeshes[i].firstIndex;
+        compactVertices(vertices, range, submeshes[i].indexCount, globalToLocal, localToGlobal, localVertices, localIndices);
+        optimizeVertexCache(localIndices.data(), localIndices.size(), localVertices.size(), clusters[i]);
+        restoreIndices(range);
+        clusterCount += clusters[i].size();
+    }
+    VertexCacheStatistics cacheOptimized = analyzeVertexCache(indices, indexCount, vertexCount);
+
+    for (size_t i = 0; i < submeshCount; i++)
+    {
+        uint32_t *range = indices + submeshes[i].firstIndex;
+        compactVertices(vertices, range, submeshes[i].indexCount, globalToLocal, localToGlobal, localVertices, localIndices);
+        optimizeOverdraw(localIndices.data(), localIndices.size(), localVertices.data(), localVertices.size(), clusters[i]);
+        restoreIndices(range);
+    }
+    VertexCacheStatistics overdrawOptimized = analyzeVertexCache(indices, indexCount, vertexCount);
+
+    // 頂点の並べ替えは番号を付け替えるだけなので、ACMRとATVRは変わらない
+    optimizeVertexFetch(vertices, vertexCount, indices, indexCount);
+
+    printf("mesh optimization (vertex cache size %u)\n", VERTEX_CACHE_SIZE);
+    printf("  original        : ACMR %.3f, ATVR %.3f\n", original.acmr, original.atvr);
+    printf("  vertex cache    : ACMR %.3f, ATVR %.3f (%zu clusters in %zu submeshes)\n", cacheOptimized.acmr, cacheOptimized.atvr, clusterCount, submeshCount);
+    printf("  overdraw        : ACMR %.3f, ATVR %.3f\n", overdrawOptimized.acmr, overdrawOptimized.atvr);
+}
+
+void optimizeMeshInWindows(const Vertex *vertices,
+                           uint32_t *indices,
+                           size_t indexCount,
+                           size_t windowIndexCount)
+{
+    std::unordered_map<uint32_t, uint32_t> localIndices; // 元の頂点番号から窓の中での番号
+    std::vector<uint32_t> globalIndices;                 // 窓の中での番号から元の頂点番号
+    std::vector<Vertex> localVertices;                   // 窓の中で使われる頂点。オーバードローの最適化で位置を参照する
+    std::vector<uint32_t> window;                        // 窓の中での番号に付け替えたインデックス
+    std::vector<uint32_t> clusters;
+    localIndices.reserve(windowIndexCount);
+
+    double originalMisses = 0.0;
+    double optimizedMisses = 0.0;
+    size_t windowCount = 0;
+    for (size_t first = 0; first < indexCount; first += windowIndexCount)
+    {
+        size_t count = std::min(windowIndexCount, indexCount - first);
+        localIndices.clear();
+        globalIndices.clear();
+        localVertices.clear();
+        window.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            auto [local, inserted] = localIndices.emplace(indices[first + i], static_cast<uint32_t>(globalIndices.size()));
+            if (inserted)
+            {
+                globalIndices.push_back(indices[first + i]);
+                localVertices.push_back(vertices[indices[first + i]]);
+            }
+            window[i] = local->second;
+        }
+
+        size_t localVertexCount = localVertices.size();
+        VertexCacheStatistics original = analyzeVertexCache(window.data(), count, localVertexCount);
+        optimizeVertexCache(window.data(), count, localVertexCount, clusters);
+        optimizeOverdraw(window.data(), count, localVertices.data(), localVertexCount, clusters);
+        VertexCacheStatistics optimized = analyzeVertexCache(window.data(), count, localVertexCount);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            indices[first + i] = globalIndices[window[i]];
+        }
+
+        // 窓毎のACMRを三角形の数で重み付けして、全体のACMRにする
+        originalMisses += static_cast<double>(original.acmr) * (count / 3);
+        optimizedMisses += static_cast<double>(optimized.acmr) * (count / 3);
+        windowCount++;
+    }
+
+    double triangleCount = static_cast<double>(indexCount / 3);
+    printf("mesh optimization in %zu windows (vertex cache size %u, %zu indices per window)\n", windowCount, VERTEX_CACHE_SIZE, windowIndexCount);
+    printf("  original        : ACMR %.3f\n", triangleCount == 0.0 ? 0.0 : originalMisses / triangleCount);
+    printf("  optimized       : ACMR %.3f\n", triangleCount == 0.0 ? 0.0 : optimizedMisses / triangleCount);
+    printf("  vertex fetch    : skipped (needs the whole vertex array in memory)\n");
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+#include <cstddef> // size_tを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"
+#include "Submesh.hpp" // 三角形をマテリアル毎の範囲の中だけで並べ替える
+
+// 頂点シェーダの出力を再利用するキャッシュ(post-transform vertex cache)をどれだけ活かせているかの指標
+struct VertexCacheStatistics
+{
+    float acmr; // 三角形一つ当たりに頂点シェーダが実行される回数(Average Cache Miss Ratio)。理想は0.5前後、最悪は3.0
+    float atvr; // 参照される頂点一つ当たりに頂点シェーダが実行される回数(Average Transformed Vertex Ratio)。理想は1.0
+};
+
+// 最適化の際に想定する頂点キャッシュのエントリ数。実際のGPUのキャッシュの大きさはまちまちだが、FIFOで16程度とみなしておけば大きく外れない
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// 三角形の並び順をFIFOの頂点キャッシュでシミュレートし、ACMRとATVRを計算する
+VertexCacheStatistics analyzeVertexCache(const uint32_t *indices,
+                                         size_t indexCount,
+                                         size_t vertexCount,
+                                         uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Tipsifyで三角形を頂点キャッシュに乗りやすい順に並べ替える
+// clustersには、キャッシュの内容が途切れた(隣接する三角形が無くなって別の場所に飛んだ)位置の三角形番号が昇順に格納される
+void optimizeVertexCache(uint32_t *indices,
+                         size_t indexCount,
+                         size_t vertexCount,
+                         std::vector<uint32_t> &clusters,
+                         uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// optimizeVertexCacheで求めたクラスタを、外側を向いているものほど先に描かれるように並べ替えてオーバードローを減らす
+// クラスタ内の三角形の並びは変えないので、ACMRの悪化はthreshold倍程度に抑えられる
+void optimizeOverdraw(uint32_t *indices,
+                      size_t indexCount,
+                      const Vertex *vertices,
+                      size_t vertexCount,
+                      const std::vector<uint32_t> &clusters,
+                      float threshold = 1.05f,
+                      uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// 頂点配列をインデックスから最初に参照される順に並べ替え、頂点を読み込む際のメモリアクセスを連続させる
+// どこからも参照されない頂点は配列の末尾に回される
+void optimizeVertexFetch(Vertex *vertices,
+                         size_t vertexCount,
+                         uint32_t *indices,
+                         size_t indexCount);
+
+const uint32_t NOT_COMPACTED = UINT32_MAX; // compactVerticesで、まだ詰めていない頂点を表す値
+
+// indicesが使う頂点だけをlocalVerticesに詰めて並べ、その番号に付け替えたインデックスをlocalIndicesに書き込む
+// サブメッシュ毎の最適化や簡略化を詰めた番号で行うと、作業用のメモリと時間がメッシュ全体ではなくサブメッシュの大きさに比例する
+// localToGlobalには詰めた番号から元の頂点番号を入れる。globalToLocalは頂点数分の全ての要素がNOT_COMPACTEDの作業用の配列で、戻る前に元に戻すので使い回せる
+void compactVertices(const Vertex *vertices,
+                     const uint32_t *indices,
+                     size_t indexCount,
+                     std::vector<uint32_t> &globalToLocal,
+                     std::vector<uint32_t> &localToGlobal,
+                     std::vector<Vertex> &localVertices,
+                     std::vector<uint32_t> &localIndices);
+
+// 上の3つの最適化を順番に行い、最適化前後のACMRとATVRを表示する。頂点・インデックスの数は変わらない
+// submeshesを渡した場合、三角形の並べ替えはサブメッシュの範囲毎に行い、マテリアルの違う範囲をまたいで三角形を動かさない
+void optimizeMesh(Vertex *vertices,
+                  size_t vertexCount,
+                  uint32_t *indices,
+                  size_t indexCount,
+                  const Submesh *submeshes = nullptr,
+                  size_t submeshCount = 0);
+
+// インデックス配列を先頭からwindowIndexCount個ずつの窓に分け、窓毎に頂点キャッシュとオーバードローの最適化を行う
+// 窓の中で使われる頂点だけを詰めた番号に付け替えてから最適化するので、作業用のメモリは窓の大きさに比例する分しか使わない
+// メモリに載りきらないメッシュ(少しずつ解析して書き出したキャッシュ)向けで、窓をまたいで三角形を動かさず、頂点配列の並べ替えも行わない
+// windowIndexCountは3の倍数にする事
+void optimizeMeshInWindows(const Vertex *vertices,
+                           uint32_t *indices,
+                           size_t indexCount,
+                           size_t windowIndexCount);
\ No newline at end of file
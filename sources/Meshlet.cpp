@@ -0,0 +1,234 @@
+#include "Meshlet.hpp"
+
+// ----------STLのinclude----------
+#include <algorithm> // min, maxを使用するのに必要
+#include <cmath>     // sqrtを使用するのに必要
+
+namespace
+{
+    const uint32_t NOT_IN_MESHLET = UINT32_MAX; // 頂点がまだどの塊にも含まれていないことを表す値
+
+    // 塊を囲む球と、塊の三角形の法線を囲む円錐を求める
+    void computeMeshletBounds(const Vertex *vertices,
+                              const uint32_t *indices,
+                              const std::vector<uint32_t> &meshletVertices,
+                              size_t triangleBegin,
+                              size_t triangleEnd,
+                              Meshlet &meshlet)
+    {
+        // 球の中心は塊の頂点を囲む箱の中心とし、半径は中心から最も遠い頂点までの距離とする
+        glm::vec3 minPosition = vertices[meshletVertices[0]].pos;
+        glm::vec3 maxPosition = minPosition;
+        for (uint32_t vertex : meshletVertices)
+        {
+            minPosition = glm::min(minPosition, vertices[vertex].pos);
+            maxPosition = glm::max(maxPosition, vertices[vertex].pos);
+        }
+        meshlet.center = (minPosition + maxPosition) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (uint32_t vertex : meshletVertices)
+        {
+            meshlet.radius = std::max(meshlet.radius, glm::length(vertices[vertex].pos - meshlet.center));
+        }
+
+        // 法線の平均を円錐の軸とし、軸から最も離れた法線との角度から円錐の広がりを求める
+        std::vector<glm::vec3> normals;
+        normals.reserve(triangleEnd - triangleBegin);
+        glm::vec3 axis(0.0f);
+        for (size_t t = triangleBegin; t < triangleEnd; t++)
+        {
+            const glm::vec3 &p0 = vertices[indices[t * 3 + 0]].pos;
+            const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].pos;
+            const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].pos;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f)
+            {
+                normals.push_back(normal / length);
+                axis += normal / length;
+            }
+        }
+
+        // 法線が打ち消し合う場合や、半球より広く広がっている場合はどこから見ても表を向いた三角形があるので裏面カリングしない
+        meshlet.coneAxis = glm::vec3(0.0f);
+        meshlet.coneCutoff = 1.0f;
+        float axisLength = glm::length(axis);
+        if (axisLength <= 0.0f)
+        {
+            return;
+        }
+        axis /= axisLength;
+
+        float minDot = 1.0f;
+        for (const auto &normal : normals)
+        {
+            minDot = std::min(minDot, glm::dot(normal, axis));
+        }
+        if (minDot <= 0.0f)
+        {
+            return;
+        }
+
+        // 視線と軸のなす角が(90度 - 円錐の半頂角)以内なら全ての三角形が裏を向いているので、その角度のcos(= 半頂角のsin)を持っておく
+        meshlet.coneAxis = axis;
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+}
+
+void buildMeshlets(const Vertex *vertices,
+                   size_t vertexCount,
+                   const uint32_t *indices,
+                   size_t indexCount,
+                   std::vector<Meshlet> &meshlets,
+                   std::vector<uint16_t> &indices16,
+                   std::vector<uint32_t> &indices32,
+                   std::vector<uint32_t> &scratch)
+{
+    // 頂点を使っている塊の番号。今の塊に含まれているかの判定に使う
+    // 塊を確定させる度にその塊の頂点の分だけ元に戻すので、初期化が要るのは配列を伸ばした分だけ
+    std::vector<uint32_t> &owner = scratch;
+    if (owner.size() < vertexCount)
+    {
+        owner.resize(vertexCount, NOT_IN_MESHLET);
+    }
+    std::vector<uint32_t> meshletVertices;
+    meshletVertices.reserve(MAX_MESHLET_VERTICES);
+
+    // 塊を確定させ、インデックスを16ビットか32ビットの配列に書き出す
+    size_t triangleBegin = 0;
+    auto flush = [&](size_t triangleEnd)
+    {
+        if (triangleBegin == triangleEnd)
+        {
+            return;
+        }
+
+        Meshlet meshlet{};
+        computeMeshletBounds(vertices, indices, meshletVertices, triangleBegin, triangleEnd, meshlet);
+
+        uint32_t minVertex = *std::min_element(meshletVertices.begin(), meshletVertices.end());
+        uint32_t maxVertex = *std::max_element(meshletVertices.begin(), meshletVertices.end());
+        meshlet.vertexOffset = minVertex;
+        meshlet.indexCount = static_cast<uint32_t>((triangleEnd - triangleBegin) * 3);
+        meshlet.wideIndices = maxVertex - minVertex > UINT16_MAX;
+        if (meshlet.wideIndices)
+        {
+            meshlet.firstIndex = static_cast<uint32_t>(indices32.size());
+            for (size_t i = triangleBegin * 3; i < triangleEnd * 3; i++)
+            {
+                indices32.push_back(indices[i] - minVertex);
+            }
+        }
+        else
+        {
+            meshlet.firstIndex = static_cast<uint32_t>(indices16.size());
+            for (size_t i = triangleBegin * 3; i < triangleEnd * 3; i++)
+            {
+                indices16.push_back(static_cast<uint16_t>(indices[i] - minVertex));
+            }
+        }
+
+        meshlets.push_back(meshlet);
+        for (uint32_t vertex : meshletVertices)
+        {
+            owner[vertex] = NOT_IN_MESHLET;
+        }
+        meshletVertices.clear();
+        triangleBegin = triangleEnd;
+    };
+
+    size_t triangleCount = indexCount / 3;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        // この三角形を加えると頂点数か三角形数の上限を超える場合は、今の塊を確定させて新しい塊を始める
+        uint32_t meshletIndex = static_cast<uint32_t>(meshlets.size());
+        size_t newVertices = 0;
+        for (size_t k = 0; k < 3; k++)
+        {
+            uint32_t vertex = indices[t * 3 + k];
+            bool duplicated = (k > 0 && vertex == indices[t * 3]) || (k > 1 && vertex == indices[t * 3 + 1]);
+            if (owner[vertex] != meshletIndex && !duplicated)
+            {
+                newVertices++;
+            }
+        }
+        if (meshletVertices.size() + newVertices > MAX_MESHLET_VERTICES ||
+            t - triangleBegin + 1 > MAX_MESHLET_TRIANGLES)
+        {
+            flush(t);
+            meshletIndex = static_cast<uint32_t>(meshlets.size());
+        }
+
+        for (size_t k = 0; k < 3; k++)
+        {
+            uint32_t vertex = indices[t * 3 + k];
+            if (owner[vertex] != meshletIndex)
+            {
+                owner[vertex] = meshletIndex;
+                meshletVertices.push_back(vertex);
+            }
+        }
+    }
+    flush(triangleCount);
+}
+
+Frustum extractFrustum(const glm::mat4 &matrix)
+{
+    // クリップ座標(x, y, z, w)が視錐台の中にある条件 -w <= x <= w, -w <= y <= w, 0 <= z <= w を、
+    // 行列の各行を使って元の座標系の平面の式に直す
+    auto row = [&](int i)
+    {
+        return glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+    };
+
+    Frustum frustum{};
+    frustum.planes[0] = row(3) + row(0); // 左
+    frustum.planes[1] = row(3) - row(0); // 右
+    frustum.planes[2] = row(3) + row(1); // 下
+    frustum.planes[3] = row(3) - row(1); // 上
+    frustum.planes[4] = row(2);          // 手前(深度は0~1)
+    frustum.planes[5] = row(3) - row(2); // 奥
+
+    // 球との距離を計算できるように、法線を単位ベクトルにしておく
+    for (auto &plane : frustum.planes)
+    {
+        float length = glm::length(glm::vec3(plane.x, plane.y, plane.z));
+        if (length > 0.0f)
+        {
+            plane = plane / length;
+        }
+    }
+
+    return frustum;
+}
+
+bool isSphereInFrustum(const glm::vec3 &center, float radius, const Frustum &frustum)
+{
+    // 球がいずれかの平面の完全に外側にあれば見えない
+    for (const auto &plane : frustum.planes)
+    {
+        float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+        if (distance < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isMeshletVisible(const Meshlet &meshlet, const Frustum &frustum, const glm::vec3 &cameraPosition)
+{
+    if (!isSphereInFrustum(meshlet.center, meshlet.radius, frustum))
+    {
+        return false;
+    }
+
+    // 球のどこを見ても視線が法線の円錐と同じ向きを向いていれば、全ての三角形が裏を向いている
+    glm::vec3 toCenter = meshlet.center - cameraPosition;
+    if (glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius)
+    {
+        return false;
+    }
+
+    return true;
+}
\ No newline at end of file
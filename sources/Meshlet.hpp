@@ -0,0 +1,56 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <array>
+#include <cstdint> // uint32_tを使用するために必要
+#include <cstddef> // size_tを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"
+
+// メッシュを小さく分割した三角形の塊。塊単位で視錐台・裏面のカリングを行い、見えるものだけを描画する
+struct Meshlet
+{
+    glm::vec3 center;     // 塊を囲む球の中心
+    float radius;         // 塊を囲む球の半径
+    glm::vec3 coneAxis;   // 塊の三角形の法線の平均の向き
+    float coneCutoff;     // 法線の広がり具合。1の場合は裏面カリングを行わない
+    uint32_t vertexOffset; // 塊の中のインデックスに足される頂点番号。vkCmdDrawIndexedのvertexOffsetに渡す
+    uint32_t firstIndex;   // 16ビットか32ビットのインデックス配列の中での、塊の最初のインデックスの位置
+    uint32_t indexCount;   // 塊のインデックスの数
+    uint32_t lod;          // 塊が属するLODの番号
+    uint32_t material;     // 塊の三角形のマテリアルの番号。塊はサブメッシュをまたがないので一つに決まる
+    bool wideIndices;      // 塊の頂点番号の幅が16ビットに収まらず、32ビットのインデックス配列に格納されているか
+};
+
+const size_t MAX_MESHLET_VERTICES = 64;   // 一つの塊が使う頂点の最大数
+const size_t MAX_MESHLET_TRIANGLES = 124; // 一つの塊に含まれる三角形の最大数
+
+// インデックス配列を先頭から順番に塊に分割する。三角形の並び順は変えないので、MeshOptimizerで並べ替えた後に呼ぶと頂点キャッシュの効率を保てる
+// 塊のインデックスはvertexOffsetを引いた値で格納され、16ビットに収まる塊はindices16に、収まらない塊はindices32に格納される
+// 塊とインデックスはmeshlets, indices16, indices32の末尾に追加されるので、複数のインデックス配列(LODなど)の塊を一つの配列にまとめられる
+// scratchは頂点毎の作業用の配列で、使った要素は戻る前に元に戻す。呼び出し側で使い回すと、サブメッシュやLOD毎の頂点数分の確保と初期化を省ける
+void buildMeshlets(const Vertex *vertices,
+                   size_t vertexCount,
+                   const uint32_t *indices,
+                   size_t indexCount,
+                   std::vector<Meshlet> &meshlets,
+                   std::vector<uint16_t> &indices16,
+                   std::vector<uint32_t> &indices32,
+                   std::vector<uint32_t> &scratch);
+
+// 視錐台を構成する6枚の平面。xyzが内側を向いた単位法線、wが原点からの距離
+struct Frustum
+{
+    std::array<glm::vec4, 6> planes;
+};
+
+// 変換行列(proj * view * model)から、その行列を掛ける前の座標系での視錐台を求める
+Frustum extractFrustum(const glm::mat4 &matrix);
+
+// 球が視錐台の中にあるか、一部でも掛かっている場合にtrueを返す
+bool isSphereInFrustum(const glm::vec3 &center, float radius, const Frustum &frustum);
+
+// 塊が視錐台の中にあり、かつcameraPositionから見て全ての三角形が裏を向いているわけではない場合にtrueを返す
+// cameraPositionとfrustumは塊と同じ(モデルの)座標系で与える
+bool isMeshletVisible(const Meshlet &meshlet, const Frustum &frustum, const glm::vec3 &cameraPosition);
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include "MeshletCuller.hpp"
+
+// ----------STLのinclude----------
+#include <stdexcept> // 例外を投げるために必要
+#include <vector>
+#include <algorithm> // sort, unique, lower_boundを使用するのに必要
+
+std::vector<MeshletDrawBatch> buildMeshletDrawBatches(const std::vector<Meshlet> &meshlets, std::vector<uint32_t> &meshletBatches)
+{
+    // 距離を0にしたソートキーで塊を分けるので、キーの順に並べたバッチはマテリアルとインデックスの幅の切り替えが少ない順になる
+    std::vector<uint64_t> keys;
+    keys.reserve(meshlets.size());
+    for (const Meshlet &meshlet : meshlets)
+    {
+        keys.push_back(makeDrawSortKey(0, meshlet.wideIndices, meshlet.material, 0.0f));
+    }
+    std::vector<uint64_t> batchKeys = keys;
+    std::sort(batchKeys.begin(), batchKeys.end());
+    batchKeys.erase(std::unique(batchKeys.begin(), batchKeys.end()), batchKeys.end());
+
+    std::vector<MeshletDrawBatch> batches(batchKeys.size());
+    meshletBatches.resize(meshlets.size());
+    for (size_t i = 0; i < meshlets.size(); i++)
+    {
+        uint32_t batch = static_cast<uint32_t>(std::lower_bound(batchKeys.begin(), batchKeys.end(), keys[i]) - batchKeys.begin());
+        meshletBatches[i] = batch;
+        batches[batch].key = keys[i];
+        batches[batch].commandCount++;
+    }
+
+    // バッチ毎の描画コマンドの領域を、バッチの順に詰めて割り当てる
+    uint32_t firstCommand = 0;
+    for (MeshletDrawBatch &batch : batches)
+    {
+        batch.firstCommand = firstCommand;
+        firstCommand += batch.commandCount;
+    }
+    return batches;
+}
+
+void MeshletCuller::init(VkDevice device,
+                         MemoryAllocator *allocator,
+                         PipelineCache *pipelineCache,
+                         const VkPhysicalDeviceLimits &limits,
+                         VkBuffer meshletBuffer,
+                         uint32_t meshletCount,
+                         uint32_t batchCount,
+                         uint32_t frameCount)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->meshletCount = meshletCount;
+    this->batchCount = batchCount;
+
+    cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR"));
+    if (cmdDrawIndexedIndirectCount == nullptr)
+    {
+        throw std::runtime_error("failed to get vkCmdDrawIndexedIndirectCountKHR!");
+    }
+
+    parameterRing.init(device, allocator, limits.minUniformBufferOffsetAlignment, sizeof(CullParameters), frameCount);
+    parameters.meshletCount = meshletCount;
+
+    // 各フレームの領域は、バッチ毎の描画コマンドの数の後に、塊の数だけの描画コマンドを並べる
+    // 描画コマンドの数と描画コマンドは別のバインディングから動的オフセットで指すので、描画コマンドの先頭もオフセットの境界に揃える
+    VkDeviceSize alignment = limits.minStorageBufferOffsetAlignment;
+    drawCountsSize = (sizeof(uint32_t) * batchCount + alignment - 1) / alignment * alignment;
+    drawRegionSize = drawCountsSize + sizeof(VkDrawIndexedIndirectCommand) * meshletCount;
+    drawStride = (drawRegionSize + alignment - 1) / alignment * alignment;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = drawStride * frameCount;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |  // コンピュートシェーダが描画コマンドを書き込む
+                       VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | // 描画コマンドとその数を間接描画で読む
+                       VK_BUFFER_USAGE_TRANSFER_DST_BIT;     // 描画コマンドの数をvkCmdFillBufferで0に戻す
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &drawBuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create indirect draw buffer!");
+    }
+
+    // GPUしか読み書きしないので、GPUのローカルなメモリに置く
+    // バッファはリニアなリソースなので、最適なタイリングの画像とは別のブロックから割り当てる
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, drawBuffer, &memRequirements);
+    drawBufferMemory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, MemoryCategory::Indirect);
+    vkBindBufferMemory(device, drawBuffer, drawBufferMemory.memory, drawBufferMemory.offset);
+
+    createPipeline(pipelineCache);
+    createDescriptorSet(meshletBuffer);
+}
+
+void MeshletCuller::destroy()
+{
+    if (device == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr); // デスクリプタセットはプールと一緒に破棄される
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+    vkDestroyBuffer(device, drawBuffer, nullptr);
+    allocator->free(drawBufferMemory);
+    parameterRing.destroy();
+
+    device = VK_NULL_HANDLE;
+}
+
+void MeshletCuller::createPipeline(PipelineCache *pipelineCache)
+{
+    // デスクリプタセットのレイアウトはシェーダから読み取ったバインディングから作る
+    // フレーム毎の領域を選ぶパラメータと描画コマンドのバッファだけは、動的オフセットを使う種類に書き換える
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    for (const ReflectedBinding &reflected : CULL_SHADER_BINDINGS)
+    {
+        VkDescriptorSetLayoutBinding binding{};
+        binding.binding = reflected.binding;
+        binding.descriptorType = reflected.descriptorType;
+        binding.descriptorCount = reflected.descriptorCount;
+        binding.stageFlags = reflected.stageFlags;
+        if (isSameName(reflected.name, "CullParameters"))
+        {
+            binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        }
+        else if (isSameName(reflected.name, "DrawBuffer") || isSameName(reflected.name, "DrawCountBuffer"))
+        {
+            binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        }
+        bindings.push_back(binding);
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create culling descriptor set layout!");
+    }
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create culling pipeline layout!");
+    }
+
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = CULL_SHADER.shader.codeSize;
+    moduleInfo.pCode = CULL_SHADER.shader.code;
+    VkShaderModule shaderModule;
+    if (vkCreateShaderModule(device, &moduleInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create culling shader module!");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = CULL_SHADER.shader.stage;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = CULL_SHADER.shader.entryPoint;
+    pipelineInfo.layout = pipelineLayout;
+    VkResult result = pipelineCache->createComputePipeline(pipelineInfo, &pipeline, "cullingPipeline");
+
+    // シェーダモジュールはパイプラインの作成が終われば要らない
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create culling pipeline!");
+    }
+}
+
+void MeshletCuller::createDescriptorSet(VkBuffer meshletBuffer)
+{
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    poolSizes.push_back({VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1});
+    poolSizes.push_back({VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1});
+    poolSizes.push_back({VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 2});
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create culling descriptor pool!");
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+    if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate culling descriptor set!");
+    }
+
+    // フレーム毎に変わるパラメータと描画コマンドのバッファは、一つのフレームの領域の大きさだけを範囲にし、位置は動的オフセットで与える
+    VkDescriptorBufferInfo parameterInfo{parameterRing.getBuffer(), 0, parameterRing.getRange()};
+    VkDescriptorBufferInfo meshletInfo{meshletBuffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo drawInfo{drawBuffer, 0, drawRegionSize - drawCountsSize};
+    VkDescriptorBufferInfo countInfo{drawBuffer, 0, sizeof(uint32_t) * batchCount};
+
+    std::vector<VkWriteDescriptorSet> writes;
+    for (const ReflectedBinding &reflected : CULL_SHADER_BINDINGS)
+    {
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = descriptorSet;
+        write.dstBinding = reflected.binding;
+        write.descriptorCount = 1;
+        if (isSameName(reflected.name, "CullParameters"))
+        {
+            write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            write.pBufferInfo = &parameterInfo;
+        }
+        else if (isSameName(reflected.name, "MeshletBuffer"))
+        {
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write.pBufferInfo = &meshletInfo;
+        }
+        else if (isSameName(reflected.name, "DrawBuffer"))
+        {
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+            write.pBufferInfo = &drawInfo;
+        }
+        else if (isSameName(reflected.name, "DrawCountBuffer"))
+        {
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+            write.pBufferInfo = &countInfo;
+        }
+        else
+        {
+            throw std::runtime_error("cull.comp uses an unknown binding!");
+        }
+        writes.push_back(write);
+    }
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void MeshletCuller::set(const Frustum &frustum,
+                        const glm::vec3 &cameraPosition,
+                        const std::array<LodInstanceRange, MAX_MESH_LODS> &lodInstances,
+                        bool cullingEnabled)
+{
+    parameters.frustumPlanes = frustum.planes;
+    parameters.cameraPosition = glm::vec4(cameraPosition, 1.0f);
+    parameters.cullingEnabled = cullingEnabled ? 1 : 0;
+    for (uint32_t lod = 0; lod < MAX_MESH_LODS; lod++)
+    {
+        parameters.lodInstances[lod] = glm::uvec4(lodInstances[lod].firstInstance, lodInstances[lod].instanceCount, 0, 0);
+    }
+    parameterRing.set(&parameters);
+}
+
+void MeshletCuller::acquire(uint32_t frame)
+{
+    parameterRing.acquire(frame);
+}
+
+void MeshletCuller::recordCulling(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+    VkDeviceSize regionOffset = drawStride * frame;
+
+    // 描画コマンドの数はアトミックに数え上げるので、実行前に0に戻しておく
+    // このフレームの領域を前回の描画で読み終わっている事は、drawFrameでフェンスを待つことで保証されている
+    vkCmdFillBuffer(commandBuffer, drawBuffer, regionOffset, drawCountsSize, 0);
+
+    VkBufferMemoryBarrier clearBarrier{};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT; // atomicAddは読み書きの両方
+    clearBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    clearBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    clearBarrier.buffer = drawBuffer;
+    clearBarrier.offset = regionOffset;
+    clearBarrier.size = drawCountsSize;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0, nullptr,
+                         1, &clearBarrier,
+                         0, nullptr);
+
+    // パラメータと描画コマンドとその数のバッファは、このフレームの領域を動的オフセットで選ぶ(バインディングの番号順に並べる)
+    std::array<uint32_t, 3> dynamicOffsets = {parameterRing.getOffset(frame),
+                                              static_cast<uint32_t>(regionOffset + drawCountsSize),
+                                              static_cast<uint32_t>(regionOffset)};
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(commandBuffer,
+                            VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipelineLayout,
+                            0,
+                            1,
+                            &descriptorSet,
+                            static_cast<uint32_t>(dynamicOffsets.size()),
+                            dynamicOffsets.data());
+
+    // 一つのスレッドが一つの塊を判定する
+    uint32_t groupSize = CULL_SHADER.localSize[0];
+    vkCmdDispatch(commandBuffer, (meshletCount + groupSize - 1) / groupSize, 1, 1);
+
+    // 書き込んだ描画コマンドとその数を、間接描画で読めるようにする
+    VkBufferMemoryBarrier drawBarrier = clearBarrier;
+    drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    drawBarrier.size = drawRegionSize;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         0,
+                         0, nullptr,
+                         1, &drawBarrier,
+                         0, nullptr);
+}
+
+void MeshletCuller::recordDraws(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t batchIndex, const MeshletDrawBatch &batch)
+{
+    // 描画コマンドの数はGPUが書き込んだ値を使うので、CPUは見える塊がいくつあるかを知る必要が無い
+    // maxDrawCountには、そのバッチの描画コマンドの領域に収まる最大の数を渡す
+    VkDeviceSize regionOffset = drawStride * frame;
+    VkDeviceSize countOffset = regionOffset + sizeof(uint32_t) * batchIndex;
+    VkDeviceSize commandOffset = regionOffset + drawCountsSize + sizeof(VkDrawIndexedIndirectCommand) * batch.firstCommand;
+    cmdDrawIndexedIndirectCount(commandBuffer,
+                                drawBuffer,
+                                commandOffset,
+                                drawBuffer,
+                                countOffset,
+                                batch.commandCount,
+                                sizeof(VkDrawIndexedIndirectCommand));
+}
\ No newline at end of file
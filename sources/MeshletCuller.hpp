@@ -0,0 +1,135 @@
+#pragma once
+// ----------STLのinclude----------
+#include <array>
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ----------自作クラスのinclude----------
+#include "MemoryAllocator.hpp"
+#include "UniformRing.hpp"     // フレーム毎のカリングのパラメータ
+#include "PipelineCache.hpp"   // コンピュートパイプラインの作成
+#include "Meshlet.hpp"         // 塊と視錐台の構造体
+#include "MeshLod.hpp"         // LOD毎のインスタンスの範囲
+#include "DrawSort.hpp"        // バッチを並べるソートキー
+#include "EmbeddedShaders.hpp" // ビルド時に埋め込んだカリング用のコンピュートシェーダ
+
+// cull.compのCullParametersと同じ並び(std140)
+struct CullParameters
+{
+    std::array<glm::vec4, 6> frustumPlanes; // 塊と同じ座標系での視錐台の平面
+    glm::vec4 cameraPosition;               // 塊と同じ座標系でのカメラの位置。xyzのみ使用する
+    uint32_t meshletCount;
+    uint32_t padding0;
+    uint32_t cullingEnabled; // 0の場合は全ての塊を描画する
+    uint32_t padding1;
+    std::array<glm::uvec4, MAX_MESH_LODS> lodInstances; // LOD毎のインスタンスの範囲。xが最初のインスタンス、yが数
+};
+
+static_assert(findReflectedBinding(CULL_SHADER_BINDINGS, "CullParameters") != nullptr &&
+                  findReflectedBinding(CULL_SHADER_BINDINGS, "CullParameters")->blockSize == sizeof(CullParameters),
+              "CullParameters does not match the uniform block in cull.comp");
+
+// cull.compのMeshletBoundsと同じ並び(std430)。塊の境界と描画に必要な情報をGPUに渡す
+struct GpuMeshletBounds
+{
+    glm::vec4 sphere; // 中心(xyz)と半径(w)
+    glm::vec4 cone;   // 法線の平均の向き(xyz)と広がり具合(w)
+    uint32_t vertexOffset;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t wideIndicesAndLod; // 最下位ビットが32ビットのインデックスを使う塊なら1、残りのビットが塊のLODの番号
+    uint32_t batch;             // 塊の属するバッチの番号
+    uint32_t firstCommand;      // バッチの描画コマンドの領域の先頭
+    uint32_t padding[2];
+};
+
+// インデックスの幅とマテリアルが同じ塊の集まり。GPUでカリングする場合は、バッチ毎に一度の間接描画で描画する
+// バッチの描画コマンドは描画コマンドの領域のfirstCommand番目から並び、その数はバッチの塊の数を超えない
+struct MeshletDrawBatch
+{
+    uint64_t key;          // バッチの塊に共通のソートキー。距離は0にしてある
+    uint32_t firstCommand; // 描画コマンドの領域の中での、バッチの最初の描画コマンドの位置
+    uint32_t commandCount; // バッチの塊の数
+};
+
+// 塊をバッチに分けてソートキーの順に並べ、各バッチに描画コマンドの領域を割り当てる。meshletBatchesには塊毎のバッチの番号を書き込む
+std::vector<MeshletDrawBatch> buildMeshletDrawBatches(const std::vector<Meshlet> &meshlets, std::vector<uint32_t> &meshletBatches);
+
+inline GpuMeshletBounds makeGpuMeshletBounds(const Meshlet &meshlet, uint32_t batchIndex, const MeshletDrawBatch &batch)
+{
+    GpuMeshletBounds bounds{};
+    bounds.sphere = glm::vec4(meshlet.center, meshlet.radius);
+    bounds.cone = glm::vec4(meshlet.coneAxis, meshlet.coneCutoff);
+    bounds.vertexOffset = meshlet.vertexOffset;
+    bounds.firstIndex = meshlet.firstIndex;
+    bounds.indexCount = meshlet.indexCount;
+    bounds.wideIndicesAndLod = (meshlet.wideIndices ? 1 : 0) | (meshlet.lod << 1);
+    bounds.batch = batchIndex;
+    bounds.firstCommand = batch.firstCommand;
+    return bounds;
+}
+
+// メッシュの塊のカリングをコンピュートシェーダで行い、見える塊だけをvkCmdDrawIndexedIndirectCountKHRで描画するクラス
+// 描画コマンドとその数はGPUが書き込むので、CPUは塊の数によらず毎フレーム視錐台を一つ渡すだけで済む
+// 描画コマンドのバッファはフレーム毎の領域に分かれており、どの領域を使うかは動的オフセットで選ぶ
+// 描画コマンドはバッチ毎に分けて書き出すので、バッチの間でマテリアルやインデックスバッファを切り替えられる
+// VK_KHR_draw_indirect_countとmultiDrawIndirect、drawIndirectFirstInstanceを有効にしたデバイスでのみ使える
+class MeshletCuller
+{
+public:
+    // meshletBufferにはmeshletCount個のGpuMeshletBoundsが格納されている事。batchCountは塊を分けたバッチの数
+    // limitsはminUniformBufferOffsetAlignmentとminStorageBufferOffsetAlignmentを使う
+    void init(VkDevice device,
+              MemoryAllocator *allocator,
+              PipelineCache *pipelineCache,
+              const VkPhysicalDeviceLimits &limits,
+              VkBuffer meshletBuffer,
+              uint32_t meshletCount,
+              uint32_t batchCount,
+              uint32_t frameCount);
+    void destroy();
+
+    // 最新のカリングのパラメータ。frustumとcameraPositionは塊と同じ(モデルの)座標系で与える
+    // 塊の描画コマンドはその塊のLODのインスタンスの範囲を描画し、インスタンスが無いLODの塊の描画コマンドは作られない
+    void set(const Frustum &frustum,
+             const glm::vec3 &cameraPosition,
+             const std::array<LodInstanceRange, MAX_MESH_LODS> &lodInstances,
+             bool cullingEnabled);
+    void acquire(uint32_t frame); // frame番目の領域のパラメータを最新にする。frameの前回の描画が終わってから呼ぶ事
+
+    // frame番目の領域の描画コマンドを作るコンピュートシェーダの実行を記録する。レンダーパスの外で記録する事
+    void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame);
+    // frame番目の領域の描画コマンドのうち、batchIndex番目のバッチの塊の描画を記録する
+    // バッチのインデックスの幅のインデックスバッファとマテリアルは、呼び出し側で設定しておく事
+    void recordDraws(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t batchIndex, const MeshletDrawBatch &batch);
+
+private:
+    void createPipeline(PipelineCache *pipelineCache);
+    void createDescriptorSet(VkBuffer meshletBuffer);
+
+    VkDevice device = VK_NULL_HANDLE;
+    MemoryAllocator *allocator = nullptr;
+    uint32_t meshletCount = 0;
+    uint32_t batchCount = 0;
+
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    UniformRing parameterRing;            // フレーム毎のカリングのパラメータ
+    CullParameters parameters{};          // 最新のパラメータ。変わった時だけparameterRingに書き込まれる
+    VkBuffer drawBuffer = VK_NULL_HANDLE; // フレーム毎の、バッチ毎の描画コマンドの数と描画コマンド
+    MemoryAllocation drawBufferMemory;
+    VkDeviceSize drawCountsSize = 0; // 描画コマンドの前に置く、バッチ毎の描画コマンドの数の大きさ。minStorageBufferOffsetAlignmentの倍数
+    VkDeviceSize drawRegionSize = 0; // 一つのフレームの領域の大きさ
+    VkDeviceSize drawStride = 0;     // フレーム毎の領域の間隔。minStorageBufferOffsetAlignmentの倍数
+
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr; // 拡張機能の関数なので、デバイスから取得する
+};
\ No newline at end of file
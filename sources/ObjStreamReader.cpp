@@ -0,0 +1,281 @@
+#include "ObjStreamReader.hpp"
+
+// ----------STLのinclude----------
+#include <fstream>
+#include <stdexcept> // 例外を投げるために必要
+#include <cstdlib>   // strtof, strtolを使用するのに必要
+#include <cstring>   // memmove, memchrを使用するのに必要
+#include <algorithm> // maxを使用するのに必要
+#include <cstdio>    // printfを使用するのに必要
+
+namespace
+{
+    bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    char *skipBlank(char *cursor)
+    {
+        while (isBlank(*cursor))
+        {
+            cursor++;
+        }
+        return cursor;
+    }
+}
+
+std::vector<std::string> ObjStreamReader::readMaterialLibraries(const std::string &filename)
+{
+    std::vector<std::string> libraries;
+    std::ifstream file(filename);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        // "mtllib"の後ろには空白で区切って複数のファイル名を書ける
+        if (line.compare(0, 6, "mtllib") != 0 || line.size() < 7 || !isBlank(line[6]))
+        {
+            continue;
+        }
+        size_t begin = 7;
+        while (begin < line.size())
+        {
+            while (begin < line.size() && isBlank(line[begin]))
+            {
+                begin++;
+            }
+            size_t end = begin;
+            while (end < line.size() && !isBlank(line[end]))
+            {
+                end++;
+            }
+            if (end > begin)
+            {
+                libraries.push_back(line.substr(begin, end - begin));
+            }
+            begin = end;
+        }
+    }
+    return libraries;
+}
+
+void ObjStreamReader::read(const std::string &filename, const VertexCallback &onVertices, const IndexCallback &onIndices)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        printf("file name is : %s\n", filename.c_str());
+        throw std::runtime_error("failed to open obj file!");
+    }
+
+    vertexCallback = &onVertices;
+    indexCallback = &onIndices;
+    positions.clear();
+    texCoords.clear();
+    deduplicator.clear();
+    vertexChunk.clear();
+    vertexChunk.reserve(CHUNK_SIZE);
+    indexChunk.clear();
+    indexChunk.reserve(CHUNK_SIZE);
+    indexCount = 0;
+    peakMemoryUsage = 0;
+
+    // 窓の末尾には行の途中までしか入っていない事があるので、その部分は次の窓の先頭に移してから続きを読み込む
+    window.resize(WINDOW_SIZE + 1); // 最後の行を'\0'で終端できるように1バイト余分に確保しておく
+    size_t carry = 0;               // 前の窓から持ち越した、改行で終わっていない行のバイト数
+    while (true)
+    {
+        // 1行が窓に収まらない場合は窓を広げる
+        if (carry == window.size() - 1)
+        {
+            window.resize(window.size() * 2);
+        }
+
+        file.read(window.data() + carry, window.size() - 1 - carry);
+        size_t filled = carry + static_cast<size_t>(file.gcount());
+        bool eof = file.gcount() == 0;
+
+        char *begin = window.data();
+        char *end = window.data() + filled;
+        while (begin < end)
+        {
+            char *newline = static_cast<char *>(memchr(begin, '\n', end - begin));
+            if (newline == nullptr)
+            {
+                if (!eof)
+                {
+                    break; // 行の続きは次の窓で読み込む
+                }
+                newline = end; // ファイルの最後の行は改行で終わっていない事がある
+            }
+            *newline = '\0';
+            parseLine(begin);
+            begin = newline + 1;
+        }
+
+        carry = begin < end ? static_cast<size_t>(end - begin) : 0;
+        memmove(window.data(), begin, carry);
+
+        updatePeakMemoryUsage();
+
+        if (eof)
+        {
+            break;
+        }
+    }
+
+    flushVertices();
+    flushIndices();
+
+    vertexCallback = nullptr;
+    indexCallback = nullptr;
+}
+
+void ObjStreamReader::parseLine(char *line)
+{
+    line = skipBlank(line);
+
+    if (line[0] == 'v' && isBlank(line[1]))
+    {
+        // 頂点座標 "v x y z"
+        char *cursor = line + 1;
+        glm::vec3 position;
+        position.x = strtof(cursor, &cursor);
+        position.y = strtof(cursor, &cursor);
+        position.z = strtof(cursor, &cursor);
+        positions.push_back(position);
+    }
+    else if (line[0] == 'v' && line[1] == 't' && isBlank(line[2]))
+    {
+        // UV座標 "vt u v"
+        char *cursor = line + 2;
+        glm::vec2 texCoord;
+        texCoord.x = strtof(cursor, &cursor);
+        texCoord.y = strtof(cursor, &cursor);
+        texCoords.push_back(texCoord);
+    }
+    else if (line[0] == 'f' && isBlank(line[1]))
+    {
+        parseFace(line + 1);
+    }
+    // 法線やグループ、マテリアルの指定などはこのアプリケーションでは使わないので読み飛ばす
+}
+
+void ObjStreamReader::parseFace(char *cursor)
+{
+    // 面の各頂点は "v", "v/vt", "v//vn", "v/vt/vn" のいずれかの形式で書かれている
+    faceCorners.clear();
+    while (true)
+    {
+        cursor = skipBlank(cursor);
+        if (*cursor == '\0')
+        {
+            break;
+        }
+
+        long positionIndex = strtol(cursor, &cursor, 10);
+        long texCoordIndex = 0; // 0はUV座標が指定されていないことを表す
+        if (*cursor == '/')
+        {
+            cursor++;
+            if (*cursor != '/')
+            {
+                texCoordIndex = strtol(cursor, &cursor, 10);
+            }
+            if (*cursor == '/')
+            {
+                cursor++;
+                strtol(cursor, &cursor, 10); // 法線は使わないので読み飛ばす
+            }
+        }
+
+        faceCorners.push_back(addCorner(positionIndex, texCoordIndex));
+
+        // 数値として解釈できない文字が残っている場合はその文字を飛ばして先に進む
+        if (*cursor != '\0' && !isBlank(*cursor))
+        {
+            cursor++;
+        }
+    }
+
+    // 多角形は最初の頂点を中心とした扇形に三角形分割する(tinyobjloaderと同じ分割の仕方)
+    for (size_t i = 2; i < faceCorners.size(); i++)
+    {
+        indexChunk.push_back(faceCorners[0]);
+        indexChunk.push_back(faceCorners[i - 1]);
+        indexChunk.push_back(faceCorners[i]);
+        if (indexChunk.size() + 3 > CHUNK_SIZE)
+        {
+            flushIndices();
+        }
+    }
+}
+
+uint32_t ObjStreamReader::addCorner(long positionIndex, long texCoordIndex)
+{
+    // objファイルのインデックスは1から始まり、負の値はその時点で定義されている最後の要素からの相対位置を表す
+    long position = positionIndex > 0 ? positionIndex - 1 : static_cast<long>(positions.size()) + positionIndex;
+    if (position < 0 || position >= static_cast<long>(positions.size()))
+    {
+        throw std::runtime_error("obj file has an out of range vertex index!");
+    }
+
+    Vertex vertex{};
+    vertex.pos = positions[position];
+
+    if (texCoordIndex != 0)
+    {
+        long texCoord = texCoordIndex > 0 ? texCoordIndex - 1 : static_cast<long>(texCoords.size()) + texCoordIndex;
+        if (texCoord < 0 || texCoord >= static_cast<long>(texCoords.size()))
+        {
+            throw std::runtime_error("obj file has an out of range texcoord index!");
+        }
+        vertex.texCoord = {
+            texCoords[texCoord].x,
+            1.0f - texCoords[texCoord].y, // Objファイルは画像下をVの0と扱っているが、Vulkanでは画像上をVの0としているため、上下を反転してやる必要がある。
+        };
+    }
+
+    // 新しい頂点だった場合は頂点配列の末尾に追加されるので、出力待ちの頂点にも加える
+    size_t uniqueCount = deduplicator.getVertices().size();
+    uint32_t index = deduplicator.add(vertex);
+    if (index == uniqueCount)
+    {
+        vertexChunk.push_back(vertex);
+        if (vertexChunk.size() == CHUNK_SIZE)
+        {
+            flushVertices();
+        }
+    }
+    return index;
+}
+
+void ObjStreamReader::flushVertices()
+{
+    if (!vertexChunk.empty())
+    {
+        (*vertexCallback)(vertexChunk.data(), vertexChunk.size());
+        vertexChunk.clear();
+    }
+}
+
+void ObjStreamReader::flushIndices()
+{
+    if (!indexChunk.empty())
+    {
+        (*indexCallback)(indexChunk.data(), indexChunk.size());
+        indexCount += indexChunk.size();
+        indexChunk.clear();
+    }
+}
+
+void ObjStreamReader::updatePeakMemoryUsage()
+{
+    size_t usage = positions.capacity() * sizeof(glm::vec3) +
+                   texCoords.capacity() * sizeof(glm::vec2) +
+                   deduplicator.getMemoryUsage() +
+                   vertexChunk.capacity() * sizeof(Vertex) +
+                   indexChunk.capacity() * sizeof(uint32_t) +
+                   window.capacity();
+    peakMemoryUsage = std::max(peakMemoryUsage, usage);
+}
\ No newline at end of file
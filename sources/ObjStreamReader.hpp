@@ -0,0 +1,54 @@
+#pragma once
+// ----------STLのinclude----------
+#include <string>
+#include <vector>
+#include <functional> // 出力先のコールバックを受け取るのに使用する
+#include <cstdint>    // uint32_tを使用するために必要
+#include <cstddef>    // size_tを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"
+#include "VertexDeduplicator.hpp"
+
+// objファイルを一定サイズの窓ごとに読み込みながら解析し、重複を取り除いた頂点とインデックスを一定数ずつ出力するクラス
+// tinyobjloaderと違って面の情報(インデックス)をメモリ上に溜め込まないので、巨大なobjファイルでもメモリの使用量を抑えて読み込める
+// 頂点座標とUV座標は面から任意の位置を参照されるので、これらだけはファイル全体の分を保持する
+class ObjStreamReader
+{
+public:
+    using VertexCallback = std::function<void(const Vertex *vertices, size_t count)>;   // 新しく見つかった頂点を受け取るコールバック
+    using IndexCallback = std::function<void(const uint32_t *indices, size_t count)>; // 三角形のインデックスを受け取るコールバック
+
+    // filenameのobjファイルを解析する。頂点はonVertices、インデックスはonIndicesに一定数ずつ渡される
+    void read(const std::string &filename, const VertexCallback &onVertices, const IndexCallback &onIndices);
+
+    uint32_t getVertexCount() const { return static_cast<uint32_t>(deduplicator.getVertices().size()); }
+    uint64_t getIndexCount() const { return indexCount; }
+    size_t getPeakMemoryUsage() const { return peakMemoryUsage; } // 解析中にこのクラスが確保したメモリの最大バイト数
+
+    // filenameのobjファイルの"mtllib"の行に書かれたmtlファイルの名前を、書かれている通りに全て返す。面などの解析は行わない
+    static std::vector<std::string> readMaterialLibraries(const std::string &filename);
+
+private:
+    static constexpr size_t WINDOW_SIZE = 4 << 20;  // 一度にファイルから読み込むバイト数
+    static constexpr size_t CHUNK_SIZE = 64 * 1024; // 一度にコールバックに渡す頂点・インデックスの最大数
+
+    void parseLine(char *line);                                     // 1行分(終端は'\0')を解析する
+    void parseFace(char *cursor);                                   // "f"で始まる行の残りの部分を解析する
+    uint32_t addCorner(long positionIndex, long texCoordIndex);     // 面の頂点一つを重複除去して、そのインデックスを返す
+    void flushVertices();                                           // 溜まっている頂点をコールバックに渡す
+    void flushIndices();                                            // 溜まっているインデックスをコールバックに渡す
+    void updatePeakMemoryUsage();                                   // 現在のメモリ使用量を計算し、最大値を更新する
+
+    std::vector<glm::vec3> positions;     // "v"で定義された頂点座標
+    std::vector<glm::vec2> texCoords;     // "vt"で定義されたUV座標
+    VertexDeduplicator deduplicator;      // 頂点の重複除去に使うテーブル
+    std::vector<Vertex> vertexChunk;      // まだコールバックに渡していない頂点
+    std::vector<uint32_t> indexChunk;     // まだコールバックに渡していないインデックス
+    std::vector<uint32_t> faceCorners;    // 解析中の面を構成する頂点のインデックス
+    std::vector<char> window;             // ファイルから読み込んだデータを置いておくバッファ
+    const VertexCallback *vertexCallback = nullptr;
+    const IndexCallback *indexCallback = nullptr;
+    uint64_t indexCount = 0;              // これまでに出力したインデックスの数
+    size_t peakMemoryUsage = 0;           // これまでのメモリ使用量の最大値
+};
\ No newline at end of file
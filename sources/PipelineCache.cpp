@@ -0,0 +1,240 @@
+#include "PipelineCache.hpp"
+
+// ----------STLのinclude----------
+#include <vector>
+#include <fstream>
+#include <filesystem> // 一時ファイルのリネームとディレクトリの作成に使用する
+#include <cstring>    // memcmp, memcpyを使用するために必要
+#include <cstdio>     // printf, snprintfを使用するのに必要
+#include <cstdlib>    // getenvを使用するのに必要
+#include <stdexcept>  // 例外を投げるために必要
+
+// ----------Win32APIのinclude----------------
+#include "windows.h" // 実行ファイルのパスを取得するGetModuleFileNameWを使用するのに必要
+
+namespace
+{
+    // VkPipelineCacheの内容の先頭に置かれるヘッダ(VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+    // 仕様でレイアウトが決まっているので、ドライバに渡す前にこの部分を読んで今のGPUのものかを確かめる
+    struct PipelineCacheHeader
+    {
+        uint32_t headerSize;                     // ヘッダのバイト数。32以上
+        uint32_t headerVersion;                  // VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        uint32_t vendorID;                       // キャッシュを作成したGPUのベンダー
+        uint32_t deviceID;                       // キャッシュを作成したGPUの種類
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE]; // ドライバのバージョンなどによって変わる識別子
+    };
+
+    double millisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // GPUとドライバごとに別のファイルになるように、vendorID, deviceID, pipelineCacheUUIDからファイル名を作る
+    // 複数のGPUを切り替えて使ってもお互いのキャッシュを上書きしない
+    std::string makeCacheFileName(const VkPhysicalDeviceProperties &properties)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "pipeline_%04x_%04x_", properties.vendorID, properties.deviceID);
+        std::string fileName = name;
+        for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+        {
+            snprintf(name, sizeof(name), "%02x", properties.pipelineCacheUUID[i]);
+            fileName += name;
+        }
+        return fileName + ".cache";
+    }
+}
+
+std::string PipelineCache::getDefaultDirectory(const char *applicationName)
+{
+    const char *localAppData = getenv("LOCALAPPDATA");
+    if (localAppData != nullptr && localAppData[0] != '\0')
+    {
+        return (std::filesystem::path(localAppData) / applicationName).string();
+    }
+
+    wchar_t modulePath[MAX_PATH];
+    DWORD length = GetModuleFileNameW(nullptr, modulePath, MAX_PATH);
+    if (length == 0 || length == MAX_PATH)
+    {
+        return "."; // 取得できない場合は仕方が無いので作業ディレクトリに置く
+    }
+    return std::filesystem::path(modulePath).parent_path().string();
+}
+
+void PipelineCache::init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string &directory)
+{
+    this->device = device;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    path = (std::filesystem::path(directory) / makeCacheFileName(properties)).string();
+
+    // ディレクトリを作れなかった場合も続ける。保存に失敗するだけで、キャッシュが無い時と同じように動く
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    // ファイルを読み込み、ヘッダが今のGPUとドライバに一致する場合だけ初期データとして使う
+    // 一致しないデータを渡しても仕様上は無視される事になっているが、壊れたファイルでドライバが落ちる事もあるので自前で確かめる
+    std::vector<char> data;
+    const char *rejectReason = nullptr;
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        rejectReason = "no cache file";
+    }
+    else
+    {
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), data.size());
+
+        PipelineCacheHeader header{};
+        if (file.good() && data.size() >= sizeof(PipelineCacheHeader))
+        {
+            memcpy(&header, data.data(), sizeof(header));
+        }
+
+        if (!file.good() || data.size() < sizeof(PipelineCacheHeader))
+        {
+            rejectReason = "truncated cache file";
+        }
+        else if (header.headerSize < sizeof(PipelineCacheHeader) ||
+                 header.headerSize > data.size() ||
+                 header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+        {
+            rejectReason = "unknown cache header";
+        }
+        else if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID)
+        {
+            rejectReason = "cache was created on another GPU";
+        }
+        else if (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        {
+            rejectReason = "cache was created by another driver version";
+        }
+    }
+    if (rejectReason != nullptr)
+    {
+        printf("pipeline cache : starting empty (%s)\n", rejectReason);
+        data.clear();
+    }
+    else
+    {
+        printf("pipeline cache : loaded %zu bytes from %s\n", data.size(), path.c_str());
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+
+    savedSize = getDataSize();
+    lastSave = std::chrono::steady_clock::now();
+}
+
+void PipelineCache::destroy()
+{
+    if (cache == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    save();
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+}
+
+size_t PipelineCache::getDataSize() const
+{
+    size_t size = 0;
+    vkGetPipelineCacheData(device, cache, &size, nullptr);
+    return size;
+}
+
+void PipelineCache::reportCreation(const char *name, size_t sizeBefore, double elapsed) const
+{
+    // キャッシュにヒットしたかどうかを直接知る方法はVulkan 1.0には無いので、作成後にキャッシュの内容が増えたかどうかで推定する
+    // ドライバによってはヒットしても内容が増えたり、ミスしても増えなかったりするので、あくまで目安として表示する
+    bool grew = getDataSize() > sizeBefore;
+    printf("pipeline cache : %s %s (estimated from cache size, %.2f ms)\n", name, grew ? "likely miss" : "likely hit", elapsed);
+}
+
+VkResult PipelineCache::createGraphicsPipeline(const VkGraphicsPipelineCreateInfo &pipelineInfo, VkPipeline *pipeline, const char *name)
+{
+    size_t sizeBefore = getDataSize();
+    auto start = std::chrono::steady_clock::now();
+    VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, pipeline);
+    reportCreation(name, sizeBefore, millisecondsSince(start));
+    return result;
+}
+
+VkResult PipelineCache::createComputePipeline(const VkComputePipelineCreateInfo &pipelineInfo, VkPipeline *pipeline, const char *name)
+{
+    size_t sizeBefore = getDataSize();
+    auto start = std::chrono::steady_clock::now();
+    VkResult result = vkCreateComputePipelines(device, cache, 1, &pipelineInfo, nullptr, pipeline);
+    reportCreation(name, sizeBefore, millisecondsSince(start));
+    return result;
+}
+
+bool PipelineCache::save()
+{
+    lastSave = std::chrono::steady_clock::now();
+
+    // キャッシュは追加されるだけなので、前回から大きさが変わっていなければ書き出す必要は無い
+    size_t size = getDataSize();
+    if (size == savedSize)
+    {
+        return true;
+    }
+
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+    {
+        return false;
+    }
+    data.resize(size);
+
+    // 書き込み途中で終了された場合に壊れたキャッシュが残らないように、一時ファイルに書き込んでからリネームする
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+
+        out.write(data.data(), data.size());
+        if (!out.good())
+        {
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    printf("pipeline cache : saved %zu bytes to %s\n", data.size(), path.c_str());
+    savedSize = data.size();
+    return true;
+}
+
+void PipelineCache::saveIfDue(std::chrono::steady_clock::duration interval)
+{
+    if (std::chrono::steady_clock::now() - lastSave >= interval)
+    {
+        save();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+// ----------STLのinclude----------
+#include <string>
+#include <chrono>  // 定期的に保存する間隔を扱うのに使用する
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ドライバがパイプラインの作成時にシェーダをコンパイルした結果(VkPipelineCache)をファイルに保存しておき、次回以降の起動時に読み込むクラス
+// キャッシュの中身はGPUとドライバに固有なので、ファイル名をvendorID, deviceID, pipelineCacheUUIDから作り、読み込む際にもヘッダが今のGPUと一致するかを確かめる
+class PipelineCache
+{
+public:
+    // directoryにある今のGPUとドライバ用のキャッシュファイルを読み込んでVkPipelineCacheを作成する
+    // ファイルが無いか、壊れているか、別のGPUやドライバのものであれば空のキャッシュから始める。directoryが無ければ作成する
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string &directory);
+    void destroy(); // キャッシュを保存してから破棄する
+
+    VkPipelineCache getHandle() const { return cache; }
+
+    // キャッシュを使ってグラフィックスパイプラインを作成し、かかった時間とキャッシュにヒットしたかどうかの推定を表示する
+    VkResult createGraphicsPipeline(const VkGraphicsPipelineCreateInfo &pipelineInfo, VkPipeline *pipeline, const char *name);
+    VkResult createComputePipeline(const VkComputePipelineCreateInfo &pipelineInfo, VkPipeline *pipeline, const char *name); // コンピュートパイプライン版
+
+    bool save(); // 前回の保存から内容が増えていれば、キャッシュをファイルに書き出す。書き出しに失敗した場合はfalseを返す
+    void saveIfDue(std::chrono::steady_clock::duration interval); // 前回の保存からinterval以上経っていれば保存する。毎フレーム呼んでも良い
+
+    // キャッシュを置くユーザーごとのディレクトリ(%LOCALAPPDATA%/applicationName)を返す
+    // 環境変数が無い場合は実行ファイルのあるディレクトリを返す。作業ディレクトリによって保存先が変わらないようにするため
+    static std::string getDefaultDirectory(const char *applicationName);
+
+private:
+    size_t getDataSize() const; // ドライバが持っているキャッシュの内容のバイト数
+    void reportCreation(const char *name, size_t sizeBefore, double elapsed) const; // パイプラインの作成にかかった時間とヒットしたかの推定を表示する
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties properties{}; // キャッシュのヘッダと照合するGPUの情報
+    std::string path;
+    size_t savedSize = 0; // 最後に読み込んだか保存した時のキャッシュの内容のバイト数
+    std::chrono::steady_clock::time_point lastSave{};
+};
\ No newline at end of file
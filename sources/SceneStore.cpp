@@ -0,0 +1,260 @@
+#include "SceneStore.hpp"
+
+// ----------STLのinclude----------
+#include <algorithm> // maxを使用するのに必要
+#include <chrono>    // カリングにかかった時間を測るのに使用する
+#include <cmath>     // sqrtを使用するのに必要
+
+// ----------SIMDのinclude----------
+// AVX2はコンパイラで有効にした場合(CMakeのVULKANSTUDY_USE_AVX2)だけ使う。x64では常にSSE2が使える
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCENE_CULLING_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCENE_CULLING_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCENE_CULLING_NEON
+#endif
+
+namespace
+{
+    const size_t CULLING_BATCH_SIZE = 8; // 一度にまとめて判定する球の数
+
+    // 球が全ての平面の内側(一部でも入っている)にあればtrue。SIMDで判定しきれなかった余りの球に使う
+    bool isSphereInFrustum(float x, float y, float z, float r, const Frustum &frustum)
+    {
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            if (plane.x * x + plane.y * y + plane.z * z + plane.w < -r)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // mask(下位8ビット)の立っているビットに対応する球の番号をvisibleに書き込む
+    size_t appendVisible(uint32_t mask, size_t first, uint32_t *visible)
+    {
+        size_t count = 0;
+        for (uint32_t lane = 0; lane < CULLING_BATCH_SIZE; lane++)
+        {
+            if (mask & (1u << lane))
+            {
+                visible[count++] = static_cast<uint32_t>(first + lane);
+            }
+        }
+        return count;
+    }
+
+    // 8個の球の判定結果をビットマスクで返す。平面の式に球の中心を入れた値に半径を足し、6枚全てで0以上なら見える
+#if defined(SCENE_CULLING_AVX2)
+    uint32_t testBatch(const float *x, const float *y, const float *z, const float *r, const Frustum &frustum)
+    {
+        __m256 cx = _mm256_loadu_ps(x);
+        __m256 cy = _mm256_loadu_ps(y);
+        __m256 cz = _mm256_loadu_ps(z);
+        __m256 cr = _mm256_loadu_ps(r);
+        __m256 zero = _mm256_setzero_ps();
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_set1_ps(plane.w));
+            distance = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.y), cy), distance);
+            distance = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), distance);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, cr), zero, _CMP_GE_OQ));
+        }
+        return static_cast<uint32_t>(_mm256_movemask_ps(inside));
+    }
+#elif defined(SCENE_CULLING_SSE2)
+    // 4個ずつ2回に分けて判定する
+    uint32_t testHalf(const float *x, const float *y, const float *z, const float *r, const Frustum &frustum)
+    {
+        __m128 cx = _mm_loadu_ps(x);
+        __m128 cy = _mm_loadu_ps(y);
+        __m128 cz = _mm_loadu_ps(z);
+        __m128 cr = _mm_loadu_ps(r);
+        __m128 zero = _mm_setzero_ps();
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_set1_ps(plane.w));
+            distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.y), cy), distance);
+            distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), distance);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, cr), zero));
+        }
+        return static_cast<uint32_t>(_mm_movemask_ps(inside));
+    }
+
+    uint32_t testBatch(const float *x, const float *y, const float *z, const float *r, const Frustum &frustum)
+    {
+        return testHalf(x, y, z, r, frustum) | (testHalf(x + 4, y + 4, z + 4, r + 4, frustum) << 4);
+    }
+#elif defined(SCENE_CULLING_NEON)
+    // 4個ずつ2回に分けて判定する。NEONにはmovemaskが無いので、レーン毎の重みを掛けて足し合わせる
+    uint32_t testHalf(const float *x, const float *y, const float *z, const float *r, const Frustum &frustum)
+    {
+        float32x4_t cx = vld1q_f32(x);
+        float32x4_t cy = vld1q_f32(y);
+        float32x4_t cz = vld1q_f32(z);
+        float32x4_t cr = vld1q_f32(r);
+        uint32x4_t inside = vdupq_n_u32(0xffffffffu);
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            float32x4_t distance = vmlaq_n_f32(vdupq_n_f32(plane.w), cx, plane.x);
+            distance = vmlaq_n_f32(distance, cy, plane.y);
+            distance = vmlaq_n_f32(distance, cz, plane.z);
+            inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(distance, cr), vdupq_n_f32(0.0f)));
+        }
+        const uint32_t weights[4] = {1, 2, 4, 8};
+        uint32x4_t bits = vandq_u32(inside, vld1q_u32(weights));
+        return vgetq_lane_u32(bits, 0) | vgetq_lane_u32(bits, 1) | vgetq_lane_u32(bits, 2) | vgetq_lane_u32(bits, 3);
+    }
+
+    uint32_t testBatch(const float *x, const float *y, const float *z, const float *r, const Frustum &frustum)
+    {
+        return testHalf(x, y, z, r, frustum) | (testHalf(x + 4, y + 4, z + 4, r + 4, frustum) << 4);
+    }
+#else
+    uint32_t testBatch(const float *x, const float *y, const float *z, const float *r, const Frustum &frustum)
+    {
+        uint32_t mask = 0;
+        for (uint32_t lane = 0; lane < CULLING_BATCH_SIZE; lane++)
+        {
+            if (isSphereInFrustum(x[lane], y[lane], z[lane], r[lane], frustum))
+            {
+                mask |= 1u << lane;
+            }
+        }
+        return mask;
+    }
+#endif
+}
+
+size_t cullSpheres(const float *centerX,
+                   const float *centerY,
+                   const float *centerZ,
+                   const float *radius,
+                   size_t count,
+                   const Frustum &frustum,
+                   uint32_t *visible)
+{
+    size_t visibleCount = 0;
+    size_t batchEnd = count - count % CULLING_BATCH_SIZE;
+    for (size_t i = 0; i < batchEnd; i += CULLING_BATCH_SIZE)
+    {
+        uint32_t mask = testBatch(centerX + i, centerY + i, centerZ + i, radius + i, frustum);
+        if (mask != 0)
+        {
+            visibleCount += appendVisible(mask, i, visible + visibleCount);
+        }
+    }
+
+    for (size_t i = batchEnd; i < count; i++)
+    {
+        if (isSphereInFrustum(centerX[i], centerY[i], centerZ[i], radius[i], frustum))
+        {
+            visible[visibleCount++] = static_cast<uint32_t>(i);
+        }
+    }
+
+    return visibleCount;
+}
+
+const char *getSphereCullingKernelName()
+{
+#if defined(SCENE_CULLING_AVX2)
+    return "avx2";
+#elif defined(SCENE_CULLING_SSE2)
+    return "sse2";
+#elif defined(SCENE_CULLING_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+uint32_t SceneStore::add(const glm::mat4 &transform, const glm::vec3 &boundsCenter, float boundsRadius, uint32_t meshIndex, uint32_t materialIndex)
+{
+    uint32_t object = getCount();
+    transforms.push_back(transform);
+    localCenters.push_back(boundsCenter);
+    localRadii.push_back(boundsRadius);
+    meshIndices.push_back(meshIndex);
+    materialIndices.push_back(materialIndex);
+    lods.push_back(0);
+
+    scales.push_back(1.0f);
+    centerX.push_back(0.0f);
+    centerY.push_back(0.0f);
+    centerZ.push_back(0.0f);
+    radius.push_back(0.0f);
+    updateBounds(object);
+    return object;
+}
+
+void SceneStore::setTransform(uint32_t object, const glm::mat4 &transform)
+{
+    transforms[object] = transform;
+    updateBounds(object);
+}
+
+void SceneStore::clear()
+{
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    radius.clear();
+    scales.clear();
+    transforms.clear();
+    localCenters.clear();
+    localRadii.clear();
+    meshIndices.clear();
+    materialIndices.clear();
+    lods.clear();
+    visibleObjects.clear();
+}
+
+void SceneStore::updateBounds(uint32_t object)
+{
+    // 中心は変換行列で動かし、半径は最も大きく拡大する軸の倍率で広げる
+    const glm::mat4 &transform = transforms[object];
+    glm::vec4 center = transform * glm::vec4(localCenters[object], 1.0f);
+    float scale = std::max(std::max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))), glm::length(glm::vec3(transform[2])));
+
+    centerX[object] = center.x;
+    centerY[object] = center.y;
+    centerZ[object] = center.z;
+    radius[object] = localRadii[object] * scale;
+    scales[object] = scale;
+}
+
+const std::vector<uint32_t> &SceneStore::cull(const Frustum &frustum)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    visibleObjects.resize(getCount());
+    size_t visibleCount = cullSpheres(centerX.data(), centerY.data(), centerZ.data(), radius.data(), getCount(), frustum, visibleObjects.data());
+    visibleObjects.resize(visibleCount);
+
+    cullStats.objectCount = getCount();
+    cullStats.visibleCount = static_cast<uint32_t>(visibleCount);
+    cullStats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return visibleObjects;
+}
+
+void SceneStore::selectLods(const std::vector<uint32_t> &objects, const glm::vec3 &cameraPosition, float pixelsPerUnit, const std::vector<MeshLod> &meshLods, float threshold)
+{
+    uint32_t lodCount = static_cast<uint32_t>(meshLods.size());
+    for (uint32_t object : objects)
+    {
+        // 物体の中で最もカメラに近い所のずれが一番大きく見えるので、境界球の表面までの距離で判定する
+        float dx = centerX[object] - cameraPosition.x;
+        float dy = centerY[object] - cameraPosition.y;
+        float dz = centerZ[object] - cameraPosition.z;
+        float distance = std::sqrt(dx * dx + dy * dy + dz * dz) - radius[object];
+        lods[object] = static_cast<uint8_t>(selectMeshLod(meshLods.data(), lodCount, lods[object], distance, scales[object], pixelsPerUnit, threshold));
+    }
+}
\ No newline at end of file
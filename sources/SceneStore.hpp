@@ -0,0 +1,77 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstddef> // size_tを使用するために必要
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"  // InstanceDataを使用するのに必要
+#include "Meshlet.hpp" // 視錐台の構造体
+#include "MeshLod.hpp" // 画面上の大きさによるLODの選択
+
+// 一回のカリングの結果
+struct SceneCullStats
+{
+    uint32_t objectCount = 0;  // 判定したオブジェクトの数
+    uint32_t visibleCount = 0; // 見えると判定されたオブジェクトの数
+    double milliseconds = 0.0; // 判定にかかった時間
+};
+
+// centerX, centerY, centerZ, radiusで表されるcount個の球のうち、視錐台の中にある(一部でも入っている)物の番号をvisibleに書き込み、その数を返す
+// visibleにはcount個分の領域が必要。8個ずつSIMDでまとめて判定し、余りは一つずつ判定する
+size_t cullSpheres(const float *centerX,
+                   const float *centerY,
+                   const float *centerZ,
+                   const float *radius,
+                   size_t count,
+                   const Frustum &frustum,
+                   uint32_t *visible);
+
+const char *getSphereCullingKernelName(); // cullSpheresがどの命令セットでコンパイルされたか。ログに出すのに使う
+
+// シーンに置いたオブジェクトを、要素毎の配列(structure of arrays)で持つクラス
+// カリングでは境界球の配列だけを先頭から順に読むので、オブジェクトが数十万あってもキャッシュに載る量が予測でき、SIMDでまとめて判定できる
+class SceneStore
+{
+public:
+    // meshIndexのメッシュをtransformで置いたオブジェクトを追加して、その番号を返す
+    // boundsCenterとboundsRadiusは、メッシュの座標系での境界球
+    uint32_t add(const glm::mat4 &transform, const glm::vec3 &boundsCenter, float boundsRadius, uint32_t meshIndex, uint32_t materialIndex);
+    void setTransform(uint32_t object, const glm::mat4 &transform); // オブジェクトを動かし、境界球も求め直す
+    void clear();
+
+    // frustumの中にあるオブジェクトの番号を、番号の順に並べて返す。返した配列は次にcullを呼ぶまで有効
+    // frustumはオブジェクトの変換行列を掛けた後の座標系で与える
+    const std::vector<uint32_t> &cull(const Frustum &frustum);
+    const SceneCullStats &getCullStats() const { return cullStats; } // 最後のcullの結果
+
+    // objectsのオブジェクトのLODを、形のずれが画面上でthresholdピクセルに収まるように選び直す
+    // cameraPositionはcullに渡した視錐台と同じ座標系で、pixelsPerUnitは距離1の所での1単位の長さのピクセル数で与える
+    // 選んだLODはオブジェクト毎に覚えておき、次に選び直す際に境目での切り替えを抑えるのに使う
+    void selectLods(const std::vector<uint32_t> &objects, const glm::vec3 &cameraPosition, float pixelsPerUnit, const std::vector<MeshLod> &meshLods, float threshold);
+    uint32_t getLod(uint32_t object) const { return lods[object]; }
+
+    uint32_t getCount() const { return static_cast<uint32_t>(transforms.size()); }
+    uint32_t getMeshIndex(uint32_t object) const { return meshIndices[object]; }
+    InstanceData getInstanceData(uint32_t object) const { return makeInstanceData(transforms[object], materialIndices[object]); } // インスタンスのバッファに書き込む形式
+
+private:
+    void updateBounds(uint32_t object); // 変換行列を掛けた後の境界球を求める
+
+    // カリングで読む、変換行列を掛けた後の境界球。SIMDのレジスタにそのまま読み込めるように、成分毎に別の配列にする
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> radius;
+
+    std::vector<float> scales;             // 変換行列の最も大きい拡大率。LODの形のずれを物体の大きさに合わせるのに使う
+    std::vector<glm::mat4> transforms;     // オブジェクトの変換行列
+    std::vector<glm::vec3> localCenters;   // メッシュの座標系での境界球の中心
+    std::vector<float> localRadii;         // メッシュの座標系での境界球の半径
+    std::vector<uint32_t> meshIndices;     // オブジェクトのメッシュの番号
+    std::vector<uint32_t> materialIndices; // オブジェクトのマテリアルの番号
+    std::vector<uint8_t> lods;             // オブジェクトの今のLODの番号
+
+    std::vector<uint32_t> visibleObjects; // 最後のcullで見えると判定されたオブジェクトの番号
+    SceneCullStats cullStats;
+};
\ No newline at end of file
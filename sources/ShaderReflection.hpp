@@ -0,0 +1,143 @@
+#pragma once
+// ----------STLのinclude----------
+#include <array>
+#include <cstddef> // size_tを使用するために必要
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp" // 頂点の構造体とシェーダの入力の対応を確かめるのに使用する
+
+// ビルド時にShaderEmbed(tools/ShaderEmbed.cpp)がSPIR-Vから読み取った情報の構造体
+// 生成されたEmbeddedShaders.hppはこのファイルをincludeし、これらの構造体のconstexprなstd::arrayを定義する(要素が無い場合も表せるようにstd::arrayにしている)
+
+// 実行ファイルに埋め込んだシェーダ一つ分
+struct EmbeddedShader
+{
+    VkShaderStageFlagBits stage; // OpEntryPointの実行モデルから決めたステージ
+    const uint32_t *code;        // SPIR-Vのバイトコード
+    size_t codeSize;             // バイトコードのバイト数。VkShaderModuleCreateInfo::codeSizeにそのまま渡せる
+    const char *entryPoint;
+};
+
+// 実行ファイルに埋め込んだコンピュートシェーダ。vkCmdDispatchに渡すワークグループの数を求められるように、ワークグループの大きさも持つ
+struct ComputeShader
+{
+    EmbeddedShader shader;
+    uint32_t localSize[3]; // local_size_x, local_size_y, local_size_z
+};
+
+// シェーダが使用するデスクリプタのバインディング。全てのステージの分をまとめ、使用するステージはstageFlagsに集めてある
+struct ReflectedBinding
+{
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType descriptorType; // ユニフォームバッファは常にVK_DESCRIPTOR_TYPE_UNIFORM_BUFFERになる。動的オフセットで使うかどうかはシェーダからは分からない
+    uint32_t descriptorCount;        // 配列の場合は要素数。要素数を決めていない配列の場合は0
+    VkShaderStageFlags stageFlags;
+    uint32_t blockSize; // バッファの場合の、ブロックのstd140/std430でのバイト数。それ以外は0
+    const char *name;   // バッファの場合はブロックの型名、それ以外は変数名
+};
+
+// 頂点シェーダのinput変数。formatはシェーダ側の型をそのまま表したもので、頂点バッファ側のフォーマットとは異なる場合がある
+struct ReflectedVertexInput
+{
+    uint32_t location;
+    VkFormat format;
+    const char *name;
+};
+
+// プッシュ定数のブロック。全てのステージで同じブロックを使う前提で一つにまとめてある
+struct ReflectedPushConstants
+{
+    VkShaderStageFlags stageFlags; // プッシュ定数を使うステージが無い場合は0
+    uint32_t size;
+};
+
+// constexprな文字列の比較。std::char_traitsのconstexpr対応はコンパイラによってまちまちなので自前で持つ
+constexpr bool isSameName(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// bindingsの中から名前がnameのバインディングを探す。見つからなければnullptr
+template <size_t N>
+constexpr const ReflectedBinding *findReflectedBinding(const std::array<ReflectedBinding, N> &bindings, const char *name)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        if (isSameName(bindings[i].name, name))
+        {
+            return &bindings[i];
+        }
+    }
+    return nullptr;
+}
+
+// 頂点入力のフォーマットの成分の数。頂点バッファで使うフォーマットとfloat/int/uintのベクトルのフォーマットにのみ対応する
+constexpr uint32_t getFormatComponentCount(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R32_SFLOAT:
+    case VK_FORMAT_R32_SINT:
+    case VK_FORMAT_R32_UINT:
+    case VK_FORMAT_R16_UNORM:
+    case VK_FORMAT_R16_SNORM:
+        return 1;
+    case VK_FORMAT_R32G32_SFLOAT:
+    case VK_FORMAT_R32G32_SINT:
+    case VK_FORMAT_R32G32_UINT:
+    case VK_FORMAT_R16G16_UNORM:
+    case VK_FORMAT_R16G16_SNORM:
+        return 2;
+    case VK_FORMAT_R32G32B32_SFLOAT:
+    case VK_FORMAT_R32G32B32_SINT:
+    case VK_FORMAT_R32G32B32_UINT:
+    case VK_FORMAT_R16G16B16_UNORM:
+    case VK_FORMAT_R16G16B16_SNORM:
+        return 3;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+    case VK_FORMAT_R32G32B32A32_SINT:
+    case VK_FORMAT_R32G32B32A32_UINT:
+    case VK_FORMAT_R16G16B16A16_UNORM:
+    case VK_FORMAT_R16G16B16A16_SNORM:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// 頂点の構造体の要素attributesが、シェーダのinput変数inputsを全て満たしているか
+// 同じlocationの要素があり、シェーダの型以上の成分を持っていれば良い(余った成分はシェーダ側で捨てられる)
+template <size_t AttributeCount, size_t InputCount>
+constexpr bool isVertexLayoutCompatible(const std::array<VertexAttribute, AttributeCount> &attributes, const std::array<ReflectedVertexInput, InputCount> &inputs)
+{
+    for (size_t i = 0; i < InputCount; i++)
+    {
+        bool found = false;
+        for (size_t j = 0; j < AttributeCount; j++)
+        {
+            if (attributes[j].location == inputs[i].location &&
+                getFormatComponentCount(attributes[j].format) >= getFormatComponentCount(inputs[i].format))
+            {
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            return false;
+        }
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include "StartupReport.hpp"
+
+// ----------STLのinclude----------
+#include <cstdio> // printfを使用するのに必要
+
+double StartupReport::millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void StartupReport::begin()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    startTime = Clock::now();
+    stages.clear();
+    jobs.clear();
+    waits.clear();
+}
+
+void StartupReport::addStage(const std::string &name, double milliseconds)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stages.push_back({name, milliseconds});
+}
+
+void StartupReport::addJob(const std::string &name, double milliseconds)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back({name, milliseconds});
+}
+
+void StartupReport::addWait(const std::string &name, double milliseconds)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    waits.push_back({name, milliseconds});
+}
+
+void StartupReport::print()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    double total = millisecondsSince(startTime);
+
+    printf("startup report :\n");
+    for (const auto &stage : stages)
+    {
+        printf("  %-28s %9.2f ms\n", stage.name.c_str(), stage.milliseconds);
+    }
+
+    double jobTotal = 0.0;
+    for (const auto &job : jobs)
+    {
+        printf("  [job]  %-21s %9.2f ms\n", job.name.c_str(), job.milliseconds);
+        jobTotal += job.milliseconds;
+    }
+
+    double waitTotal = 0.0;
+    for (const auto &wait : waits)
+    {
+        printf("  [wait] %-21s %9.2f ms\n", wait.name.c_str(), wait.milliseconds);
+        waitTotal += wait.milliseconds;
+    }
+
+    // 並行に処理しなかった場合は、jobの完了を待っていた時間の代わりにjobの処理時間がまるごとかかっていたはず
+    double serialized = total - waitTotal + jobTotal;
+    printf("  total %.2f ms (serialized estimate %.2f ms, overlap saved %.2f ms)\n", total, serialized, serialized - total);
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+// ----------STLのinclude----------
+#include <string>
+#include <vector>
+#include <chrono> // 経過時間の計測に使用する
+#include <mutex>  // ワーカースレッドからの記録を排他するのに使用する
+
+// 起動時の各段階にかかった時間を記録して、最後にまとめて表示するクラス
+// メインスレッドの段階(stage)、ワーカースレッドで並行に行った処理(job)、メインスレッドがjobの完了を待った時間(wait)を分けて記録し、
+// 並行に処理しなかった場合との差を「重ねた事で短縮できた時間」として表示する
+class StartupReport
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static double millisecondsSince(Clock::time_point start); // startから現在までの経過時間をミリ秒で返す
+
+    void begin(); // 起動処理全体の計測を開始する
+
+    void addStage(const std::string &name, double milliseconds); // メインスレッドで行った段階の時間を記録する
+    void addJob(const std::string &name, double milliseconds);   // ワーカースレッドで行った処理の時間を記録する。どのスレッドから呼んでも良い
+    void addWait(const std::string &name, double milliseconds);  // メインスレッドがjobの完了を待って止まっていた時間を記録する
+
+    void print(); // 記録した時間と、起動処理全体にかかった時間を表示する
+
+private:
+    struct Entry
+    {
+        std::string name;
+        double milliseconds;
+    };
+
+    Clock::time_point startTime;
+    std::vector<Entry> stages;
+    std::vector<Entry> jobs;
+    std::vector<Entry> waits;
+    std::mutex mutex; // jobsはワーカースレッドから書き込まれるので排他する
+};
\ No newline at end of file
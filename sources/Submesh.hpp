@@ -0,0 +1,22 @@
+#pragma once
+// ----------STLのinclude----------
+#include <cstdint> // uint32_tを使用するために必要
+#include <cstddef> // size_tを使用するために必要
+
+// メッシュのうち、同じマテリアルで描画するインデックス配列の中の連続した範囲
+// objファイルのshape毎に、面のマテリアルが切り替わる所で分けて作る
+struct Submesh
+{
+    uint32_t firstIndex; // インデックス配列の中での最初のインデックスの位置
+    uint32_t indexCount; // インデックスの数。3の倍数
+    uint32_t material;   // メッシュのマテリアルの配列の中での番号
+};
+
+const size_t MAX_MATERIAL_PATH = 260; // マテリアルのテクスチャのパスの最大の長さ(終端を含む)。WindowsのMAX_PATHに合わせている
+
+// メッシュのマテリアル。今はディフューズのテクスチャだけを使う
+// メッシュのキャッシュにそのまま書き出してマップしたまま読めるように、パスは固定長の配列で持つ
+struct MeshMaterial
+{
+    char texturePath[MAX_MATERIAL_PATH]; // mtlファイルのmap_Kdを、objファイルのあるディレクトリからのパスにした物。無い場合は空文字列
+};
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include "TextureContainer.hpp"
+
+// ----------STLのinclude----------
+#include <vector>
+#include <fstream>
+#include <filesystem> // 一時ファイルの削除やリネームに使用する
+#include <algorithm>  // maxを使用するのに必要
+#include <cmath>      // powを使用するのに必要
+
+// ----------自作クラスのinclude----------
+#include "BlockCompressor.hpp"
+
+// ----------STB(画像ライブラリ)のinclude---------------
+#include "stb_image.h"
+
+namespace
+{
+    // RGBAが1バイトずつ並んだ画像
+    struct RgbaImage
+    {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint8_t> pixels;
+    };
+
+    // sRGBの値を線形な明るさに変換する
+    float srgbToLinear(uint8_t value)
+    {
+        float c = value / 255.0f;
+        return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    // 線形な明るさをsRGBの値に変換する
+    uint8_t linearToSrgb(float value)
+    {
+        float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+        return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+
+    // 画素の値をsRGBとして扱うフォーマットかどうか
+    bool isSrgbFormat(VkFormat format)
+    {
+        switch (format)
+        {
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // 縦横を半分にした画像を作る。縦横2x2の画素の平均を取る
+    // srgbがtrueの場合、色はsRGBのままではなく線形な明るさに直してから平均する(SRGBフォーマットの画像をGPUでBlitした場合と同じ考え方)
+    // UNORMのフォーマットではシェーダが値をそのまま使うので、値のまま平均する
+    RgbaImage downsample(const RgbaImage &source, bool srgb, const std::vector<float> &toLinear)
+    {
+        RgbaImage result;
+        result.width = std::max(source.width / 2, 1u);
+        result.height = std::max(source.height / 2, 1u);
+        result.pixels.resize(static_cast<size_t>(result.width) * result.height * 4);
+
+        for (uint32_t y = 0; y < result.height; y++)
+        {
+            // 元の画像の幅・高さが1の場合は同じ画素を2回使う
+            uint32_t y0 = std::min(y * 2, source.height - 1);
+            uint32_t y1 = std::min(y * 2 + 1, source.height - 1);
+            for (uint32_t x = 0; x < result.width; x++)
+            {
+                uint32_t x0 = std::min(x * 2, source.width - 1);
+                uint32_t x1 = std::min(x * 2 + 1, source.width - 1);
+                const uint8_t *samples[4] = {
+                    &source.pixels[(static_cast<size_t>(y0) * source.width + x0) * 4],
+                    &source.pixels[(static_cast<size_t>(y0) * source.width + x1) * 4],
+                    &source.pixels[(static_cast<size_t>(y1) * source.width + x0) * 4],
+                    &source.pixels[(static_cast<size_t>(y1) * source.width + x1) * 4],
+                };
+
+                uint8_t *destination = &result.pixels[(static_cast<size_t>(y) * result.width + x) * 4];
+                for (int c = 0; c < 4; c++)
+                {
+                    // アルファはどちらのフォーマットでも線形な値なのでそのまま平均する
+                    if (!srgb || c == 3)
+                    {
+                        uint32_t sum = samples[0][c] + samples[1][c] + samples[2][c] + samples[3][c];
+                        destination[c] = static_cast<uint8_t>((sum + 2) / 4);
+                        continue;
+                    }
+
+                    float sum = 0.0f;
+                    for (const uint8_t *sample : samples)
+                    {
+                        sum += toLinear[sample[c]];
+                    }
+                    destination[c] = linearToSrgb(sum * 0.25f);
+                }
+            }
+        }
+
+        return result;
+    }
+
+    // 次のミップレベルの画素データの先頭をLEVEL_ALIGNMENTの倍数に揃えるための詰め物の大きさ
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+std::string TextureContainer::getContainerPath(const std::string &sourcePath)
+{
+    return sourcePath + ".vstx";
+}
+
+bool TextureContainer::bake(const std::string &sourcePath, VkFormat format)
+{
+    TextureContainerHeader header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    if (!MappedFile::getFileStamp(sourcePath, header.sourceSize, header.sourceWriteTime))
+    {
+        return false;
+    }
+
+    // 元画像を読み込む
+    int texWidth, texHeight, texChannels;
+    stbi_uc *pixels = stbi_load(sourcePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        return false;
+    }
+
+    std::vector<RgbaImage> levels(1);
+    levels[0].width = static_cast<uint32_t>(texWidth);
+    levels[0].height = static_cast<uint32_t>(texHeight);
+    levels[0].pixels.assign(pixels, pixels + static_cast<size_t>(texWidth) * texHeight * 4); // RGBAが1バイトずつ並ぶ
+    stbi_image_free(pixels);
+
+    // ミップマップをいくつ作成するかの計算。長辺を2で何回割れるかに元の画像の分で1を足す事で求められる。
+    uint32_t mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+
+    std::vector<float> toLinear(256);
+    for (int i = 0; i < 256; i++)
+    {
+        toLinear[i] = srgbToLinear(static_cast<uint8_t>(i));
+    }
+    bool srgb = isSrgbFormat(format);
+    for (uint32_t i = 1; i < mipLevels; i++)
+    {
+        levels.push_back(downsample(levels[i - 1], srgb, toLinear));
+    }
+
+    // ミップマップは圧縮前の画像から作ったので、各ミップレベルをここでまとめて指定されたフォーマットに変換する
+    std::vector<std::vector<uint8_t>> encodedLevels(mipLevels);
+    for (uint32_t i = 0; i < mipLevels; i++)
+    {
+        encodedLevels[i].resize(getEncodedImageSize(format, levels[i].width, levels[i].height));
+        encodeImage(format, levels[i].pixels.data(), levels[i].width, levels[i].height, encodedLevels[i].data());
+    }
+
+    // ミップレベル毎の情報の配列を作る。画素データはミップレベル0から順に、先頭を揃えて並べる
+    std::vector<TextureLevel> levelInfos(mipLevels);
+    uint64_t dataSize = 0;
+    for (uint32_t i = 0; i < mipLevels; i++)
+    {
+        levelInfos[i] = {};
+        levelInfos[i].offset = dataSize;
+        levelInfos[i].size = encodedLevels[i].size();
+        levelInfos[i].width = levels[i].width;
+        levelInfos[i].height = levels[i].height;
+        dataSize = alignUp(dataSize + levelInfos[i].size, LEVEL_ALIGNMENT);
+    }
+
+    header.format = format;
+    header.width = levels[0].width;
+    header.height = levels[0].height;
+    header.mipLevels = mipLevels;
+    header.dataOffset = alignUp(sizeof(TextureContainerHeader) + sizeof(TextureLevel) * mipLevels, LEVEL_ALIGNMENT);
+    header.dataSize = dataSize;
+
+    // 書き込み途中で終了された場合に壊れたコンテナが残らないように、一時ファイルに書き込んでからリネームする
+    std::string containerPath = getContainerPath(sourcePath);
+    std::string tempPath = containerPath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+
+        const char padding[LEVEL_ALIGNMENT] = {};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(levelInfos.data()), sizeof(TextureLevel) * mipLevels);
+        out.write(padding, header.dataOffset - (sizeof(TextureContainerHeader) + sizeof(TextureLevel) * mipLevels));
+        for (uint32_t i = 0; i < mipLevels; i++)
+        {
+            out.write(reinterpret_cast<const char *>(encodedLevels[i].data()), levelInfos[i].size);
+            out.write(padding, alignUp(levelInfos[i].size, LEVEL_ALIGNMENT) - levelInfos[i].size);
+        }
+
+        if (!out.good())
+        {
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, containerPath, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    return true;
+}
+
+bool TextureContainer::open(const std::string &sourcePath, VkFormat format)
+{
+    close();
+
+    if (!file.open(getContainerPath(sourcePath)) || file.size() < sizeof(TextureContainerHeader))
+    {
+        file.close();
+        return false;
+    }
+
+    auto containerHeader = reinterpret_cast<const TextureContainerHeader *>(file.data());
+
+    // 別のフォーマットで書かれたコンテナや、GPUが対応していない画素フォーマットで作ったコンテナは使えない
+    if (containerHeader->magic != MAGIC ||
+        containerHeader->version != VERSION ||
+        containerHeader->format != static_cast<uint32_t>(format) ||
+        containerHeader->mipLevels == 0)
+    {
+        file.close();
+        return false;
+    }
+
+    // コンテナを作った後に元画像が更新されていたら作り直す必要がある
+    uint64_t sourceSize;
+    int64_t sourceWriteTime;
+    if (!MappedFile::getFileStamp(sourcePath, sourceSize, sourceWriteTime) ||
+        containerHeader->sourceSize != sourceSize ||
+        containerHeader->sourceWriteTime != sourceWriteTime)
+    {
+        file.close();
+        return false;
+    }
+
+    // 書き込みが途中で途切れたファイルでないかを確認する。足し算が溢れないように、ファイルの残りの大きさと比べる
+    if (containerHeader->dataOffset < sizeof(TextureContainerHeader) + sizeof(TextureLevel) * containerHeader->mipLevels ||
+        containerHeader->dataOffset > file.size() ||
+        containerHeader->dataSize > file.size() - containerHeader->dataOffset)
+    {
+        file.close();
+        return false;
+    }
+
+    // 各ミップレベルの画素データが画素データの範囲に収まっているかを確認する。壊れたファイルで範囲外をGPUに転送しないため
+    auto levels = reinterpret_cast<const TextureLevel *>(file.data() + sizeof(TextureContainerHeader));
+    for (uint32_t i = 0; i < containerHeader->mipLevels; i++)
+    {
+        if (levels[i].size > containerHeader->dataSize ||
+            levels[i].offset > containerHeader->dataSize - levels[i].size)
+        {
+            file.close();
+            return false;
+        }
+    }
+
+    header = containerHeader;
+    return true;
+}
+
+void TextureContainer::close()
+{
+    header = nullptr;
+    file.close();
+}
+
+const TextureLevel &TextureContainer::getLevel(uint32_t level) const
+{
+    auto levels = reinterpret_cast<const TextureLevel *>(file.data() + sizeof(TextureContainerHeader));
+    return levels[level];
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+// ----------STLのinclude----------
+#include <string>
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ----------自作クラスのinclude----------
+#include "MappedFile.hpp"
+
+// テクスチャのコンテナファイルの先頭に置かれるヘッダ。この後ろにミップレベル毎の情報(TextureLevel)の配列、画素データの順で並ぶ
+struct TextureContainerHeader
+{
+    uint32_t magic;          // テクスチャのコンテナであることを示す識別子
+    uint32_t version;        // コンテナのフォーマットのバージョン。フォーマットを変えたら上げる
+    uint64_t sourceSize;     // コンテナを作成した時の元画像のファイルサイズ
+    int64_t sourceWriteTime; // コンテナを作成した時の元画像の最終更新時刻
+    uint32_t format;         // 画素データのVkFormat
+    uint32_t width;          // ミップレベル0の幅
+    uint32_t height;         // ミップレベル0の高さ
+    uint32_t mipLevels;      // ミップレベルの数
+    uint64_t dataOffset;     // ファイルの先頭から画素データの先頭までのバイト数
+    uint64_t dataSize;       // 全ミップレベルの画素データの合計のバイト数
+    uint32_t reserved[2];    // ヘッダのサイズを16バイトの倍数にするための詰め物
+};
+
+// 一つのミップレベルの画素データの位置と大きさ
+struct TextureLevel
+{
+    uint64_t offset;      // 画素データの先頭からのオフセット。vkCmdCopyBufferToImageのbufferOffsetにそのまま使える
+    uint64_t size;        // このミップレベルの画素データのバイト数
+    uint32_t width;       // このミップレベルの幅
+    uint32_t height;      // このミップレベルの高さ
+    uint32_t reserved[2]; // 構造体のサイズを16バイトの倍数にするための詰め物
+};
+
+// 全てのミップレベルを事前に作成して隙間なく並べておいたテクスチャのファイル(KTX2のような形式)
+// 画素データはBC1やBC7などのGPUがそのまま読めるブロック圧縮フォーマットに変換した状態で格納できる
+// 実行時には画像のデコードもGPUでのミップマップ生成も行わずに、マップした画素データをそのまま一次バッファにコピーして転送できる
+class TextureContainer
+{
+public:
+    static std::string getContainerPath(const std::string &sourcePath); // sourcePathの画像に対応するコンテナファイルのパスを返す
+    static bool bake(const std::string &sourcePath, VkFormat format);   // sourcePathの画像を読み込んで全てのミップレベルを作り、formatに変換してコンテナファイルに書き出す
+
+    bool open(const std::string &sourcePath, VkFormat format); // コンテナファイルをマップする。コンテナが無いか、元画像が更新されていたか、formatが違う場合はfalseを返す
+    void close();                                              // コンテナファイルのマップを解除する
+
+    bool isOpen() const { return header != nullptr; }
+    VkFormat getFormat() const { return static_cast<VkFormat>(header->format); }
+    uint32_t getWidth() const { return header->width; }
+    uint32_t getHeight() const { return header->height; }
+    uint32_t getMipLevels() const { return header->mipLevels; }
+    const TextureLevel &getLevel(uint32_t level) const;
+    const uint8_t *getData() const { return file.data() + header->dataOffset; } // 全ミップレベルの画素データの先頭
+    uint64_t getDataSize() const { return header->dataSize; }
+
+private:
+    static constexpr uint32_t MAGIC = 0x58545356; // "VSTX"
+    static constexpr uint32_t VERSION = 3;
+    static constexpr uint64_t LEVEL_ALIGNMENT = 16; // 各ミップレベルの画素データの先頭を揃える境界。圧縮フォーマットのブロックサイズの倍数にしておく
+
+    MappedFile file;                                // マップしたコンテナファイル
+    const TextureContainerHeader *header = nullptr; // マップしたコンテナファイルの先頭にあるヘッダ
+};
\ No newline at end of file
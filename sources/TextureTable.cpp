@@ -0,0 +1,200 @@
+#include "TextureTable.hpp"
+
+// ----------STLのinclude----------
+#include <stdexcept> // 例外を投げるのに使用する
+#include <algorithm> // minを使用するのに必要
+
+uint32_t TextureTable::queryCapacity(VkInstance instance, VkPhysicalDevice physicalDevice)
+{
+    // Vulkan 1.0ではvkGetPhysicalDeviceFeatures2とvkGetPhysicalDeviceProperties2はコアの関数ではないので、拡張機能の関数を取得する
+    auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+        vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
+    auto getProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+        vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR"));
+    if (getFeatures2 == nullptr || getProperties2 == nullptr)
+    {
+        return 0;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2KHR features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features.pNext = &indexingFeatures;
+    getFeatures2(physicalDevice, &features);
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT required = getRequiredFeatures();
+    if ((required.shaderSampledImageArrayNonUniformIndexing && !indexingFeatures.shaderSampledImageArrayNonUniformIndexing) ||
+        (required.descriptorBindingSampledImageUpdateAfterBind && !indexingFeatures.descriptorBindingSampledImageUpdateAfterBind) ||
+        (required.descriptorBindingUpdateUnusedWhilePending && !indexingFeatures.descriptorBindingUpdateUnusedWhilePending) ||
+        (required.descriptorBindingPartiallyBound && !indexingFeatures.descriptorBindingPartiallyBound) ||
+        (required.runtimeDescriptorArray && !indexingFeatures.runtimeDescriptorArray))
+    {
+        return 0;
+    }
+
+    // update-after-bindのデスクリプタセットには、通常とは別の上限がある
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2KHR properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties.pNext = &indexingProperties;
+    getProperties2(physicalDevice, &properties);
+
+    uint32_t capacity = indexingProperties.maxUpdateAfterBindDescriptorsInAllPools;
+    capacity = std::min(capacity, indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages);
+    capacity = std::min(capacity, indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers);
+    capacity = std::min(capacity, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages);
+    capacity = std::min(capacity, indexingProperties.maxDescriptorSetUpdateAfterBindSamplers);
+    return capacity;
+}
+
+VkPhysicalDeviceDescriptorIndexingFeaturesEXT TextureTable::getRequiredFeatures()
+{
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;    // インスタンス毎にばらばらな番号で引く
+    features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE; // バインド済みのデスクリプタセットを書き換える
+    features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;    // 描画中のコマンドが使わない要素を書き換える
+    features.descriptorBindingPartiallyBound = VK_TRUE;              // テクスチャが登録されていない要素を残す
+    features.runtimeDescriptorArray = VK_TRUE;                       // シェーダで要素数を決めない配列を使う
+    return features;
+}
+
+void TextureTable::init(VkDevice device, const ReflectedBinding &binding, uint32_t capacity, bool bindless)
+{
+    if (binding.descriptorType != VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || binding.descriptorCount != (bindless ? 0u : 1u))
+    {
+        throw std::runtime_error(bindless ? "texture table binding must be an unsized combined image sampler array!"
+                                          : "per-material texture binding must be a single combined image sampler!");
+    }
+    if (capacity == 0)
+    {
+        throw std::runtime_error("texture table capacity must not be zero!");
+    }
+
+    this->device = device;
+    this->binding = binding.binding;
+    this->capacity = capacity;
+    this->bindless = bindless;
+    count = 0;
+    descriptorSets.clear();
+
+    VkDescriptorSetLayoutBinding layoutBinding{};
+    layoutBinding.binding = binding.binding;
+    layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBinding.descriptorCount = bindless ? capacity : 1;
+    layoutBinding.stageFlags = binding.stageFlags;
+
+    VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+                                               VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+                                               VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = 1;
+    bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+    // update-after-bindのレイアウトには動的オフセットのユニフォームバッファを入れられないので、カメラのデスクリプタセットとは分けてある
+    // bindlessでない場合は拡張の構造体を繋がないので、Vulkan 1.0のコアの機能だけで作れる
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = bindless ? &bindingFlagsInfo : nullptr;
+    layoutInfo.flags = bindless ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT : 0;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &layoutBinding;
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create texture table descriptor set layout!");
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = capacity;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = bindless ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT : 0;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = bindless ? 1 : capacity;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create texture table descriptor pool!");
+    }
+
+    // bindlessでない場合のデスクリプタセットは、テクスチャを登録する時に一つずつ割り当てる
+    if (bindless)
+    {
+        descriptorSets.push_back(allocateSet());
+    }
+}
+
+void TextureTable::destroy()
+{
+    // デスクリプタセットはプールと一緒に解放される
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    descriptorPool = VK_NULL_HANDLE;
+    descriptorSetLayout = VK_NULL_HANDLE;
+    descriptorSets.clear();
+    count = 0;
+}
+
+uint32_t TextureTable::add(VkImageView imageView, VkSampler sampler)
+{
+    if (getCount() >= capacity)
+    {
+        throw std::runtime_error("texture table is full!");
+    }
+
+    // bindlessの場合は表の次の要素に、そうでない場合は新しく割り当てたデスクリプタセットの唯一の要素に書き込む
+    // どちらも描画中のコマンドからは使われていないので、そのまま書き換えられる
+    uint32_t index;
+    VkDescriptorSet dstSet;
+    if (bindless)
+    {
+        index = count++;
+        dstSet = descriptorSets[0];
+    }
+    else
+    {
+        index = static_cast<uint32_t>(descriptorSets.size());
+        dstSet = allocateSet();
+        descriptorSets.push_back(dstSet);
+    }
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = imageView;
+    imageInfo.sampler = sampler;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = dstSet;
+    descriptorWrite.dstBinding = binding;
+    descriptorWrite.dstArrayElement = bindless ? index : 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+    return index;
+}
+
+VkDescriptorSet TextureTable::allocateSet()
+{
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+
+    VkDescriptorSet set;
+    if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate texture table descriptor set!");
+    }
+    return set;
+}
\ No newline at end of file
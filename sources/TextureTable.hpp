@@ -0,0 +1,55 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ----------自作クラスのinclude----------
+#include "ShaderReflection.hpp" // シェーダから読み取ったバインディングでレイアウトを作る
+
+const uint32_t TEXTURE_TABLE_SET = 1; // テクスチャの表に使うデスクリプタセットの番号
+
+// 全てのテクスチャを登録し、シェーダからマテリアルの番号で引けるようにするクラス
+// VK_EXT_descriptor_indexingが使える場合は、全てのテクスチャを一つのデスクリプタの配列(テクスチャの表)に登録する
+// デスクリプタセットは一つだけなので、テクスチャの違うオブジェクトを描画する度にデスクリプタセットをバインドし直す必要が無い
+// update-after-bindを使うので、バインド済みのデスクリプタセットにも、使っていない要素であれば登録ができる
+// 使えない場合は、テクスチャ毎に一枚だけのデスクリプタセットを作り、マテリアルが変わる描画の前にgetSetで取り出してバインドし直す
+class TextureTable
+{
+public:
+    // physicalDeviceでテクスチャの表が使えるなら登録できるテクスチャの最大数を、使えないなら0を返す
+    // VkPhysicalDeviceFeatures2を使うので、インスタンスでVK_KHR_get_physical_device_properties2を有効にしておく事
+    static uint32_t queryCapacity(VkInstance instance, VkPhysicalDevice physicalDevice);
+    // テクスチャの表を使う場合に、論理デバイスの作成時にVkDeviceCreateInfo::pNextに繋いで有効にする機能
+    static VkPhysicalDeviceDescriptorIndexingFeaturesEXT getRequiredFeatures();
+
+    // bindlessの場合、bindingにはシェーダから読み取った要素数を決めていないcombined image samplerの配列を渡す
+    // bindlessでない場合は、一つだけのcombined image samplerを渡す。capacity個のデスクリプタセットを作れるプールを用意する
+    void init(VkDevice device, const ReflectedBinding &binding, uint32_t capacity, bool bindless);
+    void destroy();
+
+    uint32_t add(VkImageView imageView, VkSampler sampler); // テクスチャを登録して、シェーダから引く番号を返す
+
+    bool isBindless() const { return bindless; }
+    VkDescriptorSetLayout getLayout() const { return descriptorSetLayout; }
+    VkDescriptorSet getSet(uint32_t index) const { return bindless ? descriptorSets[0] : descriptorSets[index]; } // 番号indexのテクスチャを使う描画でバインドするデスクリプタセット
+    uint32_t getCapacity() const { return capacity; }
+    uint32_t getCount() const { return static_cast<uint32_t>(bindless ? count : descriptorSets.size()); } // 登録されているテクスチャの数
+
+private:
+    VkDescriptorSet allocateSet(); // プールからdescriptorSetLayoutのデスクリプタセットを一つ割り当てる
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> descriptorSets; // bindlessの場合は表の一つだけ、そうでない場合は登録したテクスチャ毎のデスクリプタセット
+    uint32_t binding = 0;
+    bool bindless = false;
+
+    uint32_t capacity = 0;
+    uint32_t count = 0; // bindlessの場合の、登録したテクスチャの数。次に登録するテクスチャの番号になる
+};
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "UniformRing.hpp"
+
+// ----------STLのinclude----------
+#include <stdexcept> // 例外を投げるために必要
+#include <cstring>   // memcmp, memcpyを使用するために必要
+#include <algorithm> // maxを使用するために必要
+
+void UniformRing::init(VkDevice device,
+                       MemoryAllocator *allocator,
+                       VkDeviceSize minAlignment,
+                       VkDeviceSize dataSize,
+                       uint32_t frameCount)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->dataSize = dataSize;
+
+    // 動的オフセットはminAlignmentの倍数でなければならない。minAlignmentは2の累乗である事が保証されている
+    VkDeviceSize alignment = std::max(minAlignment, (VkDeviceSize)1);
+    stride = (dataSize + alignment - 1) & ~(alignment - 1);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = stride * frameCount;
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create uniform ring buffer!");
+    }
+
+    // CPUから毎回書き込むのでCPUから見えるメモリに置く。メモリブロックは常にマップされているので、vkMapMemoryは呼ばない
+    // コヒーレントなメモリなので、書き込んだ後にvkFlushMappedMemoryRangesも必要ない
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+    memory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true, MemoryCategory::Uniform);
+    vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+
+    latest.assign(static_cast<size_t>(dataSize), 0);
+    version = 0;
+    frameVersions.assign(frameCount, 0);
+}
+
+void UniformRing::destroy()
+{
+    if (buffer == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator->free(memory);
+    buffer = VK_NULL_HANDLE;
+}
+
+void UniformRing::set(const void *data)
+{
+    // マップしたメモリはGPUからの読み込み向けで、CPUから読むと遅い事があるので、比較はCPU側の控えと行う
+    if (version > 0 && memcmp(latest.data(), data, latest.size()) == 0)
+    {
+        return;
+    }
+
+    memcpy(latest.data(), data, latest.size());
+    version++;
+}
+
+uint32_t UniformRing::acquire(uint32_t frame)
+{
+    VkDeviceSize offset = stride * frame;
+
+    // 他のフレームの領域はGPUが読んでいる途中かもしれないので、書き込むのはこのフレームの領域だけにする
+    // 内容が変わっていれば、全てのフレームの領域が一巡するまでの間だけ書き込みが発生する
+    if (frameVersions[frame] != version)
+    {
+        memcpy(static_cast<char *>(memory.mapped) + offset, latest.data(), latest.size());
+        frameVersions[frame] = version;
+    }
+
+    return static_cast<uint32_t>(offset);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ----------自作クラスのinclude----------
+#include "MemoryAllocator.hpp"
+
+// シェーダに渡すユニフォームデータを、常にマップした一つのバッファにフレーム数分並べて持つクラス
+// どのフレームの領域を使うかはデスクリプタの動的オフセットで選ぶので、デスクリプタセットはフレーム数によらず一つで済む
+// 最新の内容はCPU側に控えておき、内容が変わった時だけ、GPUが使い終わったフレームの領域に書き込む
+class UniformRing
+{
+public:
+    // dataSizeバイトのデータをframeCount個分並べたバッファを作成する
+    // minAlignmentにはVkPhysicalDeviceLimits::minUniformBufferOffsetAlignmentを渡す
+    void init(VkDevice device,
+              MemoryAllocator *allocator,
+              VkDeviceSize minAlignment,
+              VkDeviceSize dataSize,
+              uint32_t frameCount);
+    void destroy();
+
+    void set(const void *data);       // dataSizeバイトのdataを最新の内容にする。控えてある内容と同じなら何もしない
+    uint32_t acquire(uint32_t frame); // frame番目の領域を最新の内容にして、その動的オフセットを返す。frameの前回の描画が終わってから呼ぶ事
+    uint32_t getOffset(uint32_t frame) const { return static_cast<uint32_t>(stride * frame); } // frame番目の領域の動的オフセット。記録済みのコマンドバッファに埋め込むのに使う
+
+    VkBuffer getBuffer() const { return buffer; }
+    VkDeviceSize getRange() const { return dataSize; } // デスクリプタに設定する、一つのフレームの領域の大きさ
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    MemoryAllocator *allocator = nullptr;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    MemoryAllocation memory;
+    VkDeviceSize dataSize = 0;
+    VkDeviceSize stride = 0; // フレーム毎の領域の間隔。dataSizeをminAlignmentの倍数に切り上げた値
+
+    std::vector<uint8_t> latest;         // 最新の内容
+    uint64_t version = 0;                // latestが変わった回数
+    std::vector<uint64_t> frameVersions; // 各フレームの領域に書き込んである内容のversion
+};
\ No newline at end of file
@@ -0,0 +1,522 @@
+#include "UploadEngine.hpp"
+
+// ----------STLのinclude----------
+#include <stdexcept> // 例外を投げるために必要
+#include <limits>    // numeric_limitsを使用するために必要
+#include <algorithm> // min, maxを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "BlockCompressor.hpp" // 圧縮フォーマットのブロックの行のバイト数を求めるのに使用する
+
+void UploadEngine::init(VkDevice device,
+                        MemoryAllocator *allocator,
+                        uint32_t graphicsFamily,
+                        VkQueue graphicsQueue,
+                        std::optional<uint32_t> transferFamily,
+                        VkQueue transferQueue,
+                        VkDeviceSize stagingSize)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->graphicsFamily = graphicsFamily;
+    this->graphicsQueue = graphicsQueue;
+    this->transferFamily = transferFamily;
+    this->transferQueue = transferFamily.has_value() ? transferQueue : graphicsQueue;
+
+    // コマンドバッファはバッチ毎に使い回すので個別にリセットできるようにし、短命である事も伝えておく
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = transferFamily.value_or(graphicsFamily);
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &transferPool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create upload command pool!");
+    }
+
+    if (transferFamily.has_value())
+    {
+        poolInfo.queueFamilyIndex = graphicsFamily;
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &acquirePool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create upload command pool!");
+        }
+    }
+
+    // 一次バッファのリングは起動時に一度だけ作成し、以降の転送では切り出すだけにする
+    // 転送専用のキューとグラフィックス用のキューのどちらからもコピー元として読むが、読み込みだけなので排他モードのままで良い
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = stagingSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create staging ring buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, stagingBuffer, &memRequirements);
+    stagingMemory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true, MemoryCategory::Staging);
+    vkBindBufferMemory(device, stagingBuffer, stagingMemory.memory, stagingMemory.offset);
+
+    stagingCapacity = stagingSize;
+    stagingHead = 0;
+    stagingUsed = 0;
+}
+
+void UploadEngine::destroy()
+{
+    if (device == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    wait(flush());
+
+    for (auto &batch : freeBatches)
+    {
+        if (batch.transferFinished != VK_NULL_HANDLE)
+        {
+            vkDestroySemaphore(device, batch.transferFinished, nullptr);
+        }
+        vkDestroyFence(device, batch.fence, nullptr);
+    }
+    freeBatches.clear();
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator->free(stagingMemory);
+    stagingBuffer = VK_NULL_HANDLE;
+
+    // コマンドバッファはプールと一緒に解放される
+    vkDestroyCommandPool(device, transferPool, nullptr);
+    if (acquirePool != VK_NULL_HANDLE)
+    {
+        vkDestroyCommandPool(device, acquirePool, nullptr);
+    }
+    transferPool = VK_NULL_HANDLE;
+    acquirePool = VK_NULL_HANDLE;
+    device = VK_NULL_HANDLE;
+}
+
+void UploadEngine::beginBatch()
+{
+    if (recording.has_value())
+    {
+        return;
+    }
+
+    if (!freeBatches.empty())
+    {
+        recording = std::move(freeBatches.back());
+        freeBatches.pop_back();
+    }
+    else
+    {
+        Batch batch;
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = transferPool;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &batch.transferCommands) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate upload command buffer!");
+        }
+
+        if (transferFamily.has_value())
+        {
+            allocInfo.commandPool = acquirePool;
+            if (vkAllocateCommandBuffers(device, &allocInfo, &batch.acquireCommands) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to allocate upload command buffer!");
+            }
+
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch.transferFinished) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create upload semaphore!");
+            }
+        }
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create upload fence!");
+        }
+
+        recording = std::move(batch);
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(recording->transferCommands, &beginInfo);
+    if (recording->acquireCommands != VK_NULL_HANDLE)
+    {
+        vkBeginCommandBuffer(recording->acquireCommands, &beginInfo);
+    }
+}
+
+void UploadEngine::transferOwnership(const VkBufferMemoryBarrier *bufferBarrier,
+                                     const VkImageMemoryBarrier *imageBarrier,
+                                     VkPipelineStageFlags dstStage)
+{
+    uint32_t bufferBarrierCount = bufferBarrier != nullptr ? 1 : 0;
+    uint32_t imageBarrierCount = imageBarrier != nullptr ? 1 : 0;
+    VkBufferMemoryBarrier bufferCopy = bufferBarrier != nullptr ? *bufferBarrier : VkBufferMemoryBarrier{};
+    VkImageMemoryBarrier imageCopy = imageBarrier != nullptr ? *imageBarrier : VkImageMemoryBarrier{};
+
+    if (!transferFamily.has_value())
+    {
+        // 同じキューで使うので、所有権の移動は無く、コピーの完了を待つだけのバリアで良い
+        bufferCopy.srcQueueFamilyIndex = bufferCopy.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageCopy.srcQueueFamilyIndex = imageCopy.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        vkCmdPipelineBarrier(recording->transferCommands,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             dstStage,
+                             0,
+                             0, nullptr,
+                             bufferBarrierCount, &bufferCopy,
+                             imageBarrierCount, &imageCopy);
+    }
+    else
+    {
+        // 転送用のキューファミリー側でのrelease。コピー先のアクセスはacquire側で指定するので、ここでは書き込みの完了だけを示す
+        bufferCopy.srcQueueFamilyIndex = imageCopy.srcQueueFamilyIndex = transferFamily.value();
+        bufferCopy.dstQueueFamilyIndex = imageCopy.dstQueueFamilyIndex = graphicsFamily;
+        VkAccessFlags bufferDstAccess = bufferCopy.dstAccessMask;
+        VkAccessFlags imageDstAccess = imageCopy.dstAccessMask;
+        bufferCopy.dstAccessMask = 0;
+        imageCopy.dstAccessMask = 0;
+        vkCmdPipelineBarrier(recording->transferCommands,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0,
+                             0, nullptr,
+                             bufferBarrierCount, &bufferCopy,
+                             imageBarrierCount, &imageCopy);
+
+        // グラフィックス用のキューファミリー側でのacquire。コピーの完了はセマフォで待つので、書き込みのアクセスは指定しない
+        // 画像のレイアウトの変換はreleaseとacquireに同じものを指定する
+        // セマフォはdstStageで待つので、acquireの開始ステージもdstStageにしてセマフォの待ちの後に実行されるようにする
+        // TOP_OF_PIPEにすると、セマフォの待ちより前のステージと同期する事になり、レイアウトの変換がコピーの完了を待たずに行われ得る
+        bufferCopy.srcAccessMask = 0;
+        imageCopy.srcAccessMask = 0;
+        bufferCopy.dstAccessMask = bufferDstAccess;
+        imageCopy.dstAccessMask = imageDstAccess;
+        vkCmdPipelineBarrier(recording->acquireCommands,
+                             dstStage,
+                             dstStage,
+                             0,
+                             0, nullptr,
+                             bufferBarrierCount, &bufferCopy,
+                             imageBarrierCount, &imageCopy);
+    }
+
+    recording->dstStages |= dstStage;
+}
+
+void UploadEngine::copyBuffer(VkBuffer src,
+                              VkDeviceSize srcOffset,
+                              VkBuffer dst,
+                              VkDeviceSize dstOffset,
+                              VkDeviceSize size,
+                              VkPipelineStageFlags dstStage,
+                              VkAccessFlags dstAccess)
+{
+    beginBatch();
+
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset; // コピー先のバッファの何バイト目から書き込むか
+    copyRegion.size = size;
+    vkCmdCopyBuffer(recording->transferCommands, src, dst, 1, &copyRegion);
+
+    // コピーした範囲だけをグラフィックス用のキューに渡す
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dstAccess;
+    barrier.buffer = dst;
+    barrier.offset = dstOffset;
+    barrier.size = size;
+    transferOwnership(&barrier, nullptr, dstStage);
+}
+
+void UploadEngine::beginImageCopy(VkImage image, uint32_t mipLevels)
+{
+    beginBatch();
+
+    // imageのレイアウトを転送するのに最適な形に変換する。作られたばかりで所有しているキューファミリーは無いので、所有権の移動は不要
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(recording->transferCommands,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0, nullptr,
+                         0, nullptr,
+                         1, &barrier);
+}
+
+void UploadEngine::endImageCopy(VkImage image, uint32_t mipLevels)
+{
+    beginBatch();
+
+    // 全てのミップレベルをシェーダから読み込める形に変換しながら、グラフィックス用のキューに渡す
+    // コピーが複数のバッチに分かれていても、同じキューに提出順に流れるので、このバリアは全てのコピーの後に実行される
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    transferOwnership(nullptr, &barrier, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+UploadEngine::StagingSpan UploadEngine::allocateStaging(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (size > stagingCapacity)
+    {
+        throw std::runtime_error("staging allocation is larger than the staging ring!");
+    }
+
+    while (true)
+    {
+        // 使用中の範囲が無ければ、先頭から切り出して折り返しによる隙間を作らないようにする
+        if (stagingUsed == 0)
+        {
+            stagingHead = 0;
+        }
+
+        // 末尾に収まらない場合は先頭に折り返す。末尾の余りは隙間として、このバッチが完了するまで使用中の扱いにする
+        VkDeviceSize offset = (stagingHead + alignment - 1) / alignment * alignment;
+        VkDeviceSize padding = offset - stagingHead;
+        if (offset + size > stagingCapacity)
+        {
+            offset = 0;
+            padding = stagingCapacity - stagingHead;
+        }
+
+        if (stagingUsed + padding + size <= stagingCapacity)
+        {
+            beginBatch();
+            recording->stagingBytes += padding + size;
+            stagingUsed += padding + size;
+            stagingHead = offset + size;
+
+            StagingSpan span;
+            span.data = static_cast<char *>(stagingMemory.mapped) + offset;
+            span.buffer = stagingBuffer;
+            span.offset = offset;
+            span.size = size;
+            return span;
+        }
+
+        // 空きが足りないので、最も古い転送の完了を待って、その範囲を返してもらう
+        // 提出済みの転送が無ければ、記録中のコピーが範囲を使っているので、先に提出してから待つ
+        if (inFlight.empty())
+        {
+            flush();
+        }
+        wait(inFlight.front().ticket);
+    }
+}
+
+UploadEngine::Ticket UploadEngine::uploadBuffer(VkBuffer dst,
+                                                VkDeviceSize dstOffset,
+                                                VkDeviceSize size,
+                                                VkDeviceSize elementSize,
+                                                const FillFunction &fill,
+                                                VkPipelineStageFlags dstStage,
+                                                VkAccessFlags dstAccess)
+{
+    // リングの半分ずつに分けて転送すると、GPUが片方からコピーしている間にCPUでもう片方に次の範囲を書き込める
+    // 要素が一次バッファの境目で分断されないように、分ける大きさは要素のサイズの倍数にしておく
+    VkDeviceSize chunkLimit = std::max(stagingCapacity / 2 / elementSize, (VkDeviceSize)1) * elementSize;
+
+    Ticket ticket = nextTicket - 1;
+    for (VkDeviceSize offset = 0; offset < size; offset += chunkLimit)
+    {
+        VkDeviceSize chunkSize = std::min(chunkLimit, size - offset);
+        StagingSpan span = allocateStaging(chunkSize, 4);
+        fill(span.data, offset, chunkSize);
+        copyBuffer(span.buffer, span.offset, dst, dstOffset + offset, chunkSize, dstStage, dstAccess);
+
+        // 分けた範囲毎に提出して、次の範囲を書き込んでいる間にGPUでコピーを進めてもらう
+        ticket = flush();
+    }
+    return ticket;
+}
+
+UploadEngine::Ticket UploadEngine::uploadImage(VkImage image,
+                                               VkFormat format,
+                                               uint32_t mipLevels,
+                                               const std::vector<VkBufferImageCopy> &regions,
+                                               const FillFunction &fill)
+{
+    VkDeviceSize chunkLimit = stagingCapacity / 2;
+
+    // 圧縮フォーマットは4x4画素のブロック単位でしかコピーできないので、ブロックの行単位で分ける
+    // bufferOffsetはブロック(非圧縮なら画素)のバイト数の倍数である必要があるので、16バイト境界に揃えて切り出す
+    const uint32_t blockHeight = isBlockCompressedFormat(format) ? 4 : 1;
+
+    beginImageCopy(image, mipLevels);
+    for (const VkBufferImageCopy &region : regions)
+    {
+        uint32_t height = region.imageExtent.height;
+        uint32_t blockRows = (height + blockHeight - 1) / blockHeight;
+        VkDeviceSize rowBytes = getEncodedImageSize(format, region.imageExtent.width, blockHeight);
+        uint32_t rowsPerChunk = static_cast<uint32_t>(std::max(chunkLimit / rowBytes, (VkDeviceSize)1));
+
+        for (uint32_t row = 0; row < blockRows; row += rowsPerChunk)
+        {
+            uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+            StagingSpan span = allocateStaging(rowBytes * rows, 16);
+            fill(span.data, region.bufferOffset + rowBytes * row, rowBytes * rows);
+
+            VkBufferImageCopy piece = region;
+            piece.bufferOffset = span.offset;
+            piece.bufferRowLength = 0; // 0の場合は画素が隙間なく並んでいるものとして扱われる
+            piece.bufferImageHeight = 0;
+            piece.imageOffset.y = region.imageOffset.y + static_cast<int32_t>(row * blockHeight);
+            piece.imageExtent.height = std::min(rows * blockHeight, height - row * blockHeight);
+
+            // allocateStagingで記録中のバッチが提出されている事があるので、コピーは改めて始めたバッチに記録する
+            beginBatch();
+            vkCmdCopyBufferToImage(recording->transferCommands,
+                                   span.buffer,
+                                   image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   1,
+                                   &piece);
+        }
+    }
+    endImageCopy(image, mipLevels);
+
+    return flush();
+}
+
+UploadEngine::Ticket UploadEngine::flush()
+{
+    if (!recording.has_value())
+    {
+        return nextTicket - 1;
+    }
+
+    Batch batch = std::move(*recording);
+    recording.reset();
+    batch.ticket = nextTicket++;
+
+    vkEndCommandBuffer(batch.transferCommands);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.transferCommands;
+
+    if (!transferFamily.has_value())
+    {
+        // グラフィックス用のキューに提出するが、完了はフェンスで確認するのでキューが空になるまで待ったりはしない
+        if (vkQueueSubmit(transferQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to submit upload command buffer!");
+        }
+    }
+    else
+    {
+        vkEndCommandBuffer(batch.acquireCommands);
+
+        // 転送用のキューでコピーし、終わったらセマフォをシグナルする
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &batch.transferFinished;
+        if (vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to submit upload command buffer!");
+        }
+
+        // グラフィックス用のキューでは、セマフォを待ってからacquireバリアを実行する
+        // 待つのはコピー先を使うステージだけなので、それ以前のステージの処理は止まらない
+        VkPipelineStageFlags waitStages = batch.dstStages != 0 ? batch.dstStages : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo acquireInfo{};
+        acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        acquireInfo.waitSemaphoreCount = 1;
+        acquireInfo.pWaitSemaphores = &batch.transferFinished;
+        acquireInfo.pWaitDstStageMask = &waitStages;
+        acquireInfo.commandBufferCount = 1;
+        acquireInfo.pCommandBuffers = &batch.acquireCommands;
+        if (vkQueueSubmit(graphicsQueue, 1, &acquireInfo, batch.fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to submit upload acquire command buffer!");
+        }
+    }
+
+    Ticket ticket = batch.ticket;
+    inFlight.push_back(std::move(batch));
+    return ticket;
+}
+
+void UploadEngine::wait(Ticket ticket)
+{
+    // バッチは提出順に完了するとは限らないが、後始末は提出順に行うので先頭から順に待てば良い
+    while (!inFlight.empty() && inFlight.front().ticket <= ticket)
+    {
+        vkWaitForFences(device, 1, &inFlight.front().fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        releaseBatch(inFlight.front());
+        inFlight.pop_front();
+    }
+}
+
+void UploadEngine::collect()
+{
+    while (!inFlight.empty() && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS)
+    {
+        releaseBatch(inFlight.front());
+        inFlight.pop_front();
+    }
+}
+
+bool UploadEngine::isComplete(Ticket ticket)
+{
+    collect();
+    return ticket <= completedTicket;
+}
+
+void UploadEngine::releaseBatch(Batch &batch)
+{
+    // このバッチのコピー元の範囲はリングの使用中の範囲の先頭にあるので、その分だけ空きに戻す
+    stagingUsed -= batch.stagingBytes;
+    batch.stagingBytes = 0;
+
+    vkResetFences(device, 1, &batch.fence);
+    vkResetCommandBuffer(batch.transferCommands, 0);
+    if (batch.acquireCommands != VK_NULL_HANDLE)
+    {
+        vkResetCommandBuffer(batch.acquireCommands, 0);
+    }
+    batch.dstStages = 0;
+    completedTicket = batch.ticket;
+
+    freeBatches.push_back(std::move(batch));
+}
\ No newline at end of file
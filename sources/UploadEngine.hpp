@@ -0,0 +1,131 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <deque>
+#include <optional>   // 転送専用のキューファミリーが無い場合を表すのに使用する
+#include <cstdint>    // uint64_tを使用するために必要
+#include <functional> // 一次バッファへの書き込み処理を受け取るのに使用する
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ----------自作クラスのinclude----------
+#include "MemoryAllocator.hpp"
+
+// CPUからGPUのみが見えるバッファ・画像へのコピーをまとめて記録し、転送専用のキューに非同期に流すクラス
+// コピー毎にコマンドバッファを作ってキューが空になるまで待つのではなく、flushまでに記録したコピーを一つのコマンドバッファで提出し、完了はフェンスで確認する
+// 転送専用のキューファミリーがある場合は、コピー先の所有権をグラフィックス用のキューファミリーに移す(release/acquire)バリアも記録する
+// 一次バッファは転送の度に作らず、常にマップした固定の大きさのリングから切り出し、その転送が完了したら再利用する
+class UploadEngine
+{
+public:
+    using Ticket = uint64_t; // flushで提出した転送の番号。番号が小さいほど先に提出されている
+
+    // 一次バッファのリングから切り出した範囲
+    struct StagingSpan
+    {
+        void *data = nullptr;             // 範囲の先頭をマップしたアドレス。ここに転送するデータを直接書き込む
+        VkBuffer buffer = VK_NULL_HANDLE; // コピー元に指定するバッファ
+        VkDeviceSize offset = 0;          // buffer内での範囲の位置
+        VkDeviceSize size = 0;
+    };
+
+    // 一次バッファのoffsetバイト目からのsizeバイトを書き込む関数。offsetは転送するデータ全体の中での位置
+    using FillFunction = std::function<void(void *staging, VkDeviceSize offset, VkDeviceSize size)>;
+
+    // transferFamilyが無い場合は、グラフィックス用のキューでコピーを行う
+    // 一次バッファのリングとしてstagingSizeバイトのバッファを確保する
+    void init(VkDevice device,
+              MemoryAllocator *allocator,
+              uint32_t graphicsFamily,
+              VkQueue graphicsQueue,
+              std::optional<uint32_t> transferFamily,
+              VkQueue transferQueue,
+              VkDeviceSize stagingSize);
+    void destroy(); // 完了していない転送を待ってから、全てのオブジェクトを破棄する
+
+    bool hasDedicatedTransferQueue() const { return transferFamily.has_value(); }
+
+    // srcのsrcOffsetバイト目からsizeバイトを、dstのdstOffsetバイト目以降にコピーする
+    // dstStage, dstAccessにはコピーしたデータをグラフィックス用のキューで使うステージとアクセスの種類を指定する
+    void copyBuffer(VkBuffer src,
+                    VkDeviceSize srcOffset,
+                    VkBuffer dst,
+                    VkDeviceSize dstOffset,
+                    VkDeviceSize size,
+                    VkPipelineStageFlags dstStage,
+                    VkAccessFlags dstAccess);
+
+    // 一次バッファのリングからsizeバイトを切り出す。空きが無い場合は、古い転送が完了して空くまで待つ
+    // 切り出した範囲からのコピーは、次にallocateStagingを呼ぶ前に記録する事。その転送が完了すると範囲は再利用される
+    StagingSpan allocateStaging(VkDeviceSize size, VkDeviceSize alignment);
+
+    // fillが一次バッファに書き込んだsizeバイトのデータを、dstのdstOffsetバイト目以降に転送する
+    // リングに収まらない大きさのデータは、elementSizeの倍数ずつに分けて転送する。転送の完了は待たずに、最後の転送の番号を返す
+    Ticket uploadBuffer(VkBuffer dst,
+                        VkDeviceSize dstOffset,
+                        VkDeviceSize size,
+                        VkDeviceSize elementSize,
+                        const FillFunction &fill,
+                        VkPipelineStageFlags dstStage,
+                        VkAccessFlags dstAccess);
+
+    // 作成直後(レイアウトが未定義)のimageの0~mipLevels-1のミップレベルに、regionsに従ってfillが書き込んだデータを転送する
+    // regionsのbufferOffsetは転送するデータ全体の中での位置を指定する。リングに収まらないregionは、ブロックの行単位で分けて転送する
+    // コピー後はフラグメントシェーダから読み込めるレイアウト(SHADER_READ_ONLY_OPTIMAL)に変換される
+    Ticket uploadImage(VkImage image,
+                       VkFormat format,
+                       uint32_t mipLevels,
+                       const std::vector<VkBufferImageCopy> &regions,
+                       const FillFunction &fill);
+
+    Ticket flush();             // ここまでに記録したコピーを提出する。何も記録していなければ最後に提出した転送の番号を返す
+    void wait(Ticket ticket);   // ticketまでの転送が完了するまで待つ
+    void collect();             // 完了した転送の後始末を行う。待機はしないので毎フレーム呼んでも良い
+    bool isComplete(Ticket ticket);
+
+private:
+    // 一度の提出にまとめられたコピーと、その完了を確認するためのオブジェクト
+    struct Batch
+    {
+        Ticket ticket = 0;
+        VkCommandBuffer transferCommands = VK_NULL_HANDLE; // コピーとreleaseバリアを記録するコマンドバッファ
+        VkCommandBuffer acquireCommands = VK_NULL_HANDLE;  // グラフィックス用のキューで実行するacquireバリア。転送専用のキューが無い場合は使わない
+        VkSemaphore transferFinished = VK_NULL_HANDLE;     // コピーが終わってからacquireバリアを実行するためのセマフォ
+        VkFence fence = VK_NULL_HANDLE;                    // このバッチの全てのコマンドが完了するとシグナルされる
+        VkPipelineStageFlags dstStages = 0;                // acquireバリアの後でコピー先を使うステージ。セマフォの待機ステージに使う
+        VkDeviceSize stagingBytes = 0;                     // このバッチのコピー元として切り出した、一次バッファのリングのバイト数(隙間も含む)
+    };
+
+    void beginBatch(); // 記録中のバッチが無ければ新しく始める
+    void releaseBatch(Batch &batch); // 完了したバッチの一次バッファの範囲を返し、オブジェクトを再利用できるように戻す
+    void transferOwnership(const VkBufferMemoryBarrier *bufferBarrier,
+                           const VkImageMemoryBarrier *imageBarrier,
+                           VkPipelineStageFlags dstStage); // コピー後のバリア(転送専用のキューがある場合はrelease/acquireの組)を記録する
+    void beginImageCopy(VkImage image, uint32_t mipLevels); // imageを転送先にできるレイアウトに変換する
+    void endImageCopy(VkImage image, uint32_t mipLevels);   // imageをシェーダから読めるレイアウトに変換し、グラフィックス用のキューに渡す
+
+    VkDevice device = VK_NULL_HANDLE;
+    MemoryAllocator *allocator = nullptr; // 一次バッファのリングのメモリを割り当てる元
+    uint32_t graphicsFamily = 0;
+    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    std::optional<uint32_t> transferFamily;
+    VkQueue transferQueue = VK_NULL_HANDLE; // コピーを提出するキュー。転送専用のキューが無い場合はgraphicsQueueと同じ
+
+    VkCommandPool transferPool = VK_NULL_HANDLE; // コピーを記録するコマンドバッファのプール
+    VkCommandPool acquirePool = VK_NULL_HANDLE;  // acquireバリアを記録するコマンドバッファのプール。グラフィックス用のキューファミリーに属する
+
+    std::optional<Batch> recording; // 記録中のバッチ
+    std::deque<Batch> inFlight;     // 提出済みで、まだ後始末していないバッチ。提出順に並ぶ
+    std::vector<Batch> freeBatches; // 後始末が終わって再利用できるバッチ
+    Ticket nextTicket = 1;
+    Ticket completedTicket = 0; // この番号までの転送は完了して後始末も済んでいる
+
+    VkBuffer stagingBuffer = VK_NULL_HANDLE; // 一次バッファのリング。常にマップされている
+    MemoryAllocation stagingMemory;
+    VkDeviceSize stagingCapacity = 0;
+    VkDeviceSize stagingHead = 0; // 次に切り出す位置
+    VkDeviceSize stagingUsed = 0; // 完了していない転送が使っているバイト数。使用中の範囲はstagingHeadの手前に一続きで並ぶ
+};
\ No newline at end of file
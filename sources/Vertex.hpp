@@ -0,0 +1,155 @@
+#pragma once
+// ----------STLのinclude----------
+#include <array>
+#include <cstddef> // offsetofを使用するのに必要
+#include <cstdint> // uint16_tを使用するのに必要
+
+// ----------GLFW(Vulkan込み)のinclude-----------
+#define VK_USE_PLATFORM_WIN32_KHR // win32のAPIを使用してウインドウにアクセスするために必要
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// ----------GLMのinclude----------
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE // GLMのデフォルトでは深度は-1.0~1.0で扱われるが、Vulkanでは0.0~1.0なので変更する
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// 頂点データの構造体は、メッシュのキャッシュなどアプリケーション本体以外からも参照するのでヘッダを分けている
+
+// objファイルから読み込んだままの精度の頂点。重複除去や最適化、メッシュのキャッシュはこの形式で行う
+// 頂点色は常に白だったので持たないようにした
+struct Vertex
+{
+    glm::vec3 pos;
+    glm::vec2 texCoord;
+
+    bool operator==(const Vertex &other) const
+    {
+        return pos == other.pos && texCoord == other.texCoord;
+    }
+};
+
+// GPUに渡すために量子化した頂点。座標とUVをメッシュ毎のスケールとバイアスで0~1に正規化し、16ビットの整数で持つ
+// floatのVertexが20バイトなのに対して12バイトで済む
+struct PackedVertex
+{
+    uint16_t pos[4];      // 座標。4つ目の要素はアラインメントを揃えるための詰め物(3要素の16ビットフォーマットは頂点入力に対応していないGPUが多い)
+    uint16_t texCoord[2]; // UV座標
+};
+
+// 同じメッシュを何度も描画する際の、インスタンス毎のデータ。頂点バッファとは別のバインディングでインスタンス毎に読み込まれる
+// 変換行列はアフィン変換なので、最後の行(0, 0, 0, 1)を省いた3行だけを持つ
+struct InstanceData
+{
+    glm::vec4 transformRows[3]; // 変換行列の上3行
+    uint32_t materialIndex;     // マテリアルの番号
+};
+
+// transformとmaterialIndexからインスタンスのデータを作る
+inline InstanceData makeInstanceData(const glm::mat4 &transform, uint32_t materialIndex)
+{
+    // GLMの行列は列優先なので、m[列][行]で取り出して行を組み立てる
+    InstanceData instance{};
+    for (int row = 0; row < 3; row++)
+    {
+        instance.transformRows[row] = glm::vec4(transform[0][row], transform[1][row], transform[2][row], transform[3][row]);
+    }
+    instance.materialIndex = materialIndex;
+    return instance;
+}
+
+// インスタンスのデータの変換行列を4x4の行列に戻す
+inline glm::mat4 getInstanceTransform(const InstanceData &instance)
+{
+    return glm::transpose(glm::mat4(instance.transformRows[0], instance.transformRows[1], instance.transformRows[2], glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+}
+
+// 頂点の一つの要素が、頂点シェーダのどのinputにどのフォーマットで渡されるかの記述
+struct VertexAttribute
+{
+    uint32_t location; // vertexシェーダの何番目のinputと紐づくか
+    VkFormat format;   // データのフォーマット
+    uint32_t offset;   // 構造体の先頭アドレスからその要素が入っているアドレスのオフセット
+};
+
+// 頂点の構造体毎に特殊化して、ATTRIBUTESにその構造体の要素の記述を並べる
+// getBindingDescription, getAttributeDescriptionsはこの記述から作られる
+template <typename T>
+struct VertexLayout;
+
+template <>
+struct VertexLayout<Vertex>
+{
+    static constexpr std::array<VertexAttribute, 2> ATTRIBUTES = {{
+        {0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos)},   // 頂点座標、32ビットのfloatデータが3つ
+        {1, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, texCoord)}, // テクスチャのUVマッピング
+    }};
+};
+
+template <>
+struct VertexLayout<PackedVertex>
+{
+    static constexpr std::array<VertexAttribute, 2> ATTRIBUTES = {{
+        {0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(PackedVertex, pos)}, // 16ビットの整数を0.0~1.0に正規化して読み込む
+        {1, VK_FORMAT_R16G16_UNORM, offsetof(PackedVertex, texCoord)},
+    }};
+};
+
+// 頂点シェーダのinputの2番目以降はインスタンスのデータ。変換行列の各行を一つのinputとして渡す
+template <>
+struct VertexLayout<InstanceData>
+{
+    static constexpr std::array<VertexAttribute, 4> ATTRIBUTES = {{
+        {2, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceData, transformRows)},
+        {3, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceData, transformRows) + sizeof(glm::vec4)},
+        {4, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceData, transformRows) + sizeof(glm::vec4) * 2},
+        {5, VK_FORMAT_R32_UINT, offsetof(InstanceData, materialIndex)},
+    }};
+};
+
+// 二つのバインディングの要素の記述をつなげる。シェーダのinputを全て満たしているかをまとめて確かめるのに使う
+template <size_t N, size_t M>
+constexpr std::array<VertexAttribute, N + M> concatAttributes(const std::array<VertexAttribute, N> &a, const std::array<VertexAttribute, M> &b)
+{
+    std::array<VertexAttribute, N + M> result{};
+    for (size_t i = 0; i < N; i++)
+    {
+        result[i] = a[i];
+    }
+    for (size_t i = 0; i < M; i++)
+    {
+        result[N + i] = b[i];
+    }
+    return result;
+}
+
+template <typename T>
+VkVertexInputBindingDescription getBindingDescription(uint32_t binding = 0, VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX)
+{
+    // CPU上の頂点情報をGPUに渡す際に、情報一つ当たりのデータサイズを決定する
+    VkVertexInputBindingDescription bindingDescription{};
+
+    bindingDescription.binding = binding;     // 今から作ろうとしているバインディングのインデックス
+    bindingDescription.stride = sizeof(T);    // 一つの頂点データのサイズ
+    bindingDescription.inputRate = inputRate; // 各データが頂点ごとかインスタンス毎か。インスタンス毎のデータにはVK_VERTEX_INPUT_RATE_INSTANCEを指定する
+
+    return bindingDescription;
+}
+
+template <typename T>
+std::array<VkVertexInputAttributeDescription, VertexLayout<T>::ATTRIBUTES.size()> getAttributeDescriptions(uint32_t binding = 0)
+{
+    // CPU上の頂点情報をGPUに渡し際の渡し方を、VertexLayoutの記述から決定する
+    std::array<VkVertexInputAttributeDescription, VertexLayout<T>::ATTRIBUTES.size()> attributeDescriptions{};
+
+    for (size_t i = 0; i < attributeDescriptions.size(); i++)
+    {
+        attributeDescriptions[i].binding = binding; // どのインデックスのバインディングと紐づくか
+        attributeDescriptions[i].location = VertexLayout<T>::ATTRIBUTES[i].location;
+        attributeDescriptions[i].format = VertexLayout<T>::ATTRIBUTES[i].format;
+        attributeDescriptions[i].offset = VertexLayout<T>::ATTRIBUTES[i].offset;
+    }
+
+    return attributeDescriptions;
+}
\ No newline at end of file
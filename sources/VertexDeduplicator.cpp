@@ -0,0 +1,155 @@
+#include "VertexDeduplicator.hpp"
+
+// ----------STLのinclude----------
+#include <cstring>   // memcpy, memcmpを使用するのに必要
+#include <algorithm> // fillを使用するのに必要
+#include <utility>   // moveを使用するのに必要
+
+namespace
+{
+    // 64ビットの値のビットを満遍なく混ぜ合わせる(MurmurHash3の最終段の処理)
+    uint64_t mix64(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        value ^= value >> 33;
+        return value;
+    }
+}
+
+uint64_t VertexDeduplicator::hashVertex(const Vertex &vertex)
+{
+    // Vertexはfloatのみで構成されていて詰め物が入らないので、ビット列をそのままハッシュの入力にできる
+    static_assert(sizeof(Vertex) % sizeof(uint32_t) == 0, "Vertex must be made of 32-bit fields");
+
+    const auto bytes = reinterpret_cast<const unsigned char *>(&vertex);
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ sizeof(Vertex);
+
+    // 8バイトずつ取り出して混ぜ合わせていく
+    size_t offset = 0;
+    for (; offset + sizeof(uint64_t) <= sizeof(Vertex); offset += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + offset, sizeof(word));
+        hash = (hash ^ mix64(word)) * 0x9e3779b97f4a7c15ull;
+        hash = (hash << 31) | (hash >> 33);
+    }
+
+    // Vertexのサイズが8の倍数でない場合の残りの4バイト
+    if (offset < sizeof(Vertex))
+    {
+        uint32_t word;
+        memcpy(&word, bytes + offset, sizeof(word));
+        hash = (hash ^ mix64(word)) * 0x9e3779b97f4a7c15ull;
+    }
+
+    return mix64(hash);
+}
+
+void VertexDeduplicator::reserve(size_t vertexCount)
+{
+    vertices.reserve(vertexCount);
+
+    // 負荷率が1/2を超えないようにスロット数を決める
+    size_t capacity = 16;
+    while (capacity < vertexCount * 2)
+    {
+        capacity *= 2;
+    }
+    if (capacity > slots.size())
+    {
+        rehash(capacity);
+    }
+}
+
+void VertexDeduplicator::clear()
+{
+    vertices.clear();
+    std::fill(slots.begin(), slots.end(), EMPTY_SLOT);
+}
+
+size_t VertexDeduplicator::getMemoryUsage() const
+{
+    return vertices.capacity() * sizeof(Vertex) + slots.capacity() * sizeof(uint32_t);
+}
+
+void VertexDeduplicator::rehash(size_t newCapacity)
+{
+    slots.assign(newCapacity, EMPTY_SLOT);
+
+    // 登録済みの頂点を新しいテーブルに入れ直す。重複が無いことは分かっているので比較は不要
+    size_t mask = newCapacity - 1;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(vertices.size()); i++)
+    {
+        size_t slot = static_cast<size_t>(hashVertex(vertices[i])) & mask;
+        while (slots[slot] != EMPTY_SLOT)
+        {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = i;
+    }
+}
+
+uint32_t VertexDeduplicator::add(const Vertex &vertex)
+{
+    // 負荷率が1/2を超えたらテーブルを倍の大きさで作り直す
+    if ((vertices.size() + 1) * 2 > slots.size())
+    {
+        rehash(slots.empty() ? 16 : slots.size() * 2);
+    }
+
+    // 線形探索で、一致する頂点か空きスロットが見つかるまで順番に見ていく
+    size_t mask = slots.size() - 1;
+    size_t slot = static_cast<size_t>(hashVertex(vertex)) & mask;
+    while (slots[slot] != EMPTY_SLOT)
+    {
+        uint32_t index = slots[slot];
+        if (memcmp(&vertices[index], &vertex, sizeof(Vertex)) == 0)
+        {
+            return index;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    uint32_t index = static_cast<uint32_t>(vertices.size());
+    slots[slot] = index;
+    vertices.push_back(vertex);
+    return index;
+}
+
+void mergeVertexShards(const std::vector<VertexShard> &shards,
+                       std::vector<Vertex> &vertices,
+                       std::vector<uint32_t> &indices)
+{
+    size_t shardVertexCount = 0;
+    size_t indexCount = 0;
+    for (const auto &shard : shards)
+    {
+        shardVertexCount += shard.vertices.size();
+        indexCount += shard.indices.size();
+    }
+
+    VertexDeduplicator deduplicator;
+    deduplicator.reserve(shardVertexCount);
+    indices.clear();
+    indices.reserve(indexCount);
+
+    std::vector<uint32_t> remap; // shard内のインデックスから統合後のインデックスへの対応表
+    for (const auto &shard : shards)
+    {
+        remap.resize(shard.vertices.size());
+        for (size_t i = 0; i < shard.vertices.size(); i++)
+        {
+            remap[i] = deduplicator.add(shard.vertices[i]);
+        }
+
+        for (uint32_t index : shard.indices)
+        {
+            indices.push_back(remap[index]);
+        }
+    }
+
+    vertices = std::move(deduplicator.getVertices());
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+// ----------STLのinclude----------
+#include <vector>
+#include <cstdint> // uint32_tを使用するために必要
+#include <cstddef> // size_tを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"
+
+// 同じ頂点が何度も頂点配列に格納されないように、頂点のビット列をキーにしたハッシュテーブルで重複を取り除くクラス
+// unordered_mapと違って、テーブルは頂点配列へのインデックスを並べただけの配列(オープンアドレス法)なので、頂点一つ毎にメモリ確保が発生しない
+// 頂点の比較はビット列同士で行うので、0.0と-0.0のように==では等しくてもビット列が異なる値は別の頂点として扱われる
+class VertexDeduplicator
+{
+public:
+    void reserve(size_t vertexCount);     // vertexCount個の頂点が登録されてもテーブルを作り直さなくて済むように領域を確保しておく
+    uint32_t add(const Vertex &vertex);   // vertexと一致する頂点が登録済みならそのインデックスを、そうでなければ新たに登録してそのインデックスを返す
+    void clear();                         // 登録済みの頂点を全て削除する
+    size_t getMemoryUsage() const;        // 頂点配列とテーブルが確保しているメモリのバイト数を返す
+
+    const std::vector<Vertex> &getVertices() const { return vertices; }
+    std::vector<Vertex> &getVertices() { return vertices; }
+
+private:
+    static constexpr uint32_t EMPTY_SLOT = UINT32_MAX; // テーブル上の空きスロットを表す値
+
+    static uint64_t hashVertex(const Vertex &vertex); // 頂点のビット列全体からハッシュ値を計算する
+    void rehash(size_t newCapacity);                  // テーブルをnewCapacity個のスロットで作り直す
+
+    std::vector<Vertex> vertices; // 登録された重複の無い頂点の配列。登録された順に並ぶ
+    std::vector<uint32_t> slots;  // ハッシュテーブル本体。verticesへのインデックスが格納される。要素数は常に2のべき乗
+};
+
+// 頂点列の一部分を重複除去した結果。複数のスレッドで並列に重複除去する際に、スレッド毎の結果を保持するのに使う
+struct VertexShard
+{
+    std::vector<Vertex> vertices;  // この部分の中で重複の無い頂点の配列。部分内で最初に登場した順に並ぶ
+    std::vector<uint32_t> indices; // verticesへのインデックスの配列
+};
+
+// shardsを先頭から順番に一つの頂点・インデックス配列に統合する。
+// 各shardの頂点は最初に登場した順に並んでいるので、先頭から順番に統合すれば
+// 全ての頂点を一つのスレッドで順番に重複除去した場合と全く同じ結果になる
+void mergeVertexShards(const std::vector<VertexShard> &shards,
+                       std::vector<Vertex> &vertices,
+                       std::vector<uint32_t> &indices);
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "VertexQuantization.hpp"
+
+// ----------STLのinclude----------
+#include <algorithm> // copy, clampを使用するのに必要
+#include <cmath>     // lroundを使用するのに必要
+
+namespace
+{
+    // 0.0~1.0の値を16ビットの正規化整数に変換する。GPUはこの値を65535で割って0.0~1.0に戻す
+    uint16_t toUnorm16(float value)
+    {
+        return static_cast<uint16_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+    }
+
+    // 範囲の幅が0の場合は割り算ができないので、スケールを1にしておく(量子化した値は常に0になる)
+    float toScale(float extent)
+    {
+        return extent > 0.0f ? extent : 1.0f;
+    }
+}
+
+template <>
+MeshQuantization computeMeshQuantization<Vertex>(const Vertex *vertices, size_t count)
+{
+    MeshQuantization quantization{};
+    quantization.positionScale = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    quantization.positionBias = glm::vec4(0.0f);
+    quantization.texCoordScaleBias = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+    return quantization;
+}
+
+template <>
+MeshQuantization computeMeshQuantization<PackedVertex>(const Vertex *vertices, size_t count)
+{
+    if (count == 0)
+    {
+        return computeMeshQuantization<Vertex>(vertices, count);
+    }
+
+    // 座標とUV座標それぞれについて、メッシュ全体を囲む範囲を求める
+    glm::vec3 minPosition = vertices[0].pos;
+    glm::vec3 maxPosition = vertices[0].pos;
+    glm::vec2 minTexCoord = vertices[0].texCoord;
+    glm::vec2 maxTexCoord = vertices[0].texCoord;
+    for (size_t i = 1; i < count; i++)
+    {
+        minPosition = glm::min(minPosition, vertices[i].pos);
+        maxPosition = glm::max(maxPosition, vertices[i].pos);
+        minTexCoord = glm::min(minTexCoord, vertices[i].texCoord);
+        maxTexCoord = glm::max(maxTexCoord, vertices[i].texCoord);
+    }
+
+    // 元の値 = 正規化した値 * スケール + バイアス となるようにする
+    // UV座標も範囲で正規化しておけば、リピートするテクスチャのように0~1の外にはみ出たUV座標でも扱える
+    MeshQuantization quantization{};
+    quantization.positionScale = glm::vec4(toScale(maxPosition.x - minPosition.x),
+                                           toScale(maxPosition.y - minPosition.y),
+                                           toScale(maxPosition.z - minPosition.z),
+                                           0.0f);
+    quantization.positionBias = glm::vec4(minPosition, 0.0f);
+    quantization.texCoordScaleBias = glm::vec4(toScale(maxTexCoord.x - minTexCoord.x),
+                                               toScale(maxTexCoord.y - minTexCoord.y),
+                                               minTexCoord.x,
+                                               minTexCoord.y);
+    return quantization;
+}
+
+void encodeVertices(const Vertex *src, size_t count, const MeshQuantization &quantization, Vertex *dst)
+{
+    std::copy(src, src + count, dst);
+}
+
+void encodeVertices(const Vertex *src, size_t count, const MeshQuantization &quantization, PackedVertex *dst)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const Vertex &vertex = src[i];
+        PackedVertex &packed = dst[i];
+        packed.pos[0] = toUnorm16((vertex.pos.x - quantization.positionBias.x) / quantization.positionScale.x);
+        packed.pos[1] = toUnorm16((vertex.pos.y - quantization.positionBias.y) / quantization.positionScale.y);
+        packed.pos[2] = toUnorm16((vertex.pos.z - quantization.positionBias.z) / quantization.positionScale.z);
+        packed.pos[3] = 0;
+        packed.texCoord[0] = toUnorm16((vertex.texCoord.x - quantization.texCoordScaleBias.z) / quantization.texCoordScaleBias.x);
+        packed.texCoord[1] = toUnorm16((vertex.texCoord.y - quantization.texCoordScaleBias.w) / quantization.texCoordScaleBias.y);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+// ----------STLのinclude----------
+#include <cstddef> // size_tを使用するために必要
+
+// ----------自作クラスのinclude----------
+#include "Vertex.hpp"
+
+// 量子化した頂点を元の座標に戻すためのスケールとバイアス。プッシュ定数として頂点シェーダに渡す
+// シェーダ側のレイアウト(std430)に合わせて、全てvec4で持つ
+struct MeshQuantization
+{
+    glm::vec4 positionScale;     // 座標のスケール。xyzのみ使用する
+    glm::vec4 positionBias;      // 座標のバイアス。xyzのみ使用する
+    glm::vec4 texCoordScaleBias; // UV座標のスケール(xy)とバイアス(zw)
+};
+
+// 頂点配列をGPU用の頂点の形式Tに変換する際のスケールとバイアスを求める
+template <typename T>
+MeshQuantization computeMeshQuantization(const Vertex *vertices, size_t count);
+
+template <>
+MeshQuantization computeMeshQuantization<Vertex>(const Vertex *vertices, size_t count); // 変換しないので、スケール1、バイアス0を返す
+
+template <>
+MeshQuantization computeMeshQuantization<PackedVertex>(const Vertex *vertices, size_t count); // メッシュを囲む箱を0~1に正規化するスケールとバイアスを返す
+
+// count個の頂点をquantizationに従ってGPU用の頂点の形式に変換し、dstに書き込む
+void encodeVertices(const Vertex *src, size_t count, const MeshQuantization &quantization, Vertex *dst);
+void encodeVertices(const Vertex *src, size_t count, const MeshQuantization &quantization, PackedVertex *dst);
\ No newline at end of file
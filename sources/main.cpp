@@ -11,6 +11,10 @@
 // STBと同様の理由で、HelloTriangleApplication.hppの方で宣言してしまうと、実装部が2つ出来てしまうのでコンパイルが上手く行かない。
 #define TINYOBJLOADER_IMPLEMENTATION
 
+// ----------STB(画像ライブラリ)のinclude---------------
+// 実装部をコンパイルするためだけにincludeしている。画像の読み込みはテクスチャのコンテナを作成する時にTextureContainerが行う
+#include "stb_image.h"
+
 // ----------自作クラスのinclude----------
 #include <HelloTriangleApplication.hpp>
 
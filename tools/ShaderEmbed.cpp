@@ -0,0 +1,770 @@
+// ビルド時に実行する、SPIR-Vを実行ファイルに埋め込むためのヘッダを生成するツール
+// 使い方: ShaderEmbed <出力するヘッダ> <名前>=<SPIR-Vのファイル> ... [--variants <名前>=<SPIR-Vのファイル> ...]
+// 各SPIR-Vを<名前>_SHADER_CODEというconstexprな配列にし、さらにSPIR-Vを解析して
+// デスクリプタのバインディング、頂点シェーダのinput変数、プッシュ定数の大きさを書き出す
+// コンピュートシェーダはそれだけで一つのパイプラインになるので、グラフィックスのシェーダとは混ぜずに<名前>_から始まる定数に分けて書き出す
+// --variantsより後に指定したシェーダは、GPUの機能に応じて差し替える別版のシェーダとして、同じく<名前>_から始まる定数に分けて書き出す
+// アプリケーション本体はこの結果からデスクリプタセットのレイアウトや頂点入力を作るので、シェーダとC++側の食い違いはビルド時に分かる
+// 構造体の定義はsources/ShaderReflection.hppにある
+
+// ----------STLのinclude----------
+#include <stdexcept> // 例外を投げるために必要
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>    // SPIR-Vの読み込みとヘッダの書き出しに使用する
+#include <sstream>    // ヘッダの内容を組み立てるのに使用する
+#include <iostream>   // エラーメッセージを表示するのに使用
+#include <iomanip>    // バイトコードを16進数で書き出すのに使用する
+#include <algorithm>  // sortを使用するために必要
+#include <cstdint>    // uint32_tを使用するために必要
+#include <cctype>     // toupperを使用するために必要
+#include <cstdlib>    // EXIT_SUCCESSを使用するために必要
+#include <iterator>   // 既存のヘッダを読み込むのに使用する
+#include <filesystem> // 書き出しを一時ファイルからの置き換えで行うのに使用する
+
+namespace
+{
+    // 使用するSPIR-Vの命令・列挙値。値はSPIR-Vの仕様書(spirv.h)の通り
+    constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+    constexpr uint32_t SPIRV_HEADER_WORDS = 5;
+
+    constexpr uint32_t OP_NAME = 5;
+    constexpr uint32_t OP_ENTRY_POINT = 15;
+    constexpr uint32_t OP_EXECUTION_MODE = 16;
+    constexpr uint32_t OP_TYPE_INT = 21;
+    constexpr uint32_t OP_TYPE_FLOAT = 22;
+    constexpr uint32_t OP_TYPE_VECTOR = 23;
+    constexpr uint32_t OP_TYPE_MATRIX = 24;
+    constexpr uint32_t OP_TYPE_IMAGE = 25;
+    constexpr uint32_t OP_TYPE_SAMPLER = 26;
+    constexpr uint32_t OP_TYPE_SAMPLED_IMAGE = 27;
+    constexpr uint32_t OP_TYPE_ARRAY = 28;
+    constexpr uint32_t OP_TYPE_RUNTIME_ARRAY = 29;
+    constexpr uint32_t OP_TYPE_STRUCT = 30;
+    constexpr uint32_t OP_TYPE_POINTER = 32;
+    constexpr uint32_t OP_CONSTANT = 43;
+    constexpr uint32_t OP_VARIABLE = 59;
+    constexpr uint32_t OP_DECORATE = 71;
+    constexpr uint32_t OP_MEMBER_DECORATE = 72;
+
+    constexpr uint32_t EXECUTION_MODE_LOCAL_SIZE = 17;
+
+    constexpr uint32_t DECORATION_BUFFER_BLOCK = 3;
+    constexpr uint32_t DECORATION_ARRAY_STRIDE = 6;
+    constexpr uint32_t DECORATION_MATRIX_STRIDE = 7;
+    constexpr uint32_t DECORATION_BUILT_IN = 11;
+    constexpr uint32_t DECORATION_LOCATION = 30;
+    constexpr uint32_t DECORATION_BINDING = 33;
+    constexpr uint32_t DECORATION_DESCRIPTOR_SET = 34;
+    constexpr uint32_t DECORATION_OFFSET = 35;
+
+    constexpr uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+    constexpr uint32_t STORAGE_INPUT = 1;
+    constexpr uint32_t STORAGE_UNIFORM = 2;
+    constexpr uint32_t STORAGE_PUSH_CONSTANT = 9;
+    constexpr uint32_t STORAGE_STORAGE_BUFFER = 12;
+
+    constexpr uint32_t DIM_BUFFER = 5;
+    constexpr uint32_t DIM_SUBPASS_DATA = 6;
+
+    // SPIR-Vの型。使う情報だけを持つ
+    struct Type
+    {
+        uint32_t opcode = 0;
+        std::vector<uint32_t> operands; // 結果のIDを除いたオペランド
+    };
+
+    // 構造体のメンバーの装飾
+    struct MemberDecoration
+    {
+        uint32_t offset = 0;
+        uint32_t matrixStride = 0;
+    };
+
+    // 一つのIDの装飾
+    struct Decoration
+    {
+        bool bufferBlock = false;
+        bool builtIn = false;
+        uint32_t arrayStride = 0;
+        int64_t location = -1;
+        int64_t binding = -1;
+        int64_t descriptorSet = -1;
+        std::map<uint32_t, MemberDecoration> members;
+    };
+
+    struct Variable
+    {
+        uint32_t id;
+        uint32_t pointerType;
+        uint32_t storageClass;
+    };
+
+    // 一つのSPIR-Vモジュールを解析した結果
+    struct Module
+    {
+        std::string name; // コマンドラインで指定された名前
+        std::vector<uint32_t> code;
+        std::string stage; // VkShaderStageFlagBitsの列挙子の名前
+        std::string entryPoint;
+        uint32_t localSize[3] = {1, 1, 1}; // コンピュートシェーダのワークグループの大きさ
+        bool variant = false;              // EMBEDDED_SHADERSの同じステージの物と差し替えて使う、別版のシェーダか
+        std::map<uint32_t, std::string> names;
+        std::map<uint32_t, Type> types;
+        std::map<uint32_t, uint32_t> constants; // 32ビットの整数の定数。配列の長さを求めるのに使う
+        std::map<uint32_t, Decoration> decorations;
+        std::vector<Variable> variables;
+    };
+
+    // 全てのステージの分をまとめたバインディング
+    struct Binding
+    {
+        uint32_t set;
+        uint32_t binding;
+        std::string descriptorType;
+        uint32_t descriptorCount;
+        std::vector<std::string> stages;
+        uint32_t blockSize;
+        std::string name;
+    };
+
+    struct VertexInput
+    {
+        uint32_t location;
+        std::string format;
+        std::string name;
+    };
+
+    std::vector<uint32_t> readSpirv(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open())
+        {
+            throw std::runtime_error("failed to open " + path + "!");
+        }
+
+        size_t fileSize = static_cast<size_t>(file.tellg());
+        if (fileSize % sizeof(uint32_t) != 0 || fileSize < SPIRV_HEADER_WORDS * sizeof(uint32_t))
+        {
+            throw std::runtime_error(path + " is not a SPIR-V module!");
+        }
+
+        std::vector<uint32_t> code(fileSize / sizeof(uint32_t));
+        file.seekg(0);
+        file.read(reinterpret_cast<char *>(code.data()), fileSize);
+
+        if (code[0] != SPIRV_MAGIC)
+        {
+            throw std::runtime_error(path + " is not a SPIR-V module!");
+        }
+        return code;
+    }
+
+    // 命令のオペランドに埋め込まれたヌル終端の文字列を読む
+    std::string readString(const uint32_t *words, size_t wordCount)
+    {
+        std::string result;
+        for (size_t i = 0; i < wordCount; i++)
+        {
+            for (int byte = 0; byte < 4; byte++)
+            {
+                char c = static_cast<char>((words[i] >> (byte * 8)) & 0xff);
+                if (c == '\0')
+                {
+                    return result;
+                }
+                result += c;
+            }
+        }
+        return result;
+    }
+
+    std::string getStageName(uint32_t executionModel)
+    {
+        switch (executionModel)
+        {
+        case 0:
+            return "VK_SHADER_STAGE_VERTEX_BIT";
+        case 1:
+            return "VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT";
+        case 2:
+            return "VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT";
+        case 3:
+            return "VK_SHADER_STAGE_GEOMETRY_BIT";
+        case 4:
+            return "VK_SHADER_STAGE_FRAGMENT_BIT";
+        case 5:
+            return "VK_SHADER_STAGE_COMPUTE_BIT";
+        default:
+            throw std::runtime_error("unsupported execution model!");
+        }
+    }
+
+    Module parseModule(const std::string &name, const std::string &path)
+    {
+        Module module;
+        module.name = name;
+        module.code = readSpirv(path);
+
+        const std::vector<uint32_t> &code = module.code;
+        size_t position = SPIRV_HEADER_WORDS;
+        while (position < code.size())
+        {
+            uint32_t wordCount = code[position] >> 16;
+            uint32_t opcode = code[position] & 0xffff;
+            if (wordCount == 0 || position + wordCount > code.size())
+            {
+                throw std::runtime_error(path + " has a broken instruction!");
+            }
+            const uint32_t *operands = &code[position + 1];
+            uint32_t operandCount = wordCount - 1;
+
+            switch (opcode)
+            {
+            case OP_NAME:
+                module.names[operands[0]] = readString(operands + 1, operandCount - 1);
+                break;
+            case OP_ENTRY_POINT:
+                if (!module.stage.empty())
+                {
+                    throw std::runtime_error(path + " has more than one entry point!");
+                }
+                module.stage = getStageName(operands[0]);
+                module.entryPoint = readString(operands + 2, operandCount - 2);
+                break;
+            case OP_EXECUTION_MODE:
+                if (operands[1] == EXECUTION_MODE_LOCAL_SIZE && operandCount >= 5)
+                {
+                    module.localSize[0] = operands[2];
+                    module.localSize[1] = operands[3];
+                    module.localSize[2] = operands[4];
+                }
+                break;
+            case OP_TYPE_INT:
+            case OP_TYPE_FLOAT:
+            case OP_TYPE_VECTOR:
+            case OP_TYPE_MATRIX:
+            case OP_TYPE_IMAGE:
+            case OP_TYPE_SAMPLER:
+            case OP_TYPE_SAMPLED_IMAGE:
+            case OP_TYPE_ARRAY:
+            case OP_TYPE_RUNTIME_ARRAY:
+            case OP_TYPE_STRUCT:
+            case OP_TYPE_POINTER:
+            {
+                Type &type = module.types[operands[0]];
+                type.opcode = opcode;
+                type.operands.assign(operands + 1, operands + operandCount);
+                break;
+            }
+            case OP_CONSTANT:
+                module.constants[operands[1]] = operands[2]; // 64ビットの定数の場合は下位32ビットだけになるが、配列の長さには十分
+                break;
+            case OP_VARIABLE:
+                module.variables.push_back({operands[1], operands[0], operands[2]});
+                break;
+            case OP_DECORATE:
+            {
+                Decoration &decoration = module.decorations[operands[0]];
+                uint32_t literal = operandCount > 2 ? operands[2] : 0;
+                switch (operands[1])
+                {
+                case DECORATION_BUFFER_BLOCK:
+                    decoration.bufferBlock = true;
+                    break;
+                case DECORATION_ARRAY_STRIDE:
+                    decoration.arrayStride = literal;
+                    break;
+                case DECORATION_BUILT_IN:
+                    decoration.builtIn = true;
+                    break;
+                case DECORATION_LOCATION:
+                    decoration.location = literal;
+                    break;
+                case DECORATION_BINDING:
+                    decoration.binding = literal;
+                    break;
+                case DECORATION_DESCRIPTOR_SET:
+                    decoration.descriptorSet = literal;
+                    break;
+                }
+                break;
+            }
+            case OP_MEMBER_DECORATE:
+            {
+                MemberDecoration &member = module.decorations[operands[0]].members[operands[1]];
+                uint32_t literal = operandCount > 3 ? operands[3] : 0;
+                switch (operands[2])
+                {
+                case DECORATION_OFFSET:
+                    member.offset = literal;
+                    break;
+                case DECORATION_MATRIX_STRIDE:
+                    member.matrixStride = literal;
+                    break;
+                }
+                break;
+            }
+            }
+
+            position += wordCount;
+        }
+
+        if (module.stage.empty())
+        {
+            throw std::runtime_error(path + " has no entry point!");
+        }
+        return module;
+    }
+
+    const Type &getType(const Module &module, uint32_t id)
+    {
+        auto found = module.types.find(id);
+        if (found == module.types.end())
+        {
+            throw std::runtime_error("unknown type id " + std::to_string(id) + " in " + module.name + "!");
+        }
+        return found->second;
+    }
+
+    const Decoration *findDecoration(const Module &module, uint32_t id)
+    {
+        auto found = module.decorations.find(id);
+        return found != module.decorations.end() ? &found->second : nullptr;
+    }
+
+    uint32_t getArrayLength(const Module &module, const Type &arrayType)
+    {
+        auto found = module.constants.find(arrayType.operands[1]);
+        if (found == module.constants.end())
+        {
+            throw std::runtime_error("array length is not a constant in " + module.name + "!");
+        }
+        return found->second;
+    }
+
+    // バッファのブロック内での型のバイト数。行列の大きさはメンバーのMatrixStrideから求めるので、matrixStrideで受け取る
+    uint32_t getTypeSize(const Module &module, uint32_t id, uint32_t matrixStride)
+    {
+        const Type &type = getType(module, id);
+        switch (type.opcode)
+        {
+        case OP_TYPE_INT:
+        case OP_TYPE_FLOAT:
+            return type.operands[0] / 8;
+        case OP_TYPE_VECTOR:
+            return getTypeSize(module, type.operands[0], 0) * type.operands[1];
+        case OP_TYPE_MATRIX:
+            return (matrixStride > 0 ? matrixStride : getTypeSize(module, type.operands[0], 0)) * type.operands[1];
+        case OP_TYPE_ARRAY:
+        {
+            const Decoration *decoration = findDecoration(module, id);
+            uint32_t stride = decoration != nullptr && decoration->arrayStride > 0 ? decoration->arrayStride : getTypeSize(module, type.operands[0], matrixStride);
+            return stride * getArrayLength(module, type);
+        }
+        case OP_TYPE_RUNTIME_ARRAY:
+            return 0; // 長さが実行時に決まる配列は、大きさに含めない
+        case OP_TYPE_STRUCT:
+        {
+            // std140/std430では各メンバーの位置はOffsetで決まっているので、一番後ろのメンバーの末尾を構造体の大きさとする
+            const Decoration *decoration = findDecoration(module, id);
+            uint32_t size = 0;
+            for (uint32_t i = 0; i < type.operands.size(); i++)
+            {
+                MemberDecoration member{};
+                if (decoration != nullptr && decoration->members.count(i) > 0)
+                {
+                    member = decoration->members.at(i);
+                }
+                size = std::max(size, member.offset + getTypeSize(module, type.operands[i], member.matrixStride));
+            }
+            return size;
+        }
+        default:
+            throw std::runtime_error("unsupported type in a buffer block of " + module.name + "!");
+        }
+    }
+
+    // 頂点シェーダのinput変数の型に対応するフォーマット
+    std::string getVertexFormat(const Module &module, uint32_t id)
+    {
+        const Type &type = getType(module, id);
+        uint32_t componentCount = 1;
+        const Type *component = &type;
+        if (type.opcode == OP_TYPE_VECTOR)
+        {
+            componentCount = type.operands[1];
+            component = &getType(module, type.operands[0]);
+        }
+
+        std::string suffix;
+        if (component->opcode == OP_TYPE_FLOAT && component->operands[0] == 32)
+        {
+            suffix = "_SFLOAT";
+        }
+        else if (component->opcode == OP_TYPE_INT && component->operands[0] == 32)
+        {
+            suffix = component->operands[1] != 0 ? "_SINT" : "_UINT";
+        }
+        else
+        {
+            throw std::runtime_error("unsupported vertex input type in " + module.name + "!");
+        }
+
+        static const char *COMPONENTS[] = {"R32", "R32G32", "R32G32B32", "R32G32B32A32"};
+        if (componentCount < 1 || componentCount > 4)
+        {
+            throw std::runtime_error("unsupported vertex input type in " + module.name + "!");
+        }
+        return std::string("VK_FORMAT_") + COMPONENTS[componentCount - 1] + suffix;
+    }
+
+    // デスクリプタとして使われる変数の型から、デスクリプタの種類を決める
+    std::string getDescriptorType(const Module &module, uint32_t storageClass, uint32_t typeId)
+    {
+        const Type &type = getType(module, typeId);
+        const Decoration *decoration = findDecoration(module, typeId);
+        if (storageClass == STORAGE_STORAGE_BUFFER || (decoration != nullptr && decoration->bufferBlock))
+        {
+            return "VK_DESCRIPTOR_TYPE_STORAGE_BUFFER";
+        }
+        if (storageClass == STORAGE_UNIFORM)
+        {
+            return "VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER";
+        }
+
+        switch (type.opcode)
+        {
+        case OP_TYPE_SAMPLER:
+            return "VK_DESCRIPTOR_TYPE_SAMPLER";
+        case OP_TYPE_SAMPLED_IMAGE:
+            return "VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER";
+        case OP_TYPE_IMAGE:
+        {
+            // OpTypeImageのオペランドは サンプル型, Dim, Depth, Arrayed, MS, Sampled, ... の順
+            uint32_t dim = type.operands[1];
+            uint32_t sampled = type.operands[5];
+            if (dim == DIM_SUBPASS_DATA)
+            {
+                return "VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT";
+            }
+            if (dim == DIM_BUFFER)
+            {
+                return sampled == 2 ? "VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER" : "VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER";
+            }
+            return sampled == 2 ? "VK_DESCRIPTOR_TYPE_STORAGE_IMAGE" : "VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE";
+        }
+        default:
+            throw std::runtime_error("unsupported descriptor type in " + module.name + "!");
+        }
+    }
+
+    void reflectModule(const Module &module, std::vector<Binding> &bindings, std::vector<VertexInput> &vertexInputs, std::vector<std::string> &pushConstantStages, uint32_t &pushConstantSize)
+    {
+        for (const Variable &variable : module.variables)
+        {
+            const Type &pointer = getType(module, variable.pointerType);
+            uint32_t typeId = pointer.operands[1];
+            const Decoration *decoration = findDecoration(module, variable.id);
+
+            if (variable.storageClass == STORAGE_PUSH_CONSTANT)
+            {
+                pushConstantStages.push_back(module.stage);
+                pushConstantSize = std::max(pushConstantSize, getTypeSize(module, typeId, 0));
+                continue;
+            }
+
+            if (variable.storageClass == STORAGE_INPUT)
+            {
+                // gl_VertexIndexなどの組み込み変数は頂点バッファから来ないので除く
+                if (module.stage != "VK_SHADER_STAGE_VERTEX_BIT" || decoration == nullptr || decoration->builtIn || decoration->location < 0)
+                {
+                    continue;
+                }
+                auto name = module.names.find(variable.id);
+                vertexInputs.push_back({static_cast<uint32_t>(decoration->location), getVertexFormat(module, typeId), name != module.names.end() ? name->second : ""});
+                continue;
+            }
+
+            if (variable.storageClass != STORAGE_UNIFORM_CONSTANT && variable.storageClass != STORAGE_UNIFORM && variable.storageClass != STORAGE_STORAGE_BUFFER)
+            {
+                continue;
+            }
+            if (decoration == nullptr || decoration->binding < 0)
+            {
+                continue;
+            }
+
+            // デスクリプタの配列の場合は要素の型で種類を決め、要素数をdescriptorCountにする
+            // 要素数を決めていない配列(sampler2D textures[]など)は、要素数をアプリケーション側で決めるので0にする
+            uint32_t descriptorCount = 1;
+            const Type *type = &getType(module, typeId);
+            if (type->opcode == OP_TYPE_ARRAY)
+            {
+                descriptorCount = getArrayLength(module, *type);
+                typeId = type->operands[0];
+                type = &getType(module, typeId);
+            }
+            else if (type->opcode == OP_TYPE_RUNTIME_ARRAY && variable.storageClass == STORAGE_UNIFORM_CONSTANT)
+            {
+                descriptorCount = 0;
+                typeId = type->operands[0];
+                type = &getType(module, typeId);
+            }
+
+            Binding binding{};
+            binding.set = decoration->descriptorSet >= 0 ? static_cast<uint32_t>(decoration->descriptorSet) : 0;
+            binding.binding = static_cast<uint32_t>(decoration->binding);
+            binding.descriptorType = getDescriptorType(module, variable.storageClass, typeId);
+            binding.descriptorCount = descriptorCount;
+            binding.stages.push_back(module.stage);
+
+            bool isBuffer = type->opcode == OP_TYPE_STRUCT;
+            binding.blockSize = isBuffer ? getTypeSize(module, typeId, 0) : 0;
+            auto name = module.names.find(isBuffer ? typeId : variable.id);
+            binding.name = name != module.names.end() ? name->second : "";
+
+            // 別のステージで既に使われているバインディングなら、ステージを追加するだけにする
+            auto existing = std::find_if(bindings.begin(), bindings.end(), [&](const Binding &other)
+                                         { return other.set == binding.set && other.binding == binding.binding; });
+            if (existing == bindings.end())
+            {
+                bindings.push_back(binding);
+                continue;
+            }
+            if (existing->descriptorType != binding.descriptorType || existing->descriptorCount != binding.descriptorCount)
+            {
+                throw std::runtime_error("binding " + std::to_string(binding.binding) + " is declared differently between stages!");
+            }
+            existing->stages.push_back(module.stage);
+            existing->blockSize = std::max(existing->blockSize, binding.blockSize);
+        }
+    }
+
+    std::string joinStages(const std::vector<std::string> &stages)
+    {
+        if (stages.empty())
+        {
+            return "0";
+        }
+        std::string result;
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            if (std::find(stages.begin(), stages.begin() + i, stages[i]) != stages.begin() + i)
+            {
+                continue;
+            }
+            result += (result.empty() ? "" : " | ") + stages[i];
+        }
+        return result;
+    }
+
+    std::string toUpper(std::string text)
+    {
+        for (char &c : text)
+        {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        }
+        return text;
+    }
+
+    void sortBindings(std::vector<Binding> &bindings)
+    {
+        std::sort(bindings.begin(), bindings.end(), [](const Binding &a, const Binding &b)
+                  { return a.set != b.set ? a.set < b.set : a.binding < b.binding; });
+    }
+
+    void writeBindings(std::ostream &out, const std::string &arrayName, const std::vector<Binding> &bindings)
+    {
+        out << "constexpr std::array<ReflectedBinding, " << bindings.size() << "> " << arrayName << " = {{\n";
+        for (const Binding &binding : bindings)
+        {
+            out << "    {" << binding.set << ", " << binding.binding << ", " << binding.descriptorType << ", " << binding.descriptorCount << ", "
+                << joinStages(binding.stages) << ", " << binding.blockSize << ", \"" << binding.name << "\"},\n";
+        }
+        out << "}};\n\n";
+    }
+
+    bool isComputeModule(const Module &module)
+    {
+        return module.stage == "VK_SHADER_STAGE_COMPUTE_BIT";
+    }
+
+    // EMBEDDED_SHADERSやSHADER_BINDINGSには含めず、<名前>_から始まる定数に分けて書き出すシェーダか
+    bool isStandaloneModule(const Module &module)
+    {
+        return isComputeModule(module) || module.variant;
+    }
+
+    std::string generateHeader(const std::vector<Module> &modules)
+    {
+        std::vector<Binding> bindings;
+        std::vector<VertexInput> vertexInputs;
+        std::vector<std::string> pushConstantStages;
+        uint32_t pushConstantSize = 0;
+        size_t graphicsModuleCount = 0;
+        for (const Module &module : modules)
+        {
+            if (isStandaloneModule(module))
+            {
+                continue;
+            }
+            reflectModule(module, bindings, vertexInputs, pushConstantStages, pushConstantSize);
+            graphicsModuleCount++;
+        }
+        sortBindings(bindings);
+        std::sort(vertexInputs.begin(), vertexInputs.end(), [](const VertexInput &a, const VertexInput &b)
+                  { return a.location < b.location; });
+
+        std::ostringstream out;
+        out << "#pragma once\n";
+        out << "// ShaderEmbedがビルド時にSPIR-Vから生成したファイル。編集しても次のビルドで上書きされる\n";
+        out << "#include \"ShaderReflection.hpp\"\n\n";
+
+        for (const Module &module : modules)
+        {
+            out << "constexpr uint32_t " << toUpper(module.name) << "_SHADER_CODE[] = {";
+            for (size_t i = 0; i < module.code.size(); i++)
+            {
+                out << (i % 8 == 0 ? "\n    " : " ") << "0x" << std::hex << std::setw(8) << std::setfill('0') << module.code[i] << std::dec << ",";
+            }
+            out << "\n};\n\n";
+        }
+
+        out << "constexpr std::array<EmbeddedShader, " << graphicsModuleCount << "> EMBEDDED_SHADERS = {{\n";
+        for (const Module &module : modules)
+        {
+            if (isStandaloneModule(module))
+            {
+                continue;
+            }
+            std::string code = toUpper(module.name) + "_SHADER_CODE";
+            out << "    {" << module.stage << ", " << code << ", sizeof(" << code << "), \"" << module.entryPoint << "\"},\n";
+        }
+        out << "}};\n\n";
+
+        writeBindings(out, "SHADER_BINDINGS", bindings);
+
+        out << "constexpr std::array<ReflectedVertexInput, " << vertexInputs.size() << "> SHADER_VERTEX_INPUTS = {{\n";
+        for (const VertexInput &input : vertexInputs)
+        {
+            out << "    {" << input.location << ", " << input.format << ", \"" << input.name << "\"},\n";
+        }
+        out << "}};\n\n";
+
+        out << "constexpr ReflectedPushConstants SHADER_PUSH_CONSTANTS = {" << joinStages(pushConstantStages) << ", " << pushConstantSize << "};\n";
+
+        // 別版のシェーダは一つずつ、シェーダ本体とバインディングを書き出す。頂点入力とプッシュ定数は差し替える前のシェーダと揃えておく事
+        for (const Module &module : modules)
+        {
+            if (!module.variant)
+            {
+                continue;
+            }
+            std::vector<Binding> variantBindings;
+            std::vector<VertexInput> unusedVertexInputs;
+            std::vector<std::string> unusedPushConstantStages;
+            uint32_t unusedPushConstantSize = 0;
+            reflectModule(module, variantBindings, unusedVertexInputs, unusedPushConstantStages, unusedPushConstantSize);
+            sortBindings(variantBindings);
+
+            std::string prefix = toUpper(module.name);
+            out << "\n";
+            out << "constexpr EmbeddedShader " << prefix << "_SHADER = {" << module.stage << ", " << prefix << "_SHADER_CODE, sizeof(" << prefix << "_SHADER_CODE), \""
+                << module.entryPoint << "\"};\n";
+            writeBindings(out, prefix + "_SHADER_BINDINGS", variantBindings);
+        }
+
+        // コンピュートシェーダは一つずつ、シェーダ本体・ワークグループの大きさ・バインディング・プッシュ定数をまとめて書き出す
+        for (const Module &module : modules)
+        {
+            if (!isComputeModule(module) || module.variant)
+            {
+                continue;
+            }
+            std::vector<Binding> computeBindings;
+            std::vector<VertexInput> unusedVertexInputs;
+            std::vector<std::string> computePushConstantStages;
+            uint32_t computePushConstantSize = 0;
+            reflectModule(module, computeBindings, unusedVertexInputs, computePushConstantStages, computePushConstantSize);
+            sortBindings(computeBindings);
+
+            std::string prefix = toUpper(module.name);
+            out << "\n";
+            out << "constexpr ComputeShader " << prefix << "_SHADER = {{" << module.stage << ", " << prefix << "_SHADER_CODE, sizeof(" << prefix << "_SHADER_CODE), \""
+                << module.entryPoint << "\"}, {" << module.localSize[0] << ", " << module.localSize[1] << ", " << module.localSize[2] << "}};\n";
+            writeBindings(out, prefix + "_SHADER_BINDINGS", computeBindings);
+            out << "constexpr ReflectedPushConstants " << prefix << "_PUSH_CONSTANTS = {" << joinStages(computePushConstantStages) << ", " << computePushConstantSize << "};\n";
+        }
+        return out.str();
+    }
+
+    // 内容が変わらない場合は書き込まない。ヘッダの更新時刻が変わるとincludeしている全てのファイルがコンパイルし直されるため
+    // 更新時刻では実行済みかが分からないので、ビルドシステム側では別のスタンプファイルで実行した事を記録する
+    void writeIfChanged(const std::string &path, const std::string &content)
+    {
+        {
+            std::ifstream existing(path, std::ios::binary);
+            if (existing.is_open())
+            {
+                std::string current((std::istreambuf_iterator<char>(existing)), std::istreambuf_iterator<char>());
+                if (current == content)
+                {
+                    return;
+                }
+            }
+        }
+
+        std::string temporaryPath = path + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+            {
+                throw std::runtime_error("failed to open " + temporaryPath + "!");
+            }
+            file.write(content.data(), content.size());
+        }
+        std::filesystem::rename(temporaryPath, path);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: ShaderEmbed <output.hpp> <name>=<shader.spv> ..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        std::vector<Module> modules;
+        bool variants = false;
+        for (int i = 2; i < argc; i++)
+        {
+            std::string argument = argv[i];
+            if (argument == "--variants")
+            {
+                variants = true;
+                continue;
+            }
+            size_t separator = argument.find('=');
+            if (separator == std::string::npos)
+            {
+                throw std::runtime_error("argument must be <name>=<shader.spv>: " + argument);
+            }
+            modules.push_back(parseModule(argument.substr(0, separator), argument.substr(separator + 1)));
+            modules.back().variant = variants;
+        }
+
+        writeIfChanged(argv[1], generateHeader(modules));
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
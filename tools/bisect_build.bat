@@ -0,0 +1,19 @@
+@echo off
+rem git bisect runで各コミットを確かめるためのスクリプト
+rem SPIR-Vをビルド時に生成するようになる前のコミットには、GLSLを書き換えたのにshaders/vert.spv, frag.spvを作り直していない物があり、
+rem そのまま実行するとパイプラインの頂点入力やプッシュ定数とシェーダが食い違う。compile_shader.batがあるコミットではSPIR-Vを作り直してから確かめる
+rem 古いコミットにはこのファイルが無いので、ツリーの外にコピーしてから使う事。git bisect runはリポジトリの最上位のディレクトリで実行する
+rem 使い方: git bisect run <コピーした場所>\bisect_build.bat <確かめるコマンド>
+
+set REPO_ROOT=%CD%
+
+if exist compile_shader.bat (
+    call compile_shader.bat || exit /b 125
+    cd /d "%REPO_ROOT%"
+)
+
+cmake -S . -B _bisect_build || exit /b 125
+cmake --build _bisect_build || exit /b 125
+
+%*
+exit /b %ERRORLEVEL%
\ No newline at end of file